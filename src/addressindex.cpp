@@ -0,0 +1,282 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "chain.h"
+#include "coins.h"
+#include "crypto/sha256.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "undo.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+static const char DB_ADDRESS_HISTORY = 'h';
+static const char DB_ADDRESS_UNSPENT = 'u';
+static const char DB_BEST_BLOCK = 'B';
+
+CAddressIndexDB* paddressindex = NULL;
+
+uint256 GetScriptHash(const CScript& script)
+{
+    uint256 hash;
+    CSHA256().Write(script.data(), script.size()).Finalize(hash.begin());
+    return hash;
+}
+
+/** Whether the key under the cursor, which failed to deserialize, belongs to the entries of type chType */
+static bool IsKeyOfType(CDBIterator& cursor, char chType)
+{
+    char chKeyType;
+    return cursor.GetKey(chKeyType) && chKeyType == chType;
+}
+
+/** Make an output spent by a block available in view again */
+static void AddSpentOutput(CCoinsViewCache& view, const COutPoint& prevout, const CTxOut& txout, int nHeight)
+{
+    CCoinsModifier coins = view.ModifyCoins(prevout.hash);
+    if (coins->vout.size() <= prevout.n)
+        coins->vout.resize(prevout.n + 1);
+    coins->vout[prevout.n] = txout;
+    coins->nHeight = nHeight;
+}
+
+CAddressIndexDB::CAddressIndexDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "addressindex", nCacheSize, fMemory, fWipe, false, "addressindex")
+{
+}
+
+void CAddressIndexDB::ConnectTransaction(CDBBatch& batch, const CTransaction& tx, int nHeight, const CCoinsViewCache& view) const
+{
+    const uint256& txid = tx.GetHash();
+    if (!tx.IsCoinBase()) {
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const COutPoint& prevout = tx.vin[j].prevout;
+            const CCoins* coins = view.AccessCoins(prevout.hash);
+            if (!coins || !coins->IsAvailable(prevout.n))
+                continue;
+            const CTxOut& txout = coins->vout[prevout.n];
+            uint256 scriptHash = GetScriptHash(txout.scriptPubKey);
+            batch.Write(std::make_pair(DB_ADDRESS_HISTORY, CAddressHistoryKey(scriptHash, nHeight, txid, j, true)),
+                        CAddressHistoryValue(txout.nValue, prevout));
+            batch.Erase(std::make_pair(DB_ADDRESS_UNSPENT, CAddressUnspentKey(scriptHash, prevout)));
+        }
+    }
+    for (unsigned int n = 0; n < tx.vout.size(); n++) {
+        const CTxOut& txout = tx.vout[n];
+        if (txout.scriptPubKey.IsUnspendable())
+            continue;
+        uint256 scriptHash = GetScriptHash(txout.scriptPubKey);
+        batch.Write(std::make_pair(DB_ADDRESS_HISTORY, CAddressHistoryKey(scriptHash, nHeight, txid, n, false)),
+                    CAddressHistoryValue(txout.nValue, COutPoint()));
+        batch.Write(std::make_pair(DB_ADDRESS_UNSPENT, CAddressUnspentKey(scriptHash, COutPoint(txid, n))),
+                    CAddressUnspentValue(txout.nValue, nHeight));
+    }
+}
+
+void CAddressIndexDB::DisconnectTransaction(CDBBatch& batch, const CTransaction& tx, int nHeight, const CCoinsViewCache& view) const
+{
+    const uint256& txid = tx.GetHash();
+    for (unsigned int n = 0; n < tx.vout.size(); n++) {
+        const CTxOut& txout = tx.vout[n];
+        if (txout.scriptPubKey.IsUnspendable())
+            continue;
+        uint256 scriptHash = GetScriptHash(txout.scriptPubKey);
+        batch.Erase(std::make_pair(DB_ADDRESS_HISTORY, CAddressHistoryKey(scriptHash, nHeight, txid, n, false)));
+        batch.Erase(std::make_pair(DB_ADDRESS_UNSPENT, CAddressUnspentKey(scriptHash, COutPoint(txid, n))));
+    }
+    if (!tx.IsCoinBase()) {
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const COutPoint& prevout = tx.vin[j].prevout;
+            const CCoins* coins = view.AccessCoins(prevout.hash);
+            if (!coins || !coins->IsAvailable(prevout.n))
+                continue;
+            const CTxOut& txout = coins->vout[prevout.n];
+            uint256 scriptHash = GetScriptHash(txout.scriptPubKey);
+            batch.Erase(std::make_pair(DB_ADDRESS_HISTORY, CAddressHistoryKey(scriptHash, nHeight, txid, j, true)));
+            batch.Write(std::make_pair(DB_ADDRESS_UNSPENT, CAddressUnspentKey(scriptHash, prevout)),
+                        CAddressUnspentValue(txout.nValue, coins->nHeight));
+        }
+    }
+}
+
+bool CAddressIndexDB::WriteBlock(CDBBatch& batch, const uint256& hashBlock)
+{
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    return WriteBatch(batch);
+}
+
+bool CAddressIndexDB::ReplayBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    CDBBatch batch(*this);
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+            for (unsigned int j = 0; j < tx.vin.size(); j++)
+                AddSpentOutput(view, tx.vin[j].prevout, txundo.vprevout[j].txout, txundo.vprevout[j].nHeight);
+        }
+        ConnectTransaction(batch, tx, pindex->nHeight, view);
+    }
+    return WriteBlock(batch, pindex->GetBlockHash());
+}
+
+bool CAddressIndexDB::RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    CDBBatch batch(*this);
+    for (unsigned int i = block.vtx.size(); i-- > 0; ) {
+        const CTransaction& tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            if (txundo.vprevout.size() != tx.vin.size())
+                return error("%s: undo data of block %s does not match it", __func__, pindex->GetBlockHash().ToString());
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                // Undo data only has the height of an output that was the
+                // last unspent one of its transaction
+                const CTxInUndo& undo = txundo.vprevout[j];
+                int nHeight = undo.nHeight;
+                if (nHeight == 0 && !ReadFundingHeight(GetScriptHash(undo.txout.scriptPubKey), tx.vin[j].prevout, nHeight))
+                    return error("%s: no entry for the output %s spent in block %s", __func__, tx.vin[j].prevout.ToString(), pindex->GetBlockHash().ToString());
+                AddSpentOutput(view, tx.vin[j].prevout, undo.txout, nHeight);
+            }
+        }
+        DisconnectTransaction(batch, tx, pindex->nHeight, view);
+    }
+    return WriteBlock(batch, pindex->pprev->GetBlockHash());
+}
+
+bool CAddressIndexDB::ReadFundingHeight(const uint256& scriptHash, const COutPoint& outpoint, int& nHeight)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS_HISTORY, CAddressHistoryKey(scriptHash, 0, uint256(), 0, false)));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, CAddressHistoryKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESS_HISTORY || key.second.scriptHash != scriptHash)
+            break;
+        if (!key.second.fSpending && key.second.txid == outpoint.hash && key.second.nIndex == outpoint.n) {
+            nHeight = key.second.nHeight;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CAddressIndexDB::ReadBestBlock(uint256& hashBlock)
+{
+    return Read(DB_BEST_BLOCK, hashBlock);
+}
+
+bool CAddressIndexDB::Sync()
+{
+    CDBBatch batch(*this);
+    return WriteBatch(batch, true);
+}
+
+bool CAddressIndexDB::ReadHistory(const uint256& scriptHash, const CAddressHistoryKey* pstart, size_t nLimit,
+                                  std::vector<std::pair<CAddressHistoryKey, CAddressHistoryValue> >& vEntries, CAddressHistoryKey* pnext, bool& fMore)
+{
+    fMore = false;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS_HISTORY, pstart ? *pstart : CAddressHistoryKey(scriptHash, 0, uint256(), 0, false)));
+
+    size_t nRead = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressHistoryKey> key;
+        if (!pcursor->GetKey(key)) {
+            if (IsKeyOfType(*pcursor, DB_ADDRESS_HISTORY))
+                return error("%s: failed to read address history key", __func__);
+            break;
+        }
+        if (key.first != DB_ADDRESS_HISTORY || key.second.scriptHash != scriptHash)
+            break;
+        if (nRead++ == nLimit) {
+            *pnext = key.second;
+            fMore = true;
+            return true;
+        }
+        CAddressHistoryValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read address history entry", __func__);
+        vEntries.push_back(std::make_pair(key.second, value));
+    }
+    if (pcursor->HasError())
+        return error("%s: failed to read the address history", __func__);
+    return true;
+}
+
+bool CAddressIndexDB::ReadUnspent(const uint256& scriptHash, const CAddressUnspentKey* pstart, size_t nLimit,
+                                  std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries, CAddressUnspentKey* pnext, bool& fMore)
+{
+    fMore = false;
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS_UNSPENT, pstart ? *pstart : CAddressUnspentKey(scriptHash, COutPoint(uint256(), 0))));
+
+    size_t nRead = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressUnspentKey> key;
+        if (!pcursor->GetKey(key)) {
+            if (IsKeyOfType(*pcursor, DB_ADDRESS_UNSPENT))
+                return error("%s: failed to read unspent address key", __func__);
+            break;
+        }
+        if (key.first != DB_ADDRESS_UNSPENT || key.second.scriptHash != scriptHash)
+            break;
+        if (nRead++ == nLimit) {
+            *pnext = key.second;
+            fMore = true;
+            return true;
+        }
+        CAddressUnspentValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read unspent address entry", __func__);
+        vEntries.push_back(std::make_pair(key.second, value));
+    }
+    if (pcursor->HasError())
+        return error("%s: failed to read the unspent address entries", __func__);
+    return true;
+}
+
+bool CAddressIndexDB::ReadBalance(const uint256& scriptHash, CAddressBalance& balance)
+{
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS_UNSPENT, CAddressUnspentKey(scriptHash, COutPoint(uint256(), 0))));
+
+    balance = CAddressBalance();
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressUnspentKey> key;
+        if (!pcursor->GetKey(key)) {
+            if (IsKeyOfType(*pcursor, DB_ADDRESS_UNSPENT))
+                return error("%s: failed to read unspent address key", __func__);
+            break;
+        }
+        if (key.first != DB_ADDRESS_UNSPENT || key.second.scriptHash != scriptHash)
+            break;
+        CAddressUnspentValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read unspent address entry", __func__);
+        balance.nBalance += value.nValue;
+        balance.nUnspent++;
+    }
+    if (pcursor->HasError())
+        return error("%s: failed to read the unspent address entries", __func__);
+    return true;
+}
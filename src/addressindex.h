@@ -0,0 +1,184 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "compat/endian.h"
+#include "dbwrapper.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+class CCoinsViewCache;
+class CScript;
+
+/** Default for -addressindex */
+static const bool DEFAULT_ADDRESSINDEX = false;
+//! -dbcache share reserved for the address index database, if enabled (MiB)
+static const int64_t nMaxAddressIndexCache = 256;
+/** Default and maximum number of entries returned by one address index query */
+static const unsigned int DEFAULT_ADDRESSINDEX_PAGE_SIZE = 1000;
+static const unsigned int MAX_ADDRESSINDEX_PAGE_SIZE = 10000;
+
+/** The key under which outputs to a script are indexed: the SHA256 of the script */
+uint256 GetScriptHash(const CScript& script);
+
+/**
+ * A transaction that funds (fSpending = false, nIndex is the output) or
+ * spends (fSpending = true, nIndex is the input) an output to a script.
+ * The height is stored big-endian so entries sort by height.
+ */
+struct CAddressHistoryKey
+{
+    uint256 scriptHash;
+    int nHeight;
+    uint256 txid;
+    uint32_t nIndex;
+    bool fSpending;
+
+    CAddressHistoryKey() : nHeight(0), nIndex(0), fSpending(false) {}
+    CAddressHistoryKey(const uint256& scriptHashIn, int nHeightIn, const uint256& txidIn, uint32_t nIndexIn, bool fSpendingIn) :
+        scriptHash(scriptHashIn), nHeight(nHeightIn), txid(txidIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        s << scriptHash;
+        uint32_t nHeightBE = htobe32((uint32_t)nHeight);
+        s.write((const char*)&nHeightBE, sizeof(nHeightBE));
+        s << txid << nIndex << fSpending;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> scriptHash;
+        uint32_t nHeightBE;
+        s.read((char*)&nHeightBE, sizeof(nHeightBE));
+        nHeight = (int)be32toh(nHeightBE);
+        s >> txid >> nIndex >> fSpending;
+    }
+};
+
+struct CAddressHistoryValue
+{
+    CAmount nValue;
+    //! For spending entries, the output that was spent
+    COutPoint prevout;
+
+    CAddressHistoryValue() : nValue(0) {}
+    CAddressHistoryValue(CAmount nValueIn, const COutPoint& prevoutIn) : nValue(nValueIn), prevout(prevoutIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(prevout);
+    }
+};
+
+/** An unspent output to a script */
+struct CAddressUnspentKey
+{
+    uint256 scriptHash;
+    COutPoint outpoint;
+
+    CAddressUnspentKey() {}
+    CAddressUnspentKey(const uint256& scriptHashIn, const COutPoint& outpointIn) : scriptHash(scriptHashIn), outpoint(outpointIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(scriptHash);
+        READWRITE(outpoint);
+    }
+};
+
+struct CAddressUnspentValue
+{
+    CAmount nValue;
+    int nHeight;
+
+    CAddressUnspentValue() : nValue(0), nHeight(0) {}
+    CAddressUnspentValue(CAmount nValueIn, int nHeightIn) : nValue(nValueIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(nHeight);
+    }
+};
+
+/** Summary of the unspent outputs to a script */
+struct CAddressBalance
+{
+    CAmount nBalance;
+    unsigned int nUnspent;
+
+    CAddressBalance() : nBalance(0), nUnspent(0) {}
+};
+
+/**
+ * Access to the address index database (addressindex/): the funding and
+ * spending history and the unspent outputs of every output script, keyed by
+ * script hash. It is updated together with the chain state in ConnectBlock
+ * and DisconnectBlock, and at startup SyncAddressIndex moves it back to the
+ * block the chain state is at if it is elsewhere.
+ */
+class CAddressIndexDB : public CDBWrapper
+{
+public:
+    CAddressIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CAddressIndexDB(const CAddressIndexDB&);
+    void operator=(const CAddressIndexDB&);
+
+    /** Find the height of the block that created outpoint, from its funding entry. */
+    bool ReadFundingHeight(const uint256& scriptHash, const COutPoint& outpoint, int& nHeight);
+public:
+    /** Record the outputs created and spent by tx. Call before its inputs are spent in view. */
+    void ConnectTransaction(CDBBatch& batch, const CTransaction& tx, int nHeight, const CCoinsViewCache& view) const;
+    /** Undo ConnectTransaction. Call after the inputs of tx are restored in view. */
+    void DisconnectTransaction(CDBBatch& batch, const CTransaction& tx, int nHeight, const CCoinsViewCache& view) const;
+    /** Write the changes for one block and the block the index is now synced to. */
+    bool WriteBlock(CDBBatch& batch, const uint256& hashBlock);
+    /**
+     * Add the entries of a block the index missed, or take out those of a
+     * block that left the active chain, taking the outputs it spent from
+     * its undo data. The chain state need not be at the block.
+     */
+    bool ReplayBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex);
+    bool RewindBlock(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex);
+    bool ReadBestBlock(uint256& hashBlock);
+    /** Make all updates so far durable, before the chain state that depends on them. */
+    bool Sync();
+
+    /**
+     * Append up to nLimit history entries of a script to vEntries, starting at
+     * pstart (or the first one). If there are more, sets fMore and *pnext to
+     * the entry to continue from. Returns false on a read error.
+     */
+    bool ReadHistory(const uint256& scriptHash, const CAddressHistoryKey* pstart, size_t nLimit,
+                     std::vector<std::pair<CAddressHistoryKey, CAddressHistoryValue> >& vEntries, CAddressHistoryKey* pnext, bool& fMore);
+    bool ReadUnspent(const uint256& scriptHash, const CAddressUnspentKey* pstart, size_t nLimit,
+                     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vEntries, CAddressUnspentKey* pnext, bool& fMore);
+    bool ReadBalance(const uint256& scriptHash, CAddressBalance& balance);
+};
+
+/** Global variable that points to the address index database, NULL if -addressindex is off */
+extern CAddressIndexDB* paddressindex;
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,197 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "baseindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <chrono>
+
+CBaseIndex::CBaseIndex() : pindexBest(NULL), fSynced(false), fWake(false), fStop(false)
+{
+}
+
+CBaseIndex::~CBaseIndex()
+{
+    // Subclasses must call Stop() in their destructor, before their own
+    // members go away under the indexing thread.
+    assert(!thread.joinable());
+}
+
+bool CBaseIndex::Start()
+{
+    uint256 hashBest;
+    if (!ReadBestBlock(hashBest))
+        hashBest.SetNull();
+
+    {
+        LOCK(cs_main);
+        if (!hashBest.IsNull()) {
+            BlockMap::const_iterator mi = mapBlockIndex.find(hashBest);
+            if (mi == mapBlockIndex.end())
+                LogPrintf("%s: best block %s of the %s is unknown, rebuilding from genesis\n", __func__, hashBest.ToString(), GetName());
+            else
+                pindexBest = mi->second;
+        }
+    }
+    LogPrintf("%s: %s synced up to %s\n", __func__, GetName(), pindexBest ? pindexBest->GetBlockHash().ToString() : "(none)");
+
+    RegisterValidationInterface(this);
+    thread = std::thread(&CBaseIndex::ThreadSync, this);
+    return true;
+}
+
+void CBaseIndex::Stop()
+{
+    if (!thread.joinable())
+        return;
+    UnregisterValidationInterface(this);
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    thread.join();
+}
+
+void CBaseIndex::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fWake = true;
+    }
+    cond.notify_all();
+}
+
+bool CBaseIndex::IsSynced()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return fSynced;
+}
+
+const CBlockIndex* CBaseIndex::GetBestBlock()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return pindexBest;
+}
+
+bool CBaseIndex::BlockUntilSyncedToCurrentChain()
+{
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    if (!pindexTip)
+        return true;
+
+    std::unique_lock<std::mutex> lock(cs);
+    if (!fSynced)
+        return false;
+    // Chain work rather than ancestry, so a reorg away from pindexTip while
+    // waiting does not leave us waiting for a block that won't be indexed.
+    return cond.wait_for(lock, std::chrono::seconds(INDEX_SYNC_TIMEOUT), [this, pindexTip] {
+        return fStop || (pindexBest && pindexBest->nChainWork >= pindexTip->nChainWork);
+    }) && !fStop;
+}
+
+void CBaseIndex::ThreadSync()
+{
+    RenameThread(strprintf("bitcoin-%s", GetName()).c_str());
+
+    const CBlockIndex* pindexPending;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        pindexPending = pindexBest;
+    }
+    bool fPending = false;
+    int64_t nStart = GetTimeMillis();
+    int nBlocks = 0;
+
+    while (true) {
+        const CBlockIndex* pindexNext = NULL;
+        CDiskBlockPos blockPos;
+        {
+            LOCK(cs_main);
+            bool fAhead = false;
+            if (pindexPending && !chainActive.Contains(pindexPending)) {
+                // Either a reorg, or an active chain that is being rebuilt
+                // behind what was already indexed (-reindex-chainstate).
+                const CBlockIndex* pindexTip = chainActive.Tip();
+                if (pindexTip && pindexPending->GetAncestor(pindexTip->nHeight) == pindexTip)
+                    fAhead = true;
+                else
+                    pindexPending = chainActive.FindFork(pindexPending);
+            }
+            if (!fAhead)
+                pindexNext = pindexPending ? chainActive.Next(pindexPending) : chainActive.Genesis();
+            if (pindexNext)
+                blockPos = pindexNext->GetBlockPos();
+        }
+
+        if (pindexNext) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, blockPos, Params().GetConsensus()) || block.GetHash() != pindexNext->GetBlockHash()) {
+                LogPrintf("%s: failed to read block %s, %s stopped\n", __func__, pindexNext->GetBlockHash().ToString(), GetName());
+                break;
+            }
+            if (!AppendBlock(block, pindexNext)) {
+                LogPrintf("%s: failed to index block %s, %s stopped\n", __func__, pindexNext->GetBlockHash().ToString(), GetName());
+                break;
+            }
+            pindexPending = pindexNext;
+            fPending = true;
+            nBlocks++;
+
+            bool fStopping;
+            {
+                std::lock_guard<std::mutex> lock(cs);
+                fStopping = fStop;
+            }
+            if (!IsBatchFull() && !fStopping)
+                continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fPending |= pindexPending != pindexBest;
+        }
+        if (fPending) {
+            if (!Commit(pindexPending)) {
+                LogPrintf("%s: failed to write the %s, stopped\n", __func__, GetName());
+                break;
+            }
+            fPending = false;
+            {
+                std::lock_guard<std::mutex> lock(cs);
+                pindexBest = pindexPending;
+            }
+            cond.notify_all();
+        }
+
+        std::unique_lock<std::mutex> lock(cs);
+        if (fStop)
+            break;
+        if (pindexNext)
+            continue;
+
+        // Caught up with the active chain
+        if (!fSynced) {
+            LogPrintf("%s: %s synced, %d blocks indexed in %dms\n", __func__, GetName(), nBlocks, GetTimeMillis() - nStart);
+            fSynced = true;
+            cond.notify_all();
+        }
+        cond.wait(lock, [this] { return fStop || fWake; });
+        fWake = false;
+        if (fStop)
+            break;
+    }
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BASEINDEX_H
+#define BITCOIN_BASEINDEX_H
+
+#include "validationinterface.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+class CBlock;
+class CBlockIndex;
+class uint256;
+
+/** Maximum time an RPC waits for an index to reach the current tip, in seconds */
+static const int64_t INDEX_SYNC_TIMEOUT = 30;
+
+/**
+ * Base for indexes that are built on a background thread instead of while
+ * connecting blocks. The thread follows chainActive from the last block the
+ * index recorded, reads every block back from disk and hands it to
+ * AppendBlock, committing in batches that span many blocks. New tips wake it
+ * up through UpdatedBlockTip; after a reorg it continues from the fork point.
+ */
+class CBaseIndex : public CValidationInterface
+{
+private:
+    std::mutex cs;
+    std::condition_variable cond;
+    //! Last block whose entries are committed (NULL if none)
+    const CBlockIndex* pindexBest;
+    //! Whether the index has caught up with chainActive at least once
+    bool fSynced;
+    bool fWake;
+    bool fStop;
+    std::thread thread;
+
+    void ThreadSync();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+    /** The block the index was committed up to, if any. */
+    virtual bool ReadBestBlock(uint256& hashBest) = 0;
+    /** Index a block, connected on top of the previously appended one. */
+    virtual bool AppendBlock(const CBlock& block, const CBlockIndex* pindex) = 0;
+    /** Whether enough is pending to be committed while still catching up. */
+    virtual bool IsBatchFull() const = 0;
+    /** Write out what was appended, together with the new best block (NULL: nothing indexed). */
+    virtual bool Commit(const CBlockIndex* pindexNewBest) = 0;
+    /** Short name, used for the thread and in log messages. */
+    virtual const char* GetName() const = 0;
+
+public:
+    CBaseIndex();
+    virtual ~CBaseIndex();
+
+    /** Resume from the best block recorded by the index and start the indexing thread. */
+    bool Start();
+    /** Commit what has been indexed so far and stop the indexing thread. */
+    void Stop();
+
+    bool IsSynced();
+    /** The last block whose entries are committed. */
+    const CBlockIndex* GetBestBlock();
+    /**
+     * Wait until everything up to the current tip is indexed, so lookups see
+     * recently connected blocks. Returns immediately (and false) while the
+     * initial catch-up is still running.
+     */
+    bool BlockUntilSyncedToCurrentChain();
+};
+
+#endif // BITCOIN_BASEINDEX_H
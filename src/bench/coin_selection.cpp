@@ -5,6 +5,7 @@
 #include "bench.h"
 #include "wallet/wallet.h"
 
+#include <algorithm>
 #include <boost/foreach.hpp>
 #include <set>
 
@@ -58,3 +59,63 @@ static void CoinSelection(benchmark::State& state)
 }
 
 BENCHMARK(CoinSelection);
+
+static void emptyWallet(std::vector<COutput>& vCoins)
+{
+    BOOST_FOREACH (COutput output, vCoins)
+        delete output.tx;
+    vCoins.clear();
+}
+
+// A wallet of 5000 coins of mixed values, none of them alike, paying a little
+// less than the three largest and the smallest coin together, which the
+// branch and bound search finds without change
+static void CoinSelectionChangeless(benchmark::State& state)
+{
+    const CWallet wallet;
+    std::vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    std::vector<CAmount> vValues;
+    for (int i = 0; i < 5000; i++) {
+        vValues.push_back((i % 500 + 1) * CENT + i * 1000);
+        addCoin(vValues.back(), wallet, vCoins);
+    }
+    std::sort(vValues.begin(), vValues.end());
+    const CAmount nCostOfChange = 50000;
+    const CAmount nTarget = vValues[4999] + vValues[4998] + vValues[4997] + vValues[0] - 20000;
+
+    while (state.KeepRunning()) {
+        std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(nTarget, 1, 6, 0, vCoins, setCoinsRet, nValueRet, nCostOfChange);
+        assert(success);
+        assert(nValueRet >= nTarget && nValueRet <= nTarget + nCostOfChange);
+    }
+    emptyWallet(vCoins);
+}
+
+// A wallet of 5000 whole-cent coins and a target no subset of them hits, so
+// the search uses up its budget before the knapsack solver takes over
+static void CoinSelectionKnapsack(benchmark::State& state)
+{
+    const CWallet wallet;
+    std::vector<COutput> vCoins;
+    LOCK(wallet.cs_wallet);
+
+    for (int i = 0; i < 5000; i++)
+        addCoin((i % 500 + 1) * CENT, wallet, vCoins);
+    const CAmount nTarget = 1234 * CENT + 1;
+
+    while (state.KeepRunning()) {
+        std::set<std::pair<const CWalletTx*, unsigned int> > setCoinsRet;
+        CAmount nValueRet;
+        bool success = wallet.SelectCoinsMinConf(nTarget, 1, 6, 0, vCoins, setCoinsRet, nValueRet);
+        assert(success);
+        assert(nValueRet > nTarget);
+    }
+    emptyWallet(vCoins);
+}
+
+BENCHMARK(CoinSelectionChangeless);
+BENCHMARK(CoinSelectionKnapsack);
@@ -0,0 +1,309 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilecompress.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "streams.h"
+#include "uint256.h"
+#include "util.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <string.h>
+
+/** Marks the end of a compressed block or undo file */
+static const uint32_t COMPRESSED_FILE_MAGIC = 0x7a636c67; // "glcz"
+
+static const size_t LZ4_MINMATCH = 4;
+//! The last match must start at least this many bytes before the end
+static const size_t LZ4_MFLIMIT = 12;
+//! The last this many bytes are always literals
+static const size_t LZ4_LASTLITERALS = 5;
+static const size_t LZ4_MAX_DISTANCE = 65535;
+static const int LZ4_HASH_LOG = 12;
+
+static inline uint32_t HashLZ4(uint32_t nSequence)
+{
+    return (nSequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static void WriteLengthLZ4(std::vector<unsigned char>& vchOut, size_t nLength)
+{
+    while (nLength >= 255) {
+        vchOut.push_back(255);
+        nLength -= 255;
+    }
+    vchOut.push_back(nLength);
+}
+
+static void WriteSequenceLZ4(std::vector<unsigned char>& vchOut, const unsigned char* pLiterals, size_t nLiterals, size_t nOffset, size_t nMatch)
+{
+    size_t nMatchCode = nMatch ? nMatch - LZ4_MINMATCH : 0;
+    vchOut.push_back((std::min<size_t>(nLiterals, 15) << 4) | std::min<size_t>(nMatchCode, 15));
+    if (nLiterals >= 15)
+        WriteLengthLZ4(vchOut, nLiterals - 15);
+    vchOut.insert(vchOut.end(), pLiterals, pLiterals + nLiterals);
+    if (nMatch) {
+        vchOut.push_back(nOffset & 0xff);
+        vchOut.push_back(nOffset >> 8);
+        if (nMatchCode >= 15)
+            WriteLengthLZ4(vchOut, nMatchCode - 15);
+    }
+}
+
+static bool ReadLengthLZ4(const unsigned char* pIn, size_t nIn, size_t& nPos, size_t& nLength)
+{
+    unsigned char nByte;
+    do {
+        if (nPos >= nIn)
+            return false;
+        nByte = pIn[nPos++];
+        nLength += nByte;
+    } while (nByte == 255);
+    return true;
+}
+
+void CompressLZ4(const unsigned char* pIn, size_t nIn, std::vector<unsigned char>& vchOut)
+{
+    vchOut.clear();
+    vchOut.reserve(nIn + nIn / 255 + 16);
+
+    size_t nAnchor = 0;
+    if (nIn > LZ4_MFLIMIT) {
+        // Positions plus one of the last occurrence of each hashed 4-byte sequence
+        std::vector<uint32_t> vTable(1 << LZ4_HASH_LOG, 0);
+        const size_t nMatchLimit = nIn - LZ4_LASTLITERALS;
+        size_t nPos = 0;
+        while (nPos <= nIn - LZ4_MFLIMIT) {
+            uint32_t nSequence = ReadLE32(pIn + nPos);
+            uint32_t& nEntry = vTable[HashLZ4(nSequence)];
+            size_t nRef = nEntry;
+            nEntry = nPos + 1;
+            if (nRef == 0 || nPos - (nRef - 1) > LZ4_MAX_DISTANCE || ReadLE32(pIn + nRef - 1) != nSequence) {
+                nPos++;
+                continue;
+            }
+            nRef--;
+
+            size_t nMatch = LZ4_MINMATCH;
+            while (nPos + nMatch < nMatchLimit && pIn[nRef + nMatch] == pIn[nPos + nMatch])
+                nMatch++;
+            WriteSequenceLZ4(vchOut, pIn + nAnchor, nPos - nAnchor, nPos - nRef, nMatch);
+            nPos += nMatch;
+            nAnchor = nPos;
+        }
+    }
+    WriteSequenceLZ4(vchOut, pIn + nAnchor, nIn - nAnchor, 0, 0);
+}
+
+bool DecompressLZ4(const unsigned char* pIn, size_t nIn, unsigned char* pOut, size_t nOut)
+{
+    size_t nPos = 0, nOutPos = 0;
+    while (nPos < nIn) {
+        unsigned char nToken = pIn[nPos++];
+
+        size_t nLiterals = nToken >> 4;
+        if (nLiterals == 15 && !ReadLengthLZ4(pIn, nIn, nPos, nLiterals))
+            return false;
+        if (nLiterals > nIn - nPos || nLiterals > nOut - nOutPos)
+            return false;
+        memcpy(pOut + nOutPos, pIn + nPos, nLiterals);
+        nPos += nLiterals;
+        nOutPos += nLiterals;
+        if (nPos == nIn)
+            break; // the last sequence has no match
+
+        if (nIn - nPos < 2)
+            return false;
+        size_t nOffset = pIn[nPos] | (pIn[nPos + 1] << 8);
+        nPos += 2;
+        if (nOffset == 0 || nOffset > nOutPos)
+            return false;
+        size_t nMatch = nToken & 15;
+        if (nMatch == 15 && !ReadLengthLZ4(pIn, nIn, nPos, nMatch))
+            return false;
+        nMatch += LZ4_MINMATCH;
+        if (nMatch > nOut - nOutPos)
+            return false;
+        // Matches may overlap the bytes they produce
+        for (size_t i = 0; i < nMatch; i++, nOutPos++)
+            pOut[nOutPos] = pOut[nOutPos - nOffset];
+    }
+    return nOutPos == nOut;
+}
+
+const CCompressedFrame* CCompressedFileIndex::Find(uint32_t nRawPos) const
+{
+    std::vector<CCompressedFrame>::const_iterator it = std::upper_bound(vFrames.begin(), vFrames.end(), nRawPos,
+        [](uint32_t nPos, const CCompressedFrame& frame) { return nPos < frame.nRawPos; });
+    if (it == vFrames.begin())
+        return NULL;
+    --it;
+    if (nRawPos - it->nRawPos >= it->nRawSize)
+        return NULL;
+    return &*it;
+}
+
+boost::filesystem::path GetCompressedBlockFilename(BlockFileType type, int nFile)
+{
+    return GetBlockPosFilename(CDiskBlockPos(nFile, 0), type == BLOCK_FILE ? "zblk" : "zrev");
+}
+
+static boost::filesystem::path GetRawBlockFilename(BlockFileType type, int nFile)
+{
+    return GetBlockPosFilename(CDiskBlockPos(nFile, 0), BlockFilePrefix(type));
+}
+
+static void WriteFrame(CAutoFile& fileout, CCompressedFileIndex& index, std::vector<unsigned char>& vchFrame, uint32_t& nRawPos, uint32_t& nPos)
+{
+    CCompressedFrame frame;
+    frame.nRawPos = nRawPos;
+    frame.nRawSize = vchFrame.size();
+    frame.nPos = nPos;
+
+    std::vector<unsigned char> vchCompressed;
+    CompressLZ4(vchFrame.data(), vchFrame.size(), vchCompressed);
+    if (vchCompressed.size() < vchFrame.size()) {
+        frame.nSize = vchCompressed.size();
+        fileout.write((const char*)vchCompressed.data(), vchCompressed.size());
+    } else {
+        frame.nSize = frame.nRawSize;
+        fileout.write((const char*)vchFrame.data(), vchFrame.size());
+    }
+    index.vFrames.push_back(frame);
+
+    nRawPos += frame.nRawSize;
+    nPos += frame.nSize;
+    vchFrame.clear();
+}
+
+bool WriteCompressedBlockFile(BlockFileType type, int nFile, unsigned int nRawSize, const CMessageHeader::MessageStartChars& messageStart, const boost::filesystem::path& pathOut, uint64_t& nSizeOut)
+{
+    // Undo records are followed by a checksum
+    const unsigned int nTrailer = type == UNDO_FILE ? sizeof(uint256) : 0;
+    boost::filesystem::path pathIn = GetRawBlockFilename(type, nFile);
+
+    CAutoFile filein(fopen(pathIn.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: failed to open %s", __func__, pathIn.string());
+    CAutoFile fileout(fopen(pathOut.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("%s: failed to create %s", __func__, pathOut.string());
+
+    CCompressedFileIndex index;
+    index.nRawSize = nRawSize;
+    std::vector<unsigned char> vchFrame;
+    uint32_t nFrameRawPos = 0, nPos = 0;
+    try {
+        uint64_t nRawPos = 0;
+        while (nRawPos < nRawSize) {
+            unsigned char header[CMessageHeader::MESSAGE_START_SIZE + 4];
+            if (nRawSize - nRawPos < sizeof(header))
+                return error("%s: truncated record at position %u of %s", __func__, nRawPos, pathIn.string());
+            filein.read((char*)header, sizeof(header));
+            if (memcmp(header, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+                return error("%s: no record at position %u of %s", __func__, nRawPos, pathIn.string());
+            uint64_t nRecord = sizeof(header) + (uint64_t)ReadLE32(header + CMessageHeader::MESSAGE_START_SIZE) + nTrailer;
+            if (nRecord > MAX_SIZE || nRecord > nRawSize - nRawPos)
+                return error("%s: invalid record size at position %u of %s", __func__, nRawPos, pathIn.string());
+
+            // Records are never split across frames
+            if (!vchFrame.empty() && vchFrame.size() + nRecord > COMPRESSED_FRAME_SIZE)
+                WriteFrame(fileout, index, vchFrame, nFrameRawPos, nPos);
+            size_t nOffset = vchFrame.size();
+            vchFrame.resize(nOffset + nRecord);
+            memcpy(&vchFrame[nOffset], header, sizeof(header));
+            filein.read((char*)&vchFrame[nOffset + sizeof(header)], nRecord - sizeof(header));
+            nRawPos += nRecord;
+        }
+        if (!vchFrame.empty())
+            WriteFrame(fileout, index, vchFrame, nFrameRawPos, nPos);
+
+        uint32_t nIndexPos = nPos;
+        fileout << index << nIndexPos << COMPRESSED_FILE_MAGIC;
+        nSizeOut = ftell(fileout.Get());
+    } catch (const std::exception& e) {
+        return error("%s: I/O error - %s", __func__, e.what());
+    }
+    FileCommit(fileout.Get());
+    return true;
+}
+
+bool WriteDecompressedBlockFile(BlockFileType type, int nFile, const boost::filesystem::path& pathOut)
+{
+    boost::filesystem::path pathIn = GetCompressedBlockFilename(type, nFile);
+    FILE* filein = fopen(pathIn.string().c_str(), "rb");
+    if (!filein)
+        return error("%s: failed to open %s", __func__, pathIn.string());
+    CCompressedFileIndex index;
+    bool fOk = ReadCompressedFileIndex(filein, index);
+
+    CAutoFile fileout(fopen(pathOut.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    fOk = fOk && !fileout.IsNull();
+    std::vector<unsigned char> vchRaw;
+    for (size_t i = 0; fOk && i < index.vFrames.size(); i++) {
+        fOk = ReadCompressedFrame(filein, index.vFrames[i], vchRaw);
+        if (fOk)
+            fOk = fwrite(vchRaw.data(), 1, vchRaw.size(), fileout.Get()) == vchRaw.size();
+    }
+    fclose(filein);
+    if (!fOk)
+        return error("%s: failed to decompress %s", __func__, pathIn.string());
+    FileCommit(fileout.Get());
+    return true;
+}
+
+bool ReadCompressedFileIndex(FILE* file, CCompressedFileIndex& index)
+{
+    unsigned char footer[8];
+    if (fseek(file, 0, SEEK_END))
+        return false;
+    long nEnd = ftell(file);
+    if (nEnd < (long)sizeof(footer) || fseek(file, nEnd - sizeof(footer), SEEK_SET) ||
+        fread(footer, 1, sizeof(footer), file) != sizeof(footer))
+        return error("%s: failed to read the file footer", __func__);
+    uint32_t nIndexPos = ReadLE32(footer);
+    if (ReadLE32(footer + 4) != COMPRESSED_FILE_MAGIC || nIndexPos > nEnd - sizeof(footer))
+        return error("%s: invalid file footer", __func__);
+
+    std::vector<char> vchIndex(nEnd - sizeof(footer) - nIndexPos);
+    if (fseek(file, nIndexPos, SEEK_SET) || fread(vchIndex.data(), 1, vchIndex.size(), file) != vchIndex.size())
+        return error("%s: failed to read the frame index", __func__);
+    try {
+        CDataStream ssIndex(vchIndex.data(), vchIndex.data() + vchIndex.size(), SER_DISK, CLIENT_VERSION);
+        ssIndex >> index;
+    } catch (const std::exception& e) {
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+
+    // Frames must cover the raw file in order, so they can be searched
+    uint32_t nRawPos = 0;
+    for (const CCompressedFrame& frame : index.vFrames) {
+        if (frame.nRawPos != nRawPos || frame.nSize > frame.nRawSize || frame.nRawSize > MAX_SIZE ||
+            frame.nPos > nIndexPos || frame.nSize > nIndexPos - frame.nPos)
+            return error("%s: invalid frame index", __func__);
+        nRawPos += frame.nRawSize;
+    }
+    if (nRawPos != index.nRawSize)
+        return error("%s: invalid frame index", __func__);
+    return true;
+}
+
+bool ReadCompressedFrame(FILE* file, const CCompressedFrame& frame, std::vector<unsigned char>& vchRaw)
+{
+    std::vector<unsigned char> vchFrame(frame.nSize);
+    if (fseek(file, frame.nPos, SEEK_SET) || fread(vchFrame.data(), 1, vchFrame.size(), file) != vchFrame.size())
+        return error("%s: failed to read frame at %u", __func__, frame.nPos);
+    if (frame.nSize == frame.nRawSize) {
+        vchRaw.swap(vchFrame);
+        return true;
+    }
+    vchRaw.resize(frame.nRawSize);
+    if (!DecompressLZ4(vchFrame.data(), vchFrame.size(), vchRaw.data(), vchRaw.size()))
+        return error("%s: corrupt frame at %u", __func__, frame.nPos);
+    return true;
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILECOMPRESS_H
+#define BITCOIN_BLOCKFILECOMPRESS_H
+
+#include "blockfilereader.h"
+#include "protocol.h"
+#include "serialize.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+/** Records are grouped into frames of up to this many raw bytes; a larger record gets a frame of its own */
+static const unsigned int COMPRESSED_FRAME_SIZE = 64 * 1024;
+
+/**
+ * Compress data in the LZ4 block format. The output may be larger than the
+ * input for data that does not compress.
+ */
+void CompressLZ4(const unsigned char* pIn, size_t nIn, std::vector<unsigned char>& vchOut);
+/** Decompress LZ4 block format data that must expand to exactly nOut bytes. */
+bool DecompressLZ4(const unsigned char* pIn, size_t nIn, unsigned char* pOut, size_t nOut);
+
+/** A run of whole records of a block or undo file, compressed together */
+struct CCompressedFrame
+{
+    uint32_t nRawPos;  //!< position of the first record in the raw file
+    uint32_t nRawSize; //!< size of the records in the raw file
+    uint32_t nPos;     //!< position of the frame in the compressed file
+    uint32_t nSize;    //!< size of the frame; equal to nRawSize if stored uncompressed
+
+    CCompressedFrame() : nRawPos(0), nRawSize(0), nPos(0), nSize(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nRawPos);
+        READWRITE(nRawSize);
+        READWRITE(nPos);
+        READWRITE(nSize);
+    }
+};
+
+/**
+ * The frames of a compressed block or undo file, stored at its end. Blocks
+ * keep their raw positions: the frame holding a record is looked up here.
+ */
+class CCompressedFileIndex
+{
+public:
+    uint32_t nRawSize;
+    std::vector<CCompressedFrame> vFrames;
+
+    CCompressedFileIndex() : nRawSize(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nRawSize);
+        READWRITE(vFrames);
+    }
+
+    /** Return the frame containing raw position nRawPos, or NULL */
+    const CCompressedFrame* Find(uint32_t nRawPos) const;
+};
+
+/** Path of the compressed form of a block or undo file */
+boost::filesystem::path GetCompressedBlockFilename(BlockFileType type, int nFile);
+
+/**
+ * Write the first nRawSize bytes of a block or undo file in compressed form
+ * to pathOut. Fails if that part of the file is not made of whole records.
+ */
+bool WriteCompressedBlockFile(BlockFileType type, int nFile, unsigned int nRawSize, const CMessageHeader::MessageStartChars& messageStart, const boost::filesystem::path& pathOut, uint64_t& nSizeOut);
+/** Write the raw form of a compressed block or undo file to pathOut. */
+bool WriteDecompressedBlockFile(BlockFileType type, int nFile, const boost::filesystem::path& pathOut);
+
+bool ReadCompressedFileIndex(FILE* file, CCompressedFileIndex& index);
+bool ReadCompressedFrame(FILE* file, const CCompressedFrame& frame, std::vector<unsigned char>& vchRaw);
+
+#endif // BITCOIN_BLOCKFILECOMPRESS_H
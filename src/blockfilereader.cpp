@@ -0,0 +1,347 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+
+#include "blockfilecompress.h"
+#include "chain.h"
+#include "crypto/common.h"
+#include "serialize.h"
+#include "util.h"
+#include "validation.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** Network magic and record size in front of every record */
+static const unsigned int RECORD_HEADER_SIZE = 8;
+
+const char* BlockFilePrefix(BlockFileType type)
+{
+    return type == BLOCK_FILE ? "blk" : "rev";
+}
+
+static const char* FilePrefix(int type)
+{
+    return BlockFilePrefix((BlockFileType)type);
+}
+
+struct CBlockFileReader::MappedFile
+{
+    const unsigned char* pData;
+    size_t nLength;
+    mutable uint64_t nLastUse;
+
+    MappedFile(const unsigned char* pDataIn, size_t nLengthIn) : pData(pDataIn), nLength(nLengthIn), nLastUse(0) {}
+    ~MappedFile()
+    {
+#ifndef WIN32
+        munmap((void*)pData, nLength);
+#endif
+    }
+};
+
+struct CBlockFileReader::OpenFile
+{
+    int fd;
+    mutable uint64_t nLastUse;
+
+    explicit OpenFile(int fdIn) : fd(fdIn), nLastUse(0) {}
+    ~OpenFile()
+    {
+#ifndef WIN32
+        close(fd);
+#endif
+    }
+};
+
+CBlockFileReader::CBlockFileReader(bool fMapFilesIn) : nUseCounter(0)
+{
+    nWriteFile[BLOCK_FILE] = -1;
+    nWriteFile[UNDO_FILE] = -1;
+#ifndef WIN32
+    // Mapping many 128 MiB files needs a 64-bit address space
+    fMapFiles = fMapFilesIn && sizeof(void*) >= 8;
+#else
+    fMapFiles = false;
+#endif
+}
+
+CBlockFileReader::~CBlockFileReader()
+{
+}
+
+std::shared_ptr<const CBlockFileReader::MappedFile> CBlockFileReader::GetMapping(const FileKey& key, uint64_t nEnd)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    std::map<FileKey, std::shared_ptr<const MappedFile> >::iterator it = mapMapped.find(key);
+    if (it != mapMapped.end() && it->second->nLength >= nEnd) {
+        it->second->nLastUse = ++nUseCounter;
+        return it->second;
+    }
+
+#ifndef WIN32
+    // Not mapped yet, or the file grew since
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(key.second, 0), FilePrefix(key.first));
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < nEnd) {
+        LogPrintf("Unable to read up to position %u of %s\n", nEnd, path.string());
+        close(fd);
+        return NULL;
+    }
+    void* pData = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pData == MAP_FAILED) {
+        LogPrintf("Unable to map %s\n", path.string());
+        return NULL;
+    }
+
+    std::shared_ptr<const MappedFile> file = std::make_shared<const MappedFile>((const unsigned char*)pData, (size_t)st.st_size);
+    file->nLastUse = ++nUseCounter;
+    mapMapped[key] = file;
+
+    // Readers still holding an evicted mapping keep it alive until they are done
+    while (mapMapped.size() > MAX_MAPPED_BLOCK_FILES) {
+        std::map<FileKey, std::shared_ptr<const MappedFile> >::iterator itOldest = mapMapped.begin();
+        for (it = mapMapped.begin(); it != mapMapped.end(); ++it) {
+            if (it->second->nLastUse < itOldest->second->nLastUse)
+                itOldest = it;
+        }
+        mapMapped.erase(itOldest);
+    }
+    return file;
+#else
+    return NULL;
+#endif
+}
+
+std::shared_ptr<const CBlockFileReader::OpenFile> CBlockFileReader::GetOpenFile(const FileKey& key)
+{
+#ifndef WIN32
+    std::lock_guard<std::mutex> lock(cs);
+    std::map<FileKey, std::shared_ptr<const OpenFile> >::iterator it = mapOpen.find(key);
+    if (it != mapOpen.end()) {
+        it->second->nLastUse = ++nUseCounter;
+        return it->second;
+    }
+
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(key.second, 0), FilePrefix(key.first));
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return NULL;
+    }
+    std::shared_ptr<const OpenFile> file = std::make_shared<const OpenFile>(fd);
+    file->nLastUse = ++nUseCounter;
+    mapOpen[key] = file;
+
+    while (mapOpen.size() > MAX_OPEN_BLOCK_FILES) {
+        std::map<FileKey, std::shared_ptr<const OpenFile> >::iterator itOldest = mapOpen.begin();
+        for (it = mapOpen.begin(); it != mapOpen.end(); ++it) {
+            if (it->second->nLastUse < itOldest->second->nLastUse)
+                itOldest = it;
+        }
+        mapOpen.erase(itOldest);
+    }
+    return file;
+#else
+    return NULL;
+#endif
+}
+
+bool CBlockFileReader::ReadMapped(const FileKey& key, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span)
+{
+    std::shared_ptr<const MappedFile> file = GetMapping(key, pos.nPos);
+    if (!file)
+        return false;
+    uint32_t nSize = ReadLE32(file->pData + pos.nPos - 4);
+    if (nSize > MAX_SIZE)
+        return error("%s: invalid record size %u at %s", __func__, nSize, pos.ToString());
+
+    uint64_t nEnd = (uint64_t)pos.nPos + nSize + nTrailer;
+    if (nEnd > file->nLength) {
+        file = GetMapping(key, nEnd);
+        if (!file)
+            return false;
+    }
+    span.vchCopy.clear();
+    span.mapping = file;
+    span.pbegin = file->pData + pos.nPos;
+    span.nSize = nSize + nTrailer;
+    return true;
+}
+
+bool CBlockFileReader::ReadOpen(const FileKey& key, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span)
+{
+    unsigned char header[RECORD_HEADER_SIZE];
+    span.mapping.reset();
+#ifndef WIN32
+    std::shared_ptr<const OpenFile> file = GetOpenFile(key);
+    if (!file)
+        return false;
+    if (pread(file->fd, header, sizeof(header), pos.nPos - RECORD_HEADER_SIZE) != (ssize_t)sizeof(header))
+        return error("%s: failed to read record header at %s", __func__, pos.ToString());
+    uint32_t nSize = ReadLE32(header + 4);
+    if (nSize > MAX_SIZE)
+        return error("%s: invalid record size %u at %s", __func__, nSize, pos.ToString());
+
+    span.vchCopy.resize(nSize + nTrailer);
+    size_t nRead = 0;
+    while (nRead < span.vchCopy.size()) {
+        ssize_t nRet = pread(file->fd, span.vchCopy.data() + nRead, span.vchCopy.size() - nRead, pos.nPos + nRead);
+        if (nRet <= 0)
+            return error("%s: failed to read record at %s", __func__, pos.ToString());
+        nRead += nRet;
+    }
+#else
+    FILE* file = fopen(GetBlockPosFilename(pos, FilePrefix(key.first)).string().c_str(), "rb");
+    if (!file)
+        return error("%s: failed to open file for %s", __func__, pos.ToString());
+    bool fOk = fseek(file, pos.nPos - RECORD_HEADER_SIZE, SEEK_SET) == 0 && fread(header, 1, sizeof(header), file) == sizeof(header);
+    uint32_t nSize = fOk ? ReadLE32(header + 4) : 0;
+    fOk = fOk && nSize <= MAX_SIZE;
+    if (fOk) {
+        span.vchCopy.resize(nSize + nTrailer);
+        fOk = fread(span.vchCopy.data(), 1, span.vchCopy.size(), file) == span.vchCopy.size();
+    }
+    fclose(file);
+    if (!fOk)
+        return error("%s: failed to read record at %s", __func__, pos.ToString());
+#endif
+    span.pbegin = span.vchCopy.data();
+    span.nSize = span.vchCopy.size();
+    return true;
+}
+
+bool CBlockFileReader::ReadCompressed(const FileKey& key, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span)
+{
+    span.mapping.reset();
+    boost::filesystem::path path = GetCompressedBlockFilename((BlockFileType)key.first, key.second);
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return error("%s: failed to open %s", __func__, path.string());
+
+    std::shared_ptr<const CCompressedFileIndex> index;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        std::map<FileKey, std::shared_ptr<const CCompressedFileIndex> >::iterator it = mapCompressedIndex.find(key);
+        if (it != mapCompressedIndex.end())
+            index = it->second;
+    }
+    if (!index) {
+        std::shared_ptr<CCompressedFileIndex> indexNew = std::make_shared<CCompressedFileIndex>();
+        if (!ReadCompressedFileIndex(file, *indexNew)) {
+            fclose(file);
+            return error("%s: failed to read the frame index of %s", __func__, path.string());
+        }
+        index = indexNew;
+        std::lock_guard<std::mutex> lock(cs);
+        if (mapCompressedIndex.size() >= MAX_MAPPED_BLOCK_FILES)
+            mapCompressedIndex.erase(mapCompressedIndex.begin());
+        mapCompressedIndex[key] = index;
+    }
+
+    const CCompressedFrame* frame = index->Find(pos.nPos - RECORD_HEADER_SIZE);
+    bool fOk = frame && ReadCompressedFrame(file, *frame, span.vchCopy);
+    fclose(file);
+    if (!fOk)
+        return error("%s: failed to read the frame holding %s", __func__, pos.ToString());
+
+    // The frame starts at a record, possibly before this one
+    size_t nOffset = pos.nPos - frame->nRawPos;
+    if (nOffset > span.vchCopy.size())
+        return error("%s: invalid position %s", __func__, pos.ToString());
+    uint32_t nSize = ReadLE32(span.vchCopy.data() + nOffset - 4);
+    if ((uint64_t)nOffset + nSize + nTrailer > span.vchCopy.size())
+        return error("%s: invalid record size %u at %s", __func__, nSize, pos.ToString());
+    span.pbegin = span.vchCopy.data() + nOffset;
+    span.nSize = nSize + nTrailer;
+    return true;
+}
+
+bool CBlockFileReader::Read(BlockFileType type, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span)
+{
+    if (pos.IsNull() || pos.nPos < RECORD_HEADER_SIZE)
+        return error("%s: invalid position %s", __func__, pos.ToString());
+
+    FileKey key(type, pos.nFile);
+    bool fMap, fCompressed;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fCompressed = setCompressed.count(pos.nFile) > 0;
+        fMap = fMapFiles && nWriteFile[type] != pos.nFile;
+    }
+    while (true) {
+        bool fOk;
+        if (fCompressed)
+            fOk = ReadCompressed(key, pos, nTrailer, span);
+        else
+            fOk = fMap ? ReadMapped(key, pos, nTrailer, span) : ReadOpen(key, pos, nTrailer, span);
+        if (fOk)
+            return true;
+
+        // A file may have been (de)compressed since the format was looked
+        // up. The new format is in place before the switch and the old one
+        // is only removed after it, so read again if it has changed.
+        std::lock_guard<std::mutex> lock(cs);
+        if ((setCompressed.count(pos.nFile) > 0) == fCompressed)
+            return false;
+        fCompressed = !fCompressed;
+        fMap = fMapFiles && nWriteFile[type] != pos.nFile;
+    }
+}
+
+void CBlockFileReader::Written(BlockFileType type, int nFile)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (nWriteFile[type] == nFile)
+        return;
+    nWriteFile[type] = nFile;
+    mapMapped.erase(FileKey(type, nFile));
+}
+
+void CBlockFileReader::SetCompressed(int nFile, bool fCompressed)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    for (int type = BLOCK_FILE; type <= UNDO_FILE; type++) {
+        mapMapped.erase(FileKey(type, nFile));
+        mapOpen.erase(FileKey(type, nFile));
+        mapCompressedIndex.erase(FileKey(type, nFile));
+    }
+    if (fCompressed)
+        setCompressed.insert(nFile);
+    else
+        setCompressed.erase(nFile);
+}
+
+bool CBlockFileReader::IsCompressed(int nFile)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return setCompressed.count(nFile) > 0;
+}
+
+void CBlockFileReader::Forget(int nFile)
+{
+    SetCompressed(nFile, false);
+}
+
+void CBlockFileReader::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    mapMapped.clear();
+    mapOpen.clear();
+    mapCompressedIndex.clear();
+    setCompressed.clear();
+}
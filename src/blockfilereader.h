@@ -0,0 +1,117 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEREADER_H
+#define BITCOIN_BLOCKFILEREADER_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+class CCompressedFileIndex;
+struct CDiskBlockPos;
+
+/** Maximum number of block and undo files kept memory-mapped at once */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 128;
+/** Maximum number of file descriptors kept open for files that are still being written */
+static const unsigned int MAX_OPEN_BLOCK_FILES = 8;
+
+enum BlockFileType
+{
+    BLOCK_FILE = 0, //!< blk?????.dat
+    UNDO_FILE = 1,  //!< rev?????.dat
+};
+
+/** File name prefix of a block file type */
+const char* BlockFilePrefix(BlockFileType type);
+
+/**
+ * Read access to the records in the block and undo files. Every record is
+ * preceded by the network magic and its size, so it can be returned as a
+ * span of bytes to deserialize from.
+ *
+ * Files that are no longer appended to are memory-mapped and records are
+ * deserialized straight from the mapping. The files blocks and undo data
+ * are currently written to are read with pread() through a small cache of
+ * open descriptors instead, so appending to them never invalidates a
+ * mapping. A mapped file that grew afterwards (undo data of old blocks
+ * connected late) is mapped again when a record beyond its end is read.
+ *
+ * Without mmap (Windows, 32-bit) every read opens the file, as before.
+ *
+ * Files recompressed by -compressblockfiles are read by decompressing the
+ * frame that holds the record; their frame indexes are cached. The format of
+ * a file must be switched with SetCompressed only while both formats are on
+ * disk, so that a read that raced with the switch can be retried.
+ */
+class CBlockFileReader
+{
+public:
+    struct MappedFile;
+    struct OpenFile;
+
+    /** The bytes of one record, kept alive by a reference to the mapping or by a private copy */
+    class Span
+    {
+    private:
+        std::shared_ptr<const MappedFile> mapping;
+        std::vector<unsigned char> vchCopy;
+        const unsigned char* pbegin;
+        size_t nSize;
+
+        friend class CBlockFileReader;
+
+    public:
+        Span() : pbegin(NULL), nSize(0) {}
+        const unsigned char* data() const { return pbegin; }
+        size_t size() const { return nSize; }
+    };
+
+private:
+    typedef std::pair<int, int> FileKey; // BlockFileType, file number
+
+    std::mutex cs;
+    std::map<FileKey, std::shared_ptr<const MappedFile> > mapMapped;
+    std::map<FileKey, std::shared_ptr<const OpenFile> > mapOpen;
+    std::map<FileKey, std::shared_ptr<const CCompressedFileIndex> > mapCompressedIndex;
+    //! Files whose block and undo data are only available compressed
+    std::set<int> setCompressed;
+    //! Files that are being appended to, per file type
+    int nWriteFile[2];
+    uint64_t nUseCounter;
+    bool fMapFiles;
+
+    std::shared_ptr<const MappedFile> GetMapping(const FileKey& key, uint64_t nEnd);
+    std::shared_ptr<const OpenFile> GetOpenFile(const FileKey& key);
+    bool ReadMapped(const FileKey& key, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span);
+    bool ReadOpen(const FileKey& key, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span);
+    bool ReadCompressed(const FileKey& key, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span);
+
+public:
+    explicit CBlockFileReader(bool fMapFilesIn = true);
+    ~CBlockFileReader();
+
+    /**
+     * Get the record starting at pos, plus nTrailer bytes that follow it
+     * (the checksum of undo records).
+     */
+    bool Read(BlockFileType type, const CDiskBlockPos& pos, unsigned int nTrailer, Span& span);
+
+    /** Note that a record was appended to a file, so it is read without mapping from now on. */
+    void Written(BlockFileType type, int nFile);
+    /** Note whether the block and undo data of a file are only available compressed. */
+    void SetCompressed(int nFile, bool fCompressed);
+    bool IsCompressed(int nFile);
+    /** Drop mappings and descriptors of a file, before it is deleted. */
+    void Forget(int nFile);
+    /** Drop all mappings and descriptors. */
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEREADER_H
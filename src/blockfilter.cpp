@@ -0,0 +1,297 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+#include <ios>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+/** Writes bits to a byte vector, most significant bit first. */
+class BitStreamWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    uint8_t nBuffer;
+    int nOffset;
+
+public:
+    explicit BitStreamWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nOffset(0) {}
+    ~BitStreamWriter() { Flush(); }
+
+    /** Write the nBits (at most 64) least significant bits of nData. */
+    void Write(uint64_t nData, int nBits)
+    {
+        while (nBits > 0) {
+            int nChunk = std::min(8 - nOffset, nBits);
+            nBuffer |= (nData << (64 - nBits)) >> (64 - 8 + nOffset);
+            nOffset += nChunk;
+            nBits -= nChunk;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    /** Write out a partial byte, padded with zero bits. */
+    void Flush()
+    {
+        if (nOffset == 0)
+            return;
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+};
+
+/** Reads bits written by BitStreamWriter, starting at position nPos of a byte vector. */
+class BitStreamReader
+{
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    uint8_t nBuffer;
+    int nOffset;
+
+public:
+    BitStreamReader(const std::vector<unsigned char>& vchIn, size_t nPosIn) : vch(vchIn), nPos(nPosIn), nBuffer(0), nOffset(8) {}
+
+    uint64_t Read(int nBits)
+    {
+        uint64_t nData = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (nPos >= vch.size())
+                    throw std::ios_base::failure("BitStreamReader::Read(): end of data");
+                nBuffer = vch[nPos++];
+                nOffset = 0;
+            }
+            int nChunk = std::min(8 - nOffset, nBits);
+            nData <<= nChunk;
+            nData |= static_cast<uint8_t>(nBuffer << nOffset) >> (8 - nChunk);
+            nOffset += nChunk;
+            nBits -= nChunk;
+        }
+        return nData;
+    }
+};
+
+void GolombRiceEncode(BitStreamWriter& writer, uint8_t nP, uint64_t x)
+{
+    // Quotient in unary, terminated by a 0 bit
+    uint64_t q = x >> nP;
+    while (q > 0) {
+        int nBits = q <= 64 ? (int)q : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+    // Remainder in nP bits
+    writer.Write(x, nP);
+}
+
+uint64_t GolombRiceDecode(BitStreamReader& reader, uint8_t nP)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    uint64_t r = reader.Read(nP);
+    return (q << nP) + r;
+}
+
+/** Map x uniformly into [0, n): the high 64 bits of x * n. */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+} // anon namespace
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn, const std::vector<unsigned char>& vchEncodedIn) :
+    nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn), nM(nMIn), nN(0), nF(0), vchEncoded(vchEncodedIn)
+{
+    CDataStream ss(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nCount = ReadCompactSize(ss);
+    if (nCount > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("GCSFilter: N must be < 2^32");
+    nN = (uint32_t)nCount;
+    nF = (uint64_t)nN * nM;
+
+    // Check that the encoding holds exactly N deltas
+    BitStreamReader reader(vchEncoded, vchEncoded.size() - ss.size());
+    for (uint32_t i = 0; i < nN; i++)
+        GolombRiceDecode(reader, nP);
+}
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn, const ElementSet& elements) :
+    nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn), nM(nMIn), nN(0), nF(0)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("GCSFilter: N must be < 2^32");
+    nN = (uint32_t)elements.size();
+    nF = (uint64_t)nN * nM;
+
+    CVectorWriter stream(SER_NETWORK, PROTOCOL_VERSION, vchEncoded, 0);
+    WriteCompactSize(stream, nN);
+    if (nN == 0)
+        return;
+
+    std::vector<uint64_t> vHashes = BuildHashedSet(elements);
+    std::sort(vHashes.begin(), vHashes.end());
+
+    BitStreamWriter writer(vchEncoded);
+    uint64_t nLast = 0;
+    for (uint64_t nHash : vHashes) {
+        GolombRiceEncode(writer, nP, nHash - nLast);
+        nLast = nHash;
+    }
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t nHash = CSipHasher(nSipHashK0, nSipHashK1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(nHash, nF);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const Element& element : elements)
+        vHashes.push_back(HashToRange(element));
+    return vHashes;
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* pElementHashes, size_t nSize) const
+{
+    CDataStream ss(vchEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(ss);
+    BitStreamReader reader(vchEncoded, vchEncoded.size() - ss.size());
+
+    // Both the filter and the query are sorted, so walk them side by side
+    uint64_t nValue = 0;
+    size_t nQuery = 0;
+    for (uint32_t i = 0; i < nN; i++) {
+        nValue += GolombRiceDecode(reader, nP);
+        while (true) {
+            if (nQuery == nSize)
+                return false;
+            if (pElementHashes[nQuery] == nValue)
+                return true;
+            if (pElementHashes[nQuery] > nValue)
+                break;
+            nQuery++;
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    uint64_t nQuery = HashToRange(element);
+    return MatchInternal(&nQuery, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vQueries = BuildHashedSet(elements);
+    std::sort(vQueries.begin(), vQueries.end());
+    return MatchInternal(vQueries.data(), vQueries.size());
+}
+
+const std::string& BlockFilterTypeName(BlockFilterType filterType)
+{
+    static const std::string strBasic = "basic";
+    static const std::string strUnknown;
+    switch (filterType) {
+    case BASIC_FILTER: return strBasic;
+    }
+    return strUnknown;
+}
+
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filterType)
+{
+    if (name == BlockFilterTypeName(BASIC_FILTER)) {
+        filterType = BASIC_FILTER;
+        return true;
+    }
+    return false;
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockUndo)
+{
+    GCSFilter::ElementSet elements;
+
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxOut& txout : tx->vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    for (const CTxUndo& txundo : blockUndo.vtxundo) {
+        for (const CTxInUndo& txinundo : txundo.vprevout) {
+            const CScript& script = txinundo.txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    return elements;
+}
+
+BlockFilter::BlockFilter() :
+    filterType(BASIC_FILTER), filter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, GCSFilter::ElementSet())
+{
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vchFilter) :
+    filterType(filterTypeIn), hashBlock(hashBlockIn),
+    filter(ReadLE64(hashBlockIn.begin()), ReadLE64(hashBlockIn.begin() + 8), BASIC_FILTER_P, BASIC_FILTER_M, vchFilter)
+{
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockUndo) :
+    filterType(filterTypeIn), hashBlock(block.GetHash()),
+    filter(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8), BASIC_FILTER_P, BASIC_FILTER_M, BasicFilterElements(block, blockUndo))
+{
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vchData = filter.GetEncoded();
+    return Hash(vchData.begin(), vchData.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& hashPrevHeader) const
+{
+    const uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
@@ -0,0 +1,105 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * A Golomb-coded set (BIP158): a compact probabilistic filter for set
+ * membership. Elements are hashed into the range [0, N * M) with SipHash
+ * and the sorted hashes are stored as Golomb-Rice coded deltas with
+ * parameter P.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+private:
+    uint64_t nSipHashK0;
+    uint64_t nSipHashK1;
+    uint8_t nP;
+    uint32_t nM;
+    uint32_t nN;
+    //! Range elements are hashed into, N * M
+    uint64_t nF;
+    std::vector<unsigned char> vchEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    bool MatchInternal(const uint64_t* pElementHashes, size_t nSize) const;
+
+public:
+    /** Reconstruct a filter from its encoding (N as a CompactSize, then the coded deltas). */
+    GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn, const std::vector<unsigned char>& vchEncodedIn);
+    /** Build a filter containing the given elements. */
+    GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn, const ElementSet& elements);
+
+    uint32_t GetN() const { return nN; }
+    const std::vector<unsigned char>& GetEncoded() const { return vchEncoded; }
+
+    /** Whether element may be in the set; false positives occur at a rate of about 1/M. */
+    bool Match(const Element& element) const;
+    /** Whether any of the elements may be in the set. Faster than calling Match for each. */
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+/** Golomb-Rice parameters of the basic filter type */
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+enum BlockFilterType : uint8_t
+{
+    BASIC_FILTER = 0,
+};
+
+/** Name of a filter type, as used on the command line and in RPC; empty if unknown. */
+const std::string& BlockFilterTypeName(BlockFilterType filterType);
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filterType);
+
+/**
+ * The compact filter of a block. The basic filter holds every output script
+ * the block creates and every output script it spends (from the undo data),
+ * except empty and OP_RETURN scripts, keyed with the block hash.
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType filterType;
+    uint256 hashBlock;
+    GCSFilter filter;
+
+public:
+    BlockFilter();
+    /** Reconstruct a filter from its encoding. */
+    BlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vchFilter);
+    /** Build the filter of a block. */
+    BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockUndo);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    /** Double SHA256 of the encoded filter */
+    uint256 GetHash() const;
+    /** Commitment to this filter and all earlier ones: double SHA256 of the filter hash and the previous header */
+    uint256 ComputeHeader(const uint256& hashPrevHeader) const;
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,206 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "clientversion.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/filesystem.hpp>
+
+static const char DB_FILTER = 'h';
+static const char DB_FILTER_POS = 'P';
+static const char DB_BEST_BLOCK = 'B';
+
+std::unique_ptr<CBlockFilterIndex> g_blockfilterindex;
+
+CBlockFilterIndex::CBlockFilterIndex(BlockFilterType filterTypeIn, size_t nCacheSize, bool fMemory, bool fWipe) :
+    filterType(filterTypeIn)
+{
+    pathDir = GetDataDir() / "indexes" / "blockfilter" / BlockFilterTypeName(filterType);
+    boost::filesystem::create_directories(pathDir);
+    db.reset(new CDBWrapper(pathDir / "db", nCacheSize, fMemory, fWipe, false, "blockfilterindex"));
+    if (!db->Read(DB_FILTER_POS, posNext))
+        posNext = CDiskBlockPos(0, 0);
+}
+
+CBlockFilterIndex::~CBlockFilterIndex()
+{
+    Stop();
+}
+
+boost::filesystem::path CBlockFilterIndex::GetFilterFilename(int nFile) const
+{
+    return pathDir / strprintf("fltr%05u.dat", nFile);
+}
+
+FILE* CBlockFilterIndex::OpenFilterFile(const CDiskBlockPos& pos, bool fReadOnly) const
+{
+    boost::filesystem::path path = GetFilterFilename(pos.nFile);
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    if (!file && !fReadOnly)
+        file = fopen(path.string().c_str(), "wb+");
+    if (!file) {
+        LogPrintf("Unable to open file %s\n", path.string());
+        return NULL;
+    }
+    if (pos.nPos && fseek(file, pos.nPos, SEEK_SET)) {
+        LogPrintf("Unable to seek to position %u of %s\n", pos.nPos, path.string());
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+bool CBlockFilterIndex::ReadBestBlock(uint256& hashBest)
+{
+    return db->Read(DB_BEST_BLOCK, hashBest);
+}
+
+bool CBlockFilterIndex::AppendBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo blockundo;
+    uint256 hashPrevHeader;
+    if (pindex->pprev) {
+        CDiskBlockPos posUndo;
+        {
+            LOCK(cs_main);
+            posUndo = pindex->GetUndoPos();
+        }
+        if (!UndoReadFromDisk(blockundo, posUndo, pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+
+        // The previous block was either appended in this batch or committed before
+        CBlockFilterIndexEntry entryPrev;
+        std::map<uint256, CBlockFilterIndexEntry>::const_iterator it = mapPending.find(pindex->pprev->GetBlockHash());
+        if (it != mapPending.end())
+            entryPrev = it->second;
+        else if (!ReadEntry(pindex->pprev->GetBlockHash(), entryPrev))
+            return error("%s: no filter header for block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+        hashPrevHeader = entryPrev.header;
+    }
+
+    BlockFilter filter(filterType, block, blockundo);
+    const std::vector<unsigned char>& vchFilter = filter.GetEncodedFilter();
+
+    unsigned int nSize = ::GetSerializeSize(vchFilter, SER_DISK, CLIENT_VERSION);
+    if (posNext.nPos > 0 && posNext.nPos + nSize > MAX_FILTER_FILE_SIZE) {
+        posNext.nFile++;
+        posNext.nPos = 0;
+    }
+    {
+        CAutoFile fileout(OpenFilterFile(posNext, false), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: failed to open filter file %d", __func__, posNext.nFile);
+        try {
+            fileout << vchFilter;
+        } catch (const std::exception& e) {
+            return error("%s: I/O error - %s", __func__, e.what());
+        }
+    }
+    setDirtyFiles.insert(posNext.nFile);
+
+    mapPending[pindex->GetBlockHash()] = CBlockFilterIndexEntry(posNext, filter.GetHash(), filter.ComputeHeader(hashPrevHeader));
+    posNext.nPos += nSize;
+    return true;
+}
+
+bool CBlockFilterIndex::IsBatchFull() const
+{
+    return mapPending.size() >= BLOCKFILTERINDEX_BATCH_SIZE;
+}
+
+bool CBlockFilterIndex::Commit(const CBlockIndex* pindexNewBest)
+{
+    // The filters must be on disk before the entries that point at them
+    for (int nFile : setDirtyFiles) {
+        FILE* file = fopen(GetFilterFilename(nFile).string().c_str(), "rb+");
+        if (!file)
+            return error("%s: failed to open filter file %d", __func__, nFile);
+        FileCommit(file);
+        fclose(file);
+    }
+    setDirtyFiles.clear();
+
+    CDBBatch batch(*db);
+    for (const std::pair<const uint256, CBlockFilterIndexEntry>& pending : mapPending)
+        batch.Write(std::make_pair(DB_FILTER, pending.first), pending.second);
+    batch.Write(DB_FILTER_POS, posNext);
+    batch.Write(DB_BEST_BLOCK, pindexNewBest ? pindexNewBest->GetBlockHash() : uint256());
+    if (!db->WriteBatch(batch, true))
+        return false;
+    mapPending.clear();
+    return true;
+}
+
+bool CBlockFilterIndex::ReadEntry(const uint256& hashBlock, CBlockFilterIndexEntry& entry) const
+{
+    return db->Read(std::make_pair(DB_FILTER, hashBlock), entry);
+}
+
+bool CBlockFilterIndex::ReadFilter(const CBlockIndex* pindex, const CBlockFilterIndexEntry& entry, BlockFilter& filter) const
+{
+    CAutoFile filein(OpenFilterFile(entry.pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+
+    std::vector<unsigned char> vchFilter;
+    try {
+        filein >> vchFilter;
+        if (Hash(vchFilter.begin(), vchFilter.end()) != entry.hashFilter)
+            return error("%s: checksum mismatch for the filter of block %s", __func__, pindex->GetBlockHash().ToString());
+        filter = BlockFilter(filterType, pindex->GetBlockHash(), vchFilter);
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const
+{
+    CBlockFilterIndexEntry entry;
+    return ReadEntry(pindex->GetBlockHash(), entry) && ReadFilter(pindex, entry, filter);
+}
+
+bool CBlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const
+{
+    CBlockFilterIndexEntry entry;
+    if (!ReadEntry(pindex->GetBlockHash(), entry))
+        return false;
+    header = entry.header;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& vFilters) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+    vFilters.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        if (!LookupFilter(pindex, vFilters[pindex->nHeight - nStartHeight]))
+            return false;
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+    vHashes.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        CBlockFilterIndexEntry entry;
+        if (!ReadEntry(pindex->GetBlockHash(), entry))
+            return false;
+        vHashes[pindex->nHeight - nStartHeight] = entry.hashFilter;
+    }
+    return true;
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "baseindex.h"
+#include "blockfilter.h"
+#include "chain.h"
+#include "dbwrapper.h"
+
+#include <boost/filesystem/path.hpp>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Default for -peerblockfilters */
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+//! -dbcache share reserved for the block filter index database, if enabled (MiB)
+static const int64_t nMaxBlockFilterIndexCache = 16;
+/** The maximum size of a filter file (fltr?????.dat) */
+static const unsigned int MAX_FILTER_FILE_SIZE = 0x1000000; // 16 MiB
+/** Number of blocks whose filters are collected before they are committed while catching up */
+static const unsigned int BLOCKFILTERINDEX_BATCH_SIZE = 2000;
+
+/** Where the filter of a block is stored, and its hash and header */
+struct CBlockFilterIndexEntry
+{
+    CDiskBlockPos pos;
+    uint256 hashFilter;
+    uint256 header;
+
+    CBlockFilterIndexEntry() {}
+    CBlockFilterIndexEntry(const CDiskBlockPos& posIn, const uint256& hashFilterIn, const uint256& headerIn) :
+        pos(posIn), hashFilter(hashFilterIn), header(headerIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(pos);
+        READWRITE(hashFilter);
+        READWRITE(header);
+    }
+};
+
+/**
+ * Maintains the compact filters of all blocks in the active chain
+ * (-blockfilterindex), built on a background thread. Filters are appended to
+ * flat files in indexes/blockfilter/<type>/, and a database next to them maps
+ * block hashes to the position, hash and header of each filter. Entries are
+ * keyed by block hash, so filters of blocks that are reorged away stay
+ * harmlessly behind.
+ */
+class CBlockFilterIndex : public CBaseIndex
+{
+private:
+    BlockFilterType filterType;
+    boost::filesystem::path pathDir;
+    std::unique_ptr<CDBWrapper> db;
+    //! Where the next filter goes
+    CDiskBlockPos posNext;
+    //! Entries written to the filter files but not committed to the database yet
+    std::map<uint256, CBlockFilterIndexEntry> mapPending;
+    std::set<int> setDirtyFiles;
+
+    boost::filesystem::path GetFilterFilename(int nFile) const;
+    FILE* OpenFilterFile(const CDiskBlockPos& pos, bool fReadOnly) const;
+    bool ReadFilter(const CBlockIndex* pindex, const CBlockFilterIndexEntry& entry, BlockFilter& filter) const;
+    bool ReadEntry(const uint256& hashBlock, CBlockFilterIndexEntry& entry) const;
+
+protected:
+    bool ReadBestBlock(uint256& hashBest) override;
+    bool AppendBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    bool IsBatchFull() const override;
+    bool Commit(const CBlockIndex* pindexNewBest) override;
+    const char* GetName() const override { return "blockfilterindex"; }
+
+public:
+    CBlockFilterIndex(BlockFilterType filterTypeIn, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CBlockFilterIndex();
+
+    BlockFilterType GetFilterType() const { return filterType; }
+
+    /** Look up committed filters and their headers and hashes. */
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter) const;
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header) const;
+    /** All filters (or filter hashes) from nStartHeight up to and including pindexStop. */
+    bool LookupFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<BlockFilter>& vFilters) const;
+    bool LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes) const;
+};
+
+/** The running block filter indexer, if -blockfilterindex is enabled */
+extern std::unique_ptr<CBlockFilterIndex> g_blockfilterindex;
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
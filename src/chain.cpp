@@ -8,6 +8,34 @@
 
 #include "chain.h"
 
+/**
+ * CBlockIndexArena implementation
+ */
+void CBlockIndexArena::Reserve(size_t n)
+{
+    if (nChunkCapacity - nChunkUsed >= n)
+        return;
+    vChunks.emplace_back(new CBlockIndex[n]);
+    nChunkCapacity = n;
+    nChunkUsed = 0;
+}
+
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (nChunkUsed == nChunkCapacity)
+        Reserve(DEFAULT_CHUNK_SIZE);
+    nSize++;
+    return &vChunks.back()[nChunkUsed++];
+}
+
+void CBlockIndexArena::Clear()
+{
+    vChunks.clear();
+    nChunkCapacity = 0;
+    nChunkUsed = 0;
+    nSize = 0;
+}
+
 /**
  * CChain implementation
  */
@@ -16,6 +16,7 @@
 #include "uint256.h"
 #include "consensus/params.h"
 
+#include <memory>
 #include <vector>
 
 class CBlockFileInfo
@@ -374,6 +375,36 @@ public:
                                 unsigned int nRequired);
 };
 
+/**
+ * Hands out CBlockIndex objects from large contiguous chunks instead of one
+ * heap allocation per block. Objects are never freed individually and never
+ * move, so pointers handed out stay valid until Clear().
+ */
+class CBlockIndexArena
+{
+private:
+    static const size_t DEFAULT_CHUNK_SIZE = 4096;
+
+    std::vector<std::unique_ptr<CBlockIndex[]> > vChunks;
+    size_t nChunkCapacity; //!< number of objects in the last chunk
+    size_t nChunkUsed;     //!< number of objects handed out from the last chunk
+    size_t nSize;
+
+public:
+    CBlockIndexArena() : nChunkCapacity(0), nChunkUsed(0), nSize(0) {}
+
+    /** Make sure the next n allocations come from a single chunk. */
+    void Reserve(size_t n);
+
+    /** Return a new, null CBlockIndex owned by the arena. */
+    CBlockIndex* Allocate();
+
+    /** Release every object handed out so far. */
+    void Clear();
+
+    size_t size() const { return nSize; }
+};
+
 arith_uint256 GetBlockProof(const CBlockIndex& block);
 /** Return the time it would take to redo the work difference between from and to, assuming the current hashrate corresponds to the difficulty at tip, in seconds. */
 int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& from, const CBlockIndex& tip, const Consensus::Params&);
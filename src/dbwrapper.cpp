@@ -6,7 +6,13 @@
 
 #include "util.h"
 #include "random.h"
+#include "sync.h"
 
+#include <algorithm>
+#include <set>
+#include <stdio.h>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -15,14 +21,145 @@
 #include <memenv.h>
 #include <stdint.h>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+/** Databases that can be given a profile with -dbprofile */
+static const char* const DB_PROFILE_NAMES[] = {"chainstate", "blockindex", "addressindex", "blockfilterindex"};
+
+std::string CDBProfile::ToString() const
+{
+    return strprintf("blockcache=%d,blocksize=%u,bloombits=%d,compression=%d,maxopenfiles=%d",
+        nBlockCachePercent, nBlockSize / 1024, nBloomBits, fCompression, nMaxOpenFiles);
+}
+
+static bool SetDBProfilePreset(const std::string& strPreset, CDBProfile& profile)
+{
+    if (strPreset == "default") {
+        profile = CDBProfile();
+    } else if (strPreset == "nvme") {
+        // Random reads are cheap: favour larger write buffers, so fewer level 0
+        // files get flushed and compacted, and keep more tables open
+        profile = CDBProfile();
+        profile.nBlockCachePercent = 25;
+        profile.nMaxOpenFiles = 128;
+    } else if (strPreset == "hdd") {
+        // Seeks are expensive: read larger blocks, keep more of them cached and
+        // make false positive bloom filter hits rarer
+        profile = CDBProfile();
+        profile.nBlockCachePercent = 75;
+        profile.nBlockSize = 64 * 1024;
+        profile.nBloomBits = 16;
+        profile.fCompression = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ParseDBProfile(const std::string& strSettings, CDBProfile& profile, std::string& strError)
+{
+    std::vector<std::string> vSettings;
+    boost::split(vSettings, strSettings, boost::is_any_of(","));
+    for (const std::string& strSetting : vSettings) {
+        size_t nPos = strSetting.find('=');
+        if (nPos == std::string::npos) {
+            if (!SetDBProfilePreset(strSetting, profile)) {
+                strError = strprintf("unknown database profile '%s'", strSetting);
+                return false;
+            }
+            continue;
+        }
+        std::string strKey = strSetting.substr(0, nPos);
+        int32_t nValue;
+        if (!ParseInt32(strSetting.substr(nPos + 1), &nValue) || nValue < 0) {
+            strError = strprintf("invalid value in '%s'", strSetting);
+            return false;
+        }
+        if (strKey == "blockcache" && nValue >= 1 && nValue <= 99) {
+            profile.nBlockCachePercent = nValue;
+        } else if (strKey == "blocksize" && nValue >= 1 && nValue <= 1024) {
+            profile.nBlockSize = (size_t)nValue * 1024;
+        } else if (strKey == "bloombits" && nValue <= 64) {
+            profile.nBloomBits = nValue;
+        } else if (strKey == "compression" && nValue <= 1) {
+            profile.fCompression = nValue != 0;
+        } else if (strKey == "maxopenfiles" && nValue >= 16 && nValue <= 4096) {
+            profile.nMaxOpenFiles = nValue;
+        } else {
+            strError = strprintf("invalid database setting '%s'", strSetting);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool SplitDBProfileArg(const std::string& strArg, std::string& strName, std::string& strSettings)
+{
+    size_t nPos = strArg.find(':');
+    if (nPos == std::string::npos)
+        return false;
+    strName = strArg.substr(0, nPos);
+    strSettings = strArg.substr(nPos + 1);
+    return true;
+}
+
+CDBProfile GetDBProfile(const std::string& strName)
+{
+    CDBProfile profile;
+    if (strName.empty() || !mapMultiArgs.count("-dbprofile"))
+        return profile;
+    // Later arguments override earlier ones; they were checked at startup
+    for (const std::string& strArg : mapMultiArgs.at("-dbprofile")) {
+        std::string strArgName, strSettings, strError;
+        if (SplitDBProfileArg(strArg, strArgName, strSettings) && strArgName == strName)
+            ParseDBProfile(strSettings, profile, strError);
+    }
+    return profile;
+}
+
+bool CheckDBProfiles(std::string& strError)
+{
+    if (!mapMultiArgs.count("-dbprofile"))
+        return true;
+    for (const std::string& strArg : mapMultiArgs.at("-dbprofile")) {
+        std::string strName, strSettings;
+        if (!SplitDBProfileArg(strArg, strName, strSettings)) {
+            strError = strprintf("expected <db>:<settings> in '%s'", strArg);
+            return false;
+        }
+        if (std::find(std::begin(DB_PROFILE_NAMES), std::end(DB_PROFILE_NAMES), strName) == std::end(DB_PROFILE_NAMES)) {
+            strError = strprintf("unknown database '%s'", strName);
+            return false;
+        }
+        CDBProfile profile;
+        if (!ParseDBProfile(strSettings, profile, strError))
+            return false;
+    }
+    return true;
+}
+
+/** Open databases that can be reported by getdbstats */
+static CCriticalSection cs_dbwrappers;
+static std::set<const CDBWrapper*> setDBWrappers;
+
+std::vector<CDBStats> GetAllDBStats()
+{
+    std::vector<CDBStats> vStats;
+    LOCK(cs_dbwrappers);
+    for (const CDBWrapper* pdbw : setDBWrappers) {
+        vStats.emplace_back();
+        pdbw->GetStats(vStats.back());
+    }
+    return vStats;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.block_cache = leveldb::NewLRUCache(nCacheSize * profile.nBlockCachePercent / 100);
+    options.write_buffer_size = nCacheSize * (100 - profile.nBlockCachePercent) / 200; // up to two write buffers may be held in memory simultaneously
+    options.block_size = profile.nBlockSize;
+    options.filter_policy = profile.nBloomBits ? leveldb::NewBloomFilterPolicy(profile.nBloomBits) : NULL;
+    options.compression = profile.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = profile.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -31,14 +168,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSizeIn, bool fMemory, bool fWipe, bool obfuscate, const std::string& name) :
+    strName(name), strPath(path.string()), nCacheSize(nCacheSizeIn), profile(GetDBProfile(name)), nBytesWritten(0)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -55,6 +193,8 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
+    if (!strName.empty())
+        LogPrintf("Using LevelDB profile for %s: %s\n", strName, profile.ToString());
 
     // The base-case obfuscation key, which is a noop.
     obfuscate_key = std::vector<unsigned char>(OBFUSCATE_KEY_NUM_BYTES, '\000');
@@ -74,10 +214,19 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    if (!strName.empty()) {
+        LOCK(cs_dbwrappers);
+        setDBWrappers.insert(this);
+    }
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        LOCK(cs_dbwrappers);
+        setDBWrappers.erase(this);
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -92,6 +241,7 @@ bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
     dbwrapper_private::HandleError(status);
+    nBytesWritten += batch.SizeEstimate();
     return true;
 }
 
@@ -122,8 +272,40 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+void CDBWrapper::GetStats(CDBStats& stats) const
+{
+    stats.strName = strName;
+    stats.strPath = strPath;
+    stats.profile = profile;
+    stats.nCacheSize = nCacheSize;
+    stats.nBytesWritten = nBytesWritten;
+    stats.nBlockCacheUsage = options.block_cache->TotalCharge();
+    stats.nBlockCacheSize = nCacheSize * profile.nBlockCachePercent / 100;
+
+    std::string strValue;
+    stats.nMemoryUsage = 0;
+    if (pdb->GetProperty("leveldb.approximate-memory-usage", &strValue)) {
+        // The property includes the block cache, which is reported on its own
+        uint64_t nUsage = strtoull(strValue.c_str(), NULL, 10);
+        stats.nMemoryUsage = nUsage > stats.nBlockCacheUsage ? nUsage - stats.nBlockCacheUsage : 0;
+    }
+
+    // Only levels holding files or with compactions behind them are listed
+    stats.vLevels.clear();
+    if (pdb->GetProperty("leveldb.stats", &strValue)) {
+        std::vector<std::string> vLines;
+        boost::split(vLines, strValue, boost::is_any_of("\n"));
+        for (const std::string& strLine : vLines) {
+            CDBLevelStats level;
+            if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel, &level.nFiles, &level.dSizeMB, &level.dTimeSec, &level.dReadMB, &level.dWriteMB) == 6)
+                stats.vLevels.push_back(level);
+        }
+    }
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
+bool CDBIterator::HasError() { return !piter->status().ok(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::Next() { piter->Next(); }
 
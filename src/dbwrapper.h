@@ -12,6 +12,8 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <atomic>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -26,8 +28,66 @@ public:
     dbwrapper_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+/**
+ * LevelDB tuning for one database, set with -dbprofile. The cache size
+ * handed to the database is split between the block cache and the two write
+ * buffers LevelDB may hold at once; the defaults reproduce the historical
+ * half/quarter split.
+ */
+struct CDBProfile
+{
+    int nBlockCachePercent; //!< share of the cache used as block cache, the rest is split over the write buffers
+    size_t nBlockSize;      //!< approximate size of uncompressed data per table block
+    int nBloomBits;         //!< bloom filter bits per key, 0 to disable
+    bool fCompression;      //!< compress table blocks (only effective when LevelDB is built with Snappy)
+    int nMaxOpenFiles;      //!< number of table files LevelDB may keep open
+
+    CDBProfile() : nBlockCachePercent(50), nBlockSize(4096), nBloomBits(10), fCompression(false), nMaxOpenFiles(64) {}
+
+    std::string ToString() const;
+};
+
+/**
+ * Apply a comma separated list of settings to a profile. Each item is either
+ * a preset (default, nvme, hdd) or key=value with key one of blockcache
+ * (percent), blocksize (KiB), bloombits, compression and maxopenfiles.
+ */
+bool ParseDBProfile(const std::string& strSettings, CDBProfile& profile, std::string& strError);
+/** Profile for the named database, from all -dbprofile=<name>:<settings> arguments */
+CDBProfile GetDBProfile(const std::string& strName);
+/** Check that all -dbprofile arguments name a known database and parse */
+bool CheckDBProfiles(std::string& strError);
+
+/** Per level figures from LevelDB's compaction statistics */
+struct CDBLevelStats
+{
+    int nLevel;
+    int nFiles;
+    double dSizeMB;
+    double dTimeSec;
+    double dReadMB;
+    double dWriteMB;
+};
+
+/** Snapshot of the state and activity of one open database */
+struct CDBStats
+{
+    std::string strName;
+    std::string strPath;
+    CDBProfile profile;
+    size_t nCacheSize;
+    std::vector<CDBLevelStats> vLevels;
+    uint64_t nBytesWritten;     //!< user bytes written in batches since the database was opened
+    size_t nBlockCacheUsage;
+    size_t nBlockCacheSize;
+    uint64_t nMemoryUsage;      //!< approximate memory held by the memtables
+};
+
 class CDBWrapper;
 
+/** Snapshots of all open databases that were given a name */
+std::vector<CDBStats> GetAllDBStats();
+
 /** These should be considered an implementation detail of the specific database.
  */
 namespace dbwrapper_private {
@@ -56,11 +116,13 @@ private:
     CDataStream ssKey;
     CDataStream ssValue;
 
+    size_t size_estimate;
+
 public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION) { };
+    CDBBatch(const CDBWrapper &_parent) : parent(_parent), ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), size_estimate(0) { };
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -75,6 +137,14 @@ public:
         leveldb::Slice slValue(ssValue.data(), ssValue.size());
 
         batch.Put(slKey, slValue);
+        // LevelDB serializes writes as:
+        // - byte: header
+        // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
+        // - byte[]: key
+        // - varint: value length
+        // - byte[]: value
+        // The formula below assumes the key and value are both less than 16k.
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
         ssKey.clear();
         ssValue.clear();
     }
@@ -87,8 +157,16 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         batch.Delete(slKey);
+        // LevelDB serializes erases as:
+        // - byte: header
+        // - varint: key length
+        // - byte[]: key
+        // The formula below assumes the key is less than 16kB.
+        size_estimate += 2 + (slKey.size() > 127) + slKey.size();
         ssKey.clear();
     }
+
+    size_t SizeEstimate() const { return size_estimate; }
 };
 
 class CDBIterator
@@ -108,6 +186,8 @@ public:
     ~CDBIterator();
 
     bool Valid();
+    /** Whether the iteration stopped on a read error rather than at the end */
+    bool HasError();
 
     void SeekToFirst();
 
@@ -190,6 +270,19 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    //! name used for -dbprofile and getdbstats, empty for unlisted databases
+    std::string strName;
+
+    //! location of the database
+    std::string strPath;
+
+    size_t nCacheSize;
+
+    CDBProfile profile;
+
+    //! user bytes written in batches, for write amplification
+    std::atomic<uint64_t> nBytesWritten;
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -198,8 +291,11 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] name        Name used to select a -dbprofile and to report the
+     *                        database in getdbstats. Unnamed databases use the
+     *                        default profile.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, const std::string& name = "");
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -286,6 +382,26 @@ public:
      * Return true if the database managed by this class contains no entries.
      */
     bool IsEmpty();
+
+    /** Compact the keys in [key_begin, key_end], pushing them down to the deepest level that holds data */
+    template<typename K>
+    void CompactRange(const K& key_begin, const K& key_end) const
+    {
+        CDataStream ssKey1(SER_DISK, CLIENT_VERSION), ssKey2(SER_DISK, CLIENT_VERSION);
+        ssKey1.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey2.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+        ssKey1 << key_begin;
+        ssKey2 << key_end;
+        leveldb::Slice slKey1(ssKey1.data(), ssKey1.size());
+        leveldb::Slice slKey2(ssKey2.data(), ssKey2.size());
+        pdb->CompactRange(&slKey1, &slKey2);
+    }
+
+    /** User bytes written in batches since the database was opened */
+    uint64_t GetBytesWritten() const { return nBytesWritten; }
+
+    /** Take a snapshot of the LevelDB properties and counters of this database */
+    void GetStats(CDBStats& stats) const;
 };
 
 #endif // BITCOIN_DBWRAPPER_H
@@ -144,4 +144,6 @@ private:
     struct event* ev;
 };
 
+std::string urlDecode(const std::string &urlEncoded);
+
 #endif // BITCOIN_HTTPSERVER_H
@@ -11,6 +11,8 @@
 
 #include "init.h"
 
+#include "addressindex.h"
+#include "blockfilterindex.h"
 #include "addrman.h"
 #include "amount.h"
 #include "chain.h"
@@ -35,6 +37,7 @@
 #include "scheduler.h"
 #include "timedata.h"
 #include "txdb.h"
+#include "txindex.h"
 #include "txmempool.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
@@ -99,6 +102,37 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+/** Time between periodic writes of the fee estimates, in seconds */
+static const int64_t FEE_ESTIMATES_FLUSH_INTERVAL = 15 * 60;
+
+/**
+ * Write the fee estimates to a temporary file and move it into place, so an
+ * unclean shutdown never leaves a truncated fee_estimates.dat behind. Unless
+ * fForce is set, nothing is written if no block was processed since the last
+ * write.
+ */
+static void FlushFeeEstimates(bool fForce)
+{
+    static CCriticalSection cs_feeEstimatesFile;
+    LOCK(cs_feeEstimatesFile);
+    if (!fForce && !mempool.FeeEstimatesDirty())
+        return;
+
+    boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    boost::filesystem::path est_path_new = GetDataDir() / (std::string(FEE_ESTIMATES_FILENAME) + ".new");
+    {
+        CAutoFile est_fileout(fopen(est_path_new.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (est_fileout.IsNull()) {
+            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path_new.string());
+            return;
+        }
+        if (!mempool.WriteFeeEstimates(est_fileout))
+            return;
+        FileCommit(est_fileout.Get());
+    }
+    if (!RenameOver(est_path_new, est_path))
+        LogPrintf("%s: Failed to rename %s to %s\n", __func__, est_path_new.string(), est_path.string());
+}
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -203,8 +237,9 @@ void Shutdown()
     StopRPC();
     StopHTTPServer();
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
-        pwalletMain->Flush(false);
+    BOOST_FOREACH(CWallet* pwallet, vpwallets) {
+        pwallet->Flush(false);
+    }
 #endif
     MapPort(false);
     UnregisterValidationInterface(peerLogic.get());
@@ -216,14 +251,18 @@ void Shutdown()
     if (fDumpMempoolLater)
         DumpMempool();
 
+    if (g_txindex) {
+        g_txindex->Stop();
+        g_txindex.reset();
+    }
+    if (g_blockfilterindex) {
+        g_blockfilterindex->Stop();
+        g_blockfilterindex.reset();
+    }
+
     if (fFeeEstimatesInitialized)
     {
-        boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-        CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
-        if (!est_fileout.IsNull())
-            mempool.WriteFeeEstimates(est_fileout);
-        else
-            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
+        FlushFeeEstimates(true);
         fFeeEstimatesInitialized = false;
     }
 
@@ -231,6 +270,8 @@ void Shutdown()
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            if (GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT))
+                DumpBlockIndex();
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
@@ -240,10 +281,13 @@ void Shutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete paddressindex;
+        paddressindex = NULL;
     }
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
-        pwalletMain->Flush(true);
+    BOOST_FOREACH(CWallet* pwallet, vpwallets) {
+        pwallet->Flush(true);
+    }
 #endif
 
 #if ENABLE_ZMQ
@@ -263,7 +307,10 @@ void Shutdown()
 #endif
     UnregisterAllValidationInterfaces();
 #ifdef ENABLE_WALLET
-    delete pwalletMain;
+    BOOST_FOREACH(CWallet* pwallet, vpwallets) {
+        delete pwallet;
+    }
+    vpwallets.clear();
     pwalletMain = NULL;
 #endif
     globalVerifyHandle.reset();
@@ -326,10 +373,15 @@ std::string HelpMessage(HelpMessageMode mode)
     std::string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the history and unspent outputs of every address, used by the getaddress* rpc calls (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of compact filters by block, used by the getblockfilter rpc call and to serve filters to peers (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-blockindexsnapshot", strprintf(_("Keep a flat copy of the block index, written on shutdown, to speed up the next startup (default: %u)"), DEFAULT_BLOCKINDEX_SNAPSHOT));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
+    strUsage += HelpMessageOpt("-compactchainstate", strprintf(_("Compact the chain state database in the background while no new blocks arrive (default: %u)"), DEFAULT_COMPACT_CHAINSTATE));
+    strUsage += HelpMessageOpt("-compressblockfiles", strprintf(_("Recompress old block and undo files in the background to save disk space; recent blocks stay uncompressed. Incompatible with -prune (default: %u)"), DEFAULT_COMPRESS_BLOCK_FILES));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -339,10 +391,12 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbprofile=<db>:<settings>", _("Tune a LevelDB database (chainstate, blockindex, addressindex or blockfilterindex) with a preset (default, nvme, hdd) and/or comma separated blockcache=<percent of its cache>, blocksize=<KiB>, bloombits=<n>, compression=<0|1>, maxopenfiles=<n>; can be specified multiple times"));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphanmem=<n>", strprintf(_("Keep at most <n> megabytes of unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_MEMORY));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
@@ -381,6 +435,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers per BIP 157 (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
@@ -622,18 +677,8 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
 
     // -reindex
     if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        if (!ReindexBlockFiles(chainparams))
+            return; // Shutting down or failed; the reindex resumes on the next start
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
@@ -888,8 +933,16 @@ bool AppInitParameterInteraction()
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+        if (GetBoolArg("-compressblockfiles", DEFAULT_COMPRESS_BLOCK_FILES))
+            return InitError(_("Prune mode is incompatible with -compressblockfiles."));
     }
 
+    std::string strDBProfileError;
+    if (!CheckDBProfiles(strDBProfileError))
+        return InitError(strprintf(_("Invalid -dbprofile: %s"), strDBProfileError));
+
     // Make sure enough file descriptors are available
     int nBind = std::max(
                 (mapMultiArgs.count("-bind") ? mapMultiArgs.at("-bind").size() : 0) +
@@ -1055,6 +1108,12 @@ bool AppInitParameterInteraction()
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices = ServiceFlags(nLocalServices | NODE_BLOOM);
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_FILTERS);
+    }
+
     if (GetBoolArg("-rpcserialversion", DEFAULT_RPC_SERIALIZE_VERSION) > 0) //No segwit! (command itself is kept to keep compatibility)
         return InitError("unknown rpcserialversion requested.");
 
@@ -1195,6 +1254,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadMempoolScriptCheck);
     }
 
     // Start the lightweight task scheduler thread
@@ -1418,6 +1479,16 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nAddressIndexCache = 0;
+    if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        nAddressIndexCache = std::min(nTotalCache / 8, nMaxAddressIndexCache << 20);
+        nTotalCache -= nAddressIndexCache;
+    }
+    int64_t nBlockFilterIndexCache = 0;
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        nBlockFilterIndexCache = std::min(nTotalCache / 8, nMaxBlockFilterIndexCache << 20);
+        nTotalCache -= nBlockFilterIndexCache;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
@@ -1426,6 +1497,10 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    if (nAddressIndexCache)
+        LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexCache * (1.0 / 1024 / 1024));
+    if (nBlockFilterIndexCache)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nBlockFilterIndexCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
@@ -1443,11 +1518,15 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete paddressindex;
+                paddressindex = NULL;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                if (nAddressIndexCache)
+                    paddressindex = new CAddressIndexDB(nAddressIndexCache, false, fReindex || fReindexChainState);
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1472,9 +1551,27 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
+                // Check for changed -txindex state. The index is built in the
+                // background, so it can be switched on without a reindex.
+                uint256 hashTxIndexBest;
+                if (fTxIndex && !pblocktree->ReadTxIndexBestBlock(hashTxIndexBest)) {
+                    // Written by an older version while connecting blocks, so complete up to the tip
+                    hashTxIndexBest = chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256();
+                    pblocktree->WriteTxIndexBestBlock(hashTxIndexBest);
+                }
                 if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
+                    fTxIndex = !fTxIndex;
+                    pblocktree->WriteFlag("txindex", fTxIndex);
+                    if (fTxIndex && !pblocktree->ReadTxIndexBestBlock(hashTxIndexBest))
+                        pblocktree->WriteTxIndexBestBlock(uint256());
+                    LogPrintf("Transaction index %s\n", fTxIndex ? "enabled, building it in the background" : "disabled");
+                }
+
+                // The address index is only maintained while connecting and
+                // disconnecting blocks; move it back to the active chain if it
+                // was left on another branch or behind.
+                if (!SyncAddressIndex(chainparams)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to enable -addressindex");
                     break;
                 }
 
@@ -1567,6 +1664,21 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (!est_filein.IsNull())
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
+    scheduler.scheduleEvery(boost::bind(&FlushFeeEstimates, false), FEE_ESTIMATES_FLUSH_INTERVAL);
+    if (GetBoolArg("-compressblockfiles", DEFAULT_COMPRESS_BLOCK_FILES))
+        scheduler.scheduleEvery(boost::bind(&CompressBlockFiles, boost::cref(chainparams)), BLOCKFILE_COMPRESS_INTERVAL);
+    if (GetBoolArg("-compactchainstate", DEFAULT_COMPACT_CHAINSTATE))
+        scheduler.scheduleEvery(boost::bind(&CompactChainstate, pcoinsdbview, CHAINSTATE_COMPACT_IDLE, CHAINSTATE_COMPACT_MIN_WRITTEN), CHAINSTATE_COMPACT_INTERVAL);
+
+    if (fTxIndex) {
+        g_txindex.reset(new CTxIndex(*pblocktree));
+        g_txindex->Start();
+    }
+
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        g_blockfilterindex.reset(new CBlockFilterIndex(BASIC_FILTER, nBlockFilterIndexCache));
+        g_blockfilterindex->Start();
+    }
 
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
@@ -1661,8 +1773,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     uiInterface.InitMessage(_("Done loading"));
 
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
-        pwalletMain->postInitProcess(threadGroup);
+    BOOST_FOREACH(CWallet* pwallet, vpwallets) {
+        pwallet->postInitProcess(threadGroup);
+    }
 #endif
 
     return !fRequestShutdown;
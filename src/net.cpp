@@ -2645,6 +2645,20 @@ int CConnman::GetBestHeight() const
 unsigned int CConnman::GetReceiveFloodSize() const { return nReceiveFloodSize; }
 unsigned int CConnman::GetSendBufferSize() const{ return nSendBufferMaxSize; }
 
+bool CConnman::PollMessage(CNode* pnode, std::list<CNetMessage>& msgs, bool& fMoreWork, const std::function<bool(CNetMessage&)>& fTake)
+{
+    LOCK(pnode->cs_vProcessMsg);
+    fMoreWork = !pnode->vProcessMsg.empty();
+    if (!fMoreWork || (fTake && !fTake(pnode->vProcessMsg.front())))
+        return false;
+
+    msgs.splice(msgs.end(), pnode->vProcessMsg, pnode->vProcessMsg.begin());
+    pnode->nProcessQueueSize -= msgs.back().vRecv.size() + CMessageHeader::HEADER_SIZE;
+    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+    fMoreWork = !pnode->vProcessMsg.empty();
+    return true;
+}
+
 CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const std::string& addrNameIn, bool fInboundIn) :
     nTimeConnected(GetSystemTimeInSeconds()),
     addr(addrIn),
@@ -26,6 +26,8 @@
 
 #include <atomic>
 #include <deque>
+#include <functional>
+#include <list>
 #include <stdint.h>
 #include <thread>
 #include <memory>
@@ -42,6 +44,7 @@
 class CAddrMan;
 class CScheduler;
 class CNode;
+class CNetMessage;
 
 namespace boost {
     class thread_group;
@@ -288,6 +291,13 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /**
+     * Move the next message pnode queued for processing to the end of msgs,
+     * keeping the receive flood accounting, if fTake (when given) accepts
+     * it. fMoreWork tells whether messages are left in the queue.
+     */
+    bool PollMessage(CNode* pnode, std::list<CNetMessage>& msgs, bool& fMoreWork, const std::function<bool(CNetMessage&)>& fTake = nullptr);
+
     void WakeMessageHandler();
 private:
     struct ListenSocket {
@@ -11,6 +11,7 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "checkpointsync.h"
 #include "consensus/validation.h"
@@ -28,12 +29,15 @@
 #include "random.h"
 #include "tinyformat.h"
 #include "txmempool.h"
+#include "txorphanpool.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
+#include <limits>
+
 #include <boost/thread.hpp>
 
 #if defined(NDEBUG)
@@ -42,23 +46,7 @@
 
 std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
 
-struct IteratorComparator
-{
-    template<typename I>
-    bool operator()(const I& a, const I& b)
-    {
-        return &(*a) < &(*b);
-    }
-};
-
-struct COrphanTx {
-    // When modifying, adapt the copy of this definition in tests/DoS_tests.
-    CTransactionRef tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-std::map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+CTxOrphanPool orphanpool GUARDED_BY(cs_main);
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 static size_t vExtraTxnForCompactIt = 0;
@@ -580,7 +568,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 
 //////////////////////////////////////////////////////////////////////////////
 //
-// mapOrphanTransactions
+// orphanpool
 //
 
 void AddToCompactExtraTransactions(const CTransactionRef& tx)
@@ -597,7 +585,7 @@ void AddToCompactExtraTransactions(const CTransactionRef& tx)
 bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     const uint256& hash = tx->GetHash();
-    if (mapOrphanTransactions.count(hash))
+    if (orphanpool.HaveTx(hash))
         return false;
 
     // Ignore big transactions, to avoid a
@@ -614,87 +602,39 @@ bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRE
         return false;
     }
 
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
-    assert(ret.second);
-    BOOST_FOREACH(const CTxIn& txin, tx->vin) {
-        mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
-    }
+    // No single peer may take more than its quota of the pool's memory; it
+    // makes room by losing its own oldest orphans.
+    size_t nMaxPeerUsage = (size_t)std::max((int64_t)0, GetArg("-maxorphanmem", DEFAULT_MAX_ORPHAN_MEMORY)) * 1000000 / ORPHAN_PEER_QUOTA_DIVISOR;
+    if (!orphanpool.AddTx(tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME, nMaxPeerUsage))
+        return false;
 
     AddToCompactExtraTransactions(tx);
 
     LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+             orphanpool.size(), orphanpool.ByPrevSize());
     return true;
 }
 
 int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
-        return 0;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx->vin)
-    {
-        auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(it);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
-    }
-    mapOrphanTransactions.erase(it);
-    return 1;
+    return orphanpool.EraseTx(hash);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        std::map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
-        }
-    }
+    int nErased = orphanpool.EraseForPeer(peer);
     if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer=%d\n", nErased, peer);
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    unsigned int nEvicted = 0;
-    static int64_t nNextSweep;
-    int64_t nNow = GetTime();
-    if (nNextSweep <= nNow) {
-        // Sweep out expired orphan pool entries:
-        int nErased = 0;
-        int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
-        std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-        while (iter != mapOrphanTransactions.end())
-        {
-            std::map<uint256, COrphanTx>::iterator maybeErase = iter++;
-            if (maybeErase->second.nTimeExpire <= nNow) {
-                nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
-            } else {
-                nMinExpTime = std::min(maybeErase->second.nTimeExpire, nMinExpTime);
-            }
-        }
-        // Sweep again 5 minutes after the next entry that expires in order to batch the linear scan.
-        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
-        if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
-    }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
-    {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
-        ++nEvicted;
-    }
-    return nEvicted;
+    // Sweep out expired orphan pool entries:
+    int nErased = orphanpool.EraseExpired(GetTime());
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
+
+    // Evict from the peers using the most memory first
+    return orphanpool.LimitOrphans(nMaxOrphans, nMaxUsage);
 }
 
 // Requires cs_main.
@@ -742,15 +682,7 @@ void PeerLogicValidation::SyncTransaction(const CTransaction& tx, const CBlockIn
 
     std::vector<uint256> vOrphanErase;
     // Which orphan pool entries must we evict?
-    for (size_t j = 0; j < tx.vin.size(); j++) {
-        auto itByPrev = mapOrphanTransactionsByPrev.find(tx.vin[j].prevout);
-        if (itByPrev == mapOrphanTransactionsByPrev.end()) continue;
-        for (auto mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
-            const CTransaction& orphanTx = *(*mi)->second.tx;
-            const uint256& orphanHash = orphanTx.GetHash();
-            vOrphanErase.push_back(orphanHash);
-        }
-    }
+    orphanpool.GetConflictingOrphans(tx, vOrphanErase);
 
     // Erase orphan transactions include or precluded by this block
     if (vOrphanErase.size()) {
@@ -898,7 +830,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
             // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
+                   orphanpool.HaveTx(inv.hash) ||
                    pcoinsTip->HaveCoinsInCache(inv.hash);
         }
     case MSG_BLOCK:
@@ -1150,6 +1082,163 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+/**
+ * Validate a BIP 157 request for the filters of the blocks from nStartHeight
+ * to hashStop and look up the stop block. Peers that ask for filters we do not
+ * advertise, or for too many at once, are disconnected.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& hashStop,
+                                      uint32_t nMaxHeightDiff, const CBlockIndex*& pindexStop)
+{
+    if (!(pfrom->GetLocalServices() & NODE_COMPACT_FILTERS) || nFilterType != BASIC_FILTER ||
+        !g_blockfilterindex || g_blockfilterindex->GetFilterType() != nFilterType) {
+        LogPrint("net", "peer %d requested unsupported block filter type: %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashStop);
+        if (mi == mapBlockIndex.end()) {
+            LogPrint("net", "peer %d requested filters for unknown block %s\n", pfrom->id, hashStop.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        if (!chainActive.Contains(mi->second)) {
+            LogPrint("net", "peer %d requested filters for block %s that is not in the active chain\n", pfrom->id, hashStop.ToString());
+            return false;
+        }
+        pindexStop = mi->second;
+    }
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight) {
+        LogPrint("net", "peer %d sent invalid getcfilters/getcfheaders with start height %d > stop height %d\n",
+                 pfrom->id, nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (nStopHeight - nStartHeight >= nMaxHeightDiff) {
+        LogPrint("net", "peer %d requested too many filters/headers: %d / %d\n",
+                 pfrom->id, nStopHeight - nStartHeight + 1, nMaxHeightDiff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 hashStop;
+    vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, pindexStop))
+        return;
+
+    std::vector<BlockFilter> vFilters;
+    if (!g_blockfilterindex->LookupFilterRange(nStartHeight, pindexStop, vFilters)) {
+        LogPrint("net", "failed to find block filters for blocks %d-%d from peer=%d\n", nStartHeight, pindexStop->nHeight, pfrom->id);
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const BlockFilter& filter : vFilters)
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, (uint8_t)filter.GetFilterType(), filter.GetBlockHash(), filter.GetEncodedFilter()));
+}
+
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint32_t nStartHeight;
+    uint256 hashStop;
+    vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, pindexStop))
+        return;
+
+    uint256 hashPrevHeader;
+    if (nStartHeight > 0) {
+        const CBlockIndex* pindexPrev = pindexStop->GetAncestor(nStartHeight - 1);
+        if (!g_blockfilterindex->LookupFilterHeader(pindexPrev, hashPrevHeader)) {
+            LogPrint("net", "failed to find block filter header for block %s from peer=%d\n", pindexPrev->GetBlockHash().ToString(), pfrom->id);
+            return;
+        }
+    }
+
+    std::vector<uint256> vFilterHashes;
+    if (!g_blockfilterindex->LookupFilterHashRange(nStartHeight, pindexStop, vFilterHashes)) {
+        LogPrint("net", "failed to find block filter hashes for blocks %d-%d from peer=%d\n", nStartHeight, pindexStop->nHeight, pfrom->id);
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS, nFilterType, pindexStop->GetBlockHash(), hashPrevHeader, vFilterHashes));
+}
+
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t nFilterType;
+    uint256 hashStop;
+    vRecv >> nFilterType >> hashStop;
+
+    const CBlockIndex* pindexStop;
+    if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, hashStop, std::numeric_limits<uint32_t>::max(), pindexStop))
+        return;
+
+    std::vector<uint256> vHeaders(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        const CBlockIndex* pindex = pindexStop->GetAncestor((i + 1) * CFCHECKPT_INTERVAL);
+        if (!g_blockfilterindex->LookupFilterHeader(pindex, vHeaders[i])) {
+            LogPrint("net", "failed to find block filter header for block %s from peer=%d\n", pindex->GetBlockHash().ToString(), pfrom->id);
+            return;
+        }
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT, nFilterType, pindexStop->GetBlockHash(), vHeaders));
+}
+
+/**
+ * Move the tx messages the peer queued right behind the one being processed
+ * into vtx, up to MAX_TX_BATCH_SIZE transactions in all. Stops at the first
+ * other message, or one that doesn't check out or parse, which is left for
+ * ProcessMessages to handle as usual.
+ */
+static void TakeQueuedTransactions(CNode* pfrom, CConnman& connman, std::vector<CTransactionRef>& vtx)
+{
+    const CChainParams& chainparams = Params();
+    bool fMore = true;
+    while (vtx.size() < MAX_TX_BATCH_SIZE && fMore) {
+        CTransactionRef ptx;
+        std::list<CNetMessage> msgs;
+        bool fTaken = connman.PollMessage(pfrom, msgs, fMore, [&](CNetMessage& msg) {
+            if (memcmp(msg.hdr.pchMessageStart, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE) != 0 ||
+                !msg.hdr.IsValid(chainparams.MessageStart()) || msg.hdr.GetCommand() != NetMsgType::TX)
+                return false;
+            const uint256& hash = msg.GetMessageHash();
+            if (memcmp(hash.begin(), msg.hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) != 0)
+                return false;
+
+            msg.SetVersion(pfrom->GetRecvVersion());
+            try {
+                CDataStream vRecv(msg.vRecv);
+                vRecv >> ptx;
+            } catch (const std::exception&) {
+                return false;
+            }
+            return true;
+        });
+        if (!fTaken)
+            break;
+        vtx.push_back(ptx);
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1725,6 +1814,24 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::GETCFILTERS)
+    {
+        ProcessGetCFilters(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFHEADERS)
+    {
+        ProcessGetCFHeaders(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT)
+    {
+        ProcessGetCFCheckPt(pfrom, vRecv, connman);
+    }
+
+
     else if (strCommand == NetMsgType::GETHEADERS)
     {
         if(!defenseDelayActive) {
@@ -1800,172 +1907,221 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
+        // Validate the transactions the peer queued behind this one along
+        // with it, so a relay burst is checked as one batch
+        std::vector<CTransactionRef> vtx(1);
+        vRecv >> vtx[0];
+        TakeQueuedTransactions(pfrom, connman, vtx);
+
         std::deque<COutPoint> vWorkQueue;
         std::vector<uint256> vEraseQueue;
-        CTransactionRef ptx;
-        vRecv >> ptx;
-        const CTransaction& tx = *ptx;
+        std::list<CTransactionRef> lRemovedTxn;
 
-        CInv inv(MSG_TX, tx.GetHash());
-        pfrom->AddInventoryKnown(inv);
+        // Transactions we already have (or that repeat in the batch) are
+        // not validated again
+        std::vector<CTransactionRef> vtxNew;
+        std::vector<bool> vHave(vtx.size());
+        {
+            LOCK(cs_main);
+            std::set<uint256> setSeen;
+            for (size_t i = 0; i < vtx.size(); i++) {
+                CInv inv(MSG_TX, vtx[i]->GetHash());
+                pfrom->AddInventoryKnown(inv);
+                pfrom->setAskFor.erase(inv.hash);
+                mapAlreadyAskedFor.erase(inv.hash);
+                vHave[i] = !setSeen.insert(inv.hash).second || AlreadyHave(inv);
+                if (!vHave[i])
+                    vtxNew.push_back(vtx[i]);
+            }
+        }
 
-        LOCK(cs_main);
+        // The scripts are checked before cs_main is taken again
+        std::vector<CTxBatchResult> vResultsNew;
+        if (!vtxNew.empty())
+            AcceptToMemoryPoolBatch(mempool, vtxNew, vResultsNew, true, &lRemovedTxn);
 
-        bool fMissingInputs = false;
-        CValidationState state;
+        {
+        LOCK(cs_main);
 
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv.hash);
+        const CTxBatchResult resultHave;
+        size_t nNew = 0;
+        for (size_t nTx = 0; nTx < vtx.size(); nTx++) {
+            const CTransactionRef& ptx = vtx[nTx];
+            const CTransaction& tx = *ptx;
+            const CTxBatchResult& result = vHave[nTx] ? resultHave : vResultsNew[nNew++];
+            const CValidationState& state = result.state;
+
+            if (result.fAccepted) {
+                mempool.check(pcoinsTip);
+                RelayTransaction(tx, connman);
+                for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                    vWorkQueue.emplace_back(tx.GetHash(), i);
+                }
 
-        std::list<CTransactionRef> lRemovedTxn;
+                pfrom->nLastTXTime = GetTime();
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn)) {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
+                LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+                    pfrom->id,
+                    tx.GetHash().ToString(),
+                    mempool.size(), mempool.DynamicMemoryUsage() / 1000);
             }
-
-            pfrom->nLastTXTime = GetTime();
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->id,
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
+            else if (result.fMissingInputs)
+            {
+                bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
+                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                    if (recentRejects->contains(txin.prevout.hash)) {
+                        fRejectedParents = true;
+                        break;
                     }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!stateDummy.CorruptionPossible()) {
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
+                }
+                if (!fRejectedParents) {
+                    uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
+                    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                        CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
+                        pfrom->AddInventoryKnown(_inv);
+                        if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
+                    }
+                    AddOrphanTx(ptx, pfrom->GetId());
+
+                    // DoS prevention: do not allow the orphan pool to grow unbounded
+                    unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+                    size_t nMaxOrphanUsage = (size_t)std::max((int64_t)0, GetArg("-maxorphanmem", DEFAULT_MAX_ORPHAN_MEMORY)) * 1000000;
+                    unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanUsage);
+                    if (nEvicted > 0)
+                        LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+                } else {
+                    LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
+                    // We will continue to reject this tx since it has rejected
+                    // parents so avoid re-requesting it from other peers.
+                    recentRejects->insert(tx.GetHash());
+                }
+            } else {
+                if (!state.CorruptionPossible()) {
+                    // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                    assert(recentRejects);
+                    recentRejects->insert(tx.GetHash());
+                    if (RecursiveDynamicUsage(*ptx) < 100000) {
+                        AddToCompactExtraTransactions(ptx);
                     }
-                    mempool.check(pcoinsTip);
                 }
-            }
 
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
-            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
-                    fRejectedParents = true;
-                    break;
+                if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+                    // Always relay transactions received from whitelisted peers, even
+                    // if they were already in the mempool or rejected from it due
+                    // to policy, allowing the node to function as a gateway for
+                    // nodes hidden behind it.
+                    //
+                    // Never relay transactions that we would assign a non-zero DoS
+                    // score for, as we expect peers to do the same with us in that
+                    // case.
+                    int nDoS = 0;
+                    if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                        LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                        RelayTransaction(tx, connman);
+                    } else {
+                        LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
+                    }
                 }
             }
-            if (!fRejectedParents) {
-                uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
-                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                    CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
-                    pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
-                }
-                AddOrphanTx(ptx, pfrom->GetId());
 
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0)
-                    LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-            } else {
-                LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                recentRejects->insert(tx.GetHash());
+            int nDoS = 0;
+            if (state.IsInvalid(nDoS))
+            {
+                LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+                    pfrom->id,
+                    FormatStateMessage(state));
+                if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
+                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), tx.GetHash()));
+                if (nDoS > 0) {
+                    Misbehaving(pfrom->GetId(), nDoS);
+                }
             }
-        } else {
-            if (!state.CorruptionPossible()) {
-                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                assert(recentRejects);
-                recentRejects->insert(tx.GetHash());
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
+        }
+        }
+
+        // Process any orphan transactions that depended on the accepted
+        // ones, one generation at a time so each generation is validated as
+        // a batch
+        std::set<NodeId> setMisbehaving;
+        std::set<uint256> setOrphansDone;
+        while (!vWorkQueue.empty()) {
+            std::vector<CTransactionRef> vOrphanBatch;
+            std::vector<NodeId> vOrphanPeers;
+            {
+            LOCK(cs_main);
+            for (const COutPoint& outpoint : vWorkQueue) {
+                std::vector<COrphanTx> vOrphans;
+                orphanpool.GetOrphansByPrev(outpoint, vOrphans);
+                for (const COrphanTx& orphan : vOrphans) {
+                    if (setMisbehaving.count(orphan.fromPeer))
+                        continue;
+                    if (!setOrphansDone.insert(orphan.tx->GetHash()).second)
+                        continue;
+                    vOrphanBatch.push_back(orphan.tx);
+                    vOrphanPeers.push_back(orphan.fromPeer);
                 }
             }
+            }
+            vWorkQueue.clear();
 
-            if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx, connman);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
+            // Use dummy CValidationStates so someone can't setup nodes to counter-DoS based on orphan
+            // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+            // anyone relaying LegitTxX banned)
+            // As above, the scripts are checked before cs_main is taken again
+            std::vector<CTxBatchResult> vResults;
+            AcceptToMemoryPoolBatch(mempool, vOrphanBatch, vResults, true, &lRemovedTxn);
+
+            LOCK(cs_main);
+            for (size_t i = 0; i < vOrphanBatch.size(); i++) {
+                const CTransaction& orphanTx = *vOrphanBatch[i];
+                const uint256& orphanHash = orphanTx.GetHash();
+                NodeId fromPeer = vOrphanPeers[i];
+                const CValidationState& stateDummy = vResults[i].state;
+
+                if (vResults[i].fAccepted) {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx, connman);
+                    for (unsigned int j = 0; j < orphanTx.vout.size(); j++) {
+                        vWorkQueue.emplace_back(orphanHash, j);
+                    }
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (vResults[i].fMissingInputs)
+                {
+                    // Another parent may still arrive; allow a retry then
+                    setOrphansDone.erase(orphanHash);
+                }
+                else
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    if (!stateDummy.CorruptionPossible()) {
+                        // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanHash);
+                    }
                 }
             }
+            mempool.check(pcoinsTip);
         }
 
+        LOCK(cs_main);
+        BOOST_FOREACH(uint256 hash, vEraseQueue)
+            EraseOrphanTx(hash);
+
         for (const CTransactionRef& removedTx : lRemovedTxn)
             AddToCompactExtraTransactions(removedTx);
-
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->id,
-                FormatStateMessage(state));
-            if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-            if (nDoS > 0) {
-                Misbehaving(pfrom->GetId(), nDoS);
-            }
-        }
     }
 
 
@@ -2691,16 +2847,9 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             return false;
 
         std::list<CNetMessage> msgs;
-        {
-            LOCK(pfrom->cs_vProcessMsg);
-            if (pfrom->vProcessMsg.empty())
-                return false;
-            // Just take one message
-            msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
-            pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
-            pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
-            fMoreWork = !pfrom->vProcessMsg.empty();
-        }
+        // Just take one message
+        if (!connman.PollMessage(pfrom, msgs, fMoreWork))
+            return false;
         CNetMessage& msg(msgs.front());
 
         msg.SetVersion(pfrom->GetRecvVersion());
@@ -3301,7 +3450,6 @@ public:
     CNetProcessingCleanup() {}
     ~CNetProcessingCleanup() {
         // orphan transactions
-        mapOrphanTransactions.clear();
-        mapOrphanTransactionsByPrev.clear();
+        orphanpool.Clear();
     }
 } instance_of_cnetprocessingcleanup;
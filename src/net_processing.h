@@ -16,10 +16,20 @@
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
-/** Minimum time between orphan transactions expire time checks in seconds */
-static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+/** Default for -maxorphanmem, maximum memory used by orphan transactions in megabytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_MEMORY = 5;
+/** A single peer may use at most 1/ORPHAN_PEER_QUOTA_DIVISOR of the orphan memory limit */
+static const unsigned int ORPHAN_PEER_QUOTA_DIVISOR = 4;
+/** Maximum number of transactions queued by a peer that are validated as one batch */
+static const unsigned int MAX_TX_BATCH_SIZE = 100;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Maximum number of compact filters that may be requested with one getcfilters (BIP 157) */
+static const unsigned int MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes that may be requested with one getcfheaders (BIP 157) */
+static const unsigned int MAX_GETCFHEADERS_SIZE = 2000;
+/** Spacing of the filter headers returned by getcfcheckpt (BIP 157) */
+static const int CFCHECKPT_INTERVAL = 1000;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
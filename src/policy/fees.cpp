@@ -20,6 +20,7 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay)
 {
     decay = _decay;
+    scale = 1;
     for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
         buckets.push_back(defaultBuckets[i]);
         bucketMap[defaultBuckets[i]] = i;
@@ -34,23 +35,34 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
     }
 
     oldUnconfTxs.resize(buckets.size());
+    unconfTxsTotal.resize(maxConfirms);
     curBlockTxCt.resize(buckets.size());
     txCtAvg.resize(buckets.size());
     curBlockVal.resize(buckets.size());
     avg.resize(buckets.size());
+    touched.resize(buckets.size());
 }
 
 // Zero out the data for the current block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
+    unsigned int blockIndex = nBlockHeight % unconfTxs.size();
+    if (unconfTxsTotal[blockIndex] != 0) {
+        for (unsigned int j = 0; j < buckets.size(); j++) {
+            oldUnconfTxs[j] += unconfTxs[blockIndex][j];
+            unconfTxs[blockIndex][j] = 0;
+        }
+        unconfTxsTotal[blockIndex] = 0;
+    }
+    // Only the buckets that received data in the last block need clearing
+    for (unsigned int j : touchedBuckets) {
         for (unsigned int i = 0; i < curBlockConf.size(); i++)
             curBlockConf[i][j] = 0;
         curBlockTxCt[j] = 0;
         curBlockVal[j] = 0;
+        touched[j] = false;
     }
+    touchedBuckets.clear();
 }
 
 
@@ -65,16 +77,36 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     }
     curBlockTxCt[bucketindex]++;
     curBlockVal[bucketindex] += val;
+    if (!touched[bucketindex]) {
+        touched[bucketindex] = true;
+        touchedBuckets.push_back(bucketindex);
+    }
 }
 
 void TxConfirmStats::UpdateMovingAverages()
+{
+    // Decaying every average is done by shrinking the shared scale factor;
+    // only the buckets with new data need their stored values adjusted.
+    scale *= decay;
+    if (scale < MIN_SCALE)
+        Rescale();
+    for (unsigned int j : touchedBuckets) {
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            confAvg[i][j] += curBlockConf[i][j] / scale;
+        avg[j] += curBlockVal[j] / scale;
+        txCtAvg[j] += curBlockTxCt[j] / scale;
+    }
+}
+
+void TxConfirmStats::Rescale()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
         for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+            confAvg[i][j] *= scale;
+        avg[j] *= scale;
+        txCtAvg[j] *= scale;
     }
+    scale = 1;
 }
 
 // returns -1 on error conditions
@@ -112,8 +144,8 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     // Start counting from highest(default) or lowest feerate transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
+        nConf += confAvg[confTarget - 1][bucket] * scale;
+        totalNum += txCtAvg[bucket] * scale;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
@@ -154,13 +186,13 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int minBucket = bestNearBucket < bestFarBucket ? bestNearBucket : bestFarBucket;
     unsigned int maxBucket = bestNearBucket > bestFarBucket ? bestNearBucket : bestFarBucket;
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
-        txSum += txCtAvg[j];
+        txSum += txCtAvg[j] * scale;
     }
     if (foundAnswer && txSum != 0) {
         txSum = txSum / 2;
         for (unsigned int j = minBucket; j <= maxBucket; j++) {
-            if (txCtAvg[j] < txSum)
-                txSum -= txCtAvg[j];
+            if (txCtAvg[j] * scale < txSum)
+                txSum -= txCtAvg[j] * scale;
             else { // we're in the right bucket
                 median = avg[j] / txCtAvg[j];
                 break;
@@ -178,6 +210,8 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    // The file holds the real (fully decayed) averages
+    Rescale();
     fileout << decay;
     fileout << buckets;
     fileout << avg;
@@ -224,6 +258,7 @@ void TxConfirmStats::Read(CAutoFile& filein)
     avg = fileAvg;
     confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
+    scale = 1;
     bucketMap.clear();
 
     // Resize the current block variables which aren't stored in the data file
@@ -234,8 +269,11 @@ void TxConfirmStats::Read(CAutoFile& filein)
     }
     curBlockTxCt.resize(buckets.size());
     curBlockVal.resize(buckets.size());
+    touched.assign(buckets.size(), false);
+    touchedBuckets.clear();
 
     unconfTxs.resize(maxConfirms);
+    unconfTxsTotal.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         unconfTxs[i].resize(buckets.size());
     }
@@ -253,6 +291,7 @@ unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
     unconfTxs[blockIndex][bucketindex]++;
+    unconfTxsTotal[blockIndex]++;
     return bucketindex;
 }
 
@@ -276,9 +315,10 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
     }
     else {
         unsigned int blockIndex = entryHeight % unconfTxs.size();
-        if (unconfTxs[blockIndex][bucketindex] > 0)
+        if (unconfTxs[blockIndex][bucketindex] > 0) {
             unconfTxs[blockIndex][bucketindex]--;
-        else
+            unconfTxsTotal[blockIndex]--;
+        } else
             LogPrint("estimatefee", "Blockpolicy error, mempool tx removed from blockIndex=%u,bucketIndex=%u already\n",
                      blockIndex, bucketindex);
     }
@@ -295,6 +335,7 @@ bool CBlockPolicyEstimator::removeTx(uint256 hash)
     if (pos != mapMemPoolTxs.end()) {
         feeStats.removeTx(pos->second.blockHeight, nBestSeenHeight, pos->second.bucketIndex);
         mapMemPoolTxs.erase(hash);
+        mapEstimateCache.clear();
         return true;
     } else {
         return false;
@@ -302,7 +343,7 @@ bool CBlockPolicyEstimator::removeTx(uint256 hash)
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
-    : nBestSeenHeight(0), trackedTxs(0), untrackedTxs(0)
+    : nBestSeenHeight(0), nLastWrittenHeight(0), trackedTxs(0), untrackedTxs(0)
 {
     static_assert(MIN_FEERATE > 0, "Min feerate must be nonzero");
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
@@ -345,6 +386,7 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
 
     mapMemPoolTxs[hash].blockHeight = txHeight;
     mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+    mapEstimateCache.clear();
 }
 
 bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry)
@@ -388,6 +430,7 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     // calls to removeTx (via processBlockTx) correctly calculate age
     // of unconfirmed txs to remove from tracking.
     nBestSeenHeight = nBlockHeight;
+    mapEstimateCache.clear();
 
     // Clear the current block state and update unconfirmed circular buffer
     feeStats.ClearCurrent(nBlockHeight);
@@ -409,6 +452,16 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     untrackedTxs = 0;
 }
 
+double CBlockPolicyEstimator::CachedEstimateMedianVal(int confTarget)
+{
+    std::map<int, double>::iterator it = mapEstimateCache.find(confTarget);
+    if (it != mapEstimateCache.end())
+        return it->second;
+    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    mapEstimateCache[confTarget] = median;
+    return median;
+}
+
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
 {
     // Return failure if trying to analyze a target we're not tracking
@@ -416,7 +469,7 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     if (confTarget <= 1 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = CachedEstimateMedianVal(confTarget);
 
     if (median < 0)
         return CFeeRate(0);
@@ -438,7 +491,7 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoun
 
     double median = -1;
     while (median < 0 && (unsigned int)confTarget <= feeStats.GetMaxConfirms()) {
-        median = feeStats.EstimateMedianVal(confTarget++, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+        median = CachedEstimateMedianVal(confTarget++);
     }
 
     if (answerFoundAtTarget)
@@ -477,6 +530,12 @@ void CBlockPolicyEstimator::Write(CAutoFile& fileout)
 {
     fileout << nBestSeenHeight;
     feeStats.Write(fileout);
+    nLastWrittenHeight = nBestSeenHeight;
+}
+
+bool CBlockPolicyEstimator::IsDirty() const
+{
+    return nBestSeenHeight != nLastWrittenHeight;
 }
 
 void CBlockPolicyEstimator::Read(CAutoFile& filein, int nFileVersion)
@@ -485,6 +544,8 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein, int nFileVersion)
     filein >> nFileBestSeenHeight;
     feeStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    nLastWrittenHeight = nFileBestSeenHeight;
+    mapEstimateCache.clear();
     if (nFileVersion < 139900) {
         TxConfirmStats priStats;
         priStats.Read(filein);
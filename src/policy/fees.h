@@ -101,12 +101,27 @@ private:
 
     double decay;
 
+    // Rather than decaying every average on every block, all stored averages
+    // are kept divided by the accumulated decay; the real value of an
+    // average is its stored value multiplied by scale. This makes the
+    // per-block update proportional to the number of buckets that saw
+    // confirmations instead of to the whole table.
+    double scale;
+    // Buckets that received data in the current block
+    std::vector<unsigned int> touchedBuckets;
+    std::vector<bool> touched;
+
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
     std::vector<std::vector<int> > unconfTxs;  //unconfTxs[Y][X]
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
+    // sum of unconfTxs[Y] over all buckets, to skip empty rows
+    std::vector<int> unconfTxsTotal;
+
+    /** Fold scale back into the stored averages */
+    void Rescale();
 
 public:
     /**
@@ -175,6 +190,9 @@ static const unsigned int MAX_BLOCK_CONFIRMS = 25;
 /** Decay of .998 is a half-life of 346 blocks or about 2.4 days */
 static const double DEFAULT_DECAY = .998;
 
+/** Fold the lazy decay back into the averages once it gets this small (about every 35k blocks) */
+static const double MIN_SCALE = 1e-30;
+
 /** Require greater than 95% of X feerate transactions to be confirmed within Y blocks for X to be big enough */
 static const double MIN_SUCCESS_PCT = .95;
 
@@ -246,9 +264,13 @@ public:
     /** Read estimation data from a file */
     void Read(CAutoFile& filein, int nFileVersion);
 
+    /** Whether blocks were processed since the estimates were last read or written */
+    bool IsDirty() const;
+
 private:
     CFeeRate minTrackedFee;    //!< Passed to constructor to avoid dependency on main
     unsigned int nBestSeenHeight;
+    unsigned int nLastWrittenHeight;
     struct TxStatsInfo
     {
         unsigned int blockHeight;
@@ -262,6 +284,10 @@ private:
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats;
 
+    /** Median estimates per confirmation target, valid until the stats next change */
+    std::map<int, double> mapEstimateCache;
+    double CachedEstimateMedianVal(int confTarget);
+
     unsigned int trackedTxs;
     unsigned int untrackedTxs;
 };
@@ -633,6 +633,13 @@ int main(int argc, char *argv[])
 #ifdef ENABLE_WALLET
     // Parse URIs on command line -- this can affect Params()
     PaymentServer::ipcParseCommandLine(argc, argv);
+
+    // The transaction list reads mapWallet, which leaves out the transactions kept compact
+    if (GetArg("-walletcompactdepth", DEFAULT_WALLET_COMPACT_DEPTH) > 0) {
+        QMessageBox::critical(0, QObject::tr(PACKAGE_NAME),
+                              QObject::tr("Error: %1 is not supported by the GUI.").arg("-walletcompactdepth"));
+        return EXIT_FAILURE;
+    }
 #endif
 
     QScopedPointer<const NetworkStyle> networkStyle(NetworkStyle::instantiate(QString::fromStdString(Params().NetworkIDString())));
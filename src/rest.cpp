@@ -15,6 +15,7 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txindex.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
@@ -302,6 +303,64 @@ static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+UniValue getaddressbalance(const JSONRPCRequest& request);
+UniValue getaddresshistory(const JSONRPCRequest& request);
+UniValue getaddressutxos(const JSONRPCRequest& request);
+
+static bool rest_address(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    // <balance|history|utxos>/<address>[/<count>[/<cursor>]]
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+    if (path.size() < 2 || path.size() > 4 || (path[0] == "balance" && path.size() > 2))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/address/<balance|history|utxos>/<address>[/<count>[/<cursor>]].json");
+
+    JSONRPCRequest jsonRequest;
+    jsonRequest.params = UniValue(UniValue::VARR);
+    jsonRequest.params.push_back(path[1]);
+    if (path.size() > 2) {
+        int32_t nCount;
+        if (!ParseInt32(path[2], &nCount))
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid count: " + path[2]);
+        jsonRequest.params.push_back(nCount);
+    }
+    if (path.size() > 3)
+        jsonRequest.params.push_back(path[3]);
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue result;
+        try {
+            if (path[0] == "balance")
+                result = getaddressbalance(jsonRequest);
+            else if (path[0] == "history")
+                result = getaddresshistory(jsonRequest);
+            else if (path[0] == "utxos")
+                result = getaddressutxos(jsonRequest);
+            else
+                return RESTERR(req, HTTP_NOT_FOUND, "unknown address query " + path[0] + " (available: balance, history, utxos)");
+        } catch (const UniValue& objError) {
+            return RESTERR(req, HTTP_BAD_REQUEST, find_value(objError, "message").get_str());
+        }
+        std::string strJSON = result.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_mempool_info(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -363,6 +422,9 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    if (g_txindex)
+        g_txindex->BlockUntilSyncedToCurrentChain();
+
     CTransactionRef tx;
     uint256 hashBlock = uint256();
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
@@ -616,6 +678,7 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/address/", rest_address},
 };
 
 bool StartREST()
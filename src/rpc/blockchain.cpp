@@ -3,17 +3,22 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "amount.h"
+#include "base58.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkpointsync.h"
 #include "coins.h"
 #include "consensus/validation.h"
+#include "dbwrapper.h"
 #include "validation.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/standard.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -353,10 +358,9 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+template <typename ExistsFn>
+static void entryToJSON(UniValue &info, const CTxMemPoolEntry &e, ExistsFn fInMempool)
 {
-    AssertLockHeld(mempool.cs);
-
     info.push_back(Pair("size", (int)e.GetTxSize()));
     info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
     info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
@@ -374,7 +378,7 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     set<string> setDepends;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        if (mempool.exists(txin.prevout.hash))
+        if (fInMempool(txin.prevout.hash))
             setDepends.insert(txin.prevout.hash.ToString());
     }
 
@@ -387,17 +391,25 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("depends", depends));
 }
 
+void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+{
+    AssertLockHeld(mempool.cs);
+    entryToJSON(info, e, [](const uint256& hash) { return mempool.exists(hash); });
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose)
     {
-        LOCK(mempool.cs);
+        // Work from a snapshot so that large dumps don't hold mempool.cs
+        CTxMemPoolSnapshotRef view = mempool.GetSnapshot();
+        auto fInSnapshot = [&view](const uint256& hash) { return view->exists(hash); };
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+        for (const CTxMemPoolEntry& e : view->vEntries)
         {
             const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, e, fInSnapshot);
             o.push_back(Pair(hash.ToString(), info));
         }
         return o;
@@ -984,6 +996,122 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw runtime_error(
+            "getdbstats ( \"name\" )\n"
+            "\nReturns the LevelDB profile, compaction statistics and cache usage of the open databases.\n"
+            "Figures cover the time since each database was opened.\n"
+            "\nArguments:\n"
+            "1. \"name\"     (string, optional) Only report this database (chainstate, blockindex, addressindex or blockfilterindex)\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"name\",            (string) The database name, as used by -dbprofile\n"
+            "    \"path\": \"path\",            (string) The database location\n"
+            "    \"profile\": \"settings\",     (string) The settings in use\n"
+            "    \"cache_size\": n,            (numeric) The cache size given to the database in bytes\n"
+            "    \"block_cache_size\": n,      (numeric) The block cache capacity in bytes\n"
+            "    \"block_cache_usage\": n,     (numeric) The bytes held by the block cache\n"
+            "    \"memtable_usage\": n,        (numeric) The approximate bytes held by the write buffers\n"
+            "    \"bytes_written\": n,         (numeric) The bytes written by the node\n"
+            "    \"compaction_read_mb\": x.x,  (numeric) The MiB read by compactions\n"
+            "    \"compaction_write_mb\": x.x, (numeric) The MiB written by memtable flushes and compactions\n"
+            "    \"write_amplification\": x.x, (numeric) Bytes written to disk, log included, per byte written by the node\n"
+            "    \"read_amplification\": n,    (numeric) The most table files a point lookup may have to check\n"
+            "    \"levels\": [                 (array) Levels holding files or with compactions behind them\n"
+            "      {\n"
+            "        \"level\": n,             (numeric) The level\n"
+            "        \"files\": n,             (numeric) The number of table files\n"
+            "        \"size_mb\": n,           (numeric) The MiB stored, rounded\n"
+            "        \"time_sec\": n,          (numeric) The seconds spent compacting into the level, rounded\n"
+            "        \"read_mb\": n,           (numeric) The MiB read by those compactions, rounded\n"
+            "        \"write_mb\": n           (numeric) The MiB written by those compactions, rounded\n"
+            "      }, ...\n"
+            "    ],\n"
+            "    \"scheduled_compaction\": {    (json object, chainstate only) Idle time compactions, see -compactchainstate\n"
+            "      \"slice\": n,               (numeric) The next slice of the running sweep, -1 if none is running\n"
+            "      \"slices\": n,              (numeric) The slices compacted\n"
+            "      \"sweeps\": n,              (numeric) The sweeps over the whole database completed\n"
+            "      \"deferred\": n,            (numeric) The runs put off because a block was connected recently\n"
+            "      \"total_ms\": x.x,          (numeric) The time spent compacting\n"
+            "      \"last_slice_ms\": x.x,     (numeric) The time the last slice took\n"
+            "      \"max_slice_ms\": x.x,      (numeric) The time the slowest slice took\n"
+            "      \"last_sweep_time\": xxx    (numeric) The time the last sweep completed in seconds since epoch, 0 if never\n"
+            "    }\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleCli("getdbstats", "\"chainstate\"")
+            + HelpExampleRpc("getdbstats", "\"chainstate\"")
+        );
+
+    std::string strName;
+    if (request.params.size() > 0)
+        strName = request.params[0].get_str();
+
+    UniValue ret(UniValue::VARR);
+    for (const CDBStats& stats : GetAllDBStats()) {
+        if (!strName.empty() && stats.strName != strName)
+            continue;
+        UniValue levels(UniValue::VARR);
+        double dReadMB = 0, dWriteMB = 0;
+        int nReadAmplification = 0;
+        for (const CDBLevelStats& level : stats.vLevels) {
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("level", level.nLevel));
+            obj.push_back(Pair("files", level.nFiles));
+            obj.push_back(Pair("size_mb", level.dSizeMB));
+            obj.push_back(Pair("time_sec", level.dTimeSec));
+            obj.push_back(Pair("read_mb", level.dReadMB));
+            obj.push_back(Pair("write_mb", level.dWriteMB));
+            levels.push_back(obj);
+            dReadMB += level.dReadMB;
+            dWriteMB += level.dWriteMB;
+            // Every level 0 file may hold the key; deeper levels have one candidate each
+            if (level.nLevel == 0)
+                nReadAmplification += level.nFiles;
+            else if (level.nFiles > 0)
+                nReadAmplification++;
+        }
+        double dWriteAmplification = 0;
+        if (stats.nBytesWritten > 0)
+            dWriteAmplification = (stats.nBytesWritten + dWriteMB * 1024 * 1024) / stats.nBytesWritten;
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.strName));
+        obj.push_back(Pair("path", stats.strPath));
+        obj.push_back(Pair("profile", stats.profile.ToString()));
+        obj.push_back(Pair("cache_size", (uint64_t)stats.nCacheSize));
+        obj.push_back(Pair("block_cache_size", (uint64_t)stats.nBlockCacheSize));
+        obj.push_back(Pair("block_cache_usage", (uint64_t)stats.nBlockCacheUsage));
+        obj.push_back(Pair("memtable_usage", stats.nMemoryUsage));
+        obj.push_back(Pair("bytes_written", stats.nBytesWritten));
+        obj.push_back(Pair("compaction_read_mb", dReadMB));
+        obj.push_back(Pair("compaction_write_mb", dWriteMB));
+        obj.push_back(Pair("write_amplification", dWriteAmplification));
+        obj.push_back(Pair("read_amplification", nReadAmplification));
+        obj.push_back(Pair("levels", levels));
+        if (stats.strName == "chainstate") {
+            CChainstateCompactionStats compaction = GetChainstateCompactionStats();
+            UniValue scheduled(UniValue::VOBJ);
+            scheduled.push_back(Pair("slice", compaction.nSlice));
+            scheduled.push_back(Pair("slices", compaction.nSlices));
+            scheduled.push_back(Pair("sweeps", compaction.nSweeps));
+            scheduled.push_back(Pair("deferred", compaction.nDeferred));
+            scheduled.push_back(Pair("total_ms", compaction.nTotalMicros * 0.001));
+            scheduled.push_back(Pair("last_slice_ms", compaction.nLastSliceMicros * 0.001));
+            scheduled.push_back(Pair("max_slice_ms", compaction.nMaxSliceMicros * 0.001));
+            scheduled.push_back(Pair("last_sweep_time", compaction.nLastSweepTime));
+            obj.push_back(Pair("scheduled_compaction", scheduled));
+        }
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1064,6 +1192,269 @@ UniValue gettxout(const JSONRPCRequest& request)
     return ret;
 }
 
+static uint256 AddressScriptHashFromValue(const UniValue& value)
+{
+    const std::string& str = value.get_str();
+    CBitcoinAddress address(str);
+    if (address.IsValid())
+        return GetScriptHash(GetScriptForDestination(address.Get()));
+    if (!str.empty() && IsHex(str)) {
+        std::vector<unsigned char> data(ParseHex(str));
+        return GetScriptHash(CScript(data.begin(), data.end()));
+    }
+    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script: " + str);
+}
+
+static void EnsureAddressIndex()
+{
+    if (!paddressindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "The address index is disabled, restart with -addressindex and -reindex-chainstate to enable it");
+}
+
+static unsigned int AddressPageSizeFromValue(const JSONRPCRequest& request, size_t nParam)
+{
+    if (request.params.size() <= nParam || request.params[nParam].isNull())
+        return DEFAULT_ADDRESSINDEX_PAGE_SIZE;
+    int nCount = request.params[nParam].get_int();
+    if (nCount < 1 || nCount > (int)MAX_ADDRESSINDEX_PAGE_SIZE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("count must be between 1 and %u", MAX_ADDRESSINDEX_PAGE_SIZE));
+    return nCount;
+}
+
+/** Paging cursors are the serialized key of the next entry, which must belong to scriptHash */
+template<typename Key>
+static bool AddressCursorFromValue(const JSONRPCRequest& request, size_t nParam, const uint256& scriptHash, Key& key)
+{
+    if (request.params.size() <= nParam || request.params[nParam].isNull())
+        return false;
+    const std::string& str = request.params[nParam].get_str();
+    if (!IsHex(str))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    CDataStream ss(ParseHex(str), SER_DISK, CLIENT_VERSION);
+    try {
+        ss >> key;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+    if (!ss.empty() || key.scriptHash != scriptHash)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    return true;
+}
+
+template<typename Key>
+static UniValue AddressCursorToJSON(bool fMore, const Key& key)
+{
+    if (!fMore)
+        return NullUniValue;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+UniValue getaddressbalance(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the balance of the unspent outputs to an address. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"    (string, required) The goldcoin address, or a hex-encoded output script\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\" : x.xxx,    (numeric) The sum of the unspent outputs in " + CURRENCY_UNIT + "\n"
+            "  \"unspent\" : n         (numeric) The number of unspent outputs\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"E8r2RkGvE2kfSMnGHEVBpH3Zhp7Doy38MW\"")
+            + HelpExampleRpc("getaddressbalance", "\"E8r2RkGvE2kfSMnGHEVBpH3Zhp7Doy38MW\"")
+        );
+
+    EnsureAddressIndex();
+    uint256 scriptHash = AddressScriptHashFromValue(request.params[0]);
+
+    CAddressBalance balance;
+    if (!paddressindex->ReadBalance(scriptHash, balance))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("balance", ValueFromAmount(balance.nBalance)));
+    ret.push_back(Pair("unspent", (uint64_t)balance.nUnspent));
+    return ret;
+}
+
+UniValue getaddresshistory(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw runtime_error(
+            "getaddresshistory \"address\" ( count \"cursor\" )\n"
+            "\nReturns the transactions that funded or spent outputs to an address, by block height. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"    (string, required) The goldcoin address, or a hex-encoded output script\n"
+            "2. count        (numeric, optional, default=" + strprintf("%u", DEFAULT_ADDRESSINDEX_PAGE_SIZE) + ") The maximum number of entries to return\n"
+            "3. \"cursor\"     (string, optional) The \"next\" value of the previous call, to continue from\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"history\" : [\n"
+            "    {\n"
+            "      \"txid\" : \"hash\",        (string) The transaction id\n"
+            "      \"height\" : n,           (numeric) The height of the block containing it\n"
+            "      \"vout\" : n,             (numeric) For funding entries, the output\n"
+            "      \"vin\" : n,              (numeric) For spending entries, the input\n"
+            "      \"prevtxid\" : \"hash\",    (string) For spending entries, the transaction of the spent output\n"
+            "      \"prevvout\" : n,         (numeric) For spending entries, the spent output\n"
+            "      \"value\" : x.xxx         (numeric) The amount received (positive) or spent (negative) in " + CURRENCY_UNIT + "\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"next\" : \"cursor\"         (string) Cursor to continue from, or null if there are no more entries\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"E8r2RkGvE2kfSMnGHEVBpH3Zhp7Doy38MW\" 100")
+            + HelpExampleRpc("getaddresshistory", "\"E8r2RkGvE2kfSMnGHEVBpH3Zhp7Doy38MW\", 100")
+        );
+
+    EnsureAddressIndex();
+    uint256 scriptHash = AddressScriptHashFromValue(request.params[0]);
+    unsigned int nCount = AddressPageSizeFromValue(request, 1);
+    CAddressHistoryKey start, next;
+    bool fStart = AddressCursorFromValue(request, 2, scriptHash, start);
+
+    std::vector<std::pair<CAddressHistoryKey, CAddressHistoryValue> > vEntries;
+    bool fMore;
+    if (!paddressindex->ReadHistory(scriptHash, fStart ? &start : NULL, nCount, vEntries, &next, fMore))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+
+    UniValue history(UniValue::VARR);
+    for (const auto& entry : vEntries) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("txid", entry.first.txid.GetHex()));
+        obj.push_back(Pair("height", entry.first.nHeight));
+        if (entry.first.fSpending) {
+            obj.push_back(Pair("vin", (uint64_t)entry.first.nIndex));
+            obj.push_back(Pair("prevtxid", entry.second.prevout.hash.GetHex()));
+            obj.push_back(Pair("prevvout", (uint64_t)entry.second.prevout.n));
+            obj.push_back(Pair("value", ValueFromAmount(-entry.second.nValue)));
+        } else {
+            obj.push_back(Pair("vout", (uint64_t)entry.first.nIndex));
+            obj.push_back(Pair("value", ValueFromAmount(entry.second.nValue)));
+        }
+        history.push_back(obj);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("history", history));
+    ret.push_back(Pair("next", AddressCursorToJSON(fMore, next)));
+    return ret;
+}
+
+UniValue getaddressutxos(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw runtime_error(
+            "getaddressutxos \"address\" ( count \"cursor\" )\n"
+            "\nReturns the unspent outputs to an address. Requires -addressindex.\n"
+            "\nArguments:\n"
+            "1. \"address\"    (string, required) The goldcoin address, or a hex-encoded output script\n"
+            "2. count        (numeric, optional, default=" + strprintf("%u", DEFAULT_ADDRESSINDEX_PAGE_SIZE) + ") The maximum number of entries to return\n"
+            "3. \"cursor\"     (string, optional) The \"next\" value of the previous call, to continue from\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"utxos\" : [\n"
+            "    {\n"
+            "      \"txid\" : \"hash\",        (string) The transaction id\n"
+            "      \"vout\" : n,             (numeric) The output number\n"
+            "      \"value\" : x.xxx,        (numeric) The output value in " + CURRENCY_UNIT + "\n"
+            "      \"height\" : n            (numeric) The height of the block containing it\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"next\" : \"cursor\"         (string) Cursor to continue from, or null if there are no more entries\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "\"E8r2RkGvE2kfSMnGHEVBpH3Zhp7Doy38MW\"")
+            + HelpExampleRpc("getaddressutxos", "\"E8r2RkGvE2kfSMnGHEVBpH3Zhp7Doy38MW\"")
+        );
+
+    EnsureAddressIndex();
+    uint256 scriptHash = AddressScriptHashFromValue(request.params[0]);
+    unsigned int nCount = AddressPageSizeFromValue(request, 1);
+    CAddressUnspentKey start, next;
+    bool fStart = AddressCursorFromValue(request, 2, scriptHash, start);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vEntries;
+    bool fMore;
+    if (!paddressindex->ReadUnspent(scriptHash, fStart ? &start : NULL, nCount, vEntries, &next, fMore))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the address index");
+
+    UniValue utxos(UniValue::VARR);
+    for (const auto& entry : vEntries) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("txid", entry.first.outpoint.hash.GetHex()));
+        obj.push_back(Pair("vout", (uint64_t)entry.first.outpoint.n));
+        obj.push_back(Pair("value", ValueFromAmount(entry.second.nValue)));
+        obj.push_back(Pair("height", entry.second.nHeight));
+        utxos.push_back(obj);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("utxos", utxos));
+    ret.push_back(Pair("next", AddressCursorToJSON(fMore, next)));
+    return ret;
+}
+
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nReturns the BIP 158 compact filter of a block. Requires -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"    (string, required) The hash of the block\n"
+            "2. \"filtertype\"   (string, optional, default=basic) The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) The hex-encoded filter data\n"
+            "  \"header\" : \"hash\"   (string) The hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"e2acdf2dd19a702e5d12a925f1e984b01e47a933562ca893656d4afb38b44ee3\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"e2acdf2dd19a702e5d12a925f1e984b01e47a933562ca893656d4afb38b44ee3\", \"basic\"")
+        );
+
+    uint256 hash(ParseHashV(request.params[0], "blockhash"));
+    BlockFilterType filterType = BASIC_FILTER;
+    if (request.params.size() > 1 && !BlockFilterTypeByName(request.params[1].get_str(), filterType))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+
+    if (!g_blockfilterindex || g_blockfilterindex->GetFilterType() != filterType)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + BlockFilterTypeName(filterType));
+
+    const CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
+    }
+
+    bool fSynced = g_blockfilterindex->BlockUntilSyncedToCurrentChain();
+
+    BlockFilter filter;
+    uint256 header;
+    if (!g_blockfilterindex->LookupFilter(pblockindex, filter) || !g_blockfilterindex->LookupFilterHeader(pblockindex, header)) {
+        std::string strError = "Filter not found.";
+        if (!fSynced)
+            strError += " Block filters are still in the process of being indexed.";
+        else
+            strError += " This block is not in the active chain, or was never indexed.";
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", header.GetHex()));
+    return ret;
+}
+
 UniValue verifychain(const JSONRPCRequest& request)
 {
     int nCheckLevel = GetArg("-checklevel", DEFAULT_CHECKLEVEL);
@@ -1500,9 +1891,14 @@ UniValue reconsiderblock(const JSONRPCRequest& request)
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafe argNames
   //  --------------------- ------------------------  -----------------------  ------ ----------
+    { "blockchain",         "getaddressbalance",      &getaddressbalance,      true,  {"address"} },
+    { "blockchain",         "getaddresshistory",      &getaddresshistory,      true,  {"address","count","cursor"} },
+    { "blockchain",         "getaddressutxos",        &getaddressutxos,        true,  {"address","count","cursor"} },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  {} },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,  {"name"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {} },
     { "blockchain",         "getblockcount",          &getblockcount,          true,  {} },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true,  {"blockhash","filtertype"} },
     { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"} },
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
@@ -90,6 +90,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 2, "privkeys" },
     { "sendrawtransaction", 1, "allowhighfees" },
     { "fundrawtransaction", 1, "options" },
+    { "getaddresshistory", 1, "count" },
+    { "getaddressutxos", 1, "count" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
     { "gettxoutproof", 0, "txids" },
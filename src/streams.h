@@ -141,6 +141,48 @@ private:
     size_t nPos;
 };
 
+/** Minimal stream for reading from an existing span of bytes, without copying it.
+ *
+ * The referenced memory must outlive the reader.
+ */
+class CSpanReader
+{
+private:
+    const int nType;
+    const int nVersion;
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+
+public:
+    CSpanReader(int nTypeIn, int nVersionIn, const unsigned char* pbeginIn, size_t nSize) :
+        nType(nTypeIn), nVersion(nVersionIn), pbegin(pbeginIn), pend(pbeginIn + nSize) {}
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pbegin))
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+    }
+    void ignore(size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pbegin))
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pbegin += nSize;
+    }
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+    int GetVersion() const { return nVersion; }
+    int GetType() const { return nType; }
+    size_t size() const { return pend - pbegin; }
+    bool empty() const { return pbegin == pend; }
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -11,6 +11,7 @@
 #include "pow.h"
 #include "script/sign.h"
 #include "serialize.h"
+#include "txorphanpool.h"
 #include "util.h"
 #include "validation.h"
 
@@ -26,13 +27,8 @@
 // Tests these internal-to-net_processing.cpp methods:
 extern bool AddOrphanTx(const CTransactionRef& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-struct COrphanTx {
-    CTransactionRef tx;
-    NodeId fromPeer;
-    int64_t nTimeExpire;
-};
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxUsage);
+extern CTxOrphanPool orphanpool;
 
 CService ip(uint32_t i)
 {
@@ -126,13 +122,11 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     BOOST_CHECK(!connman->IsBanned(addr));
 }
 
+static std::vector<CTransactionRef> vAddedOrphans;
+
 CTransactionRef RandomOrphan()
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    return vAddedOrphans[GetRandInt(vAddedOrphans.size())];
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -154,7 +148,9 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        if (AddOrphanTx(ptx, i))
+            vAddedOrphans.push_back(ptx);
     }
 
     // ... and 50 that depend on other orphans:
@@ -171,7 +167,9 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, *txPrev, tx, 0, SIGHASH_ALL);
 
-        AddOrphanTx(MakeTransactionRef(tx), i);
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        if (AddOrphanTx(ptx, i))
+            vAddedOrphans.push_back(ptx);
     }
 
     // This really-big orphan should be ignored:
@@ -201,18 +199,124 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     // Test EraseOrphansFor:
     for (NodeId i = 0; i < 3; i++)
     {
-        size_t sizeBefore = mapOrphanTransactions.size();
+        size_t sizeBefore = orphanpool.size();
         EraseOrphansFor(i);
-        BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        BOOST_CHECK(orphanpool.size() < sizeBefore);
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
+    LimitOrphanTxSize(40, 0);
+    BOOST_CHECK(orphanpool.size() <= 40);
+    LimitOrphanTxSize(10, 0);
+    BOOST_CHECK(orphanpool.size() <= 10);
+    LimitOrphanTxSize(0, 0);
+    BOOST_CHECK(orphanpool.size() == 0);
+}
+
+static CTransactionRef OrphanSpending(const uint256& hashPrev, unsigned int nInputs = 1)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        tx.vin[i].prevout.hash = hashPrev;
+        tx.vin[i].prevout.n = i;
+        tx.vin[i].scriptSig << OP_1;
+    }
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1*CENT;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return MakeTransactionRef(tx);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanpool_indexes)
+{
+    CTxOrphanPool pool;
+
+    // Lookups by parent outpoint and by conflicting spend
+    CTransactionRef parent = OrphanSpending(GetRandHash());
+    CTransactionRef child = OrphanSpending(parent->GetHash(), 2);
+    BOOST_CHECK(pool.AddTx(child, 1, 100));
+    BOOST_CHECK(!pool.AddTx(child, 2, 100));
+    BOOST_CHECK(pool.HaveTx(child->GetHash()));
+    std::vector<COrphanTx> vOrphans;
+    pool.GetOrphansByPrev(COutPoint(parent->GetHash(), 1), vOrphans);
+    BOOST_CHECK_EQUAL(vOrphans.size(), 1);
+    BOOST_CHECK(vOrphans[0].tx == child);
+    BOOST_CHECK_EQUAL(vOrphans[0].fromPeer, 1);
+    std::vector<uint256> vConflicts;
+    pool.GetConflictingOrphans(*OrphanSpending(parent->GetHash()), vConflicts);
+    BOOST_CHECK_EQUAL(vConflicts.size(), 1);
+    BOOST_CHECK(vConflicts[0] == child->GetHash());
+    BOOST_CHECK_EQUAL(pool.EraseTx(child->GetHash()), 1);
+    BOOST_CHECK_EQUAL(pool.ByPrevSize(), 0);
+    BOOST_CHECK_EQUAL(pool.TotalUsage(), 0);
+
+    // Expiry only removes entries that are due
+    for (int i = 0; i < 10; i++)
+        pool.AddTx(OrphanSpending(GetRandHash()), i % 3, 100 + i);
+    BOOST_CHECK_EQUAL(pool.EraseExpired(104), 5);
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    // Disconnect cleanup only touches the given peer
+    size_t nPeer1 = pool.PeerUsage(1);
+    BOOST_CHECK(nPeer1 > 0);
+    BOOST_CHECK_EQUAL(pool.EraseForPeer(2), 2);
+    BOOST_CHECK_EQUAL(pool.PeerUsage(1), nPeer1);
+    BOOST_CHECK_EQUAL(pool.PeerUsage(2), 0);
+    pool.Clear();
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanpool_peer_quota)
+{
+    CTxOrphanPool pool;
+
+    // An honest peer's orphans survive a flood from another peer
+    std::vector<CTransactionRef> vHonest;
+    for (int i = 0; i < 5; i++) {
+        vHonest.push_back(OrphanSpending(GetRandHash()));
+        BOOST_CHECK(pool.AddTx(vHonest.back(), 1, 1000));
+    }
+    for (int i = 0; i < 100; i++)
+        pool.AddTx(OrphanSpending(GetRandHash()), 2, 1000 + i);
+    BOOST_CHECK_EQUAL(pool.LimitOrphans(20), 85);
+    BOOST_CHECK_EQUAL(pool.size(), 20);
+    for (const CTransactionRef& tx : vHonest)
+        BOOST_CHECK(pool.HaveTx(tx->GetHash()));
+
+    // The memory limit is honoured as well
+    BOOST_CHECK(pool.LimitOrphans(1000, pool.TotalUsage() / 2) > 0);
+    for (const CTransactionRef& tx : vHonest)
+        BOOST_CHECK(pool.HaveTx(tx->GetHash()));
+
+    // A peer over its quota loses its own oldest orphans first
+    pool.Clear();
+    CTransactionRef oldest = OrphanSpending(GetRandHash());
+    BOOST_CHECK(pool.AddTx(oldest, 3, 10));
+    size_t nQuota = pool.PeerUsage(3) * 3;
+    BOOST_CHECK(pool.AddTx(OrphanSpending(GetRandHash()), 3, 11, nQuota));
+    BOOST_CHECK(pool.AddTx(OrphanSpending(GetRandHash()), 3, 12, nQuota));
+    BOOST_CHECK(pool.AddTx(OrphanSpending(GetRandHash()), 3, 13, nQuota));
+    BOOST_CHECK(!pool.HaveTx(oldest->GetHash()));
+    BOOST_CHECK(pool.PeerUsage(3) <= nQuota);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // Over the entry limit, the peer with the most orphans loses them even
+    // if another peer's few large orphans use more memory
+    pool.Clear();
+    std::vector<CTransactionRef> vLarge;
+    for (int i = 0; i < 3; i++) {
+        vLarge.push_back(OrphanSpending(GetRandHash(), 50));
+        BOOST_CHECK(pool.AddTx(vLarge.back(), 4, 10 + i));
+    }
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(pool.AddTx(OrphanSpending(GetRandHash()), 5, 10 + i));
+    BOOST_CHECK(pool.PeerUsage(4) > pool.PeerUsage(5));
+    BOOST_CHECK_EQUAL(pool.LimitOrphans(8), 5);
+    BOOST_CHECK_EQUAL(pool.PeerCount(4), 3);
+    BOOST_CHECK_EQUAL(pool.PeerCount(5), 5);
+    for (const CTransactionRef& tx : vLarge)
+        BOOST_CHECK(pool.HaveTx(tx->GetHash()));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,150 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static CMutableTransaction Spend(const COutPoint& prevout, const CScript& scriptPubKey, CAmount nValue)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(addressindex_connect_disconnect, TestChain100Setup)
+{
+    paddressindex = new CAddressIndexDB(1 << 20, true, true);
+
+    CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CScript scriptA = CScript() << OP_TRUE;
+    uint256 scriptHashA = GetScriptHash(scriptA);
+
+    // Fund scriptA from a mature coinbase
+    CMutableTransaction fund = Spend(COutPoint(coinbaseTxns[0].GetHash(), 0), scriptA, 11 * CENT);
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, fund, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    fund.vin[0].scriptSig << vchSig;
+    CBlock block1 = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, fund), scriptCoinbase);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block1.GetHash());
+
+    CAddressBalance balance;
+    BOOST_CHECK(paddressindex->ReadBalance(scriptHashA, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, 11 * CENT);
+    BOOST_CHECK_EQUAL(balance.nUnspent, 1U);
+
+    // The coinbase script was paid by block1 and spent from by fund
+    std::vector<std::pair<CAddressHistoryKey, CAddressHistoryValue> > vHistory;
+    CAddressHistoryKey next;
+    bool fMore;
+    BOOST_CHECK(paddressindex->ReadHistory(GetScriptHash(scriptCoinbase), NULL, 10, vHistory, &next, fMore) && !fMore);
+    BOOST_CHECK_EQUAL(vHistory.size(), 2U);
+    for (const auto& entry : vHistory) {
+        BOOST_CHECK_EQUAL(entry.first.nHeight, 101);
+        if (entry.first.fSpending) {
+            BOOST_CHECK(entry.first.txid == fund.GetHash());
+            BOOST_CHECK(entry.second.prevout == fund.vin[0].prevout);
+        }
+    }
+
+    // Spend it again in the next block
+    CMutableTransaction spend = Spend(COutPoint(fund.GetHash(), 0), scriptCoinbase, 10 * CENT);
+    CBlock block2 = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptCoinbase);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block2.GetHash());
+
+    BOOST_CHECK(paddressindex->ReadBalance(scriptHashA, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, 0);
+    BOOST_CHECK_EQUAL(balance.nUnspent, 0U);
+
+    // History is ordered by height and can be read a page at a time
+    vHistory.clear();
+    BOOST_CHECK(paddressindex->ReadHistory(scriptHashA, NULL, 1, vHistory, &next, fMore) && fMore);
+    BOOST_CHECK_EQUAL(vHistory.size(), 1U);
+    BOOST_CHECK(!vHistory[0].first.fSpending && vHistory[0].first.nHeight == 101);
+    BOOST_CHECK(paddressindex->ReadHistory(scriptHashA, &next, 1, vHistory, &next, fMore) && !fMore);
+    BOOST_CHECK_EQUAL(vHistory.size(), 2U);
+    BOOST_CHECK(vHistory[1].first.fSpending && vHistory[1].first.nHeight == 102);
+    BOOST_CHECK_EQUAL(vHistory[1].second.nValue, 11 * CENT);
+
+    // Disconnecting block2 restores the unspent output, with its height
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[block2.GetHash()]));
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block1.GetHash());
+    }
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    CAddressUnspentKey nextUnspent;
+    BOOST_CHECK(paddressindex->ReadUnspent(scriptHashA, NULL, 10, vUnspent, &nextUnspent, fMore) && !fMore);
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.outpoint == COutPoint(fund.GetHash(), 0));
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nValue, 11 * CENT);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nHeight, 101);
+    vHistory.clear();
+    BOOST_CHECK(paddressindex->ReadHistory(scriptHashA, NULL, 10, vHistory, &next, fMore) && !fMore);
+    BOOST_CHECK_EQUAL(vHistory.size(), 1U);
+
+    uint256 hashBest;
+    BOOST_CHECK(paddressindex->ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == block1.GetHash());
+
+    // An index left on a branch the chain state is not on is moved back to
+    // the active chain at startup: block2 is taken out and a longer branch
+    // without it is added
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ResetBlockFailureFlags(mapBlockIndex[block2.GetHash()]));
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block2.GetHash());
+    CAddressIndexDB* paddressindexSaved = paddressindex;
+    paddressindex = NULL;
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[block2.GetHash()]));
+    }
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptCoinbase);
+    CBlock block3 = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptCoinbase);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block3.GetHash());
+    paddressindex = paddressindexSaved;
+    BOOST_CHECK(paddressindex->ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == block2.GetHash());
+
+    BOOST_CHECK(SyncAddressIndex(Params()));
+    BOOST_CHECK(paddressindex->ReadBestBlock(hashBest));
+    BOOST_CHECK(hashBest == block3.GetHash());
+    BOOST_CHECK(paddressindex->ReadBalance(scriptHashA, balance));
+    BOOST_CHECK_EQUAL(balance.nBalance, 11 * CENT);
+    BOOST_CHECK_EQUAL(balance.nUnspent, 1U);
+    vHistory.clear();
+    BOOST_CHECK(paddressindex->ReadHistory(scriptHashA, NULL, 10, vHistory, &next, fMore) && !fMore);
+    BOOST_CHECK_EQUAL(vHistory.size(), 1U);
+    vHistory.clear();
+    BOOST_CHECK(paddressindex->ReadHistory(GetScriptHash(scriptCoinbase), NULL, 10, vHistory, &next, fMore) && !fMore);
+    BOOST_CHECK_EQUAL(vHistory.size(), 4U);
+
+    delete paddressindex;
+    paddressindex = NULL;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
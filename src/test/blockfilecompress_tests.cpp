@@ -0,0 +1,139 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilecompress.h"
+#include "blockfilereader.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "undo.h"
+#include "validation.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilecompress_tests, BasicTestingSetup)
+
+static bool RoundTripLZ4(const std::vector<unsigned char>& vchData, size_t& nCompressed)
+{
+    std::vector<unsigned char> vchCompressed, vchOut(vchData.size());
+    CompressLZ4(vchData.data(), vchData.size(), vchCompressed);
+    nCompressed = vchCompressed.size();
+    return DecompressLZ4(vchCompressed.data(), vchCompressed.size(), vchOut.data(), vchOut.size()) && vchOut == vchData;
+}
+
+BOOST_AUTO_TEST_CASE(lz4_roundtrip)
+{
+    size_t nCompressed;
+    BOOST_CHECK(RoundTripLZ4(std::vector<unsigned char>(), nCompressed));
+    BOOST_CHECK(RoundTripLZ4(std::vector<unsigned char>(12, 7), nCompressed));
+    BOOST_CHECK(RoundTripLZ4(std::vector<unsigned char>(13, 7), nCompressed));
+
+    // Long runs need extra length bytes
+    std::vector<unsigned char> vchRepeat(100000, 0x42);
+    BOOST_CHECK(RoundTripLZ4(vchRepeat, nCompressed));
+    BOOST_CHECK(nCompressed < 1000);
+
+    std::vector<unsigned char> vchRandom(70000);
+    GetRandBytes(vchRandom.data(), vchRandom.size());
+    BOOST_CHECK(RoundTripLZ4(vchRandom, nCompressed));
+
+    // Random data with one repeat too far back to be matched and one within reach
+    std::vector<unsigned char> vchMixed(vchRandom);
+    vchMixed.insert(vchMixed.end(), vchRandom.begin(), vchRandom.begin() + 1000);
+    vchMixed.insert(vchMixed.end(), vchRandom.end() - 1000, vchRandom.end());
+    BOOST_CHECK(RoundTripLZ4(vchMixed, nCompressed));
+    BOOST_CHECK(nCompressed < vchMixed.size());
+}
+
+BOOST_AUTO_TEST_CASE(lz4_invalid)
+{
+    std::vector<unsigned char> vchData(1000);
+    for (size_t i = 0; i < vchData.size(); i++)
+        vchData[i] = i % 37;
+    std::vector<unsigned char> vchCompressed, vchOut(vchData.size());
+    CompressLZ4(vchData.data(), vchData.size(), vchCompressed);
+
+    // Wrong expected size, truncated input
+    BOOST_CHECK(!DecompressLZ4(vchCompressed.data(), vchCompressed.size(), vchOut.data(), vchOut.size() - 1));
+    BOOST_CHECK(!DecompressLZ4(vchCompressed.data(), vchCompressed.size() - 3, vchOut.data(), vchOut.size()));
+
+    // A match reaching before the start of the output
+    const unsigned char vchBadOffset[] = {0x10, 'a', 0x02, 0x00, 0x00};
+    BOOST_CHECK(!DecompressLZ4(vchBadOffset, sizeof(vchBadOffset), vchOut.data(), 5));
+    const unsigned char vchGood[] = {0x10, 'a', 0x01, 0x00, 0x00};
+    BOOST_CHECK(DecompressLZ4(vchGood, sizeof(vchGood), vchOut.data(), 5));
+    BOOST_CHECK(std::string(vchOut.begin(), vchOut.begin() + 5) == "aaaaa");
+}
+
+BOOST_FIXTURE_TEST_CASE(compressed_block_files, TestChain100Setup)
+{
+    const int nFile = 9200;
+    std::vector<const CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight++)
+            vIndex.push_back(chainActive[nHeight]);
+    }
+
+    // The chain was written in order into the first block and undo files
+    const CBlockIndex* pindexTip = vIndex.back();
+    CBlockUndo undoTip;
+    BOOST_REQUIRE(UndoReadFromDisk(undoTip, pindexTip->GetUndoPos(), pindexTip->pprev->GetBlockHash()));
+    CBlock blockTip;
+    BOOST_REQUIRE(ReadBlockFromDisk(blockTip, pindexTip, Params().GetConsensus()));
+    unsigned int nBlockSize = pindexTip->GetBlockPos().nPos + ::GetSerializeSize(blockTip, SER_DISK, CLIENT_VERSION);
+    unsigned int nUndoSize = pindexTip->GetUndoPos().nPos + ::GetSerializeSize(undoTip, SER_DISK, CLIENT_VERSION) + sizeof(uint256);
+
+    boost::filesystem::path pathBlock = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    boost::filesystem::path pathUndo = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "rev");
+    boost::filesystem::copy_file(GetBlockPosFilename(CDiskBlockPos(0, 0), "blk"), pathBlock);
+    boost::filesystem::copy_file(GetBlockPosFilename(CDiskBlockPos(0, 0), "rev"), pathUndo);
+
+    uint64_t nCompressedSize;
+    BOOST_REQUIRE(WriteCompressedBlockFile(BLOCK_FILE, nFile, nBlockSize, Params().MessageStart(), GetCompressedBlockFilename(BLOCK_FILE, nFile), nCompressedSize));
+    BOOST_CHECK(nCompressedSize < nBlockSize);
+    BOOST_REQUIRE(WriteCompressedBlockFile(UNDO_FILE, nFile, nUndoSize, Params().MessageStart(), GetCompressedBlockFilename(UNDO_FILE, nFile), nCompressedSize));
+    // Only whole records can be compressed
+    BOOST_CHECK(!WriteCompressedBlockFile(BLOCK_FILE, nFile, nBlockSize - 1, Params().MessageStart(), GetCompressedBlockFilename(BLOCK_FILE, nFile + 1), nCompressedSize));
+    BOOST_CHECK(!WriteCompressedBlockFile(BLOCK_FILE, nFile, nBlockSize + 8, Params().MessageStart(), GetCompressedBlockFilename(BLOCK_FILE, nFile + 1), nCompressedSize));
+
+    // Restoring gives back the raw files
+    boost::filesystem::path pathRestored = GetBlockPosFilename(CDiskBlockPos(nFile + 1, 0), "blk");
+    BOOST_REQUIRE(WriteDecompressedBlockFile(BLOCK_FILE, nFile, pathRestored));
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(pathRestored), nBlockSize);
+    boost::filesystem::remove(pathBlock);
+    boost::filesystem::remove(pathUndo);
+
+    // Every block and its undo data read the same from the compressed files
+    CBlockFileReader reader;
+    reader.SetCompressed(nFile, true);
+    BOOST_CHECK(reader.IsCompressed(nFile));
+    for (const CBlockIndex* pindex : vIndex) {
+        CBlockFileReader::Span span;
+        BOOST_REQUIRE(reader.Read(BLOCK_FILE, CDiskBlockPos(nFile, pindex->GetBlockPos().nPos), 0, span));
+        CBlock block;
+        CSpanReader(SER_DISK, CLIENT_VERSION, span.data(), span.size()) >> block;
+        BOOST_CHECK(block.GetHash() == pindex->GetBlockHash());
+        if (!pindex->pprev)
+            continue;
+
+        BOOST_REQUIRE(reader.Read(UNDO_FILE, CDiskBlockPos(nFile, pindex->GetUndoPos().nPos), sizeof(uint256), span));
+        CBlockUndo undo, undoExpected;
+        uint256 hashChecksum;
+        CSpanReader(SER_DISK, CLIENT_VERSION, span.data(), span.size()) >> undo >> hashChecksum;
+        BOOST_REQUIRE(UndoReadFromDisk(undoExpected, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()));
+        BOOST_CHECK_EQUAL(undo.vtxundo.size(), undoExpected.vtxundo.size());
+    }
+
+    // Past the last frame, and raw reads once the raw file is gone
+    CBlockFileReader::Span span;
+    BOOST_CHECK(!reader.Read(BLOCK_FILE, CDiskBlockPos(nFile, nBlockSize + 8), 0, span));
+    reader.SetCompressed(nFile, false);
+    BOOST_CHECK(!reader.Read(BLOCK_FILE, CDiskBlockPos(nFile, vIndex[1]->GetBlockPos().nPos), 0, span));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
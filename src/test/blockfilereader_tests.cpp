@@ -0,0 +1,109 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilereader.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilereader_tests, TestingSetup)
+
+/** Append a record with the same framing as WriteBlockToDisk, returning its position */
+static CDiskBlockPos AppendRecord(int nFile, const std::vector<unsigned char>& vchRecord)
+{
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    boost::filesystem::create_directories(path.parent_path());
+    CAutoFile fileout(fopen(path.string().c_str(), "ab"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!fileout.IsNull());
+    fseek(fileout.Get(), 0, SEEK_END);
+    fileout << FLATDATA(Params().MessageStart()) << (unsigned int)vchRecord.size();
+    CDiskBlockPos pos(nFile, ftell(fileout.Get()));
+    fileout.write((const char*)vchRecord.data(), vchRecord.size());
+    return pos;
+}
+
+static bool ReadRecord(CBlockFileReader& reader, const CDiskBlockPos& pos, std::vector<unsigned char>& vchRecord)
+{
+    CBlockFileReader::Span span;
+    if (!reader.Read(BLOCK_FILE, pos, 0, span))
+        return false;
+    vchRecord.assign(span.data(), span.data() + span.size());
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilereader_read)
+{
+    const int nFile = 9000;
+    std::vector<unsigned char> vchRecord1(1000, 0x11), vchRecord2(5000, 0x22), vchRecord3(10, 0x33);
+    CDiskBlockPos pos1 = AppendRecord(nFile, vchRecord1);
+
+    CBlockFileReader reader;
+    std::vector<unsigned char> vchRead;
+    BOOST_CHECK(ReadRecord(reader, pos1, vchRead));
+    BOOST_CHECK(vchRead == vchRecord1);
+
+    // The file grew after it was mapped
+    CDiskBlockPos pos2 = AppendRecord(nFile, vchRecord2);
+    BOOST_CHECK(ReadRecord(reader, pos2, vchRead));
+    BOOST_CHECK(vchRead == vchRecord2);
+
+    // Files that are being written are read without a mapping
+    reader.Written(BLOCK_FILE, nFile);
+    CDiskBlockPos pos3 = AppendRecord(nFile, vchRecord3);
+    BOOST_CHECK(ReadRecord(reader, pos3, vchRead));
+    BOOST_CHECK(vchRead == vchRecord3);
+    BOOST_CHECK(ReadRecord(reader, pos1, vchRead));
+    BOOST_CHECK(vchRead == vchRecord1);
+
+    CBlockFileReader readerNoMap(false);
+    BOOST_CHECK(ReadRecord(readerNoMap, pos2, vchRead));
+    BOOST_CHECK(vchRead == vchRecord2);
+
+    // Positions without a record in front of them, or past the end
+    BOOST_CHECK(!ReadRecord(reader, CDiskBlockPos(nFile, 4), vchRead));
+    BOOST_CHECK(!ReadRecord(reader, CDiskBlockPos(nFile + 1, 8), vchRead));
+    CDiskBlockPos posTruncated(nFile, pos3.nPos + 8);
+    BOOST_CHECK(!ReadRecord(reader, posTruncated, vchRead));
+    reader.Forget(nFile);
+    BOOST_CHECK(!ReadRecord(reader, posTruncated, vchRead));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilereader_block_roundtrip)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    CDiskBlockPos pos(9001, 0);
+    BOOST_CHECK(WriteBlockToDisk(genesis, pos, Params().MessageStart()));
+
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pos, Params().GetConsensus()));
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+    BOOST_CHECK(block.vtx.size() == genesis.vtx.size());
+}
+
+BOOST_AUTO_TEST_CASE(spanreader_test)
+{
+    std::vector<unsigned char> vch;
+    CVectorWriter(SER_DISK, CLIENT_VERSION, vch, 0, (uint32_t)7, std::string("span"));
+
+    CSpanReader reader(SER_DISK, CLIENT_VERSION, vch.data(), vch.size());
+    uint32_t n;
+    std::string str;
+    reader >> n >> str;
+    BOOST_CHECK_EQUAL(n, 7U);
+    BOOST_CHECK_EQUAL(str, "span");
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+
+    CSpanReader reader2(SER_DISK, CLIENT_VERSION, vch.data(), vch.size());
+    reader2.ignore(4);
+    reader2 >> str;
+    BOOST_CHECK_EQUAL(str, "span");
+    BOOST_CHECK_THROW(reader2.ignore(1), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
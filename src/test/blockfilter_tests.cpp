@@ -0,0 +1,195 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "blockfilterindex.h"
+#include "chain.h"
+#include "key.h"
+#include "primitives/block.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "undo.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded.insert(std::move(element2));
+    }
+
+    GCSFilter filter(0, 0, 10, 1 << 10, included);
+    for (const GCSFilter::Element& element : included) {
+        BOOST_CHECK(filter.Match(element));
+
+        GCSFilter::ElementSet single;
+        single.insert(element);
+        BOOST_CHECK(filter.MatchAny(single));
+    }
+    BOOST_CHECK(filter.MatchAny(included));
+
+    // With M = 1024 a false positive among 100 queries is unlikely but possible;
+    // just check that most of them miss
+    int nFalsePositives = 0;
+    for (const GCSFilter::Element& element : excluded)
+        nFalsePositives += filter.Match(element);
+    BOOST_CHECK(nFalsePositives < 5);
+
+    // The encoding round-trips
+    GCSFilter filter2(0, 0, 10, 1 << 10, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetN(), 100U);
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+    for (const GCSFilter::Element& element : included)
+        BOOST_CHECK(filter2.Match(element));
+
+    // A truncated encoding is rejected
+    std::vector<unsigned char> vchTruncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 8);
+    BOOST_CHECK_THROW(GCSFilter(0, 0, 10, 1 << 10, vchTruncated), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_empty_test)
+{
+    GCSFilter filter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, GCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(filter.GetN(), 0U);
+    BOOST_CHECK_EQUAL(filter.GetEncoded().size(), 1U);
+    BOOST_CHECK(!filter.Match(GCSFilter::Element(32)));
+
+    GCSFilter filter2(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetN(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included1 = CScript() << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    CScript included2 = CScript() << OP_1 << std::vector<unsigned char>(1, 65) << OP_1 << OP_CHECKMULTISIG;
+    CScript excludedReturn = CScript() << OP_RETURN << std::vector<unsigned char>(4, 65);
+    CScript excludedOther = CScript() << OP_1 << std::vector<unsigned char>(2, 65) << OP_1 << OP_CHECKMULTISIG;
+    CScript spent1 = CScript() << std::vector<unsigned char>(5, 33) << OP_CHECKSIG;
+    CScript spent2 = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 7) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    CMutableTransaction tx;
+    tx.vout.resize(4);
+    tx.vout[0].nValue = 100;
+    tx.vout[0].scriptPubKey = included1;
+    tx.vout[1].nValue = 200;
+    tx.vout[1].scriptPubKey = included2;
+    tx.vout[2].nValue = 300;
+    tx.vout[2].scriptPubKey = excludedReturn;
+    tx.vout[3].nValue = 400;
+    tx.vout[3].scriptPubKey = CScript();
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(500, spent1)));
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(600, spent2)));
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(700, CScript())));
+
+    BlockFilter blockFilter(BASIC_FILTER, block, blockundo);
+    const GCSFilter& filter = blockFilter.GetFilter();
+    BOOST_CHECK_EQUAL(filter.GetN(), 4U);
+
+    BOOST_CHECK(filter.Match(GCSFilter::Element(included1.begin(), included1.end())));
+    BOOST_CHECK(filter.Match(GCSFilter::Element(included2.begin(), included2.end())));
+    BOOST_CHECK(filter.Match(GCSFilter::Element(spent1.begin(), spent1.end())));
+    BOOST_CHECK(filter.Match(GCSFilter::Element(spent2.begin(), spent2.end())));
+    BOOST_CHECK(!filter.Match(GCSFilter::Element(excludedReturn.begin(), excludedReturn.end())));
+    BOOST_CHECK(!filter.Match(GCSFilter::Element(excludedOther.begin(), excludedOther.end())));
+
+    // Reconstructed from its encoding, the filter is keyed with the same block hash
+    BlockFilter blockFilter2(BASIC_FILTER, block.GetHash(), blockFilter.GetEncodedFilter());
+    BOOST_CHECK(blockFilter2.GetHash() == blockFilter.GetHash());
+    BOOST_CHECK(blockFilter2.GetFilter().Match(GCSFilter::Element(spent2.begin(), spent2.end())));
+
+    // Headers chain the filter hashes
+    uint256 hashPrevHeader = uint256S("0x01");
+    BOOST_CHECK(blockFilter.ComputeHeader(hashPrevHeader) != blockFilter.ComputeHeader(uint256()));
+    uint256 hashFilter = blockFilter.GetHash();
+    BOOST_CHECK(blockFilter.ComputeHeader(hashPrevHeader) == Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end()));
+}
+
+BOOST_FIXTURE_TEST_CASE(blockfilterindex_initial_sync, TestChain100Setup)
+{
+    CBlockFilterIndex filterIndex(BASIC_FILTER, 1 << 20, true);
+    BOOST_CHECK(filterIndex.Start());
+    for (int i = 0; i < 1000 && !filterIndex.IsSynced(); i++)
+        MilliSleep(10);
+    BOOST_CHECK(filterIndex.BlockUntilSyncedToCurrentChain());
+
+    // Every block of the existing chain has a filter whose header commits to the previous one
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    uint256 hashPrevHeader;
+    for (int nHeight = 0; nHeight <= pindexTip->nHeight; nHeight++) {
+        const CBlockIndex* pindex = pindexTip->GetAncestor(nHeight);
+        BlockFilter filter;
+        uint256 header;
+        BOOST_CHECK(filterIndex.LookupFilter(pindex, filter));
+        BOOST_CHECK(filterIndex.LookupFilterHeader(pindex, header));
+        BOOST_CHECK(header == filter.ComputeHeader(hashPrevHeader));
+        hashPrevHeader = header;
+        if (nHeight > 0)
+            BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptPubKey.begin(), scriptPubKey.end())));
+    }
+
+    std::vector<uint256> vHashes;
+    BOOST_CHECK(filterIndex.LookupFilterHashRange(10, pindexTip, vHashes));
+    BOOST_CHECK_EQUAL(vHashes.size(), (size_t)pindexTip->nHeight - 9);
+    std::vector<BlockFilter> vFilters;
+    BOOST_CHECK(filterIndex.LookupFilterRange(10, pindexTip, vFilters));
+    BOOST_CHECK_EQUAL(vFilters.size(), vHashes.size());
+    for (size_t i = 0; i < vFilters.size(); i++)
+        BOOST_CHECK(vFilters[i].GetHash() == vHashes[i]);
+
+    // A block spending a coinbase gets a filter that includes the spent script
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(coinbaseTxns[0].vout[0].scriptPubKey, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), CScript() << OP_2);
+    BOOST_CHECK(filterIndex.BlockUntilSyncedToCurrentChain());
+    const CBlockIndex* pindexNew;
+    {
+        LOCK(cs_main);
+        pindexNew = chainActive.Tip();
+    }
+    BOOST_CHECK(pindexNew->GetBlockHash() == block.GetHash());
+    BlockFilter filter;
+    BOOST_CHECK(filterIndex.LookupFilter(pindexNew, filter));
+    BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptPubKey.begin(), scriptPubKey.end())));
+    CScript scriptTrue = CScript() << OP_TRUE;
+    BOOST_CHECK(filter.GetFilter().Match(GCSFilter::Element(scriptTrue.begin(), scriptTrue.end())));
+
+    filterIndex.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
+#include "txdb.h"
 #include "validation.h"
 #include "consensus/validation.h"
 
@@ -873,4 +874,55 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_FIXTURE_TEST_CASE(chainstate_compaction, TestingSetup)
+{
+    CCoinsMap mapCoins;
+    std::vector<uint256> vTxid;
+    for (int i = 0; i < 2000; i++) {
+        vTxid.push_back(GetRandHash());
+        CCoinsCacheEntry& entry = mapCoins[vTxid.back()];
+        entry.coins.nVersion = 1;
+        entry.coins.nHeight = 1;
+        entry.coins.vout.push_back(CTxOut(i + 1, CScript() << OP_TRUE));
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    BOOST_CHECK(pcoinsdbview->BatchWrite(mapCoins, uint256()));
+
+    // Not enough was written, and the tip just changed
+    CompactChainstate(pcoinsdbview, 0, pcoinsdbview->GetBytesWritten() + 1);
+    CompactChainstate(pcoinsdbview, 3600, 0);
+    CChainstateCompactionStats stats = GetChainstateCompactionStats();
+    BOOST_CHECK_EQUAL(stats.nSlice, -1);
+    BOOST_CHECK_EQUAL(stats.nSlices, 0U);
+
+    // One slice per run, with pauses after each
+    for (int i = 0; i < 1000 && stats.nSweeps == 0; i++) {
+        CompactChainstate(pcoinsdbview, 0, 0);
+        stats = GetChainstateCompactionStats();
+        BOOST_CHECK(stats.nSlices <= (uint64_t)i + 1);
+        MilliSleep(1);
+    }
+    BOOST_CHECK_EQUAL(stats.nSweeps, 1U);
+    BOOST_CHECK_EQUAL(stats.nSlices, (uint64_t)COINSDB_COMPACT_SLICES);
+    BOOST_CHECK_EQUAL(stats.nSlice, -1);
+    BOOST_CHECK(stats.nLastSweepTime > 0);
+    for (int i = 0; i < 2000; i += 97) {
+        CCoins coins;
+        BOOST_CHECK(pcoinsdbview->GetCoins(vTxid[i], coins));
+        BOOST_CHECK_EQUAL(coins.vout[0].nValue, i + 1);
+    }
+
+    // A running sweep waits for the tip to settle
+    for (int i = 0; i < 1000 && stats.nSlice < 0; i++) {
+        CompactChainstate(pcoinsdbview, 0, 0);
+        stats = GetChainstateCompactionStats();
+        MilliSleep(1);
+    }
+    BOOST_CHECK_EQUAL(stats.nSlice, 1);
+    CompactChainstate(pcoinsdbview, 3600, 0);
+    stats = GetChainstateCompactionStats();
+    BOOST_CHECK_EQUAL(stats.nSlice, 1);
+    BOOST_CHECK_EQUAL(stats.nDeferred, 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -319,4 +319,112 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profile)
+{
+    CDBProfile profile;
+    std::string strError;
+    BOOST_CHECK(ParseDBProfile("hdd", profile, strError));
+    BOOST_CHECK_EQUAL(profile.nBlockSize, 64U * 1024);
+    BOOST_CHECK(profile.fCompression);
+
+    // Settings apply in order on top of presets
+    BOOST_CHECK(ParseDBProfile("nvme,blocksize=16,bloombits=0,compression=1", profile, strError));
+    BOOST_CHECK_EQUAL(profile.nBlockCachePercent, 25);
+    BOOST_CHECK_EQUAL(profile.nBlockSize, 16U * 1024);
+    BOOST_CHECK_EQUAL(profile.nBloomBits, 0);
+    BOOST_CHECK(profile.fCompression);
+    BOOST_CHECK(ParseDBProfile("default", profile, strError));
+    BOOST_CHECK_EQUAL(profile.ToString(), CDBProfile().ToString());
+
+    BOOST_CHECK(!ParseDBProfile("ssd", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("blockcache=100", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("blocksize=-4", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("maxopenfiles=", profile, strError));
+    BOOST_CHECK(!ParseDBProfile("writebuffer=10", profile, strError));
+
+    const char* argv[] = {"ignored", "-dbprofile=chainstate:hdd", "-dbprofile=chainstate:blockcache=40", "-dbprofile=blockindex:nvme"};
+    ParseParameters(4, (char**)argv);
+    BOOST_CHECK(CheckDBProfiles(strError));
+    profile = GetDBProfile("chainstate");
+    BOOST_CHECK_EQUAL(profile.nBlockCachePercent, 40);
+    BOOST_CHECK(profile.fCompression);
+    BOOST_CHECK_EQUAL(GetDBProfile("blockindex").nMaxOpenFiles, 128);
+    BOOST_CHECK_EQUAL(GetDBProfile("addressindex").ToString(), CDBProfile().ToString());
+    BOOST_CHECK_EQUAL(GetDBProfile("").ToString(), CDBProfile().ToString());
+
+    const char* argvBadName[] = {"ignored", "-dbprofile=wallet:hdd"};
+    ParseParameters(2, (char**)argvBadName);
+    BOOST_CHECK(!CheckDBProfiles(strError));
+    const char* argvNoName[] = {"ignored", "-dbprofile=hdd"};
+    ParseParameters(2, (char**)argvNoName);
+    BOOST_CHECK(!CheckDBProfiles(strError));
+    ParseParameters(1, (char**)argv);
+    BOOST_CHECK(CheckDBProfiles(strError));
+}
+
+static bool FindDBStats(const std::string& strPath, CDBStats& stats)
+{
+    for (const CDBStats& s : GetAllDBStats()) {
+        if (s.strPath == strPath) {
+            stats = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_stats)
+{
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    CDBStats stats;
+    {
+        // Unnamed databases are not reported
+        CDBWrapper dbw(ph, (1 << 20), true, false, false);
+        BOOST_CHECK(!FindDBStats(ph.string(), stats));
+    }
+
+    CDBWrapper* dbw = new CDBWrapper(ph, (1 << 20), false, true, false, "chainstate");
+    BOOST_REQUIRE(FindDBStats(ph.string(), stats));
+    BOOST_CHECK_EQUAL(stats.strName, "chainstate");
+    BOOST_CHECK_EQUAL(stats.nCacheSize, 1U << 20);
+    BOOST_CHECK_EQUAL(stats.nBlockCacheSize, 1U << 19);
+    uint64_t nBytesWritten = stats.nBytesWritten;
+
+    // Enough batches to fill the write buffer and flush it into level 0 tables
+    std::vector<unsigned char> vchValue(1000, 0x5a);
+    for (uint32_t i = 0; i < 2000; i += 100) {
+        CDBBatch batch(*dbw);
+        for (uint32_t j = i; j < i + 100; j++)
+            batch.Write(j, vchValue);
+        BOOST_CHECK(batch.SizeEstimate() > 100 * vchValue.size());
+        BOOST_CHECK(dbw->WriteBatch(batch, true));
+        nBytesWritten += batch.SizeEstimate();
+    }
+    uint32_t nKey = 1999;
+    std::vector<unsigned char> vchRead;
+    BOOST_CHECK(dbw->Read(nKey, vchRead));
+    BOOST_CHECK(vchRead == vchValue);
+
+    // Compactions run in the background
+    for (int i = 0; i < 100 && stats.vLevels.empty(); i++) {
+        MilliSleep(20);
+        BOOST_REQUIRE(FindDBStats(ph.string(), stats));
+    }
+    BOOST_CHECK_EQUAL(stats.nBytesWritten, nBytesWritten);
+    BOOST_CHECK(!stats.vLevels.empty());
+    BOOST_CHECK(stats.nBlockCacheUsage <= stats.nBlockCacheSize);
+
+    // A range compaction moves everything out of level 0
+    dbw->CompactRange((uint32_t)0, (uint32_t)0xffffffff);
+    BOOST_REQUIRE(FindDBStats(ph.string(), stats));
+    BOOST_CHECK(!stats.vLevels.empty());
+    for (const CDBLevelStats& level : stats.vLevels)
+        BOOST_CHECK(level.nLevel > 0 || level.nFiles == 0);
+    BOOST_CHECK(dbw->Read(nKey, vchRead));
+    BOOST_CHECK(vchRead == vchValue);
+
+    delete dbw;
+    BOOST_CHECK(!FindDBStats(ph.string(), stats));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,9 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chain.h"
 #include "chainparams.h"
 #include "validation.h"
 #include "net.h"
+#include "txdb.h"
 
 #include "test/test_bitcoin.h"
 
@@ -42,4 +44,41 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_AUTO_TEST_CASE(block_index_arena)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vpindex;
+    for (int i = 0; i < 10000; i++) {
+        CBlockIndex* pindex = arena.Allocate();
+        BOOST_CHECK(pindex->phashBlock == NULL && pindex->nHeight == 0);
+        pindex->nHeight = i;
+        vpindex.push_back(pindex);
+    }
+    arena.Reserve(100);
+    vpindex.push_back(arena.Allocate());
+    vpindex.back()->nHeight = vpindex.size() - 1;
+    BOOST_CHECK_EQUAL(arena.size(), vpindex.size());
+    // Growing the arena never moves existing entries
+    for (size_t i = 0; i < vpindex.size(); i++)
+        BOOST_CHECK_EQUAL(vpindex[i]->nHeight, (int)i);
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(block_index_snapshot)
+{
+    LOCK(cs_main);
+    FlushStateToDisk();
+    BOOST_CHECK(DumpBlockIndex());
+    uint256 hashSnapshot;
+    uint64_t nEntries;
+    BOOST_CHECK(pblocktree->ReadBlockIndexSnapshot(hashSnapshot, nEntries));
+    BOOST_CHECK_EQUAL(nEntries, mapBlockIndex.size());
+
+    // Any later write to the index invalidates the snapshot
+    BOOST_CHECK(pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), 0, std::vector<const CBlockIndex*>()));
+    BOOST_CHECK(!pblocktree->ReadBlockIndexSnapshot(hashSnapshot, nEntries));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,8 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "policy/policy.h"
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
@@ -584,4 +586,144 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolReorgTouchedTest)
+{
+    // removeForReorg restricted to the outputs of disconnected transactions
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    uint256 hashTouched = GetRandHash();
+    uint256 hashUntouched = GetRandHash();
+    CMutableTransaction txA, txB;
+    txA.vin.resize(1);
+    txA.vin[0].prevout = COutPoint(hashTouched, 0);
+    txA.vout.resize(1);
+    txA.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txA.vout[0].nValue = 10000LL;
+    txB = txA;
+    txB.vin[0].prevout = COutPoint(hashUntouched, 0);
+    CMutableTransaction txC; // child of txB, goes with it
+    txC.vin.resize(1);
+    txC.vin[0].prevout = COutPoint(txB.GetHash(), 0);
+    txC.vout = txA.vout;
+
+    // Neither coinbase output is in pcoinsTip, so both spenders are invalid
+    pool.addUnchecked(txA.GetHash(), entry.SpendsCoinbase(true).FromTx(txA));
+    pool.addUnchecked(txB.GetHash(), entry.SpendsCoinbase(true).FromTx(txB));
+    pool.addUnchecked(txC.GetHash(), entry.SpendsCoinbase(false).FromTx(txC));
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    LOCK(cs_main);
+    std::set<uint256> setTouched;
+    setTouched.insert(hashTouched);
+    pool.removeForReorg(pcoinsTip, chainActive.Height() + 1, STANDARD_LOCKTIME_VERIFY_FLAGS, &setTouched);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(!pool.exists(txA.GetHash()));
+
+    pool.removeForReorg(pcoinsTip, chainActive.Height() + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(DisconnectedBlockTransactionsTest)
+{
+    std::vector<CTransactionRef> vtxBlock1, vtxBlock2;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), i);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        vtxBlock1.push_back(MakeTransactionRef(tx));
+        tx.vin[0].prevout = COutPoint(GetRandHash(), i);
+        vtxBlock2.push_back(MakeTransactionRef(tx));
+    }
+
+    DisconnectedBlockTransactions disconnectpool;
+    BOOST_CHECK_EQUAL(disconnectpool.DynamicMemoryUsage(), 0U);
+    // Blocks are disconnected from the tip down, each in reverse
+    for (auto it = vtxBlock2.rbegin(); it != vtxBlock2.rend(); ++it)
+        disconnectpool.addTransaction(*it);
+    for (auto it = vtxBlock1.rbegin(); it != vtxBlock1.rend(); ++it)
+        disconnectpool.addTransaction(*it);
+    BOOST_CHECK_EQUAL(disconnectpool.queuedTx.size(), 6U);
+    BOOST_CHECK_EQUAL(disconnectpool.setTouched.size(), 6U);
+    size_t nUsageFull = disconnectpool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsageFull > 0);
+
+    // Walking insertion order backwards yields chain order
+    std::vector<CTransactionRef> vtxOrdered;
+    for (auto it = disconnectpool.queuedTx.get<insertion_order>().rbegin(); it != disconnectpool.queuedTx.get<insertion_order>().rend(); ++it)
+        vtxOrdered.push_back(*it);
+    std::vector<CTransactionRef> vtxExpected(vtxBlock1);
+    vtxExpected.insert(vtxExpected.end(), vtxBlock2.begin(), vtxBlock2.end());
+    BOOST_CHECK(vtxOrdered == vtxExpected);
+
+    // Reconfirmed transactions leave the queue but stay touched
+    disconnectpool.removeForBlock(vtxBlock1);
+    BOOST_CHECK_EQUAL(disconnectpool.queuedTx.size(), 3U);
+    BOOST_CHECK_EQUAL(disconnectpool.setTouched.size(), 6U);
+    BOOST_CHECK(disconnectpool.DynamicMemoryUsage() < nUsageFull);
+
+    // Evicting from the front drops the most recently disconnected first
+    disconnectpool.removeEntry(disconnectpool.queuedTx.get<insertion_order>().begin());
+    BOOST_CHECK(disconnectpool.queuedTx.find(vtxBlock2.back()->GetHash()) == disconnectpool.queuedTx.end());
+
+    disconnectpool.removeEntry(disconnectpool.queuedTx.get<insertion_order>().begin());
+    disconnectpool.removeEntry(disconnectpool.queuedTx.get<insertion_order>().begin());
+    BOOST_CHECK_EQUAL(disconnectpool.DynamicMemoryUsage(), 0U);
+    disconnectpool.clear();
+    BOOST_CHECK(disconnectpool.setTouched.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10000LL;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout = txParent.vout;
+
+    CTxMemPoolSnapshotRef empty = pool.GetSnapshot();
+    BOOST_CHECK(empty->vEntries.empty());
+    // Unchanged mempool republishes nothing
+    BOOST_CHECK(pool.GetSnapshot() == empty);
+
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(2000LL).FromTx(txChild));
+    CTxMemPoolSnapshotRef full = pool.GetSnapshot();
+    BOOST_CHECK(full != empty);
+    BOOST_CHECK(empty->vEntries.empty());
+    BOOST_CHECK_EQUAL(full->vEntries.size(), 2U);
+    // Parents sort ahead of their children
+    BOOST_CHECK(full->vEntries[0].GetTx().GetHash() == txParent.GetHash());
+    BOOST_CHECK(full->exists(txChild.GetHash()));
+    BOOST_CHECK_EQUAL(full->find(txChild.GetHash())->GetCountWithAncestors(), 2U);
+
+    std::vector<uint256> vtxid;
+    pool.queryHashes(vtxid);
+    BOOST_CHECK_EQUAL(vtxid.size(), 2U);
+    BOOST_CHECK(vtxid[1] == txChild.GetHash());
+    BOOST_CHECK(pool.GetSnapshot() == full);
+
+    // Prioritisation changes entries in place and must be picked up
+    pool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0., 5000LL);
+    CTxMemPoolSnapshotRef prioritised = pool.GetSnapshot();
+    BOOST_CHECK(prioritised != full);
+    BOOST_CHECK_EQUAL(prioritised->find(txChild.GetHash())->GetModifiedFee(), 7000LL);
+    BOOST_CHECK_EQUAL(full->find(txChild.GetHash())->GetModifiedFee(), 2000LL);
+
+    pool.removeRecursive(txParent);
+    BOOST_CHECK(pool.GetSnapshot()->vEntries.empty());
+    BOOST_CHECK_EQUAL(prioritised->vEntries.size(), 2U);
+    BOOST_CHECK(pool.infoAll().empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "policy/policy.h"
 #include "policy/fees.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
@@ -197,4 +198,69 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesPersistence)
+{
+    CTxMemPool mpool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+
+    CScript garbage;
+    for (unsigned int i = 0; i < 128; i++)
+        garbage.push_back('X');
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = garbage;
+    tx.vout.resize(1);
+    tx.vout[0].nValue=0LL;
+
+    // Confirm higher fee transactions faster; a new block only touches the
+    // buckets its transactions fall in, the rest decay lazily.
+    std::vector<uint256> vPending[3];
+    std::vector<CTransactionRef> block;
+    for (int blocknum = 0; blocknum < 100; blocknum++) {
+        for (int j = 0; j < 3; j++) {
+            for (int k = 0; k < 4; k++) {
+                tx.vin[0].prevout.n = 10000*blocknum+100*j+k;
+                uint256 hash = tx.GetHash();
+                mpool.addUnchecked(hash, entry.Fee(5000 * (j+1)).Time(GetTime()).Priority(0).Height(blocknum).FromTx(tx, &mpool));
+                vPending[j].push_back(hash);
+            }
+        }
+        for (int j = 0; j < 3; j++) {
+            if (blocknum % (3 - j) != 0)
+                continue;
+            for (const uint256& hash : vPending[j]) {
+                CTransactionRef ptx = mpool.get(hash);
+                if (ptx)
+                    block.push_back(ptx);
+            }
+            vPending[j].clear();
+        }
+        mpool.removeForBlock(block, blocknum + 1);
+        block.clear();
+    }
+    // Leave nothing unconfirmed, the mempool counts aren't persisted
+    for (int j = 0; j < 3; j++) {
+        for (const uint256& hash : vPending[j])
+            block.push_back(mpool.get(hash));
+    }
+    mpool.removeForBlock(block, 101);
+    BOOST_CHECK(mpool.FeeEstimatesDirty());
+    BOOST_CHECK(mpool.estimateFee(3) > CFeeRate(0));
+
+    // Estimates survive a round trip through the file, and are stable across
+    // repeated (memoized) queries.
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(mpool.WriteFeeEstimates(file));
+    BOOST_CHECK(!mpool.FeeEstimatesDirty());
+    rewind(file.Get());
+    CTxMemPool mpool2(CFeeRate(1000));
+    BOOST_CHECK(mpool2.ReadFeeEstimates(file));
+    BOOST_CHECK(!mpool2.FeeEstimatesDirty());
+    for (int i = 2; i <= 25; i++) {
+        CFeeRate rate = mpool.estimateFee(i);
+        BOOST_CHECK(rate == mpool.estimateFee(i));
+        BOOST_CHECK(std::abs(rate.GetFeePerK() - mpool2.estimateFee(i).GetFeePerK()) <= 1);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,96 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "key.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "txindex.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(txindex_tests)
+
+static bool WaitForInitialSync(CTxIndex& txindex)
+{
+    for (int i = 0; i < 1000 && !txindex.IsSynced(); i++)
+        MilliSleep(10);
+    return txindex.IsSynced();
+}
+
+BOOST_FIXTURE_TEST_CASE(txindex_initial_sync, TestChain100Setup)
+{
+    bool fTxIndexOld = fTxIndex;
+    fTxIndex = true;
+
+    CTxIndex txindex(*pblocktree);
+    BOOST_CHECK(!txindex.IsSynced());
+    BOOST_CHECK(!txindex.BlockUntilSyncedToCurrentChain());
+    BOOST_CHECK(txindex.Start());
+    BOOST_CHECK(WaitForInitialSync(txindex));
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+
+    // The existing chain was indexed in the background
+    for (const CTransaction& txn : coinbaseTxns) {
+        CTransactionRef tx;
+        uint256 hashBlock;
+        BOOST_CHECK(GetTransaction(txn.GetHash(), tx, Params().GetConsensus(), hashBlock, false));
+        BOOST_CHECK(tx && tx->GetHash() == txn.GetHash());
+        BOOST_CHECK(!hashBlock.IsNull());
+    }
+
+    // New blocks are picked up once they are connected
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    BOOST_CHECK(txindex.BlockUntilSyncedToCurrentChain());
+    CDiskTxPos pos;
+    BOOST_CHECK(pblocktree->ReadTxIndex(block.vtx[0]->GetHash(), pos));
+
+    txindex.Stop();
+
+    // The best block was recorded, so a restarted indexer resumes from there
+    uint256 hashBest;
+    BOOST_CHECK(pblocktree->ReadTxIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == block.GetHash());
+
+    fTxIndex = fTxIndexOld;
+}
+
+BOOST_FIXTURE_TEST_CASE(txindex_resume_after_reorg, TestChain100Setup)
+{
+    // Pretend the index was synced to a block that is no longer part of the
+    // active chain; the indexer has to continue from the fork point.
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    uint256 hashStale;
+    {
+        LOCK(cs_main);
+        hashStale = chainActive.Tip()->GetBlockHash();
+    }
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[hashStale]));
+        BOOST_CHECK(chainActive.Height() == 99);
+    }
+    CBlock blockNew = CreateAndProcessBlock(std::vector<CMutableTransaction>(), CScript() << OP_TRUE);
+    BOOST_CHECK(pblocktree->WriteTxIndexBestBlock(block.GetHash()));
+
+    CTxIndex txindex(*pblocktree);
+    BOOST_CHECK(txindex.Start());
+    BOOST_CHECK(WaitForInitialSync(txindex));
+    txindex.Stop();
+
+    CDiskTxPos pos;
+    BOOST_CHECK(pblocktree->ReadTxIndex(blockNew.vtx[0]->GetHash(), pos));
+    uint256 hashBest;
+    BOOST_CHECK(pblocktree->ReadTxIndexBestBlock(hashBest));
+    BOOST_CHECK(hashBest == blockNew.GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -84,4 +84,59 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+static CMutableTransaction
+SignedSpend(const uint256& hashPrev, const CScript& scriptPubKey, const CKey& key, CAmount nValue)
+{
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = hashPrev;
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = nValue;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    return spend;
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_batch_accept, TestChain100Setup)
+{
+    // A batch is committed in dependency order regardless of the order it
+    // was submitted in, and each transaction gets its own result.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction parent = SignedSpend(coinbaseTxns[0].GetHash(), scriptPubKey, coinbaseKey, 11*CENT);
+    CMutableTransaction child = SignedSpend(parent.GetHash(), scriptPubKey, coinbaseKey, 10*CENT);
+    CMutableTransaction doubleSpend = SignedSpend(coinbaseTxns[0].GetHash(), scriptPubKey, coinbaseKey, 9*CENT);
+    CMutableTransaction orphan = SignedSpend(GetRandHash(), scriptPubKey, coinbaseKey, 1*CENT);
+
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(child));
+    vtx.push_back(MakeTransactionRef(parent));
+    vtx.push_back(MakeTransactionRef(doubleSpend));
+    vtx.push_back(MakeTransactionRef(orphan));
+
+    std::vector<CTxBatchResult> vResults;
+    AcceptToMemoryPoolBatch(mempool, vtx, vResults, false);
+    BOOST_CHECK_EQUAL(vResults.size(), vtx.size());
+
+    BOOST_CHECK(vResults[0].fAccepted);
+    BOOST_CHECK(vResults[1].fAccepted);
+    BOOST_CHECK(!vResults[2].fAccepted);
+    BOOST_CHECK(!vResults[2].fMissingInputs);
+    BOOST_CHECK_EQUAL(vResults[2].state.GetRejectReason(), "txn-mempool-conflict");
+    BOOST_CHECK(!vResults[3].fAccepted);
+    BOOST_CHECK(vResults[3].fMissingInputs);
+
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(mempool.exists(parent.GetHash()));
+    BOOST_CHECK(mempool.exists(child.GetHash()));
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
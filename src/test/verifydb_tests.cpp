@@ -0,0 +1,57 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(verifydb_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(verifydb_levels)
+{
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+    for (int nCheckLevel = 0; nCheckLevel <= 4; nCheckLevel++) {
+        BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip, nCheckLevel, 50));
+        BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip, nCheckLevel, 0));
+    }
+
+    // Checking only disconnects and reconnects in a scratch view
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashTip);
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == hashTip);
+}
+
+BOOST_AUTO_TEST_CASE(verifydb_bad_block)
+{
+    CDiskBlockPos pos;
+    {
+        LOCK(cs_main);
+        pos = chainActive[60]->GetBlockPos();
+    }
+    BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip, 1, 50));
+
+    // Overwrite the header of a block inside the checked range
+    {
+        FILE* file = fopen(GetBlockPosFilename(pos, "blk").string().c_str(), "rb+");
+        BOOST_REQUIRE(file);
+        fseek(file, pos.nPos, SEEK_SET);
+        std::vector<unsigned char> vchZero(80, 0);
+        fwrite(vchZero.data(), 1, vchZero.size(), file);
+        fclose(file);
+    }
+    BOOST_CHECK(!CVerifyDB().VerifyDB(Params(), pcoinsTip, 0, 50));
+    BOOST_CHECK(!CVerifyDB().VerifyDB(Params(), pcoinsTip, 3, 0));
+    // Blocks above the bad one still verify
+    BOOST_CHECK(CVerifyDB().VerifyDB(Params(), pcoinsTip, 3, 30));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
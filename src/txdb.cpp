@@ -26,9 +26,11 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'S';
+static const char DB_TXINDEX_BEST_BLOCK = 'T';
 
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true, "chainstate") 
 {
 }
 
@@ -70,7 +72,18 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+void CCoinsViewDB::CompactSlice(int nSlice) const
+{
+    assert(nSlice >= 0 && nSlice < COINSDB_COMPACT_SLICES);
+    // Coin keys sort by the first serialized byte of the txid
+    uint256 txidBegin, txidEnd;
+    memset(txidEnd.begin(), 0xff, txidEnd.size());
+    *txidBegin.begin() = nSlice * 256 / COINSDB_COMPACT_SLICES;
+    *txidEnd.begin() = (nSlice + 1) * 256 / COINSDB_COMPACT_SLICES - 1;
+    db.CompactRange(std::make_pair(DB_COINS, txidBegin), std::make_pair(DB_COINS, txidEnd));
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, false, "blockindex") {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -146,20 +159,44 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // Any flat snapshot of the index is stale from here on
+    batch.Erase(DB_BLOCK_INDEX_SNAPSHOT);
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadBlockIndexSnapshot(uint256 &hashSnapshot, uint64_t &nEntries) {
+    std::pair<uint256, uint64_t> marker;
+    if (!Read(DB_BLOCK_INDEX_SNAPSHOT, marker))
+        return false;
+    hashSnapshot = marker.first;
+    nEntries = marker.second;
+    return true;
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const uint256 &hashSnapshot, uint64_t nEntries) {
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, std::make_pair(hashSnapshot, nEntries), true);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(std::make_pair(DB_TXINDEX, txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect, const uint256 &hashBestBlock) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(std::make_pair(DB_TXINDEX, it->first), it->second);
+    batch.Write(DB_TXINDEX_BEST_BLOCK, hashBestBlock);
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadTxIndexBestBlock(uint256 &hashBestBlock) {
+    return Read(DB_TXINDEX_BEST_BLOCK, hashBestBlock);
+}
+
+bool CBlockTreeDB::WriteTxIndexBestBlock(const uint256 &hashBestBlock) {
+    return Write(DB_TXINDEX_BEST_BLOCK, hashBestBlock);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -44,6 +44,8 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Number of slices of the txid space the coin DB is compacted in, one at a time
+static const int COINSDB_COMPACT_SLICES = 16;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -83,6 +85,11 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    //! Compact the coins of the txids in slice nSlice of COINSDB_COMPACT_SLICES
+    void CompactSlice(int nSlice) const;
+    //! Bytes written to the coin DB since it was opened
+    uint64_t GetBytesWritten() const { return db.GetBytesWritten(); }
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -122,10 +129,16 @@ public:
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    /** Write transaction positions together with the block the index is now synced to, atomically. */
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, const uint256 &hashBestBlock);
+    bool ReadTxIndexBestBlock(uint256 &hashBestBlock);
+    bool WriteTxIndexBestBlock(const uint256 &hashBestBlock);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /** The flat block index snapshot matching this database, if any. Erased by every WriteBatchSync. */
+    bool ReadBlockIndexSnapshot(uint256 &hashSnapshot, uint64_t &nEntries);
+    bool WriteBlockIndexSnapshot(const uint256 &hashSnapshot, uint64_t nEntries);
     bool ReadSyncCheckpoint(uint256& hashCheckpoint);
     bool WriteSyncCheckpoint(uint256 hashCheckpoint);
     bool ReadCheckpointPubKey(std::string& strPubKey);
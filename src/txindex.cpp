@@ -0,0 +1,49 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindex.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+
+std::unique_ptr<CTxIndex> g_txindex;
+
+CTxIndex::CTxIndex(CBlockTreeDB& dbIn) : db(dbIn)
+{
+}
+
+CTxIndex::~CTxIndex()
+{
+    Stop();
+}
+
+bool CTxIndex::ReadBestBlock(uint256& hashBest)
+{
+    return db.ReadTxIndexBestBlock(hashBest);
+}
+
+bool CTxIndex::AppendBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    for (const CTransactionRef& tx : block.vtx) {
+        vPos.push_back(std::make_pair(tx->GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    return true;
+}
+
+bool CTxIndex::IsBatchFull() const
+{
+    return vPos.size() >= TXINDEX_BATCH_SIZE;
+}
+
+bool CTxIndex::Commit(const CBlockIndex* pindexNewBest)
+{
+    if (!db.WriteTxIndex(vPos, pindexNewBest ? pindexNewBest->GetBlockHash() : uint256()))
+        return false;
+    vPos.clear();
+    return true;
+}
@@ -0,0 +1,46 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXINDEX_H
+#define BITCOIN_TXINDEX_H
+
+#include "baseindex.h"
+#include "txdb.h"
+
+#include <memory>
+#include <vector>
+
+/** Number of indexed transactions collected before they are written out while catching up */
+static const unsigned int TXINDEX_BATCH_SIZE = 50000;
+
+/**
+ * Maintains the transaction index (-txindex) on a background thread instead
+ * of while connecting blocks. Transaction positions go to the block tree
+ * database in batches that span many blocks, together with the block the
+ * index is synced to.
+ */
+class CTxIndex : public CBaseIndex
+{
+private:
+    CBlockTreeDB& db;
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+
+protected:
+    bool ReadBestBlock(uint256& hashBest) override;
+    bool AppendBlock(const CBlock& block, const CBlockIndex* pindex) override;
+    bool IsBatchFull() const override;
+    bool Commit(const CBlockIndex* pindexNewBest) override;
+    const char* GetName() const override { return "txindex"; }
+
+public:
+    explicit CTxIndex(CBlockTreeDB& dbIn);
+    ~CTxIndex();
+};
+
+/** The running transaction indexer, if -txindex is enabled */
+extern std::unique_ptr<CTxIndex> g_txindex;
+
+#endif // BITCOIN_TXINDEX_H
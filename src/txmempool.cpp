@@ -165,6 +165,7 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
         }
         UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
     }
+    ++nSnapshotSequence;
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
@@ -347,7 +348,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nSnapshotSequence(0)
 {
     _clear(); //lock free clear
 
@@ -439,6 +440,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     UpdateEntryForAncestors(newit, setAncestors);
 
     nTransactionsUpdated++;
+    ++nSnapshotSequence;
     totalTxSize += entry.GetTxSize();
     minerPolicyEstimator->processTransaction(entry, validFeeEstimate);
 
@@ -470,6 +472,7 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
+    ++nSnapshotSequence;
     minerPolicyEstimator->removeTx(hash);
 }
 
@@ -534,12 +537,29 @@ void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReaso
     }
 }
 
-void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags)
+void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags, const std::set<uint256>* psetTouched)
 {
     // Remove transactions spending a coinbase which are now immature and no-longer-final transactions
     LOCK(cs);
+    std::vector<txiter> vCandidates;
+    if (psetTouched) {
+        // Only entries spending outputs of the touched transactions
+        setEntries setCandidates;
+        for (const uint256& hash : *psetTouched) {
+            for (auto it = mapNextTx.lower_bound(COutPoint(hash, 0)); it != mapNextTx.end() && it->first->hash == hash; ++it) {
+                txiter spender = mapTx.find(it->second->GetHash());
+                if (spender != mapTx.end() && setCandidates.insert(spender).second)
+                    vCandidates.push_back(spender);
+            }
+        }
+    } else {
+        vCandidates.reserve(mapTx.size());
+        for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++)
+            vCandidates.push_back(it);
+    }
+
     setEntries txToRemove;
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+    for (txiter it : vCandidates) {
         const CTransaction& tx = it->GetTx();
         LockPoints lp = it->GetLockPoints();
         bool validLP =  TestLockPointValidity(&lp);
@@ -631,6 +651,7 @@ void CTxMemPool::_clear()
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    ++nSnapshotSequence;
 }
 
 void CTxMemPool::clear()
@@ -816,35 +837,59 @@ std::vector<CTxMemPool::indexed_transaction_set::const_iterator> CTxMemPool::Get
 
 void CTxMemPool::queryHashes(std::vector<uint256>& vtxid)
 {
-    LOCK(cs);
-    auto iters = GetSortedDepthAndScore();
+    CTxMemPoolSnapshotRef view = GetSnapshot();
 
     vtxid.clear();
-    vtxid.reserve(mapTx.size());
+    vtxid.reserve(view->vEntries.size());
 
-    for (auto it : iters) {
-        vtxid.push_back(it->GetTx().GetHash());
+    for (const CTxMemPoolEntry& e : view->vEntries) {
+        vtxid.push_back(e.GetTx().GetHash());
     }
 }
 
-static TxMempoolInfo GetInfo(CTxMemPool::indexed_transaction_set::const_iterator it) {
-    return TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetModifiedFee() - it->GetFee()};
+static TxMempoolInfo GetInfo(const CTxMemPoolEntry& e) {
+    return TxMempoolInfo{e.GetSharedTx(), e.GetTime(), CFeeRate(e.GetFee(), e.GetTxSize()), e.GetModifiedFee() - e.GetFee()};
 }
 
 std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
 {
-    LOCK(cs);
-    auto iters = GetSortedDepthAndScore();
+    CTxMemPoolSnapshotRef view = GetSnapshot();
 
     std::vector<TxMempoolInfo> ret;
-    ret.reserve(mapTx.size());
-    for (auto it : iters) {
-        ret.push_back(GetInfo(it));
+    ret.reserve(view->vEntries.size());
+    for (const CTxMemPoolEntry& e : view->vEntries) {
+        ret.push_back(GetInfo(e));
     }
 
     return ret;
 }
 
+CTxMemPoolSnapshotRef CTxMemPool::GetSnapshot() const
+{
+    CTxMemPoolSnapshotRef ret = std::atomic_load(&snapshot);
+    if (ret && ret->nSequence == nSnapshotSequence.load())
+        return ret;
+
+    LOCK(cs);
+    // Another reader may have published while we waited for the lock.
+    ret = std::atomic_load(&snapshot);
+    if (ret && ret->nSequence == nSnapshotSequence.load())
+        return ret;
+
+    auto iters = GetSortedDepthAndScore();
+    std::shared_ptr<CTxMemPoolSnapshot> view = std::make_shared<CTxMemPoolSnapshot>();
+    view->nSequence = nSnapshotSequence.load();
+    view->vEntries.reserve(iters.size());
+    view->mapIndex.reserve(iters.size());
+    for (auto it : iters) {
+        view->mapIndex.emplace(it->GetTx().GetHash(), view->vEntries.size());
+        view->vEntries.push_back(*it);
+    }
+    ret = view;
+    std::atomic_store(&snapshot, ret);
+    return ret;
+}
+
 CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -860,7 +905,7 @@ TxMempoolInfo CTxMemPool::info(const uint256& hash) const
     indexed_transaction_set::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end())
         return TxMempoolInfo();
-    return GetInfo(i);
+    return GetInfo(*i);
 }
 
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
@@ -918,6 +963,12 @@ CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
     return true;
 }
 
+bool CTxMemPool::FeeEstimatesDirty() const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->IsDirty();
+}
+
 void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta)
 {
     {
@@ -943,6 +994,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
             BOOST_FOREACH(txiter descendantIt, setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
+            ++nSnapshotSequence;
         }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
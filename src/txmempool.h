@@ -9,15 +9,18 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <atomic>
 #include <memory>
 #include <set>
 #include <map>
 #include <vector>
 #include <utility>
 #include <string>
+#include <unordered_map>
 
 #include "amount.h"
 #include "coins.h"
+#include "core_memusage.h"
 #include "indirectmap.h"
 #include "primitives/transaction.h"
 #include "sync.h"
@@ -27,6 +30,7 @@
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
+#include "boost/multi_index/sequenced_index.hpp"
 
 #include <boost/signals2/signal.hpp>
 
@@ -221,6 +225,11 @@ struct mempoolentry_txid
     {
         return entry.GetTx().GetHash();
     }
+
+    result_type operator() (const CTransactionRef& tx) const
+    {
+        return tx->GetHash();
+    }
 };
 
 /** \class CompareTxMemPoolEntryByDescendantScore
@@ -336,6 +345,35 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * Immutable copy of the mempool contents, sorted by depth and score (the
+ * order used by queryHashes and infoAll). Readers get one through
+ * CTxMemPool::GetSnapshot() and may walk it for as long as they like
+ * without holding any lock; the mempool only builds a new one after
+ * its contents changed.
+ */
+struct CTxMemPoolSnapshot
+{
+    /** Value of the mempool change sequence this snapshot reflects. */
+    uint64_t nSequence;
+
+    /** Entries as they were when the snapshot was taken. */
+    std::vector<CTxMemPoolEntry> vEntries;
+
+    /** Position of each transaction in vEntries, by txid. */
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> mapIndex;
+
+    bool exists(const uint256& hash) const { return mapIndex.count(hash) != 0; }
+
+    const CTxMemPoolEntry* find(const uint256& hash) const
+    {
+        auto it = mapIndex.find(hash);
+        return it == mapIndex.end() ? NULL : &vEntries[it->second];
+    }
+};
+
+typedef std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPoolSnapshotRef;
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -443,6 +481,9 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    std::atomic<uint64_t> nSnapshotSequence; //!< bumped (under cs) on every change readers of a snapshot could observe
+    mutable CTxMemPoolSnapshotRef snapshot; //!< latest published snapshot, only accessed through std::atomic_load/atomic_store
+
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -539,7 +580,14 @@ public:
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, setEntries &setAncestors, bool validFeeEstimate = true);
 
     void removeRecursive(const CTransaction &tx, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
-    void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags);
+    /**
+     * Remove transactions spending a coinbase which are now immature and
+     * no-longer-final transactions after a reorg. If psetTouched is given,
+     * only entries spending outputs of those transactions are revisited;
+     * that is sufficient as long as the new tip is not lower (in height and
+     * median time past) than the old one.
+     */
+    void removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight, int flags, const std::set<uint256>* psetTouched = NULL);
     void removeConflicts(const CTransaction &tx);
     void removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight);
 
@@ -641,6 +689,14 @@ public:
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
+    /**
+     * Return a read-only snapshot of the whole mempool. cs is only taken to
+     * build a new snapshot when the mempool changed since the last one was
+     * published, so repeated or concurrent large queries share one copy and
+     * walk it without blocking transaction acceptance.
+     */
+    CTxMemPoolSnapshotRef GetSnapshot() const;
+
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
      *  at the lowest number of blocks where one can be given
@@ -662,6 +718,8 @@ public:
     /** Write/Read estimates to disk */
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
+    /** Whether the fee estimates changed since they were last written or read */
+    bool FeeEstimatesDirty() const;
 
     size_t DynamicMemoryUsage() const;
 
@@ -722,6 +780,104 @@ public:
     bool HaveCoins(const uint256 &txid) const;
 };
 
+/**
+ * DisconnectedBlockTransactions
+
+ * During the reorg, it's desirable to re-add previously confirmed transactions
+ * to the mempool, so that anything not re-confirmed in the new chain is
+ * available to be mined. However, it's more efficient to wait until the reorg
+ * is complete and process all still-unconfirmed transactions at that time,
+ * since we expect most confirmed transactions to (typically) still be
+ * confirmed in the new chain, and re-accepting to the memory pool is expensive
+ * (and therefore better to not do in the middle of reorg-processing).
+ * Instead, store the disconnected transactions (in order!) as we go, remove any
+ * that are included in blocks in the new chain, and then process the remaining
+ * still-unconfirmed transactions at the end.
+ */
+
+// multi_index tag names
+struct txid_index {};
+struct insertion_order {};
+
+struct DisconnectedBlockTransactions {
+    typedef boost::multi_index_container<
+        CTransactionRef,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::hashed_unique<
+                boost::multi_index::tag<txid_index>,
+                mempoolentry_txid,
+                SaltedTxidHasher
+            >,
+            // sorted by order in the blockchain
+            boost::multi_index::sequenced<
+                boost::multi_index::tag<insertion_order>
+            >
+        >
+    > indexed_disconnected_transactions;
+
+    // It's almost certainly a logic bug if we don't clear out queuedTx before
+    // destruction, as we add to it while disconnecting blocks, and then we
+    // need to re-process remaining transactions to ensure mempool consistency.
+    // For now, assert() that we've emptied out this object on destruction.
+    // This assert() can always be removed if the reorg-processing code were
+    // to be refactored such that this assumption is no longer true (for
+    // instance if there was some other way we cleaned up the mempool after a
+    // reorg, besides draining this object).
+    ~DisconnectedBlockTransactions() { assert(queuedTx.empty()); }
+
+    indexed_disconnected_transactions queuedTx;
+    uint64_t cachedInnerUsage = 0;
+
+    //! Every transaction that was disconnected, including ones since
+    //! re-confirmed or evicted; mempool entries spending their outputs need
+    //! to be rechecked once the reorg is done.
+    std::set<uint256> setTouched;
+
+    // Estimate the overhead of queuedTx to be 6 pointers + an allocation, as
+    // no exact formula for boost::multi_index_contained is implemented.
+    size_t DynamicMemoryUsage() const {
+        return memusage::MallocUsage(sizeof(CTransactionRef) + 6 * sizeof(void*)) * queuedTx.size() + cachedInnerUsage;
+    }
+
+    void addTransaction(const CTransactionRef& tx)
+    {
+        queuedTx.insert(tx);
+        cachedInnerUsage += RecursiveDynamicUsage(tx);
+        setTouched.insert(tx->GetHash());
+    }
+
+    // Remove entries based on txid_index, and update memory usage.
+    void removeForBlock(const std::vector<CTransactionRef>& vtx)
+    {
+        // Short-circuit in the common case of a block being added to the tip
+        if (queuedTx.empty()) {
+            return;
+        }
+        for (auto const &tx : vtx) {
+            auto it = queuedTx.find(tx->GetHash());
+            if (it != queuedTx.end()) {
+                cachedInnerUsage -= RecursiveDynamicUsage(*it);
+                queuedTx.erase(it);
+            }
+        }
+    }
+
+    // Remove an entry by insertion_order index, and update memory usage.
+    void removeEntry(indexed_disconnected_transactions::index<insertion_order>::type::iterator entry)
+    {
+        cachedInnerUsage -= RecursiveDynamicUsage(*entry);
+        queuedTx.get<insertion_order>().erase(entry);
+    }
+
+    void clear()
+    {
+        cachedInnerUsage = 0;
+        queuedTx.clear();
+        setTouched.clear();
+    }
+};
+
 // We want to sort transactions by coin age priority
 typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
 
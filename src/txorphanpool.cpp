@@ -0,0 +1,179 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txorphanpool.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+
+CTxOrphanPool::CTxOrphanPool() : nTotalUsage(0)
+{
+}
+
+void CTxOrphanPool::UpdatePeer(NodeId peer, size_t nUsage, bool fAdd)
+{
+    size_t& nPeerUsage = mapPeerUsage[peer];
+    size_t& nPeerCount = mapPeerCount[peer];
+    setPeersByUsage.erase(std::make_pair(nPeerUsage, peer));
+    setPeersByCount.erase(std::make_pair(nPeerCount, peer));
+    if (fAdd) {
+        nPeerUsage += nUsage;
+        nTotalUsage += nUsage;
+        nPeerCount++;
+    } else {
+        nPeerUsage -= nUsage;
+        nTotalUsage -= nUsage;
+        nPeerCount--;
+    }
+    if (nPeerCount == 0) {
+        mapPeerUsage.erase(peer);
+        mapPeerCount.erase(peer);
+    } else {
+        setPeersByUsage.insert(std::make_pair(nPeerUsage, peer));
+        setPeersByCount.insert(std::make_pair(nPeerCount, peer));
+    }
+}
+
+void CTxOrphanPool::EraseEntry(txiter it)
+{
+    for (const CTxIn& txin : it->tx->vin) {
+        auto itPrev = mapOrphansByPrev.find(txin.prevout);
+        if (itPrev == mapOrphansByPrev.end())
+            continue;
+        itPrev->second.erase(it);
+        if (itPrev->second.empty())
+            mapOrphansByPrev.erase(itPrev);
+    }
+    UpdatePeer(it->fromPeer, it->nUsage, false);
+    mapOrphans.erase(it);
+}
+
+bool CTxOrphanPool::AddTx(const CTransactionRef& tx, NodeId peer, int64_t nTimeExpire, size_t nMaxPeerUsage)
+{
+    if (HaveTx(tx->GetHash()))
+        return false;
+
+    // Charge the peer for the transaction and its share of the prevout index.
+    size_t nUsage = RecursiveDynamicUsage(*tx) + memusage::DynamicUsage(tx) +
+                    tx->vin.size() * memusage::MallocUsage(sizeof(std::pair<COutPoint, txiter>));
+
+    if (nMaxPeerUsage > 0) {
+        // Make room within the peer's quota by dropping its oldest orphans
+        if (nUsage > nMaxPeerUsage)
+            return false;
+        auto& index = mapOrphans.get<orphan_peer>();
+        while (PeerUsage(peer) + nUsage > nMaxPeerUsage) {
+            auto it = index.lower_bound(boost::make_tuple(peer));
+            assert(it != index.end() && it->fromPeer == peer);
+            EraseEntry(mapOrphans.project<0>(it));
+        }
+    }
+
+    auto ret = mapOrphans.insert(COrphanTx{tx, peer, nTimeExpire, nUsage});
+    assert(ret.second);
+    for (const CTxIn& txin : tx->vin) {
+        mapOrphansByPrev[txin.prevout].insert(ret.first);
+    }
+    UpdatePeer(peer, nUsage, true);
+    return true;
+}
+
+bool CTxOrphanPool::HaveTx(const uint256& hash) const
+{
+    return mapOrphans.find(hash) != mapOrphans.end();
+}
+
+int CTxOrphanPool::EraseTx(const uint256& hash)
+{
+    txiter it = mapOrphans.find(hash);
+    if (it == mapOrphans.end())
+        return 0;
+    EraseEntry(it);
+    return 1;
+}
+
+int CTxOrphanPool::EraseForPeer(NodeId peer)
+{
+    int nErased = 0;
+    auto& index = mapOrphans.get<orphan_peer>();
+    auto it = index.lower_bound(boost::make_tuple(peer));
+    while (it != index.end() && it->fromPeer == peer) {
+        EraseEntry(mapOrphans.project<0>(it++));
+        ++nErased;
+    }
+    return nErased;
+}
+
+int CTxOrphanPool::EraseExpired(int64_t nNow)
+{
+    int nErased = 0;
+    auto& index = mapOrphans.get<orphan_expiry>();
+    auto it = index.begin();
+    while (it != index.end() && it->nTimeExpire <= nNow) {
+        EraseEntry(mapOrphans.project<0>(it++));
+        ++nErased;
+    }
+    return nErased;
+}
+
+unsigned int CTxOrphanPool::LimitOrphans(unsigned int nMaxOrphans, size_t nMaxUsage)
+{
+    unsigned int nEvicted = 0;
+    auto& index = mapOrphans.get<orphan_peer>();
+    while (!mapOrphans.empty() && (mapOrphans.size() > nMaxOrphans || (nMaxUsage > 0 && nTotalUsage > nMaxUsage))) {
+        // Evict the oldest orphan of the peer with the most orphans, or of
+        // the one using the most memory if only the memory limit is exceeded
+        NodeId peer = mapOrphans.size() > nMaxOrphans ? setPeersByCount.rbegin()->second : setPeersByUsage.rbegin()->second;
+        auto it = index.lower_bound(boost::make_tuple(peer));
+        assert(it != index.end() && it->fromPeer == peer);
+        EraseEntry(mapOrphans.project<0>(it));
+        ++nEvicted;
+    }
+    return nEvicted;
+}
+
+void CTxOrphanPool::GetOrphansByPrev(const COutPoint& prevout, std::vector<COrphanTx>& vOrphans) const
+{
+    auto itByPrev = mapOrphansByPrev.find(prevout);
+    if (itByPrev == mapOrphansByPrev.end())
+        return;
+    for (const txiter& it : itByPrev->second)
+        vOrphans.push_back(*it);
+}
+
+void CTxOrphanPool::GetConflictingOrphans(const CTransaction& tx, std::vector<uint256>& vOrphanHashes) const
+{
+    for (const CTxIn& txin : tx.vin) {
+        auto itByPrev = mapOrphansByPrev.find(txin.prevout);
+        if (itByPrev == mapOrphansByPrev.end())
+            continue;
+        for (const txiter& it : itByPrev->second)
+            vOrphanHashes.push_back(it->tx->GetHash());
+    }
+}
+
+size_t CTxOrphanPool::PeerUsage(NodeId peer) const
+{
+    auto it = mapPeerUsage.find(peer);
+    return it == mapPeerUsage.end() ? 0 : it->second;
+}
+
+size_t CTxOrphanPool::PeerCount(NodeId peer) const
+{
+    auto it = mapPeerCount.find(peer);
+    return it == mapPeerCount.end() ? 0 : it->second;
+}
+
+void CTxOrphanPool::Clear()
+{
+    mapOrphans.clear();
+    mapOrphansByPrev.clear();
+    mapPeerUsage.clear();
+    setPeersByUsage.clear();
+    mapPeerCount.clear();
+    setPeersByCount.clear();
+    nTotalUsage = 0;
+}
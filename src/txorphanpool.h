@@ -0,0 +1,159 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXORPHANPOOL_H
+#define BITCOIN_TXORPHANPOOL_H
+
+#include "coins.h"
+#include "primitives/transaction.h"
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+#undef foreach
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/composite_key.hpp"
+#include "boost/multi_index/hashed_index.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+
+typedef int64_t NodeId;
+
+/** An orphan transaction: one whose inputs we haven't seen yet */
+struct COrphanTx
+{
+    CTransactionRef tx;
+    NodeId fromPeer;
+    int64_t nTimeExpire;
+    //! Memory charged to fromPeer for this entry
+    size_t nUsage;
+};
+
+// extracts a COrphanTx's transaction hash
+struct orphantx_txid
+{
+    typedef uint256 result_type;
+    result_type operator() (const COrphanTx& orphan) const
+    {
+        return orphan.tx->GetHash();
+    }
+};
+
+// multi_index tags
+struct orphan_peer {};
+struct orphan_expiry {};
+
+/**
+ * Pool of transactions whose parents are not known yet.
+ *
+ * Entries are indexed by txid, by (peer, expiry time) and by expiry time, and
+ * a separate map tracks the orphans spending each outpoint. This makes expiry,
+ * peer disconnect cleanup and parent-arrival lookups logarithmic.
+ *
+ * Memory and entries are accounted per peer. When the pool holds too many
+ * entries they are evicted from whichever peer has the most of them, and when
+ * it uses too much memory from the peer using the most, oldest first, so a
+ * single peer flooding the pool only pushes out its own orphans.
+ *
+ * The pool does no locking of its own; callers must serialize access.
+ */
+class CTxOrphanPool
+{
+public:
+    typedef boost::multi_index_container<
+        COrphanTx,
+        boost::multi_index::indexed_by<
+            // sorted by txid
+            boost::multi_index::hashed_unique<orphantx_txid, SaltedTxidHasher>,
+            // sorted by peer, then expiry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_peer>,
+                boost::multi_index::composite_key<
+                    COrphanTx,
+                    boost::multi_index::member<COrphanTx, NodeId, &COrphanTx::fromPeer>,
+                    boost::multi_index::member<COrphanTx, int64_t, &COrphanTx::nTimeExpire>
+                >
+            >,
+            // sorted by expiry time
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<orphan_expiry>,
+                boost::multi_index::member<COrphanTx, int64_t, &COrphanTx::nTimeExpire>
+            >
+        >
+    > indexed_orphan_set;
+
+    typedef indexed_orphan_set::nth_index<0>::type::const_iterator txiter;
+
+private:
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->tx->GetHash() < b->tx->GetHash();
+        }
+    };
+
+    indexed_orphan_set mapOrphans;
+    std::map<COutPoint, std::set<txiter, CompareIteratorByHash> > mapOrphansByPrev;
+
+    //! Memory used by each peer that currently has orphans in the pool
+    std::map<NodeId, size_t> mapPeerUsage;
+    //! The same information ordered by usage, to find the heaviest peer
+    std::set<std::pair<size_t, NodeId> > setPeersByUsage;
+    //! Number of orphans of each peer that currently has orphans in the pool
+    std::map<NodeId, size_t> mapPeerCount;
+    //! The same information ordered by count, to find the peer with the most
+    std::set<std::pair<size_t, NodeId> > setPeersByCount;
+    size_t nTotalUsage;
+
+    void UpdatePeer(NodeId peer, size_t nUsage, bool fAdd);
+    void EraseEntry(txiter it);
+
+public:
+    CTxOrphanPool();
+
+    /**
+     * Add an orphan received from peer. Returns false if it is already
+     * present. If the peer would exceed nMaxPeerUsage, its oldest orphans are
+     * evicted first (a value of zero means no per-peer quota).
+     */
+    bool AddTx(const CTransactionRef& tx, NodeId peer, int64_t nTimeExpire, size_t nMaxPeerUsage = 0);
+
+    bool HaveTx(const uint256& hash) const;
+
+    /** Erase an orphan by txid. Returns the number of entries erased (0 or 1). */
+    int EraseTx(const uint256& hash);
+
+    /** Erase all orphans announced by peer. Returns the number erased. */
+    int EraseForPeer(NodeId peer);
+
+    /** Erase all orphans with nTimeExpire <= nNow. Returns the number erased. */
+    int EraseExpired(int64_t nNow);
+
+    /**
+     * Evict orphans until at most nMaxOrphans entries and nMaxUsage bytes
+     * (if non-zero) remain. Over the entry limit, the peer with the most
+     * orphans loses its oldest one; otherwise the peer using the most memory
+     * does. Returns the number evicted.
+     */
+    unsigned int LimitOrphans(unsigned int nMaxOrphans, size_t nMaxUsage = 0);
+
+    /** Return the orphans spending the given outpoint */
+    void GetOrphansByPrev(const COutPoint& prevout, std::vector<COrphanTx>& vOrphans) const;
+
+    /** Return the txids of orphans spending any of the inputs of tx */
+    void GetConflictingOrphans(const CTransaction& tx, std::vector<uint256>& vOrphanHashes) const;
+
+    size_t size() const { return mapOrphans.size(); }
+    size_t ByPrevSize() const { return mapOrphansByPrev.size(); }
+    size_t TotalUsage() const { return nTotalUsage; }
+    size_t PeerUsage(NodeId peer) const;
+    size_t PeerCount(NodeId peer) const;
+    void Clear();
+};
+
+#endif // BITCOIN_TXORPHANPOOL_H
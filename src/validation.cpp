@@ -8,7 +8,10 @@
 
 #include "validation.h"
 
+#include "addressindex.h"
 #include "arith_uint256.h"
+#include "blockfilecompress.h"
+#include "blockfilereader.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -43,8 +46,13 @@
 #include "checkpointsync.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <sstream>
 #include <memory>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -67,6 +75,8 @@
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+/** Backing storage for every CBlockIndex in mapBlockIndex. */
+static CBlockIndexArena blockIndexArena;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 CWaitableCriticalSection csBestBlock;
@@ -175,6 +185,22 @@ namespace {
 
     /** Dirty block file entries. */
     std::set<int> setDirtyFileInfo;
+
+    /** Reads blocks and undo data, from mappings of the block files where possible. */
+    CBlockFileReader blockFileReader;
+    /** Files below this one were compressed or skipped by CompressBlockFiles. Protected by cs_LastBlockFile. */
+    int nCompressCursor = 0;
+
+    /** When the chain tip last changed, to find idle periods for CompactChainstate. */
+    std::atomic<int64_t> nTimeLastTipUpdate(0);
+
+    CCriticalSection cs_chainstateCompaction;
+    /** Progress and counters of CompactChainstate. Protected by cs_chainstateCompaction. */
+    CChainstateCompactionStats chainstateCompactionStats;
+    /** Bytes written to the coin database when the last sweep started. Protected by cs_chainstateCompaction. */
+    uint64_t nCompactWrittenMark = 0;
+    /** No slice is compacted before this time (micros), to throttle I/O. Protected by cs_chainstateCompaction. */
+    int64_t nCompactNextTime = 0;
 } // anon namespace
 
 /* Use this class to start tracking transactions that are removed from the
@@ -1035,6 +1061,153 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee);
 }
 
+namespace {
+
+/**
+ * Script check run ahead of mempool acceptance to populate the signature
+ * cache. It always reports success so that one invalid transaction doesn't
+ * stop the rest of a batch from being verified; the authoritative result
+ * comes from CheckInputs when the transaction is actually accepted.
+ */
+class CMempoolScriptPreCheck
+{
+private:
+    CScriptCheck check;
+
+public:
+    CMempoolScriptPreCheck() {}
+
+    bool operator()() {
+        check();
+        return true;
+    }
+
+    void swap(CMempoolScriptPreCheck& other) { check.swap(other.check); }
+
+    void swap(CScriptCheck& other) { check.swap(other); }
+};
+
+CCheckQueue<CMempoolScriptPreCheck> mempoolcheckqueue(128);
+
+} // anon namespace
+
+void ThreadMempoolScriptCheck() {
+    RenameThread("bitcoin-mempoolch");
+    mempoolcheckqueue.Thread();
+}
+
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, std::vector<CTxBatchResult>& vResults,
+                             bool fLimitFree, std::list<CTransactionRef>* plTxnReplaced, bool fOverrideMempoolLimit)
+{
+    vResults.assign(vtx.size(), CTxBatchResult());
+
+    // Order the batch so that transactions are committed after any parents
+    // that are part of the same batch.
+    std::map<uint256, size_t> mapBatchIndex;
+    for (size_t i = 0; i < vtx.size(); i++)
+        mapBatchIndex.emplace(vtx[i]->GetHash(), i);
+
+    std::vector<std::vector<size_t> > vChildren(vtx.size());
+    std::vector<size_t> vParentCount(vtx.size(), 0);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        std::set<size_t> setParents;
+        for (const CTxIn& txin : vtx[i]->vin) {
+            auto it = mapBatchIndex.find(txin.prevout.hash);
+            if (it != mapBatchIndex.end() && it->second != i && setParents.insert(it->second).second)
+                vChildren[it->second].push_back(i);
+        }
+        vParentCount[i] = setParents.size();
+    }
+
+    std::vector<size_t> vOrder;
+    vOrder.reserve(vtx.size());
+    for (size_t i = 0; i < vtx.size(); i++)
+        if (vParentCount[i] == 0)
+            vOrder.push_back(i);
+    for (size_t n = 0; n < vOrder.size(); n++) {
+        for (size_t child : vChildren[vOrder[n]]) {
+            if (--vParentCount[child] == 0)
+                vOrder.push_back(child);
+        }
+    }
+    // Anything left over is part of a cycle (or a duplicate); let the
+    // individual acceptance logic reject it.
+    for (size_t i = 0; i < vtx.size(); i++)
+        if (vParentCount[i] != 0)
+            vOrder.push_back(i);
+
+    // Verify the scripts of every transaction whose inputs are known on the
+    // mempool check threads, with outputs of earlier batch members visible to
+    // later ones. This only warms the signature cache: the stateless checks
+    // and the script checks run without cs_main and pool.cs (unless the
+    // caller holds them), which are only taken to look up the spent outputs,
+    // so the serial pass below doesn't do the expensive work under the locks.
+    std::vector<std::vector<uint256> > vHashTxToUncache(vtx.size());
+    if (nScriptCheckThreads && vtx.size() > 1) {
+        std::vector<bool> vValid(vtx.size());
+        for (size_t i = 0; i < vtx.size(); i++) {
+            CValidationState stateDummy;
+            vValid[i] = !vtx[i]->IsCoinBase() && CheckTransaction(*vtx[i], stateDummy);
+        }
+
+        unsigned int scriptVerifyFlags = getSTANDARD_SCRIPT_VERIFY_FLAGS();
+        if (!Params().RequireStandard()) {
+            scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+        }
+
+        // The checks copy the scripts they verify, so they stay valid once
+        // the view is gone
+        std::vector<std::vector<CMempoolScriptPreCheck> > vChecks(vtx.size());
+        {
+            LOCK2(cs_main, pool.cs);
+            CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+            CCoinsViewCache view(&viewMemPool);
+            const int nSpendHeight = chainActive.Height() + 1;
+            for (size_t i : vOrder) {
+                const CTransaction& tx = *vtx[i];
+                if (!vValid[i])
+                    continue;
+                for (const CTxIn& txin : tx.vin) {
+                    if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                        vHashTxToUncache[i].push_back(txin.prevout.hash);
+                }
+                if (!view.HaveInputs(tx))
+                    continue;
+
+                vChecks[i].resize(tx.vin.size());
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    CScriptCheck check(*view.AccessCoins(tx.vin[j].prevout.hash), tx, j, scriptVerifyFlags, true);
+                    vChecks[i][j].swap(check);
+                }
+                UpdateCoins(tx, view, nSpendHeight);
+            }
+        }
+
+        CCheckQueueControl<CMempoolScriptPreCheck> control(&mempoolcheckqueue);
+        for (size_t i : vOrder)
+            control.Add(vChecks[i]);
+        control.Wait();
+    }
+
+    LOCK2(cs_main, pool.cs);
+    for (size_t i : vOrder) {
+        CTxBatchResult& result = vResults[i];
+        std::vector<uint256> vHashTxToUncacheWorker;
+        result.fAccepted = AcceptToMemoryPoolWorker(pool, result.state, vtx[i], fLimitFree, &result.fMissingInputs, GetTime(),
+                                                    plTxnReplaced, fOverrideMempoolLimit, 0, vHashTxToUncacheWorker);
+        if (!result.fAccepted) {
+            for (const uint256& hashTx : vHashTxToUncache[i])
+                pcoinsTip->Uncache(hashTx);
+            for (const uint256& hashTx : vHashTxToUncacheWorker)
+                pcoinsTip->Uncache(hashTx);
+        }
+    }
+
+    // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
+    CValidationState stateDummy;
+    FlushStateToDisk(stateDummy, FLUSH_STATE_PERIODIC);
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1052,13 +1225,14 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
+            CBlockFileReader::Span span;
+            if (!blockFileReader.Read(BLOCK_FILE, postx, 0, span))
+                return error("%s: failed to read block at %s", __func__, postx.ToString());
             CBlockHeader header;
             try {
+                CSpanReader file(SER_DISK, CLIENT_VERSION, span.data(), span.size());
                 file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                file.ignore(postx.nTxOffset);
                 file >> txOut;
             } catch (const std::exception& e) {
                 return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -1114,6 +1288,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
         return error("WriteBlockToDisk: OpenBlockFile failed");
+    blockFileReader.Written(BLOCK_FILE, pos.nFile);
 
     // Write index header
     unsigned int nSize = GetSerializeSize(fileout, block);
@@ -1133,13 +1308,13 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    CBlockFileReader::Span span;
+    if (!blockFileReader.Read(BLOCK_FILE, pos, 0, span))
+        return error("ReadBlockFromDisk: failed to read block at %s", pos.ToString());
 
     // Read block
     try {
+        CSpanReader filein(SER_DISK, CLIENT_VERSION, span.data(), span.size());
         filein >> block;
     }
     catch (const std::exception& e) {
@@ -1496,6 +1671,34 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     return true;
 }
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+{
+    // The undo data is followed by its checksum
+    CBlockFileReader::Span span;
+    if (!blockFileReader.Read(UNDO_FILE, pos, sizeof(uint256), span))
+        return error("%s: failed to read undo data at %s", __func__, pos.ToString());
+
+    // Read block
+    uint256 hashChecksum;
+    try {
+        CSpanReader filein(SER_DISK, CLIENT_VERSION, span.data(), span.size());
+        filein >> blockundo;
+        filein >> hashChecksum;
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // Verify checksum
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << blockundo;
+    if (hashChecksum != hasher.GetHash())
+        return error("%s: Checksum mismatch", __func__);
+
+    return true;
+}
+
 namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
@@ -1504,6 +1707,7 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
+    blockFileReader.Written(UNDO_FILE, pos.nFile);
 
     // Write index header
     unsigned int nSize = GetSerializeSize(fileout, blockundo);
@@ -1525,33 +1729,6 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
-{
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Read block
-    uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-    }
-
-    // Verify checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    if (hashChecksum != hasher.GetHash())
-        return error("%s: Checksum mismatch", __func__);
-
-    return true;
-}
-
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1605,7 +1782,7 @@ bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, bool fJustCheck)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1614,6 +1791,10 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
     bool fClean = true;
 
+    std::unique_ptr<CDBBatch> paddressbatch;
+    if (paddressindex && !fJustCheck)
+        paddressbatch.reset(new CDBBatch(*paddressindex));
+
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull())
@@ -1660,8 +1841,14 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                     fClean = false;
             }
         }
+
+        if (paddressbatch)
+            paddressindex->DisconnectTransaction(*paddressbatch, tx, pindex->nHeight, view);
     }
 
+    if (paddressbatch && !paddressindex->WriteBlock(*paddressbatch, pindex->pprev->GetBlockHash()))
+        return AbortNode(state, "Failed to write address index");
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -1880,10 +2067,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nFees = 0;
     int nInputs = 0;
     int64_t nSigOpsCost = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    std::unique_ptr<CDBBatch> paddressbatch;
+    if (paddressindex && !fJustCheck)
+        paddressbatch.reset(new CDBBatch(*paddressindex));
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
@@ -1934,10 +2121,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
+        if (paddressbatch)
+            paddressindex->ConnectTransaction(*paddressbatch, tx, pindex->nHeight, view);
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
@@ -1993,9 +2179,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
+    if (paddressbatch && !paddressindex->WriteBlock(*paddressbatch, pindex->GetBlockHash()))
+        return AbortNode(state, "Failed to write address index");
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
@@ -2110,6 +2295,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
         // overwrite one. Still, use a conservative safety factor of 2.
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
+        // The address index is updated as blocks are connected; make it
+        // durable first so it is never behind the chainstate.
+        if (paddressindex && !paddressindex->Sync())
+            return AbortNode(state, "Failed to write to address index database");
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
@@ -2140,6 +2329,7 @@ void PruneAndFlush() {
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     chainActive.SetTip(pindexNew);
+    nTimeLastTipUpdate = GetTime();
 
     // New best block
     mempool.AddTransactionsUpdated(1);
@@ -2203,8 +2393,17 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
-bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, bool fBare = false)
+/** Disconnect chainActive's tip.
+  * After calling, the mempool will be in an inconsistent state, with
+  * transactions from disconnected blocks being added to disconnectpool.  You
+  * should make the mempool consistent again by calling UpdateMempoolForReorg
+  * with cs_main held.
+  *
+  * If disconnectpool is NULL, then no disconnected transactions are added to
+  * disconnectpool (note that the caller is responsible for mempool consistency
+  * in any case).
+  */
+bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool)
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
@@ -2226,25 +2425,17 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
 
-    if (!fBare) {
-        // Resurrect mempool transactions from the disconnected block.
-        std::vector<uint256> vHashUpdate;
-        for (const auto& it : block.vtx) {
-            const CTransaction& tx = *it;
-            // ignore validation errors in resurrected transactions
-            CValidationState stateDummy;
-            if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, it, false, NULL, NULL, true)) {
-                mempool.removeRecursive(tx, MemPoolRemovalReason::REORG);
-            } else if (mempool.exists(tx.GetHash())) {
-                vHashUpdate.push_back(tx.GetHash());
-            }
+    if (disconnectpool) {
+        // Save transactions to re-add to mempool at end of reorg
+        for (auto it = block.vtx.rbegin(); it != block.vtx.rend(); ++it) {
+            disconnectpool->addTransaction(*it);
+        }
+        while (disconnectpool->DynamicMemoryUsage() > MAX_DISCONNECTED_TX_POOL_SIZE * 1000) {
+            // Drop the earliest entry, and remove its children from the mempool.
+            auto it = disconnectpool->queuedTx.get<insertion_order>().begin();
+            mempool.removeRecursive(**it, MemPoolRemovalReason::REORG);
+            disconnectpool->removeEntry(it);
         }
-        // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
-        // no in-mempool children, which is generally not true when adding
-        // previously-confirmed transactions back to the mempool.
-        // UpdateTransactionsFromBlock finds descendants of any transactions in this
-        // block that were added back and cleans up the mempool state.
-        mempool.UpdateTransactionsFromBlock(vHashUpdate);
     }
 
     // Update chainActive and related variables.
@@ -2257,6 +2448,80 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     return true;
 }
 
+/**
+ * Make mempool consistent after a reorg, by re-adding or recursively erasing
+ * disconnected block transactions from the mempool, and also removing any
+ * other transactions from the mempool that are no longer valid given the new
+ * tip/height.
+ *
+ * The surviving transactions are resubmitted as a single batch, so their
+ * script checks run in parallel and in-batch parents are accepted ahead of
+ * their children. Only mempool entries spending outputs of disconnected
+ * transactions can have become immature or non-final, unless the new tip is
+ * lower than pindexOldTip, in which case the whole mempool is rechecked.
+ *
+ * Note: we assume that disconnectpool only contains transactions that are NOT
+ * confirmed in the current chain nor already in the mempool (otherwise,
+ * in-mempool descendants of such transactions would be removed).
+ *
+ * Passing fAddToMempool=false will skip trying to add the transactions back,
+ * and instead just erase from the mempool as needed.
+ */
+static void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool fAddToMempool, const CBlockIndex* pindexOldTip)
+{
+    AssertLockHeld(cs_main);
+    // disconnectpool's insertion_order index sorts the entries from
+    // oldest to newest, but the oldest entry will be the last tx from the
+    // latest mined block that was disconnected.
+    // Iterate disconnectpool in reverse, so that we add transactions
+    // back to the mempool starting with the earliest transaction that had
+    // been previously seen in a block.
+    std::vector<CTransactionRef> vtxResurrect;
+    vtxResurrect.reserve(disconnectpool.queuedTx.size());
+    auto it = disconnectpool.queuedTx.get<insertion_order>().rbegin();
+    while (it != disconnectpool.queuedTx.get<insertion_order>().rend()) {
+        if (!fAddToMempool || (*it)->IsCoinBase()) {
+            // If the transaction doesn't make it in to the mempool, remove any
+            // transactions that depend on it (which would now be orphans).
+            mempool.removeRecursive(**it, MemPoolRemovalReason::REORG);
+        } else {
+            vtxResurrect.push_back(*it);
+        }
+        ++it;
+    }
+
+    std::vector<uint256> vHashUpdate;
+    if (!vtxResurrect.empty()) {
+        // ignore validation errors in resurrected transactions
+        std::vector<CTxBatchResult> vResults;
+        AcceptToMemoryPoolBatch(mempool, vtxResurrect, vResults, false, NULL, true);
+        for (size_t i = 0; i < vtxResurrect.size(); i++) {
+            if (!vResults[i].fAccepted) {
+                mempool.removeRecursive(*vtxResurrect[i], MemPoolRemovalReason::REORG);
+            } else if (mempool.exists(vtxResurrect[i]->GetHash())) {
+                vHashUpdate.push_back(vtxResurrect[i]->GetHash());
+            }
+        }
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in
+    // the disconnectpool that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
+
+    // We also need to remove any now-immature transactions
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    bool fTipNotLower = pindexOldTip && pindexTip->nHeight >= pindexOldTip->nHeight &&
+                        pindexTip->GetMedianTimePast() >= pindexOldTip->GetMedianTimePast();
+    mempool.removeForReorg(pcoinsTip, pindexTip->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS,
+                           fTipNotLower ? &disconnectpool.setTouched : NULL);
+    // Re-limit mempool size, in case we added any transactions
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+
+    disconnectpool.clear();
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
@@ -2279,7 +2544,7 @@ struct ConnectTrace {
  * pblock) - if that is not intended, care must be taken to remove the last entry in
  * blocksConnected in case of failure.
  */
-bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace)
+bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool)
 {
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
@@ -2320,6 +2585,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.;
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
+    disconnectpool.removeForBlock(blockConnecting.vtx);
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
 
@@ -2411,9 +2677,14 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
+    DisconnectedBlockTransactions disconnectpool;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams))
+        if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+            // This is likely a fatal error, but keep the mempool consistent,
+            // just in case. Only remove from the mempool in this case.
+            UpdateMempoolForReorg(disconnectpool, false, pindexOldTip);
             return false;
+        }
         fBlocksDisconnected = true;
     }
 
@@ -2436,7 +2707,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace)) {
+            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2449,6 +2720,9 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
                     break;
                 } else {
                     // A system error occurred (disk space, database error, ...).
+                    // Make the mempool consistent with the current tip, just in case
+                    // any observers try to use it before shutdown.
+                    UpdateMempoolForReorg(disconnectpool, false, pindexOldTip);
                     return false;
                 }
             } else {
@@ -2463,8 +2737,9 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     }
 
     if (fBlocksDisconnected) {
-        mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
-        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        // If any blocks were disconnected, disconnectpool may be non empty.  Add
+        // any disconnected transactions back to the mempool.
+        UpdateMempoolForReorg(disconnectpool, true, pindexOldTip);
     }
     mempool.check(pcoinsTip);
 
@@ -2624,6 +2899,7 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     setDirtyBlockIndex.insert(pindex);
     setBlockIndexCandidates.erase(pindex);
 
+    DisconnectedBlockTransactions disconnectpool;
     while (chainActive.Contains(pindex)) {
         CBlockIndex *pindexWalk = chainActive.Tip();
         pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
@@ -2631,13 +2907,18 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
         setBlockIndexCandidates.erase(pindexWalk);
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state, chainparams)) {
-            mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
+        if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+            // It's probably hopeless to try to make the mempool consistent
+            // here if DisconnectTip failed, but we can try.
+            UpdateMempoolForReorg(disconnectpool, false, NULL);
             return false;
         }
     }
 
-    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    // DisconnectTip will add transactions to disconnectpool; try to add these
+    // back to the mempool. The new tip is always lower here, so the whole
+    // mempool gets rechecked.
+    UpdateMempoolForReorg(disconnectpool, true, NULL);
 
     // The resulting new best tip may not be in setBlockIndexCandidates anymore, so
     // add it again.
@@ -2650,7 +2931,6 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     }
 
     InvalidChainFound(pindex);
-    mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
     uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindex->pprev);
     return true;
 }
@@ -2697,8 +2977,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -2826,12 +3106,147 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
     return true;
 }
 
+/** Restore the raw block and undo files of a compressed file number. */
+static bool DecompressBlockFiles(int nFile)
+{
+    AssertLockHeld(cs_LastBlockFile);
+    for (BlockFileType type : {BLOCK_FILE, UNDO_FILE}) {
+        if (!boost::filesystem::exists(GetCompressedBlockFilename(type, nFile)))
+            continue;
+        boost::filesystem::path pathRaw = GetBlockPosFilename(CDiskBlockPos(nFile, 0), BlockFilePrefix(type));
+        boost::filesystem::path pathTmp = pathRaw.string() + ".tmp";
+        if (!WriteDecompressedBlockFile(type, nFile, pathTmp) || !RenameOver(pathTmp, pathRaw))
+            return error("%s: failed to restore %s", __func__, pathRaw.string());
+    }
+    blockFileReader.SetCompressed(nFile, false);
+    boost::system::error_code ec;
+    boost::filesystem::remove(GetCompressedBlockFilename(BLOCK_FILE, nFile), ec);
+    boost::filesystem::remove(GetCompressedBlockFilename(UNDO_FILE, nFile), ec);
+    nCompressCursor = std::min(nCompressCursor, nFile);
+    LogPrintf("Decompressed blk%05u.dat and rev%05u.dat\n", nFile, nFile);
+    return true;
+}
+
+void CompressBlockFiles(const CChainParams& chainparams)
+{
+    if (fImporting || fReindex || ShutdownRequested())
+        return;
+
+    // Pick the oldest file that is not compressed yet and not among the most
+    // recent ones, once all of its blocks are buried deep enough that reads
+    // of them are rare
+    int nFile;
+    CBlockFileInfo info;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        for (nFile = nCompressCursor; nFile < nLastBlockFile - BLOCKFILE_COMPRESS_KEEP; nFile++) {
+            if (!blockFileReader.IsCompressed(nFile) && vinfoBlockFile[nFile].nSize > 0)
+                break;
+        }
+        nCompressCursor = nFile;
+        if (nFile >= nLastBlockFile - BLOCKFILE_COMPRESS_KEEP ||
+            chainActive.Height() < (int)(vinfoBlockFile[nFile].nHeightLast + MIN_BLOCKS_TO_KEEP))
+            return;
+        info = vinfoBlockFile[nFile];
+    }
+
+    // Compress next to the raw files without holding any lock
+    boost::filesystem::path pathBlock = GetCompressedBlockFilename(BLOCK_FILE, nFile);
+    boost::filesystem::path pathUndo = GetCompressedBlockFilename(UNDO_FILE, nFile);
+    boost::filesystem::path pathBlockTmp = pathBlock.string() + ".tmp";
+    boost::filesystem::path pathUndoTmp = pathUndo.string() + ".tmp";
+    uint64_t nBlockSize = 0, nUndoSize = 0;
+    bool fOk = WriteCompressedBlockFile(BLOCK_FILE, nFile, info.nSize, chainparams.MessageStart(), pathBlockTmp, nBlockSize) &&
+               (info.nUndoSize == 0 || WriteCompressedBlockFile(UNDO_FILE, nFile, info.nUndoSize, chainparams.MessageStart(), pathUndoTmp, nUndoSize));
+
+    LOCK(cs_LastBlockFile);
+    boost::system::error_code ec;
+    if (!fOk) {
+        LogPrintf("Unable to compress blk%05u.dat and rev%05u.dat, leaving them uncompressed\n", nFile, nFile);
+        nCompressCursor = std::max(nCompressCursor, nFile + 1);
+    } else if (vinfoBlockFile[nFile].nSize != info.nSize || vinfoBlockFile[nFile].nUndoSize != info.nUndoSize) {
+        // Undo data was appended in the meantime; try again later
+        fOk = false;
+    } else if (!RenameOver(pathBlockTmp, pathBlock) || (info.nUndoSize > 0 && !RenameOver(pathUndoTmp, pathUndo))) {
+        // The raw files are still complete and used
+        LogPrintf("Unable to rename compressed blk%05u.dat and rev%05u.dat\n", nFile, nFile);
+        fOk = false;
+    }
+    if (!fOk) {
+        boost::filesystem::remove(pathBlockTmp, ec);
+        boost::filesystem::remove(pathUndoTmp, ec);
+        return;
+    }
+
+    blockFileReader.SetCompressed(nFile, true);
+    boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"), ec);
+    boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "rev"), ec);
+    LogPrintf("Compressed blk%05u.dat and rev%05u.dat from %u to %u bytes\n", nFile, nFile,
+        (uint64_t)info.nSize + info.nUndoSize, nBlockSize + nUndoSize);
+}
+
+void CompactChainstate(const CCoinsViewDB* pcoinsdb, int64_t nIdleSeconds, uint64_t nMinWritten)
+{
+    if (fImporting || fReindex || ShutdownRequested())
+        return;
+
+    int nSlice;
+    {
+        LOCK(cs_chainstateCompaction);
+        if (GetTime() - nTimeLastTipUpdate < nIdleSeconds) {
+            if (chainstateCompactionStats.nSlice >= 0)
+                chainstateCompactionStats.nDeferred++;
+            return;
+        }
+        if (GetTimeMicros() < nCompactNextTime)
+            return;
+        if (chainstateCompactionStats.nSlice < 0) {
+            uint64_t nWritten = pcoinsdb->GetBytesWritten();
+            if (nWritten - nCompactWrittenMark < nMinWritten)
+                return;
+            nCompactWrittenMark = nWritten;
+            chainstateCompactionStats.nSlice = 0;
+        }
+        nSlice = chainstateCompactionStats.nSlice;
+    }
+
+    // LevelDB keeps accepting writes while compacting, so a block arriving
+    // now only competes for I/O with the rest of this slice
+    int64_t nStart = GetTimeMicros();
+    pcoinsdb->CompactSlice(nSlice);
+    int64_t nTime = GetTimeMicros() - nStart;
+    LogPrint("coindb", "Compacted coin database slice %d/%d in %.2fms\n", nSlice + 1, COINSDB_COMPACT_SLICES, nTime * 0.001);
+
+    LOCK(cs_chainstateCompaction);
+    CChainstateCompactionStats& stats = chainstateCompactionStats;
+    stats.nSlices++;
+    stats.nTotalMicros += nTime;
+    stats.nLastSliceMicros = nTime;
+    stats.nMaxSliceMicros = std::max(stats.nMaxSliceMicros, nTime);
+    nCompactNextTime = GetTimeMicros() + nTime * CHAINSTATE_COMPACT_BACKOFF;
+    if (++stats.nSlice == COINSDB_COMPACT_SLICES) {
+        stats.nSlice = -1;
+        stats.nSweeps++;
+        stats.nLastSweepTime = GetTime();
+    }
+}
+
+CChainstateCompactionStats GetChainstateCompactionStats()
+{
+    LOCK(cs_chainstateCompaction);
+    return chainstateCompactionStats;
+}
+
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize)
 {
     pos.nFile = nFile;
 
     LOCK(cs_LastBlockFile);
 
+    // Undo data of a block stored long ago is appended to a compressed file
+    if (blockFileReader.IsCompressed(nFile) && !DecompressBlockFiles(nFile))
+        return state.Error("failed to decompress block files");
+
     unsigned int nNewSize;
     pos.nPos = vinfoBlockFile[nFile].nUndoSize;
     nNewSize = vinfoBlockFile[nFile].nUndoSize += nAddSize;
@@ -3095,7 +3510,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Co
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3114,7 +3529,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3175,8 +3590,11 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidatio
     return true;
 }
 
-/** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+/**
+ * Store block on disk. If dbp is non-NULL, the file is known to already reside on disk.
+ * fCheckPOW=false is for callers that have verified the proof of work themselves.
+ */
+static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, bool fCheckPOW = true)
 {
     const CBlock& block = *pblock;
 
@@ -3186,7 +3604,7 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, fCheckPOW))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3216,7 +3634,7 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if (!CheckBlock(block, state, chainparams.GetConsensus()) ||
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), fCheckPOW) ||
         !ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3224,6 +3642,9 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
         }
         return error("%s: %s", __func__, FormatStateMessage(state));
     }
+    // Let ConnectBlock skip CheckBlock when the work was already verified.
+    if (!fCheckPOW)
+        block.fChecked = true;
 
     // Header is valid/has work, merkle tree are good...RELAY NOW
     // (but if it does not build on our best tip, let the SendMessages loop relay it)
@@ -3475,8 +3896,11 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileReader.Forget(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        boost::filesystem::remove(GetCompressedBlockFilename(BLOCK_FILE, *it));
+        boost::filesystem::remove(GetCompressedBlockFilename(UNDO_FILE, *it));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
     }
 }
@@ -3616,31 +4040,153 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw std::runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB(const CChainParams& chainparams)
+static const uint64_t BLOCKINDEX_SNAPSHOT_VERSION = 1;
+
+static boost::filesystem::path GetBlockIndexSnapshotFile()
 {
-    if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+    return GetDataDir() / "blocks" / "blockindex.dat";
+}
+
+/**
+ * Load mapBlockIndex from the flat snapshot written by DumpBlockIndex, if
+ * the block tree database says it is still current. The file is read in one
+ * go and fully decoded before anything is inserted, so on failure nothing
+ * has changed and the caller can fall back to the database. Entries are
+ * stored by height, which is the order they are returned in.
+ */
+static bool LoadBlockIndexSnapshot(std::vector<std::pair<int, CBlockIndex*> >& vSortedByHeight)
+{
+    uint256 hashExpected;
+    uint64_t nExpected;
+    if (!GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT) || !pblocktree->ReadBlockIndexSnapshot(hashExpected, nExpected))
         return false;
 
-    boost::this_thread::interruption_point();
+    std::vector<std::pair<uint256, CDiskBlockIndex> > vEntries;
+    try {
+        FILE* filestr = fopen(GetBlockIndexSnapshotFile().string().c_str(), "rb");
+        if (!filestr)
+            return error("%s: snapshot file missing", __func__);
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss.resize(boost::filesystem::file_size(GetBlockIndexSnapshotFile()));
+        if (!ss.empty())
+            file.read(ss.data(), ss.size());
+        file.fclose();
 
-    // Calculate nChainWork
-    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
+        if (Hash(ss.begin(), ss.end()) != hashExpected)
+            return error("%s: snapshot does not match the block tree database", __func__);
+
+        uint64_t nVersion, nEntries;
+        ss >> nVersion >> nEntries;
+        if (nVersion != BLOCKINDEX_SNAPSHOT_VERSION || nEntries != nExpected)
+            return error("%s: unexpected snapshot version or size", __func__);
+        vEntries.resize(nEntries);
+        for (auto& entry : vEntries) {
+            ss >> entry.first >> entry.second;
+        }
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    mapBlockIndex.reserve(vEntries.size());
+    blockIndexArena.Reserve(vEntries.size());
+    vSortedByHeight.reserve(vEntries.size());
+    for (const auto& entry : vEntries) {
+        const CDiskBlockIndex& diskindex = entry.second;
+        // The hash is stored alongside the entry, saving a header hash per block.
+        CBlockIndex* pindexNew = InsertBlockIndex(entry.first);
+        pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+        pindexNew->nHeight        = diskindex.nHeight;
+        pindexNew->nFile          = diskindex.nFile;
+        pindexNew->nDataPos       = diskindex.nDataPos;
+        pindexNew->nUndoPos       = diskindex.nUndoPos;
+        pindexNew->nVersion       = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->nTime          = diskindex.nTime;
+        pindexNew->nBits          = diskindex.nBits;
+        pindexNew->nNonce         = diskindex.nNonce;
+        pindexNew->nStatus        = diskindex.nStatus;
+        pindexNew->nTx            = diskindex.nTx;
+        vSortedByHeight.push_back(std::make_pair(pindexNew->nHeight, pindexNew));
+    }
+    return true;
+}
+
+bool DumpBlockIndex()
+{
+    LOCK(cs_main);
+    // The snapshot must describe exactly what is in the block tree database.
+    if (!setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty())
+        return false;
+
+    int64_t nStart = GetTimeMicros();
+    std::vector<std::pair<int, const CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+    for (const auto& item : mapBlockIndex) {
+        vSortedByHeight.push_back(std::make_pair(item.second->nHeight, item.second));
+    }
+    std::sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << BLOCKINDEX_SNAPSHOT_VERSION << (uint64_t)vSortedByHeight.size();
+    for (const auto& item : vSortedByHeight) {
+        ss << item.second->GetBlockHash() << CDiskBlockIndex(item.second);
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    uint256 hashSnapshot = Hash(ss.begin(), ss.end());
+
+    try {
+        boost::filesystem::path pathTmp = GetBlockIndexSnapshotFile();
+        pathTmp += ".new";
+        FILE* filestr = fopen(pathTmp.string().c_str(), "wb");
+        if (!filestr)
+            return false;
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        file.write(ss.data(), ss.size());
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetBlockIndexSnapshotFile()))
+            return false;
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump block index: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    if (!pblocktree->WriteBlockIndexSnapshot(hashSnapshot, vSortedByHeight.size()))
+        return false;
+    LogPrintf("Dumped block index: %u entries in %.2fms\n", vSortedByHeight.size(), (GetTimeMicros() - nStart) * 0.001);
+    return true;
+}
+
+bool static LoadBlockIndexDB(const CChainParams& chainparams)
+{
+    std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
+    int64_t nStart = GetTimeMicros();
+    if (LoadBlockIndexSnapshot(vSortedByHeight)) {
+        LogPrintf("%s: loaded %u entries from block index snapshot in %.2fms\n", __func__, vSortedByHeight.size(), (GetTimeMicros() - nStart) * 0.001);
+    } else {
+        if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
+            return false;
+
+        boost::this_thread::interruption_point();
+
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    }
+
+    boost::this_thread::interruption_point();
+
+    // Calculate nChainWork
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
@@ -3706,6 +4252,11 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     for (std::set<int>::iterator it = setBlkDataFiles.begin(); it != setBlkDataFiles.end(); it++)
     {
         CDiskBlockPos pos(*it, 0);
+        if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")) &&
+            boost::filesystem::exists(GetCompressedBlockFilename(BLOCK_FILE, *it))) {
+            blockFileReader.SetCompressed(*it, true);
+            continue;
+        }
         if (CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION).IsNull()) {
             return false;
         }
@@ -3741,6 +4292,181 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     return true;
 }
 
+namespace {
+
+/**
+ * Reads blocks from disk ahead of the thread processing them, in the order
+ * given, keeping at most nMaxQueued of them in memory.
+ */
+class CBlockPrefetcher
+{
+public:
+    /** Read the i-th block in order, returning NULL if it could not be read */
+    typedef std::function<std::shared_ptr<const CBlock>(size_t)> ReadBlockFn;
+
+private:
+    const size_t nBlocks;
+    ReadBlockFn readBlock;
+    const size_t nMaxQueued;
+    const std::string strThreadName;
+
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<std::shared_ptr<const CBlock> > queue;
+    bool fStop;
+    std::thread thread;
+
+    void ThreadRead()
+    {
+        RenameThread(strThreadName.c_str());
+        for (size_t i = 0; i < nBlocks; i++) {
+            std::shared_ptr<const CBlock> pblock = readBlock(i);
+
+            std::unique_lock<std::mutex> lock(cs);
+            cond.wait(lock, [this] { return fStop || queue.size() < nMaxQueued; });
+            if (fStop)
+                return;
+            queue.push_back(pblock);
+            cond.notify_all();
+        }
+    }
+
+public:
+    CBlockPrefetcher(size_t nBlocksIn, const ReadBlockFn& readBlockIn, size_t nMaxQueuedIn, const std::string& strThreadNameIn) :
+        nBlocks(nBlocksIn), readBlock(readBlockIn), nMaxQueued(nMaxQueuedIn), strThreadName(strThreadNameIn), fStop(false)
+    {
+        thread = std::thread(&CBlockPrefetcher::ThreadRead, this);
+    }
+
+    ~CBlockPrefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+
+    /** Return the next block in order, or NULL if it could not be read. */
+    std::shared_ptr<const CBlock> Next()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        cond.wait(lock, [this] { return !queue.empty(); });
+        std::shared_ptr<const CBlock> pblock = queue.front();
+        queue.pop_front();
+        cond.notify_all();
+        return pblock;
+    }
+};
+
+/** Number of blocks read ahead of the disconnecting and reconnecting thread in VerifyDB */
+static const size_t VERIFYDB_PREFETCH_BLOCKS = 16;
+
+/** A block checked by VerifyDB, with the positions needed to read it without cs_main */
+struct CVerifyBlock
+{
+    CBlockIndex* pindex;
+    uint256 hash;
+    uint256 hashPrev;
+    CDiskBlockPos pos;
+    CDiskBlockPos posUndo;
+};
+
+std::shared_ptr<const CBlock> ReadVerifyBlock(const CVerifyBlock& entry, const Consensus::Params& consensusParams)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblock, entry.pos, consensusParams)) {
+        error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", entry.pindex->nHeight, entry.hash.ToString());
+        return NULL;
+    }
+    if (pblock->GetHash() != entry.hash) {
+        error("VerifyDB(): *** block at %s does not match the index at %d, hash=%s", entry.pos.ToString(), entry.pindex->nHeight, entry.hash.ToString());
+        return NULL;
+    }
+    return pblock;
+}
+
+/** Check levels 0 to 2 of one block: it can be read, is valid and has readable undo data */
+bool VerifyBlockData(const CVerifyBlock& entry, int nCheckLevel, const Consensus::Params& consensusParams)
+{
+    // check level 0: read from disk
+    std::shared_ptr<const CBlock> pblock = ReadVerifyBlock(entry, consensusParams);
+    if (!pblock)
+        return false;
+    // check level 1: verify block validity
+    CValidationState state;
+    if (nCheckLevel >= 1 && !CheckBlock(*pblock, state, consensusParams))
+        return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
+                     entry.pindex->nHeight, entry.hash.ToString(), FormatStateMessage(state));
+    // check level 2: verify undo validity
+    if (nCheckLevel >= 2 && !entry.posUndo.IsNull()) {
+        CBlockUndo undo;
+        if (!UndoReadFromDisk(undo, entry.posUndo, entry.hashPrev))
+            return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", entry.pindex->nHeight, entry.hash.ToString());
+    }
+    return true;
+}
+
+/**
+ * Threads running VerifyBlockData over a list of blocks. They are stopped and
+ * joined when this goes out of scope, also when VerifyDB is interrupted.
+ */
+class CVerifyBlockThreads
+{
+private:
+    const std::vector<CVerifyBlock>& vBlocks;
+    const int nCheckLevel;
+    const Consensus::Params& consensusParams;
+
+    std::atomic<size_t> nNext;
+    std::atomic<size_t> nDone;
+    //! Lowest index of a block that failed its checks, or vBlocks.size()
+    std::atomic<size_t> nFailed;
+    std::atomic<bool> fStop;
+    std::atomic<int> nRunning;
+    std::vector<std::thread> vThreads;
+
+    void ThreadVerify()
+    {
+        RenameThread("bitcoin-verifydb");
+        size_t i;
+        // Blocks before a failed one are still checked, so the failure
+        // reported is the one closest to the tip, as when checking serially
+        while (!fStop && !ShutdownRequested() && (i = nNext++) < nFailed) {
+            if (!VerifyBlockData(vBlocks[i], nCheckLevel, consensusParams)) {
+                size_t nFailedPrev = nFailed;
+                while (i < nFailedPrev && !nFailed.compare_exchange_weak(nFailedPrev, i)) {}
+            }
+            nDone++;
+        }
+        nRunning--;
+    }
+
+public:
+    CVerifyBlockThreads(const std::vector<CVerifyBlock>& vBlocksIn, int nCheckLevelIn, const Consensus::Params& consensusParamsIn, int nThreads) :
+        vBlocks(vBlocksIn), nCheckLevel(nCheckLevelIn), consensusParams(consensusParamsIn),
+        nNext(0), nDone(0), nFailed(vBlocksIn.size()), fStop(false), nRunning(nThreads)
+    {
+        for (int i = 0; i < nThreads; i++)
+            vThreads.emplace_back(&CVerifyBlockThreads::ThreadVerify, this);
+    }
+
+    ~CVerifyBlockThreads()
+    {
+        fStop = true;
+        for (std::thread& thread : vThreads)
+            thread.join();
+    }
+
+    bool IsRunning() const { return nRunning > 0; }
+    size_t GetDone() const { return nDone; }
+    /** Index of the block closest to the tip that failed its checks, or the number of blocks */
+    size_t GetFailed() const { return nFailed; }
+};
+
+} // anon namespace
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0);
@@ -3765,23 +4491,12 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
-    CCoinsViewCache coins(coinsview);
-    CBlockIndex* pindexState = chainActive.Tip();
-    CBlockIndex* pindexFailure = NULL;
-    int nGoodTransactions = 0;
-    CValidationState state;
-    int reportDone = 0;
-    LogPrintf("[0%%]...");
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+
+    // Collect the blocks to check, from the tip down
+    std::vector<CVerifyBlock> vBlocks;
     for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
     {
-        boost::this_thread::interruption_point();
-        int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-        if (reportDone < percentageDone/10) {
-            // report every 10% step
-            LogPrintf("[%d%%]...", percentageDone);
-            reportDone = percentageDone/10;
-        }
-        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
         if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
@@ -3789,53 +4504,94 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
-            return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
-                         pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
+        vBlocks.push_back(CVerifyBlock{pindex, pindex->GetBlockHash(), pindex->pprev->GetBlockHash(), pindex->GetBlockPos(), pindex->GetUndoPos()});
+    }
+
+    // Progress is split evenly between checking the stored data and, at the
+    // higher levels, disconnecting and reconnecting blocks
+    const int nPhases = 1 + (nCheckLevel >= 3) + (nCheckLevel >= 4);
+    int reportDone = 0;
+    auto reportProgress = [&reportDone, nPhases](int nPhase, size_t nDone, size_t nTotal) {
+        int percentageDone = std::max(1, std::min(99, (int)((nPhase + (double)nDone / std::max<size_t>(nTotal, 1)) * 100 / nPhases)));
+        if (reportDone < percentageDone/10) {
+            // report every 10% step
+            LogPrintf("[%d%%]...", percentageDone);
+            reportDone = percentageDone/10;
         }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
+    };
+    LogPrintf("[0%%]...");
+
+    // check levels 0-2: read the blocks and their undo data and check them,
+    // several blocks at a time
+    {
+        int nThreads = std::max(1, std::min((int)vBlocks.size(), nScriptCheckThreads + 1));
+        CVerifyBlockThreads threads(vBlocks, nCheckLevel, consensusParams, nThreads);
+        while (threads.IsRunning()) {
+            boost::this_thread::interruption_point();
+            reportProgress(0, threads.GetDone(), vBlocks.size());
+            MilliSleep(50);
+        }
+        if (threads.GetFailed() < vBlocks.size())
+            return false; // The failure was logged by VerifyBlockData
+    }
+    if (ShutdownRequested())
+        return true;
+
+    CCoinsViewCache coins(coinsview);
+    CBlockIndex* pindexState = chainActive.Tip();
+    CBlockIndex* pindexFailure = NULL;
+    int nGoodTransactions = 0;
+    CValidationState state;
+    size_t nDisconnected = 0;
+
+    // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+    if (nCheckLevel >= 3) {
+        CBlockPrefetcher prefetcher(vBlocks.size(), [&vBlocks, &consensusParams](size_t i) {
+            return ReadVerifyBlock(vBlocks[i], consensusParams);
+        }, VERIFYDB_PREFETCH_BLOCKS, "bitcoin-verifyread");
+        for (const CVerifyBlock& entry : vBlocks) {
+            boost::this_thread::interruption_point();
+            reportProgress(1, nDisconnected, vBlocks.size());
+            if (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage)
+                break;
+            std::shared_ptr<const CBlock> pblock = prefetcher.Next();
+            if (!pblock)
+                return false; // The failure was logged by ReadVerifyBlock
             bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
+            if (!DisconnectBlock(*pblock, state, entry.pindex, coins, &fClean, true))
+                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", entry.pindex->nHeight, entry.hash.ToString());
+            pindexState = entry.pindex->pprev;
+            nDisconnected++;
             if (!fClean) {
                 nGoodTransactions = 0;
-                pindexFailure = pindex;
+                pindexFailure = entry.pindex;
             } else
-                nGoodTransactions += block.vtx.size();
+                nGoodTransactions += pblock->vtx.size();
+            if (ShutdownRequested())
+                return true;
         }
-        if (ShutdownRequested())
-            return true;
     }
     if (pindexFailure)
         return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
 
-    // check level 4: try reconnecting blocks
+    // check level 4: try reconnecting blocks, oldest first; ConnectBlock
+    // hands the script checks to the script check threads
     if (nCheckLevel >= 4) {
-        CBlockIndex *pindex = pindexState;
-        while (pindex != chainActive.Tip()) {
+        CBlockPrefetcher prefetcher(nDisconnected, [&vBlocks, &consensusParams, nDisconnected](size_t i) {
+            return ReadVerifyBlock(vBlocks[nDisconnected - 1 - i], consensusParams);
+        }, VERIFYDB_PREFETCH_BLOCKS, "bitcoin-verifyread");
+        for (size_t i = 0; i < nDisconnected; i++) {
             boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
-            pindex = chainActive.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!ConnectBlock(block, state, pindex, coins, chainparams))
-                return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            reportProgress(2, i, nDisconnected);
+            const CVerifyBlock& entry = vBlocks[nDisconnected - 1 - i];
+            std::shared_ptr<const CBlock> pblock = prefetcher.Next();
+            if (!pblock)
+                return false; // The failure was logged by ReadVerifyBlock
+            if (!ConnectBlock(*pblock, state, entry.pindex, coins, chainparams))
+                return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", entry.pindex->nHeight, entry.hash.ToString());
+            if (ShutdownRequested())
+                return true;
         }
     }
 
@@ -3845,6 +4601,58 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     return true;
 }
 
+bool SyncAddressIndex(const CChainParams& params)
+{
+    LOCK(cs_main);
+    if (!paddressindex || chainActive.Height() <= 0)
+        return true;
+
+    uint256 hashBest;
+    BlockMap::iterator mi = mapBlockIndex.end();
+    if (paddressindex->ReadBestBlock(hashBest))
+        mi = mapBlockIndex.find(hashBest);
+    if (mi == mapBlockIndex.end())
+        return error("%s: the address index was not built along this block chain", __func__);
+
+    const CBlockIndex* pindexBest = mi->second;
+    if (pindexBest == chainActive.Tip())
+        return true;
+
+    // Take out the blocks the chain state does not have: those of a branch
+    // the chain left, or those connected after its last flush before an
+    // unclean shutdown. Then add the blocks of the active chain the index
+    // missed.
+    const CBlockIndex* pindexFork = chainActive.FindFork(pindexBest);
+    LogPrintf("Moving the address index from %s (height %d) back to the active chain, forking at height %d\n",
+        pindexBest->GetBlockHash().ToString(), pindexBest->nHeight, pindexFork->nHeight);
+    std::vector<const CBlockIndex*> vRewind, vReplay;
+    for (const CBlockIndex* pindex = pindexBest; pindex != pindexFork; pindex = pindex->pprev)
+        vRewind.push_back(pindex);
+    for (const CBlockIndex* pindex = chainActive.Next(pindexFork); pindex; pindex = chainActive.Next(pindex))
+        vReplay.push_back(pindex);
+    for (const CBlockIndex* pindex : vRewind) {
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!(pindex->nStatus & BLOCK_HAVE_UNDO) || !ReadBlockFromDisk(block, pindex, params.GetConsensus()) ||
+            !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) ||
+            !paddressindex->RewindBlock(block, blockundo, pindex))
+            return error("%s: failed to take block %s out of the address index", __func__, pindex->GetBlockHash().ToString());
+    }
+    for (const CBlockIndex* pindex : vReplay) {
+        boost::this_thread::interruption_point();
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!(pindex->nStatus & BLOCK_HAVE_UNDO) || !ReadBlockFromDisk(block, pindex, params.GetConsensus()) ||
+            !UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash()) ||
+            !paddressindex->ReplayBlock(block, blockundo, pindex))
+            return error("%s: failed to add block %s to the address index", __func__, pindex->GetBlockHash().ToString());
+    }
+    if (!paddressindex->Sync())
+        return error("%s: failed to write the address index", __func__);
+    LogPrintf("Took %u blocks out of the address index and added %u\n", vRewind.size(), vReplay.size());
+    return true;
+}
+
 bool RewindBlockIndex(const CChainParams& params)
 {
     LOCK(cs_main);
@@ -3863,7 +4671,7 @@ bool RewindBlockIndex(const CChainParams& params)
             // of the blockchain).
             break;
         }
-        if (!DisconnectTip(state, params, true)) {
+        if (!DisconnectTip(state, params, NULL)) {
             return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
         }
         // Occasionally flush state to disk.
@@ -3937,6 +4745,14 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    blockFileReader.Clear();
+    nCompressCursor = 0;
+    {
+        LOCK(cs_chainstateCompaction);
+        chainstateCompactionStats = CChainstateCompactionStats();
+        nCompactWrittenMark = 0;
+        nCompactNextTime = 0;
+    }
     nBlockSequenceId = 1;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
@@ -3945,10 +4761,8 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
 }
 
@@ -3971,6 +4785,9 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    uint256 hashTxIndexBest;
+    if (fTxIndex && !pblocktree->ReadTxIndexBestBlock(hashTxIndexBest))
+        pblocktree->WriteTxIndexBestBlock(uint256());
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3998,6 +4815,233 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+namespace {
+
+/** Number of blocks read ahead of the connecting thread during -reindex */
+static const size_t REINDEX_PREFETCH_BLOCKS = 64;
+
+/** A block found while scanning the block files during -reindex */
+struct CReindexBlock
+{
+    uint256 hash;
+    uint256 hashPrev;
+    CDiskBlockPos pos;
+};
+
+/**
+ * Find the blocks stored in one blk?????.dat file and check their proof of
+ * work. Only the headers are deserialized; block bodies are skipped using the
+ * size recorded in front of every block.
+ */
+void ScanBlockFile(const CChainParams& chainparams, int nFile, std::vector<CReindexBlock>& vBlocks)
+{
+    CDiskBlockPos pos(nFile, 0);
+    FILE* fileIn = OpenBlockFile(pos, true);
+    if (!fileIn)
+        return; // This error is logged in OpenBlockFile
+    LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof() && !ShutdownRequested()) {
+            if (!blkdat.SetPos(nRewind))
+                blkdat.Seek(nRewind); // skipped past the buffered data
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(chainparams.MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                uint64_t nBlockPos = blkdat.GetPos();
+                CBlockHeader header;
+                blkdat >> header;
+                uint256 hash = header.GetHash();
+                if (hash != chainparams.GetConsensus().hashGenesisBlock &&
+                    !CheckProofOfWork(header.GetPoWHash(), header.nBits, chainparams.GetConsensus())) {
+                    LogPrint("reindex", "%s: Skipping block %s with invalid proof of work\n", __func__, hash.ToString());
+                    continue;
+                }
+                vBlocks.push_back(CReindexBlock{hash, header.hashPrevBlock, CDiskBlockPos(nFile, nBlockPos)});
+                nRewind = nBlockPos + nSize;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+}
+
+/** Read a block found by ScanBlockFile, reusing pfile if it is already in the same file */
+std::shared_ptr<const CBlock> ReadReindexBlock(const CReindexBlock& entry, std::shared_ptr<CAutoFile>& pfile, int& nFileOpen)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    try {
+        if (entry.pos.nFile != nFileOpen) {
+            pfile.reset(new CAutoFile(OpenBlockFile(CDiskBlockPos(entry.pos.nFile, 0), true), SER_DISK, CLIENT_VERSION));
+            nFileOpen = entry.pos.nFile;
+        }
+        if (pfile->IsNull() || fseek(pfile->Get(), entry.pos.nPos, SEEK_SET))
+            throw std::runtime_error("cannot seek to block");
+        *pfile >> *pblock;
+        if (pblock->GetHash() != entry.hash)
+            throw std::runtime_error("block hash changed since scan");
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Deserialize or I/O error - %s at %s\n", __func__, e.what(), entry.pos.ToString());
+        return NULL;
+    }
+    return pblock;
+}
+
+} // anon namespace
+
+bool ReindexBlockFiles(const CChainParams& chainparams)
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Compressed files are restored first, as they are scanned raw
+    int nFiles = 0;
+    while (boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "blk")) ||
+           boost::filesystem::exists(GetCompressedBlockFilename(BLOCK_FILE, nFiles))) {
+        if (!boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "blk"))) {
+            LOCK(cs_LastBlockFile);
+            if (!DecompressBlockFiles(nFiles))
+                return AbortNode(strprintf("Failed to decompress block file %d for -reindex", nFiles));
+        }
+        nFiles++;
+    }
+
+    // Stage 1: find the blocks in every file and check their proof of work,
+    // several files at a time.
+    std::vector<std::vector<CReindexBlock> > vFileBlocks(nFiles);
+    {
+        std::atomic<int> nNextFile(0);
+        std::vector<std::thread> vScanners;
+        int nScanners = std::max(1, std::min(nFiles, nScriptCheckThreads + 1));
+        for (int i = 0; i < nScanners; i++) {
+            vScanners.emplace_back([&chainparams, &vFileBlocks, &nNextFile, nFiles]() {
+                RenameThread("bitcoin-reidxscan");
+                int nFile;
+                while ((nFile = nNextFile++) < nFiles && !ShutdownRequested())
+                    ScanBlockFile(chainparams, nFile, vFileBlocks[nFile]);
+            });
+        }
+        for (std::thread& scanner : vScanners)
+            scanner.join();
+    }
+    if (ShutdownRequested())
+        return false;
+    boost::this_thread::interruption_point();
+    int64_t nScanned = GetTimeMillis();
+
+    // Stage 2: order the blocks so that every block follows its parent,
+    // walking the block tree from the genesis block (or from blocks whose
+    // parent is already indexed, when resuming an interrupted reindex).
+    std::vector<const CReindexBlock*> vOrder;
+    size_t nFound = 0;
+    {
+        boost::unordered_map<uint256, const CReindexBlock*, BlockHasher> mapFound;
+        std::multimap<uint256, const CReindexBlock*> mapChildren;
+        for (const std::vector<CReindexBlock>& vBlocks : vFileBlocks) {
+            for (const CReindexBlock& entry : vBlocks) {
+                // The first copy of a block wins
+                if (mapFound.emplace(entry.hash, &entry).second)
+                    mapChildren.emplace(entry.hashPrev, &entry);
+            }
+        }
+        nFound = mapFound.size();
+
+        LOCK(cs_main);
+        std::deque<const CReindexBlock*> queue;
+        for (const auto& item : mapFound) {
+            const CReindexBlock* pentry = item.second;
+            if (pentry->hash == chainparams.GetConsensus().hashGenesisBlock ||
+                (!mapFound.count(pentry->hashPrev) && mapBlockIndex.count(pentry->hashPrev)))
+                queue.push_back(pentry);
+        }
+        vOrder.reserve(nFound);
+        while (!queue.empty()) {
+            const CReindexBlock* pentry = queue.front();
+            queue.pop_front();
+            BlockMap::iterator mi = mapBlockIndex.find(pentry->hash);
+            if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+                vOrder.push_back(pentry);
+            auto range = mapChildren.equal_range(pentry->hash);
+            for (auto it = range.first; it != range.second; ++it)
+                queue.push_back(it->second);
+        }
+    }
+    LogPrintf("Found %u blocks in %d block files in %dms, %u to process\n", nFound, nFiles, nScanned - nStart, vOrder.size());
+
+    // Stage 3: accept and connect the blocks in order, while they are read
+    // from disk ahead of time. Proof of work was checked in stage 1.
+    int nLoaded = 0;
+    int nMaxFile = -1;
+    bool fAborted = false;
+    {
+        // The prefetching thread keeps the block file it read from last open
+        std::shared_ptr<CAutoFile> pfile;
+        int nFileOpen = -1;
+        CBlockPrefetcher prefetcher(vOrder.size(), [&vOrder, pfile, nFileOpen](size_t i) mutable {
+            return ReadReindexBlock(*vOrder[i], pfile, nFileOpen);
+        }, REINDEX_PREFETCH_BLOCKS, "bitcoin-reidxread");
+        for (const CReindexBlock* pentry : vOrder) {
+            boost::this_thread::interruption_point();
+            std::shared_ptr<const CBlock> pblock = prefetcher.Next();
+            if (!pblock)
+                continue;
+
+            CValidationState state;
+            {
+                LOCK(cs_main);
+                if (!AcceptBlock(pblock, state, chainparams, NULL, true, &pentry->pos, NULL, false)) {
+                    if (state.IsError()) {
+                        fAborted = true;
+                        break;
+                    }
+                    continue;
+                }
+                nLoaded++;
+                nMaxFile = std::max(nMaxFile, pentry->pos.nFile);
+            }
+            NotifyHeaderTip();
+
+            if (!ActivateBestChain(state, chainparams, pblock)) {
+                fAborted = true;
+                break;
+            }
+        }
+    }
+
+    {
+        // Blocks were accepted across files out of file order; make sure new
+        // blocks get appended after the last one that holds any.
+        LOCK(cs_main);
+        if (nMaxFile > nLastBlockFile)
+            nLastBlockFile = nMaxFile;
+    }
+    LogPrintf("Loaded %i blocks from block files in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    if (fAborted)
+        return error("%s: stopped on an error accepting or connecting a block", __func__);
+    return true;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
@@ -4460,9 +5504,7 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
     }
 } instance_of_cmaincleanup;
@@ -16,6 +16,7 @@
 #include "amount.h"
 #include "chain.h"
 #include "coins.h"
+#include "consensus/validation.h"
 #include "protocol.h" // For CMessageHeader::MessageStartChars
 #include "script/script_error.h"
 #include "sync.h"
@@ -40,6 +41,8 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -75,6 +78,8 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
+/** Maximum kilobytes for transactions to store for processing during reorg */
+static const unsigned int MAX_DISCONNECTED_TX_POOL_SIZE = 20000;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -138,6 +143,8 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -blockindexsnapshot */
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = true;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -mempoolreplacement */
@@ -213,6 +220,24 @@ extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
+/** Default for -compressblockfiles */
+static const bool DEFAULT_COMPRESS_BLOCK_FILES = false;
+/** Number of most recent block files that are never compressed */
+static const int BLOCKFILE_COMPRESS_KEEP = 2;
+/** Seconds between runs of CompressBlockFiles, which compresses at most one file each */
+static const int64_t BLOCKFILE_COMPRESS_INTERVAL = 10;
+
+/** Default for -compactchainstate */
+static const bool DEFAULT_COMPACT_CHAINSTATE = true;
+/** Seconds between runs of CompactChainstate, which compacts at most one slice of the coin database each */
+static const int64_t CHAINSTATE_COMPACT_INTERVAL = 5;
+/** Seconds without a new tip after which the chain state is idle enough to compact */
+static const int64_t CHAINSTATE_COMPACT_IDLE = 20;
+/** Bytes written to the coin database that start a new compaction sweep over it */
+static const uint64_t CHAINSTATE_COMPACT_MIN_WRITTEN = 32 << 20;
+/** Time spent waiting after a slice, as a multiple of the time it took to compact */
+static const int CHAINSTATE_COMPACT_BACKOFF = 4;
+
 static const signed int DEFAULT_CHECKBLOCKS = 6 * 4;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
 
@@ -269,6 +294,14 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/**
+ * Rebuild the block index and chain state from the blk?????.dat files (-reindex).
+ * The files are scanned and their proof of work checked in parallel, then the
+ * blocks are accepted and connected in chain order while a reader thread
+ * prefetches them. Returns false if interrupted by a shutdown or stopped by
+ * an error; the reindex then resumes on the next start.
+ */
+bool ReindexBlockFiles(const CChainParams& chainparams);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
@@ -277,6 +310,8 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the mempool batch script checking thread */
+void ThreadMempoolScriptCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -323,6 +358,39 @@ void PruneOneBlockFile(const int fileNumber);
  */
 void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune);
 
+/**
+ *  Recompress the oldest finalized block and undo files that are not
+ *  compressed yet. Files holding blocks within MIN_BLOCKS_TO_KEEP of the tip,
+ *  and the BLOCKFILE_COMPRESS_KEEP most recent files, stay raw.
+ */
+void CompressBlockFiles(const CChainParams& chainparams);
+
+/** Counters of the compactions run by CompactChainstate */
+struct CChainstateCompactionStats
+{
+    int nSlice;                 //!< next slice of the running sweep, -1 when none is running
+    uint64_t nSlices;           //!< slices compacted
+    uint64_t nSweeps;           //!< sweeps over the whole coin database completed
+    uint64_t nDeferred;         //!< runs of a sweep skipped because a block was connected recently
+    int64_t nTotalMicros;       //!< time spent compacting
+    int64_t nLastSliceMicros;
+    int64_t nMaxSliceMicros;
+    int64_t nLastSweepTime;     //!< when the last sweep completed, 0 if never
+
+    CChainstateCompactionStats() : nSlice(-1), nSlices(0), nSweeps(0), nDeferred(0), nTotalMicros(0), nLastSliceMicros(0), nMaxSliceMicros(0), nLastSweepTime(0) {}
+};
+
+/**
+ *  Compact one slice of the coin database if the chain tip has not changed
+ *  for nIdleSeconds, so LevelDB's own compactions are less likely to stall
+ *  the next block connection. A sweep over all slices starts once
+ *  nMinWritten bytes were written since the previous one started, and after
+ *  each slice the next one waits CHAINSTATE_COMPACT_BACKOFF times as long as
+ *  the slice took.
+ */
+void CompactChainstate(const CCoinsViewDB* pcoinsdb, int64_t nIdleSeconds, uint64_t nMinWritten);
+CChainstateCompactionStats GetChainstateCompactionStats();
+
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Flush all state, indexes and buffers to disk. */
@@ -343,6 +411,28 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** Outcome of a single transaction submitted through AcceptToMemoryPoolBatch */
+struct CTxBatchResult
+{
+    CValidationState state;
+    bool fAccepted;
+    bool fMissingInputs;
+
+    CTxBatchResult() : fAccepted(false), fMissingInputs(false) {}
+};
+
+/**
+ * (try to) add a batch of transactions to memory pool.
+ * Stateless and script checks for the whole batch are run up front on the
+ * script check threads, outside cs_main and pool.cs unless the caller holds
+ * them; then the transactions are committed under a single lock in
+ * dependency order, so children in the batch may spend their parents.
+ * vResults is filled in the same order as vtx.
+ */
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, std::vector<CTxBatchResult>& vResults,
+                             bool fLimitFree, std::list<CTransactionRef>* plTxnReplaced = NULL,
+                             bool fOverrideMempoolLimit = false);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -484,6 +574,7 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -538,14 +629,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. With fJustCheck, the address
+ *  index is left untouched. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, bool fJustCheck = false);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** When there are blocks in the active chain with missing data, rewind the chainstate and remove them from the block index */
 bool RewindBlockIndex(const CChainParams& params);
+/**
+ * Bring the address index back to the active chain when it was left behind
+ * or on another branch, from the blocks and their undo data. Returns false
+ * if it cannot, e.g. because the blocks were pruned.
+ */
+bool SyncAddressIndex(const CChainParams& params);
 
 /** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
 class CVerifyDB {
@@ -611,4 +709,11 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/**
+ * Write the block index to a flat file that the next startup can load with
+ * a single sequential read. Only done while the block tree database is fully
+ * flushed, as the file is validated against it on load.
+ */
+bool DumpBlockIndex();
+
 #endif // BITCOIN_VALIDATION_H
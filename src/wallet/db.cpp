@@ -52,6 +52,7 @@ void CDBEnv::Reset()
     dbenv = new DbEnv(DB_CXX_NO_EXCEPTIONS);
     fDbEnvInit = false;
     fMockDb = false;
+    fRecordLog = false;
 }
 
 CDBEnv::CDBEnv() : dbenv(NULL)
@@ -61,6 +62,9 @@ CDBEnv::CDBEnv() : dbenv(NULL)
 
 CDBEnv::~CDBEnv()
 {
+    for (std::map<std::string, CRecordLog*>::iterator it = mapLog.begin(); it != mapLog.end(); ++it)
+        delete it->second;
+    mapLog.clear();
     EnvShutdown();
     delete dbenv;
     dbenv = NULL;
@@ -231,6 +235,107 @@ bool CDBEnv::Salvage(const std::string& strFile, bool fAggressive, std::vector<C
 }
 
 
+boost::filesystem::path CDBEnv::GetLogPath(const std::string& strFile)
+{
+    return GetDataDir() / (strFile + ".log");
+}
+
+CRecordLog* CDBEnv::OpenLog(const std::string& strFile, bool fCreate)
+{
+    AssertLockHeld(cs_db);
+    std::map<std::string, CRecordLog*>::iterator it = mapLog.find(strFile);
+    if (it != mapLog.end())
+        return it->second;
+
+    CRecordLog* plog = new CRecordLog();
+    if (!plog->Open(GetLogPath(strFile), fCreate)) {
+        delete plog;
+        return NULL;
+    }
+    mapLog[strFile] = plog;
+    return plog;
+}
+
+bool CDBEnv::SyncLog(const std::string& strFile)
+{
+    LOCK(cs_db);
+    std::map<std::string, CRecordLog*>::iterator it = mapLog.find(strFile);
+    if (it == mapLog.end())
+        return false;
+    if (!it->second->Sync())
+        return false;
+    if (it->second->NeedsCompaction())
+        return it->second->Compact();
+    return true;
+}
+
+bool CDBEnv::MigrateToLog(const std::string& strFile)
+{
+    LOCK(cs_db);
+    assert(mapFileUseCount.count(strFile) == 0);
+
+    boost::filesystem::path pathLog = GetLogPath(strFile);
+    boost::filesystem::path pathNew = pathLog.string() + ".new";
+    boost::filesystem::remove(pathNew);
+
+    Db db(dbenv, 0);
+    int ret = db.open(NULL, strFile.c_str(), "main", DB_BTREE, DB_RDONLY, 0);
+    if (ret != 0)
+        return error("CDBEnv::MigrateToLog: Error %d, can't open database %s", ret, strFile);
+
+    bool fSuccess = false;
+    size_t nRecords = 0;
+    Dbc* pcursor = NULL;
+    if (db.cursor(NULL, &pcursor, 0) == 0) {
+        CRecordLog log;
+        CDBCursor cursor(pcursor);
+        fSuccess = log.Open(pathNew, true);
+        // The copy only takes the place of the log once it is complete
+        CRecordLogBatch batch;
+        size_t nBatchSize = 0;
+        while (fSuccess) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret1 = cursor.Read(ssKey, ssValue, false);
+            if (ret1 == DB_NOTFOUND)
+                break;
+            if (ret1 != 0) {
+                fSuccess = false;
+                break;
+            }
+            batch.Write(std::string(ssKey.begin(), ssKey.end()), ssValue);
+            nBatchSize += ssKey.size() + ssValue.size();
+            nRecords++;
+            if (nBatchSize >= 1024 * 1024) {
+                fSuccess = log.WriteBatch(batch);
+                batch.Clear();
+                nBatchSize = 0;
+            }
+        }
+        if (fSuccess)
+            fSuccess = log.WriteBatch(batch) && log.Sync();
+        log.Close();
+    }
+    db.close(0);
+
+    if (fSuccess)
+        fSuccess = RenameOver(pathNew, pathLog);
+    if (!fSuccess) {
+        boost::filesystem::remove(pathNew);
+        return error("CDBEnv::MigrateToLog: Failed to copy %s to %s", strFile, pathLog.string());
+    }
+    LogPrintf("CDBEnv::MigrateToLog: Copied %u records of %s to %s\n", nRecords, strFile, pathLog.string());
+
+    // Only one of the stores may be current
+    std::string strFileOld = strprintf("%s.%d.migrated", strFile, GetTime());
+    Db dbOld(dbenv, 0);
+    if (dbOld.rename(strFile.c_str(), NULL, strFileOld.c_str(), 0))
+        return error("CDBEnv::MigrateToLog: Failed to move %s aside", strFile);
+    LogPrintf("CDBEnv::MigrateToLog: Moved %s to %s\n", strFile, strFileOld);
+    return true;
+}
+
+
 void CDBEnv::CheckpointLSN(const std::string& strFile)
 {
     dbenv->txn_checkpoint(0, 0, 0);
@@ -240,7 +345,66 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDBCursor::~CDBCursor()
+{
+    if (pcursor)
+        pcursor->close();
+}
+
+int CDBCursor::Read(CDataStream& ssKey, CDataStream& ssValue, bool setRange)
+{
+    if (plog) {
+        std::string strKeyRet;
+        ssValue.SetType(SER_DISK);
+        if (setRange) {
+            if (!plog->ReadNext(std::string(ssKey.begin(), ssKey.end()), true, strKeyRet, ssValue))
+                return DB_NOTFOUND;
+        } else if (!plog->ReadNext(strKey, !fStarted, strKeyRet, ssValue)) {
+            return DB_NOTFOUND;
+        }
+        fStarted = true;
+        strKey = strKeyRet;
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write(strKey.data(), strKey.size());
+        return 0;
+    }
+
+    // Read at cursor
+    Dbt datKey;
+    unsigned int fFlags = DB_NEXT;
+    if (setRange) {
+        datKey.set_data(ssKey.data());
+        datKey.set_size(ssKey.size());
+        fFlags = DB_SET_RANGE;
+    }
+    Dbt datValue;
+    datKey.set_flags(DB_DBT_MALLOC);
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pcursor->get(&datKey, &datValue, fFlags);
+    if (ret != 0)
+        return ret;
+    else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
+        return 99999;
+
+    // Convert to streams
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write((char*)datKey.get_data(), datKey.get_size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+    // Clear and free memory
+    memset(datKey.get_data(), 0, datKey.get_size());
+    memset(datValue.get_data(), 0, datValue.get_size());
+    free(datKey.get_data());
+    free(datValue.get_data());
+    return 0;
+}
+
+
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), plog(NULL), activeTxn(NULL), fLogTxn(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -249,6 +413,22 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
         return;
 
     bool fCreate = strchr(pszMode, 'c') != NULL;
+
+    if (bitdb.IsRecordLog()) {
+        LOCK(bitdb.cs_db);
+        plog = bitdb.OpenLog(strFilename, fCreate);
+        if (!plog)
+            throw runtime_error(strprintf("CDB: can't open record log of %s", strFilename));
+        strFile = strFilename;
+        ++bitdb.mapFileUseCount[strFile];
+        if (fCreate && !Exists(string("version"))) {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -299,9 +479,55 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
     }
 }
 
+bool CDB::ReadLog(const std::string& strKey, CDataStream& ssValue)
+{
+    if (fLogTxn) {
+        std::map<std::string, std::pair<bool, CSerializeData> >::const_iterator it = logTxn.mapChanges.find(strKey);
+        if (it != logTxn.mapChanges.end()) {
+            if (it->second.first)
+                return false;
+            ssValue.clear();
+            ssValue.write(it->second.second.data(), it->second.second.size());
+            return true;
+        }
+    }
+    return plog->Read(strKey, ssValue);
+}
+
+bool CDB::WriteLog(const std::string& strKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && ExistsLog(strKey))
+        return false;
+    if (fLogTxn) {
+        logTxn.Write(strKey, ssValue);
+        return true;
+    }
+    return plog->Write(strKey, ssValue);
+}
+
+bool CDB::EraseLog(const std::string& strKey)
+{
+    if (fLogTxn) {
+        logTxn.Erase(strKey);
+        return true;
+    }
+    return plog->Erase(strKey);
+}
+
+bool CDB::ExistsLog(const std::string& strKey)
+{
+    if (fLogTxn) {
+        std::map<std::string, std::pair<bool, CSerializeData> >::const_iterator it = logTxn.mapChanges.find(strKey);
+        if (it != logTxn.mapChanges.end())
+            return !it->second.first;
+    }
+    return plog->Exists(strKey);
+}
+
 void CDB::Flush()
 {
-    if (activeTxn)
+    // Record logs are written as they go; there is no checkpoint to take
+    if (activeTxn || plog)
         return;
 
     // Flush database activity from memory pool to disk log
@@ -314,15 +540,18 @@ void CDB::Flush()
 
 void CDB::Close()
 {
-    if (!pdb)
+    if (!pdb && !plog)
         return;
     if (activeTxn)
         activeTxn->abort();
     activeTxn = NULL;
+    logTxn.Clear();
+    fLogTxn = false;
     pdb = NULL;
 
     if (fFlushOnClose)
         Flush();
+    plog = NULL;
 
     {
         LOCK(bitdb.cs_db);
@@ -334,6 +563,13 @@ void CDBEnv::CloseDb(const string& strFile)
 {
     {
         LOCK(cs_db);
+        std::map<std::string, CRecordLog*>::iterator it = mapLog.find(strFile);
+        if (it != mapLog.end()) {
+            if (it->second->NeedsCompaction())
+                it->second->Compact();
+            delete it->second;
+            mapLog.erase(it);
+        }
         if (mapDb[strFile] != NULL) {
             // Close the database handle
             Db* pdb = mapDb[strFile];
@@ -349,12 +585,36 @@ bool CDBEnv::RemoveDb(const string& strFile)
     this->CloseDb(strFile);
 
     LOCK(cs_db);
+    if (fRecordLog)
+        return boost::filesystem::remove(GetLogPath(strFile));
     int rc = dbenv->dbremove(NULL, strFile.c_str(), NULL, DB_AUTO_COMMIT);
     return (rc == 0);
 }
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    if (bitdb.IsRecordLog()) {
+        // A record log can be compacted while it is in use
+        LOCK(bitdb.cs_db);
+        CRecordLog* plog = bitdb.OpenLog(strFile, false);
+        if (!plog)
+            return false;
+        LogPrintf("CDB::Rewrite: Compacting %s...\n", strFile);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << std::string("version");
+        std::string strKey(ssKey.begin(), ssKey.end());
+        if (plog->Exists(strKey)) {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            ssValue << CLIENT_VERSION;
+            plog->Write(strKey, ssValue);
+        }
+        if (!plog->Compact(pszSkip)) {
+            LogPrintf("CDB::Rewrite: Failed to compact %s\n", strFile);
+            return false;
+        }
+        return true;
+    }
+
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -382,17 +642,17 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
                             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
                             int ret1 = db.ReadAtCursor(pcursor, ssKey, ssValue);
                             if (ret1 == DB_NOTFOUND) {
-                                pcursor->close();
+                                delete pcursor;
                                 break;
                             } else if (ret1 != 0) {
-                                pcursor->close();
+                                delete pcursor;
                                 fSuccess = false;
                                 break;
                             }
@@ -442,7 +702,7 @@ void CDBEnv::Flush(bool fShutdown)
     int64_t nStart = GetTimeMillis();
     // Flush log data to the actual data file on all files that are not in use
     LogPrint("db", "CDBEnv::Flush: Flush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " database not started");
-    if (!fDbEnvInit)
+    if (!fDbEnvInit && mapLog.empty())
         return;
     {
         LOCK(cs_db);
@@ -451,7 +711,11 @@ void CDBEnv::Flush(bool fShutdown)
             string strFile = (*mi).first;
             int nRefCount = (*mi).second;
             LogPrint("db", "CDBEnv::Flush: Flushing %s (refcount = %d)...\n", strFile, nRefCount);
-            if (nRefCount == 0) {
+            if (nRefCount == 0 && mapLog.count(strFile)) {
+                CloseDb(strFile);
+                LogPrint("db", "CDBEnv::Flush: %s closed\n", strFile);
+                mapFileUseCount.erase(mi++);
+            } else if (nRefCount == 0) {
                 // Move log data to the dat file
                 CloseDb(strFile);
                 LogPrint("db", "CDBEnv::Flush: %s checkpoint\n", strFile);
@@ -465,7 +729,7 @@ void CDBEnv::Flush(bool fShutdown)
                 mi++;
         }
         LogPrint("db", "CDBEnv::Flush: Flush(%s)%s took %15dms\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " database not started", GetTimeMillis() - nStart);
-        if (fShutdown) {
+        if (fShutdown && fDbEnvInit) {
             char** listp;
             if (mapFileUseCount.empty()) {
                 dbenv->log_archive(&listp, DB_ARCH_REMOVE);
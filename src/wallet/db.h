@@ -14,6 +14,7 @@
 #include "streams.h"
 #include "sync.h"
 #include "version.h"
+#include "wallet/recordlog.h"
 
 #include <map>
 #include <string>
@@ -25,12 +26,15 @@
 
 static const unsigned int DEFAULT_WALLET_DBLOGSIZE = 100;
 static const bool DEFAULT_WALLET_PRIVDB = true;
+//! -walletbackend default
+static const char* const DEFAULT_WALLET_BACKEND = "bdb";
 
 class CDBEnv
 {
 private:
     bool fDbEnvInit;
     bool fMockDb;
+    bool fRecordLog;
     // Don't change into boost::filesystem::path, as that can result in
     // shutdown problems/crashes caused by a static initialized internal pointer.
     std::string strPath;
@@ -42,6 +46,7 @@ public:
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    std::map<std::string, CRecordLog*> mapLog;
 
     CDBEnv();
     ~CDBEnv();
@@ -50,6 +55,23 @@ public:
     void MakeMock();
     bool IsMock() { return fMockDb; }
 
+    /**
+     * Keep wallet files in record logs (see CRecordLog) instead of Berkeley
+     * DB files. The log of a file is stored next to it, under GetLogPath.
+     */
+    void UseRecordLog(bool fUse) { fRecordLog = fUse; }
+    bool IsRecordLog() const { return fRecordLog; }
+    static boost::filesystem::path GetLogPath(const std::string& strFile);
+    /** Return the open record log of strFile, opening it if needed; NULL on failure */
+    CRecordLog* OpenLog(const std::string& strFile, bool fCreate);
+    /** Write the record log of strFile to disk and compact it if mostly superseded */
+    bool SyncLog(const std::string& strFile);
+    /**
+     * Copy all records of the Berkeley DB file strFile into a new record log.
+     * The Berkeley DB file is then moved aside to strFile.<time>.migrated.
+     */
+    bool MigrateToLog(const std::string& strFile);
+
     /**
      * Verify that database file strFile is OK. If it is not,
      * call the callback to try to recover.
@@ -91,13 +113,43 @@ public:
 extern CDBEnv bitdb;
 
 
+/** Iterates over the records of a Berkeley DB file or a record log in key order */
+class CDBCursor
+{
+private:
+    Dbc* pcursor;
+    CRecordLog* plog;
+    //! Key of the last record read from the log
+    std::string strKey;
+    bool fStarted;
+
+    CDBCursor(const CDBCursor&);
+    void operator=(const CDBCursor&);
+
+public:
+    explicit CDBCursor(Dbc* pcursorIn) : pcursor(pcursorIn), plog(NULL), fStarted(false) {}
+    explicit CDBCursor(CRecordLog* plogIn) : pcursor(NULL), plog(plogIn), fStarted(false) {}
+    ~CDBCursor();
+
+    /**
+     * Read the next record, or the first one at or after ssKey if setRange.
+     * Returns 0, DB_NOTFOUND past the last record, or another error.
+     */
+    int Read(CDataStream& ssKey, CDataStream& ssValue, bool setRange);
+};
+
+
 /** RAII class that provides access to a Berkeley database */
 class CDB
 {
 protected:
     Db* pdb;
+    CRecordLog* plog;
     std::string strFile;
     DbTxn* activeTxn;
+    //! Changes made in the active transaction on a record log
+    CRecordLogBatch logTxn;
+    bool fLogTxn;
     bool fReadOnly;
     bool fFlushOnClose;
 
@@ -112,17 +164,34 @@ private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
+    bool ReadLog(const std::string& strKey, CDataStream& ssValue);
+    bool WriteLog(const std::string& strKey, const CDataStream& ssValue, bool fOverwrite);
+    bool EraseLog(const std::string& strKey);
+    bool ExistsLog(const std::string& strKey);
+
 protected:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (!ReadLog(std::string(ssKey.begin(), ssKey.end()), ssValue))
+                return false;
+            try {
+                ssValue >> value;
+            } catch (const std::exception&) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Read
@@ -150,7 +219,7 @@ protected:
     template <typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite = true)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -159,12 +228,15 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(ssKey.data(), ssKey.size());
 
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+
+        if (plog)
+            return WriteLog(std::string(ssKey.begin(), ssKey.end()), ssValue, fOverwrite);
+        Dbt datKey(ssKey.data(), ssKey.size());
         Dbt datValue(ssValue.data(), ssValue.size());
 
         // Write
@@ -179,7 +251,7 @@ protected:
     template <typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -188,6 +260,9 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog)
+            return EraseLog(std::string(ssKey.begin(), ssKey.end()));
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Erase
@@ -201,13 +276,16 @@ protected:
     template <typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog)
+            return ExistsLog(std::string(ssKey.begin(), ssKey.end()));
         Dbt datKey(ssKey.data(), ssKey.size());
 
         // Exists
@@ -218,55 +296,36 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
+        if (plog)
+            return new CDBCursor(plog);
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pcursor);
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, bool setRange = false)
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, bool setRange = false)
     {
-        // Read at cursor
-        Dbt datKey;
-        unsigned int fFlags = DB_NEXT;
-        if (setRange) {
-            datKey.set_data(ssKey.data());
-            datKey.set_size(ssKey.size());
-            fFlags = DB_SET_RANGE;
-        }
-        Dbt datValue;
-        datKey.set_flags(DB_DBT_MALLOC);
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
-        if (ret != 0)
-            return ret;
-        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
-            return 99999;
-
-        // Convert to streams
-        ssKey.SetType(SER_DISK);
-        ssKey.clear();
-        ssKey.write((char*)datKey.get_data(), datKey.get_size());
-        ssValue.SetType(SER_DISK);
-        ssValue.clear();
-        ssValue.write((char*)datValue.get_data(), datValue.get_size());
-
-        // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datKey.get_data());
-        free(datValue.get_data());
-        return 0;
+        return pcursor->Read(ssKey, ssValue, setRange);
     }
 
 public:
+    /** Bytes written in the open transaction, if the database is a record log */
+    size_t GetLogTxnSize() const { return logTxn.nSize; }
+
     bool TxnBegin()
     {
+        if (plog) {
+            if (fLogTxn)
+                return false;
+            fLogTxn = true;
+            return true;
+        }
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -278,6 +337,14 @@ public:
 
     bool TxnCommit()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            bool ret = plog->WriteBatch(logTxn);
+            logTxn.Clear();
+            fLogTxn = false;
+            return ret;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -287,6 +354,13 @@ public:
 
     bool TxnAbort()
     {
+        if (plog) {
+            if (!fLogTxn)
+                return false;
+            logTxn.Clear();
+            fLogTxn = false;
+            return true;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
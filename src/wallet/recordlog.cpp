@@ -0,0 +1,422 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/recordlog.h"
+
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "util.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/* File layout: the magic bytes and format version, then frames of
+ * [payload size:4][checksum:4][payload], where the checksum is the start of
+ * the payload's double SHA256 and the payload is a series of records:
+ * [type:1][key size][key], followed by [value size][value] for writes. */
+static const char pchRecordLogMagic[8] = {'g', 'l', 'd', 'w', 'l', 'o', 'g', '\0'};
+static const uint32_t RECORD_LOG_VERSION = 1;
+static const unsigned int RECORD_LOG_HEADER_SIZE = sizeof(pchRecordLogMagic) + 4;
+static const unsigned int FRAME_HEADER_SIZE = 8;
+/** Compaction writes the live records in frames of about this size */
+static const unsigned int COMPACT_FRAME_SIZE = 256 * 1024;
+
+enum RecordType
+{
+    RECORD_WRITE = 0,
+    RECORD_ERASE = 1,
+};
+
+static uint64_t GetRecordSize(size_t nKeySize, size_t nValueSize)
+{
+    return 1 + GetSizeOfCompactSize(nKeySize) + nKeySize + GetSizeOfCompactSize(nValueSize) + nValueSize;
+}
+
+/** Serialize a batch as a frame; vValueOffsets gets the offsets of the written values in it */
+static void SerializeFrame(const CRecordLogBatch& batch, CDataStream& ssFrame, std::vector<uint64_t>& vValueOffsets)
+{
+    ssFrame.clear();
+    ssFrame.resize(FRAME_HEADER_SIZE);
+    vValueOffsets.clear();
+    for (std::map<std::string, std::pair<bool, CSerializeData> >::const_iterator it = batch.mapChanges.begin(); it != batch.mapChanges.end(); ++it) {
+        const std::string& strKey = it->first;
+        ser_writedata8(ssFrame, it->second.first ? RECORD_ERASE : RECORD_WRITE);
+        WriteCompactSize(ssFrame, strKey.size());
+        ssFrame.write(strKey.data(), strKey.size());
+        if (!it->second.first) {
+            const CSerializeData& vchValue = it->second.second;
+            WriteCompactSize(ssFrame, vchValue.size());
+            vValueOffsets.push_back(ssFrame.size());
+            ssFrame.write(vchValue.data(), vchValue.size());
+        }
+    }
+    uint256 hash = Hash(ssFrame.data() + FRAME_HEADER_SIZE, ssFrame.data() + ssFrame.size());
+    WriteLE32((unsigned char*)ssFrame.data(), ssFrame.size() - FRAME_HEADER_SIZE);
+    WriteLE32((unsigned char*)ssFrame.data() + 4, ReadLE32(hash.begin()));
+}
+
+static bool WriteHeader(FILE* file)
+{
+    unsigned char header[RECORD_LOG_HEADER_SIZE];
+    memcpy(header, pchRecordLogMagic, sizeof(pchRecordLogMagic));
+    WriteLE32(header + sizeof(pchRecordLogMagic), RECORD_LOG_VERSION);
+    return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+bool CRecordLog::Open(const boost::filesystem::path& pathIn, bool fCreate)
+{
+    LOCK(cs);
+    assert(!file);
+    path = pathIn;
+    file = fopen(path.string().c_str(), "r+b");
+    if (!file && fCreate)
+        file = fopen(path.string().c_str(), "w+b");
+    if (!file)
+        return error("CRecordLog::Open: cannot open %s", path.string());
+    if (!Replay()) {
+        fclose(file);
+        file = NULL;
+        mapIndex.clear();
+        return false;
+    }
+    return true;
+}
+
+bool CRecordLog::Replay()
+{
+    mapIndex.clear();
+    nLiveSize = 0;
+    fseek(file, 0, SEEK_END);
+    long nLength = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (nLength == 0) {
+        if (!WriteHeader(file) || fflush(file) != 0)
+            return error("CRecordLog::Replay: cannot write to %s", path.string());
+        nFileSize = RECORD_LOG_HEADER_SIZE;
+        return true;
+    }
+
+    unsigned char header[RECORD_LOG_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, pchRecordLogMagic, sizeof(pchRecordLogMagic)) != 0)
+        return error("CRecordLog::Replay: %s is not a record log", path.string());
+    if (ReadLE32(header + sizeof(pchRecordLogMagic)) > RECORD_LOG_VERSION)
+        return error("CRecordLog::Replay: %s was written by a newer version", path.string());
+
+    nFileSize = RECORD_LOG_HEADER_SIZE;
+    while (true) {
+        unsigned char frameHeader[FRAME_HEADER_SIZE];
+        size_t nRead = fread(frameHeader, 1, sizeof(frameHeader), file);
+        if (nRead == 0 && (uint64_t)nLength == nFileSize)
+            break;
+        bool fValid = nRead == sizeof(frameHeader);
+        uint32_t nPayloadSize = fValid ? ReadLE32(frameHeader) : 0;
+        uint64_t nFrameEnd = nFileSize + FRAME_HEADER_SIZE + nPayloadSize;
+        CSerializeData vchPayload;
+        if (fValid && nPayloadSize <= MAX_SIZE && nFrameEnd <= (uint64_t)nLength) {
+            vchPayload.resize(nPayloadSize);
+            fValid = fread(vchPayload.data(), 1, nPayloadSize, file) == nPayloadSize &&
+                     ReadLE32(Hash(vchPayload.begin(), vchPayload.end()).begin()) == ReadLE32(frameHeader + 4);
+        } else {
+            fValid = false;
+        }
+        if (!fValid) {
+            // Only the last frame can have been cut short by a crash, and
+            // never to a size no write would have. A damaged size field
+            // elsewhere looks the same, so the bytes dropped are kept aside.
+            if (nRead == sizeof(frameHeader) && (nPayloadSize > MAX_SIZE || nFrameEnd < (uint64_t)nLength))
+                return error("CRecordLog::Replay: %s is damaged at position %u", path.string(), nFileSize);
+            if (!SaveTail(nLength))
+                return error("CRecordLog::Replay: cannot keep the end of %s aside", path.string());
+            LogPrintf("CRecordLog::Replay: dropping %u bytes of an unfinished write at the end of %s\n", nLength - nFileSize, path.string());
+            if (!TruncateFile(file, nFileSize))
+                return error("CRecordLog::Replay: cannot truncate %s", path.string());
+            break;
+        }
+
+        CDataStream ssPayload(vchPayload, SER_DISK, CLIENT_VERSION);
+        try {
+            while (!ssPayload.empty()) {
+                uint8_t nType = ser_readdata8(ssPayload);
+                std::string strKey(ReadCompactSize(ssPayload), '\0');
+                ssPayload.read(&strKey[0], strKey.size());
+                std::map<std::string, CRecordPos>::iterator it = mapIndex.find(strKey);
+                if (it != mapIndex.end()) {
+                    nLiveSize -= GetRecordSize(strKey.size(), it->second.nSize);
+                    mapIndex.erase(it);
+                }
+                if (nType == RECORD_WRITE) {
+                    CRecordPos pos;
+                    pos.nSize = ReadCompactSize(ssPayload);
+                    pos.nPos = nFileSize + FRAME_HEADER_SIZE + vchPayload.size() - ssPayload.size();
+                    ssPayload.ignore(pos.nSize);
+                    mapIndex.insert(std::make_pair(strKey, pos));
+                    nLiveSize += GetRecordSize(strKey.size(), pos.nSize);
+                } else if (nType != RECORD_ERASE) {
+                    return error("CRecordLog::Replay: unknown record type %d in %s", nType, path.string());
+                }
+            }
+        } catch (const std::exception& e) {
+            return error("CRecordLog::Replay: malformed frame at position %u in %s: %s", nFileSize, path.string(), e.what());
+        }
+        nFileSize = nFrameEnd;
+    }
+    return true;
+}
+
+bool CRecordLog::SaveTail(uint64_t nLength)
+{
+    boost::filesystem::path pathTail = path.string() + strprintf(".%u.tail", nFileSize);
+    FILE* fileTail = fopen(pathTail.string().c_str(), "wb");
+    if (!fileTail)
+        return false;
+    bool fSuccess = fseek(file, nFileSize, SEEK_SET) == 0;
+    std::vector<char> vch(COMPACT_FRAME_SIZE);
+    for (uint64_t nPos = nFileSize; fSuccess && nPos < nLength; ) {
+        size_t nChunk = std::min<uint64_t>(vch.size(), nLength - nPos);
+        fSuccess = fread(vch.data(), 1, nChunk, file) == nChunk && fwrite(vch.data(), 1, nChunk, fileTail) == nChunk;
+        nPos += nChunk;
+    }
+    fSuccess = fSuccess && fflush(fileTail) == 0;
+    if (fSuccess)
+        FileCommit(fileTail);
+    fclose(fileTail);
+    if (fSuccess)
+        LogPrintf("CRecordLog::SaveTail: kept the end of %s in %s\n", path.string(), pathTail.string());
+    return fSuccess;
+}
+
+void CRecordLog::Close()
+{
+    LOCK(cs);
+    if (!file)
+        return;
+    fflush(file);
+    FileCommit(file);
+    fclose(file);
+    file = NULL;
+    mapIndex.clear();
+    nFileSize = 0;
+    nLiveSize = 0;
+}
+
+bool CRecordLog::Append(const CRecordLogBatch& batch)
+{
+    AssertLockHeld(cs);
+    if (!file)
+        return false;
+
+    CDataStream ssFrame(SER_DISK, CLIENT_VERSION);
+    std::vector<uint64_t> vValueOffsets;
+    SerializeFrame(batch, ssFrame, vValueOffsets);
+    // Replay takes a larger frame for damage
+    if (ssFrame.size() - FRAME_HEADER_SIZE > MAX_SIZE)
+        return error("CRecordLog::Append: a batch of %u bytes is too large for %s", ssFrame.size() - FRAME_HEADER_SIZE, path.string());
+    if (fseek(file, nFileSize, SEEK_SET) != 0 ||
+        fwrite(ssFrame.data(), 1, ssFrame.size(), file) != ssFrame.size() ||
+        fflush(file) != 0) {
+        // Do not leave part of the frame for later writes to follow
+        TruncateFile(file, nFileSize);
+        return error("CRecordLog::Append: cannot write to %s", path.string());
+    }
+
+    std::vector<uint64_t>::const_iterator itOffset = vValueOffsets.begin();
+    for (std::map<std::string, std::pair<bool, CSerializeData> >::const_iterator it = batch.mapChanges.begin(); it != batch.mapChanges.end(); ++it) {
+        std::map<std::string, CRecordPos>::iterator itIndex = mapIndex.find(it->first);
+        if (itIndex != mapIndex.end()) {
+            nLiveSize -= GetRecordSize(it->first.size(), itIndex->second.nSize);
+            mapIndex.erase(itIndex);
+        }
+        if (!it->second.first) {
+            CRecordPos pos;
+            pos.nPos = nFileSize + *itOffset++;
+            pos.nSize = it->second.second.size();
+            mapIndex.insert(std::make_pair(it->first, pos));
+            nLiveSize += GetRecordSize(it->first.size(), pos.nSize);
+        }
+    }
+    nFileSize += ssFrame.size();
+    return true;
+}
+
+bool CRecordLog::ReadValue(const CRecordPos& pos, CDataStream& ssValue) const
+{
+    AssertLockHeld(cs);
+    ssValue.clear();
+    ssValue.resize(pos.nSize);
+    if (fseek(file, pos.nPos, SEEK_SET) != 0 ||
+        fread(ssValue.data(), 1, pos.nSize, file) != pos.nSize) {
+        ssValue.clear();
+        return error("CRecordLog::ReadValue: cannot read from %s", path.string());
+    }
+    return true;
+}
+
+bool CRecordLog::Read(const std::string& strKey, CDataStream& ssValue) const
+{
+    LOCK(cs);
+    std::map<std::string, CRecordPos>::const_iterator it = mapIndex.find(strKey);
+    if (it == mapIndex.end())
+        return false;
+    return ReadValue(it->second, ssValue);
+}
+
+bool CRecordLog::Exists(const std::string& strKey) const
+{
+    LOCK(cs);
+    return mapIndex.count(strKey) > 0;
+}
+
+bool CRecordLog::Write(const std::string& strKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    LOCK(cs);
+    if (!fOverwrite && mapIndex.count(strKey))
+        return false;
+    CRecordLogBatch batch;
+    batch.Write(strKey, ssValue);
+    return Append(batch);
+}
+
+bool CRecordLog::Erase(const std::string& strKey)
+{
+    LOCK(cs);
+    if (!mapIndex.count(strKey))
+        return true;
+    CRecordLogBatch batch;
+    batch.Erase(strKey);
+    return Append(batch);
+}
+
+bool CRecordLog::WriteBatch(const CRecordLogBatch& batch)
+{
+    LOCK(cs);
+    if (batch.IsEmpty())
+        return true;
+    return Append(batch);
+}
+
+bool CRecordLog::ReadNext(const std::string& strKey, bool fInclusive, std::string& strKeyRet, CDataStream& ssValue) const
+{
+    LOCK(cs);
+    std::map<std::string, CRecordPos>::const_iterator it = fInclusive ? mapIndex.lower_bound(strKey) : mapIndex.upper_bound(strKey);
+    if (it == mapIndex.end())
+        return false;
+    strKeyRet = it->first;
+    return ReadValue(it->second, ssValue);
+}
+
+bool CRecordLog::Sync()
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+    if (fflush(file) != 0)
+        return error("CRecordLog::Sync: cannot write to %s", path.string());
+    FileCommit(file);
+    return true;
+}
+
+bool CRecordLog::NeedsCompaction() const
+{
+    LOCK(cs);
+    return nFileSize >= RECORD_LOG_MIN_COMPACT_SIZE && nFileSize > 2 * nLiveSize;
+}
+
+bool CRecordLog::Compact(const char* pszSkip)
+{
+    LOCK(cs);
+    if (!file)
+        return false;
+
+    boost::filesystem::path pathNew = path.string() + ".compact";
+    FILE* fileNew = fopen(pathNew.string().c_str(), "wb");
+    if (!fileNew)
+        return error("CRecordLog::Compact: cannot create %s", pathNew.string());
+
+    std::map<std::string, CRecordPos> mapIndexNew;
+    uint64_t nFileSizeNew = RECORD_LOG_HEADER_SIZE, nLiveSizeNew = 0;
+    size_t nSkip = pszSkip ? strlen(pszSkip) : 0;
+    bool fSuccess = WriteHeader(fileNew);
+    CRecordLogBatch batch;
+    uint64_t nBatchSize = 0;
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION), ssFrame(SER_DISK, CLIENT_VERSION);
+    std::vector<uint64_t> vValueOffsets;
+    std::map<std::string, CRecordPos>::const_iterator it = mapIndex.begin();
+    while (fSuccess && (it != mapIndex.end() || !batch.IsEmpty())) {
+        if (it != mapIndex.end()) {
+            std::map<std::string, CRecordPos>::const_iterator itRecord = it++;
+            if (nSkip && itRecord->first.compare(0, nSkip, pszSkip) == 0)
+                continue;
+            if (!ReadValue(itRecord->second, ssValue)) {
+                fSuccess = false;
+                break;
+            }
+            batch.Write(itRecord->first, ssValue);
+            nBatchSize += GetRecordSize(itRecord->first.size(), ssValue.size());
+            if (nBatchSize < COMPACT_FRAME_SIZE && it != mapIndex.end())
+                continue;
+        }
+
+        SerializeFrame(batch, ssFrame, vValueOffsets);
+        if (fwrite(ssFrame.data(), 1, ssFrame.size(), fileNew) != ssFrame.size()) {
+            fSuccess = false;
+            break;
+        }
+        std::vector<uint64_t>::const_iterator itOffset = vValueOffsets.begin();
+        for (std::map<std::string, std::pair<bool, CSerializeData> >::const_iterator itBatch = batch.mapChanges.begin(); itBatch != batch.mapChanges.end(); ++itBatch) {
+            CRecordPos pos;
+            pos.nPos = nFileSizeNew + *itOffset++;
+            pos.nSize = itBatch->second.second.size();
+            mapIndexNew.insert(std::make_pair(itBatch->first, pos));
+            nLiveSizeNew += GetRecordSize(itBatch->first.size(), pos.nSize);
+        }
+        nFileSizeNew += ssFrame.size();
+        batch.Clear();
+        nBatchSize = 0;
+    }
+    if (fSuccess && fflush(fileNew) == 0) {
+        FileCommit(fileNew);
+    } else {
+        fSuccess = false;
+    }
+    fclose(fileNew);
+    if (!fSuccess) {
+        boost::filesystem::remove(pathNew);
+        return error("CRecordLog::Compact: cannot write %s", pathNew.string());
+    }
+
+    fclose(file);
+    file = NULL;
+    if (!RenameOver(pathNew, path)) {
+        boost::filesystem::remove(pathNew);
+        file = fopen(path.string().c_str(), "r+b");
+        return error("CRecordLog::Compact: cannot replace %s", path.string());
+    }
+    file = fopen(path.string().c_str(), "r+b");
+    if (!file) {
+        mapIndex.clear();
+        return error("CRecordLog::Compact: cannot reopen %s", path.string());
+    }
+    LogPrint("db", "CRecordLog::Compact: %s from %u to %u bytes\n", path.string(), nFileSize, nFileSizeNew);
+    mapIndex.swap(mapIndexNew);
+    nFileSize = nFileSizeNew;
+    nLiveSize = nLiveSizeNew;
+    return true;
+}
+
+uint64_t CRecordLog::GetFileSize() const
+{
+    LOCK(cs);
+    return nFileSize;
+}
+
+size_t CRecordLog::GetRecordCount() const
+{
+    LOCK(cs);
+    return mapIndex.size();
+}
@@ -0,0 +1,132 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_RECORDLOG_H
+#define BITCOIN_WALLET_RECORDLOG_H
+
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+
+/** A record log is not compacted before it reaches this size, in bytes */
+static const uint64_t RECORD_LOG_MIN_COMPACT_SIZE = 1024 * 1024;
+
+/**
+ * Changes to a record log that are written together: each key maps to its
+ * new value, or is erased. Values are kept in zero-after-free memory, as
+ * they can be private keys.
+ */
+class CRecordLogBatch
+{
+public:
+    //! key -> (erased, new value)
+    std::map<std::string, std::pair<bool, CSerializeData> > mapChanges;
+    //! Bytes of the keys and values added, including those replaced since
+    size_t nSize;
+
+    CRecordLogBatch() : nSize(0) {}
+
+    void Write(const std::string& strKey, const CDataStream& ssValue)
+    {
+        mapChanges[strKey] = std::make_pair(false, CSerializeData(ssValue.begin(), ssValue.end()));
+        nSize += strKey.size() + ssValue.size();
+    }
+
+    void Erase(const std::string& strKey)
+    {
+        mapChanges[strKey] = std::make_pair(true, CSerializeData());
+        nSize += strKey.size();
+    }
+
+    bool IsEmpty() const { return mapChanges.empty(); }
+    void Clear() { mapChanges.clear(); nSize = 0; }
+};
+
+/**
+ * Key/value storage in a single append-only file. Every batch of changes
+ * is appended as one checksummed frame, so it is written sequentially and
+ * in full or not at all; an index in memory maps each live key to the
+ * position of its latest value. Superseded and erased records stay in the
+ * file until it is compacted, which rewrites the live records into a new
+ * file.
+ *
+ * Keys are ordered by their bytes, as in a Berkeley DB btree.
+ */
+class CRecordLog
+{
+private:
+    struct CRecordPos
+    {
+        uint64_t nPos;  //!< position of the value in the file
+        uint32_t nSize; //!< size of the value
+    };
+
+    mutable CCriticalSection cs;
+    boost::filesystem::path path;
+    FILE* file;
+    std::map<std::string, CRecordPos> mapIndex;
+    //! End of the last whole frame, where the next one is appended
+    uint64_t nFileSize;
+    //! Size the live records would take in a compacted file
+    uint64_t nLiveSize;
+
+    bool Replay();
+    /** Copy the file from nFileSize to nLength into a file next to it, before it is truncated */
+    bool SaveTail(uint64_t nLength);
+    bool Append(const CRecordLogBatch& batch);
+    bool ReadValue(const CRecordPos& pos, CDataStream& ssValue) const;
+
+    CRecordLog(const CRecordLog&);
+    void operator=(const CRecordLog&);
+
+public:
+    CRecordLog() : file(NULL), nFileSize(0), nLiveSize(0) {}
+    ~CRecordLog() { Close(); }
+
+    /**
+     * Open the log at pathIn and load its index. A frame cut short by a
+     * crash at the end of the file is dropped, after being copied to
+     * <path>.<position>.tail; fails on any other damage.
+     */
+    bool Open(const boost::filesystem::path& pathIn, bool fCreate);
+    void Close();
+    bool IsOpen() const { return file != NULL; }
+
+    bool Read(const std::string& strKey, CDataStream& ssValue) const;
+    bool Exists(const std::string& strKey) const;
+    /** Write one value; fails if fOverwrite is false and the key exists */
+    bool Write(const std::string& strKey, const CDataStream& ssValue, bool fOverwrite = true);
+    bool Erase(const std::string& strKey);
+    /** Write a batch as one frame; fails if it takes more than MAX_SIZE bytes */
+    bool WriteBatch(const CRecordLogBatch& batch);
+
+    /**
+     * Read the first record with a key after strKey, or from strKey on if
+     * fInclusive. Returns false past the last record.
+     */
+    bool ReadNext(const std::string& strKey, bool fInclusive, std::string& strKeyRet, CDataStream& ssValue) const;
+
+    /** Write the file out to disk */
+    bool Sync();
+    /** Whether superseded records take up most of the file */
+    bool NeedsCompaction() const;
+    /**
+     * Rewrite the file with only the live records, leaving out those whose
+     * key starts with pszSkip.
+     */
+    bool Compact(const char* pszSkip = NULL);
+
+    uint64_t GetFileSize() const;
+    size_t GetRecordCount() const;
+};
+
+#endif // BITCOIN_WALLET_RECORDLOG_H
@@ -5,8 +5,25 @@
 #ifndef BITCOIN_WALLET_RPCWALLET_H
 #define BITCOIN_WALLET_RPCWALLET_H
 
+#include <string>
+
 class CRPCTable;
+class CWallet;
+class JSONRPCRequest;
 
 void RegisterWalletRPCCommands(CRPCTable &t);
 
+/**
+ * Figures out what wallet, if any, to use for a JSONRPCRequest: the one
+ * named by a /wallet/<filename> endpoint, or else the only one loaded.
+ *
+ * @param[in] request JSONRPCRequest that wishes to access a wallet
+ * @return NULL if no wallet should be used, or a pointer to the CWallet
+ */
+CWallet *GetWalletForJSONRPCRequest(const JSONRPCRequest& request);
+
+std::string HelpRequiringPassphrase(CWallet * const pwallet);
+void EnsureWalletIsUnlocked(CWallet * const pwallet);
+bool EnsureWalletIsAvailable(CWallet * const pwallet, bool avoidException);
+
 #endif //BITCOIN_WALLET_RPCWALLET_H
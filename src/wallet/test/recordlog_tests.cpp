@@ -0,0 +1,223 @@
+// Copyright (c) 2013-2023 The Goldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/recordlog.h"
+
+#include "clientversion.h"
+#include "util.h"
+#include "wallet/db.h"
+#include "wallet/wallet.h"
+#include "wallet/walletdb.h"
+#include "wallet/test/wallet_test_fixture.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(recordlog_tests, WalletTestingSetup)
+
+static CDataStream MakeValue(int n)
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << n << std::string(n % 50, 'x');
+    return ssValue;
+}
+
+static bool CheckValue(const CRecordLog& log, const std::string& strKey, int n)
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    if (!log.Read(strKey, ssValue))
+        return false;
+    CDataStream ssExpected = MakeValue(n);
+    return std::string(ssValue.begin(), ssValue.end()) == std::string(ssExpected.begin(), ssExpected.end());
+}
+
+static void AppendBytes(const boost::filesystem::path& path, const std::string& str)
+{
+    FILE* file = fopen(path.string().c_str(), "ab");
+    fwrite(str.data(), 1, str.size(), file);
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(record_log)
+{
+    boost::filesystem::path path = GetDataDir() / "record_log_test.log";
+    CRecordLog log;
+    BOOST_CHECK(!log.Open(path, false));
+    BOOST_REQUIRE(log.Open(path, true));
+
+    BOOST_CHECK(log.Write("a", MakeValue(1)));
+    BOOST_CHECK(log.Write("b", MakeValue(2)));
+    BOOST_CHECK(!log.Write("b", MakeValue(3), false));
+    BOOST_CHECK(log.Write("b", MakeValue(3)));
+    BOOST_CHECK(log.Erase("a"));
+    BOOST_CHECK(log.Erase("missing"));
+    CRecordLogBatch batch;
+    batch.Write("c", MakeValue(4));
+    batch.Write(std::string("\xff\x01", 2), MakeValue(5));
+    batch.Erase("b");
+    BOOST_CHECK(log.WriteBatch(batch));
+    BOOST_CHECK(!log.Exists("a") && !log.Exists("b"));
+    BOOST_CHECK(CheckValue(log, "c", 4));
+
+    // Keys come in byte order
+    std::string strKey;
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(log.ReadNext("", true, strKey, ssValue) && strKey == "c");
+    BOOST_CHECK(log.ReadNext("c", false, strKey, ssValue) && strKey == std::string("\xff\x01", 2));
+    BOOST_CHECK(!log.ReadNext(strKey, false, strKey, ssValue));
+
+    // The index is rebuilt from the file; an unfinished last write is dropped
+    uint64_t nFileSize = log.GetFileSize();
+    log.Close();
+    AppendBytes(path, std::string("\x20\x00\x00\x00\x01\x02", 6));
+    BOOST_REQUIRE(log.Open(path, false));
+    BOOST_CHECK_EQUAL(log.GetFileSize(), nFileSize);
+    BOOST_CHECK(boost::filesystem::exists(path.string() + strprintf(".%u.tail", nFileSize)));
+    BOOST_CHECK_EQUAL(log.GetRecordCount(), 2U);
+    BOOST_CHECK(CheckValue(log, "c", 4));
+    BOOST_CHECK(CheckValue(log, std::string("\xff\x01", 2), 5));
+
+    // A damaged frame followed by others is not taken for an unfinished write
+    BOOST_CHECK(log.Write("d", MakeValue(6)));
+    nFileSize = log.GetFileSize();
+    log.Close();
+    AppendBytes(path, std::string("\x00\x00\x00\x00\x01\x02\x03\x04", 8) + std::string(8, '\0'));
+    BOOST_CHECK(!log.Open(path, false));
+    boost::filesystem::resize_file(path, nFileSize);
+    BOOST_REQUIRE(log.Open(path, false));
+    BOOST_CHECK(CheckValue(log, "d", 6));
+
+    // So is a huge size field in the middle of the file; the first frame
+    // follows the 12 byte file header
+    log.Close();
+    char pchSize[4];
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    fseek(file, 12, SEEK_SET);
+    BOOST_REQUIRE(fread(pchSize, 1, sizeof(pchSize), file) == sizeof(pchSize));
+    fseek(file, 12, SEEK_SET);
+    fwrite("\xf0\xff\xff\xff", 1, 4, file);
+    fclose(file);
+    BOOST_CHECK(!log.Open(path, false));
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), nFileSize);
+    file = fopen(path.string().c_str(), "r+b");
+    fseek(file, 12, SEEK_SET);
+    fwrite(pchSize, 1, sizeof(pchSize), file);
+    fclose(file);
+    BOOST_REQUIRE(log.Open(path, false));
+    BOOST_CHECK(CheckValue(log, "d", 6));
+
+    // Compaction keeps the live records only
+    for (int i = 0; i < 2000; i++)
+        BOOST_CHECK(log.Write(strprintf("key%d", i % 100), MakeValue(i)));
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(log.Write(strprintf("skip%d", i), MakeValue(i)));
+    BOOST_CHECK(!log.NeedsCompaction());
+    CDataStream ssLarge(SER_DISK, CLIENT_VERSION);
+    ssLarge << std::string(1000, 'y');
+    while (log.GetFileSize() < RECORD_LOG_MIN_COMPACT_SIZE)
+        BOOST_CHECK(log.Write("large", ssLarge));
+    BOOST_CHECK(log.NeedsCompaction());
+    BOOST_CHECK(log.Erase("large"));
+    nFileSize = log.GetFileSize();
+    BOOST_CHECK(log.Compact("skip"));
+    BOOST_CHECK(log.GetFileSize() < nFileSize / 10);
+    BOOST_CHECK_EQUAL(log.GetRecordCount(), 103U);
+    BOOST_CHECK(!log.NeedsCompaction());
+    BOOST_CHECK(!log.Exists("skip0"));
+    BOOST_CHECK(CheckValue(log, "key7", 1907));
+    BOOST_CHECK(log.Write("key7", MakeValue(7)));
+    log.Close();
+    BOOST_REQUIRE(log.Open(path, false));
+    BOOST_CHECK_EQUAL(log.GetRecordCount(), 103U);
+    BOOST_CHECK(CheckValue(log, "key7", 7));
+    BOOST_CHECK(CheckValue(log, "key99", 1999));
+    BOOST_CHECK(CheckValue(log, "c", 4));
+
+    // A batch too large to be read back as one frame is not written
+    {
+        CRecordLogBatch batchLarge;
+        CDataStream ssHalf(SER_DISK, CLIENT_VERSION);
+        ssHalf << std::string(MAX_SIZE / 2, 'z');
+        batchLarge.Write("large1", ssHalf);
+        batchLarge.Write("large2", ssHalf);
+        BOOST_CHECK(batchLarge.nSize > MAX_SIZE);
+        nFileSize = log.GetFileSize();
+        BOOST_CHECK(!log.WriteBatch(batchLarge));
+        BOOST_CHECK_EQUAL(log.GetFileSize(), nFileSize);
+        batchLarge.Clear();
+        batchLarge.Write("large1", ssHalf);
+        BOOST_CHECK(log.WriteBatch(batchLarge));
+        log.Close();
+        BOOST_REQUIRE(log.Open(path, false));
+        BOOST_CHECK(log.Exists("large1") && !log.Exists("large2"));
+        BOOST_CHECK(log.Erase("large1"));
+        BOOST_CHECK(CheckValue(log, "c", 4));
+    }
+    log.Close();
+}
+
+BOOST_AUTO_TEST_CASE(record_log_walletdb)
+{
+    bitdb.UseRecordLog(true);
+    const std::string strFile = "record_log_wallet.dat";
+    {
+        CWalletDB walletdb(strFile, "cr+");
+        BOOST_CHECK(walletdb.WriteName("address", "name"));
+        BOOST_CHECK(walletdb.WritePool(1, CKeyPool()));
+        BOOST_CHECK(walletdb.WritePool(2, CKeyPool()));
+
+        // Changes in a transaction are seen by it, and written together
+        CAccount account;
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WriteAccount("account", account));
+        BOOST_CHECK(walletdb.ErasePool(2));
+        BOOST_CHECK(walletdb.ReadAccount("account", account));
+        CKeyPool keypool;
+        BOOST_CHECK(!walletdb.ReadPool(2, keypool));
+        BOOST_CHECK(walletdb.TxnAbort());
+        BOOST_CHECK(!walletdb.ReadAccount("account", account));
+        BOOST_CHECK(walletdb.ReadPool(2, keypool));
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WriteAccount("account", account));
+        BOOST_CHECK(walletdb.TxnCommit());
+
+        // Cursors see the records in key order
+        for (int i = 0; i < 3; i++) {
+            CAccountingEntry entry;
+            entry.strAccount = "account";
+            entry.nCreditDebit = i;
+            BOOST_CHECK(walletdb.WriteAccountingEntry(i, entry));
+        }
+        std::list<CAccountingEntry> entries;
+        walletdb.ListAccountCreditDebit("account", entries);
+        BOOST_CHECK_EQUAL(entries.size(), 3U);
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("account"), 3);
+    }
+    BOOST_CHECK(boost::filesystem::exists(CDBEnv::GetLogPath(strFile)));
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / strFile));
+
+    // Rewriting the wallet compacts its log
+    BOOST_CHECK(CDB::Rewrite(strFile, "\x04pool"));
+    {
+        CWalletDB walletdb(strFile, "r");
+        CKeyPool keypool;
+        BOOST_CHECK(!walletdb.ReadPool(1, keypool));
+        CAccount account;
+        BOOST_CHECK(walletdb.ReadAccount("account", account));
+    }
+
+    // The log is read back from disk once closed
+    bitdb.CloseDb(strFile);
+    {
+        CWalletDB walletdb(strFile, "r");
+        CAccount account;
+        BOOST_CHECK(walletdb.ReadAccount("account", account));
+        BOOST_CHECK_EQUAL(walletdb.GetAccountCreditDebit("*"), 3);
+    }
+    bitdb.UseRecordLog(false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
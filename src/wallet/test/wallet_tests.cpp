@@ -9,7 +9,9 @@
 #include <utility>
 #include <vector>
 
+#include "chainparams.h"
 #include "rpc/server.h"
+#include "script/interpreter.h"
 #include "test/test_bitcoin.h"
 #include "validation.h"
 #include "wallet/test/wallet_test_fixture.h"
@@ -363,6 +365,57 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(branch_and_bound)
+{
+    std::vector<char> vfBest;
+    CAmount nBest;
+
+    // Values are given largest first; the first best match found is kept
+    std::vector<CAmount> vValues = {5 * CENT, 4 * CENT, 3 * CENT, 2 * CENT, 1 * CENT};
+    BOOST_CHECK(SelectCoinsBnB(vValues, 7 * CENT, 0, 1000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 7 * CENT);
+    BOOST_CHECK(vfBest == std::vector<char>({1, 0, 0, 1, 0}));
+    BOOST_CHECK(SelectCoinsBnB(vValues, 15 * CENT, 0, 1000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 16 * CENT, 0, 1000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+
+    // Only matches within the cost of change are taken, the closest first
+    vValues = {10 * CENT, 6 * CENT};
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 5 * CENT, 0, 1000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK(SelectCoinsBnB(vValues, 5 * CENT, CENT, 1000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 6 * CENT);
+    vValues = {7 * CENT, 6 * CENT, 3 * CENT, 3 * CENT};
+    BOOST_CHECK(SelectCoinsBnB(vValues, 6 * CENT, 3 * CENT, 1000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 6 * CENT);
+
+    // Many equal coins do not blow up the search
+    vValues.assign(1000, 2 * CENT);
+    vValues.push_back(CENT);
+    BOOST_CHECK(SelectCoinsBnB(vValues, 1001 * CENT, 0, 10000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK_EQUAL(nBest, 1001 * CENT);
+
+    // The search gives up when out of tries or time
+    vValues.clear();
+    for (int i = 0; i < 100; i++)
+        vValues.push_back((100 - i) * 2 * CENT);
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 101 * CENT, 0, 100000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 100 * CENT + 2 * CENT, 0, 10, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+    BOOST_CHECK(!SelectCoinsBnB(vValues, 100 * CENT + 2 * CENT, 0, 100000, 0, vfBest, nBest));
+    BOOST_CHECK(SelectCoinsBnB(vValues, 100 * CENT + 2 * CENT, 0, 100000, std::numeric_limits<int64_t>::max(), vfBest, nBest));
+
+    // Coin selection takes coins within the cost of change of the target
+    LOCK(wallet.cs_wallet);
+    empty_wallet();
+    add_coin(10 * CENT);
+    add_coin(6 * CENT);
+    add_coin(3 * CENT);
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+    BOOST_CHECK(wallet.SelectCoinsMinConf(12 * CENT, 1, 6, 0, vCoins, setCoinsRet, nValueRet, CENT));
+    BOOST_CHECK_EQUAL(nValueRet, 13 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    empty_wallet();
+}
+
 BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
 {
     LOCK(cs_main);
@@ -430,6 +483,281 @@ BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
     }
 }
 
+BOOST_AUTO_TEST_CASE(script_filter)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(false);
+    CScript scriptMultisig = GetScriptForMultisig(1, {keyOther.GetPubKey(), key.GetPubKey()});
+    CScript scriptWatch = CScript() << OP_RETURN << ToByteVector(keyOther.GetPubKey());
+    CScript scriptRedeem = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    CScript scriptRedeemMine = GetScriptForMultisig(1, {key.GetPubKey()});
+
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+    wallet.AddKeyPubKey(key, key.GetPubKey());
+    wallet.AddCScript(scriptRedeem);
+    wallet.AddCScript(scriptRedeemMine);
+    wallet.AddWatchOnly(scriptWatch, 0);
+    CWalletScriptFilter filter = wallet.GetScriptFilter();
+
+    std::vector<unsigned char> vchPubKey = ToByteVector(key.GetPubKey()), vchKeyID = ToByteVector(key.GetPubKey().GetID());
+    std::vector<unsigned char> vchPushData1PubKey = {OP_PUSHDATA1, 33}, vchPushData1KeyHash = {OP_DUP, OP_HASH160, OP_PUSHDATA1, 20};
+    vchPushData1PubKey.insert(vchPushData1PubKey.end(), vchPubKey.begin(), vchPubKey.end());
+    vchPushData1PubKey.push_back(OP_CHECKSIG);
+    vchPushData1KeyHash.insert(vchPushData1KeyHash.end(), vchKeyID.begin(), vchKeyID.end());
+    vchPushData1KeyHash.push_back(OP_EQUALVERIFY);
+    vchPushData1KeyHash.push_back(OP_CHECKSIG);
+
+    // Everything ::IsMine recognizes passes the filter, including pushes
+    // that are not minimal
+    std::vector<CScript> vScripts = {
+        GetScriptForDestination(key.GetPubKey().GetID()),
+        GetScriptForRawPubKey(key.GetPubKey()),
+        CScript(vchPushData1PubKey.begin(), vchPushData1PubKey.end()),
+        CScript(vchPushData1KeyHash.begin(), vchPushData1KeyHash.end()),
+        scriptMultisig,
+        scriptRedeemMine,
+        GetScriptForDestination(CScriptID(scriptRedeem)),
+        GetScriptForDestination(CScriptID(scriptRedeemMine)),
+        scriptWatch,
+        GetScriptForDestination(keyOther.GetPubKey().GetID()),
+        GetScriptForRawPubKey(keyOther.GetPubKey()),
+        CScript() << OP_TRUE,
+    };
+    BOOST_CHECK_EQUAL(::IsMine(wallet, vScripts[2]), ISMINE_SPENDABLE);
+    BOOST_CHECK_EQUAL(::IsMine(wallet, vScripts[3]), ISMINE_SPENDABLE);
+    for (const CScript& script : vScripts) {
+        isminetype mine = ::IsMine(wallet, script);
+        if (mine != ISMINE_NO)
+            BOOST_CHECK(filter.MayMatch(script));
+        BOOST_CHECK_EQUAL(wallet.IsMine(CTxOut(1, script)), mine);
+    }
+    BOOST_CHECK(filter.MayMatch(GetScriptForDestination(CScriptID(scriptRedeem))));
+    BOOST_CHECK(!filter.MayMatch(scriptMultisig));
+    BOOST_CHECK(!filter.MayMatch(GetScriptForDestination(keyOther.GetPubKey().GetID())));
+    BOOST_CHECK(!filter.MayMatch(GetScriptForRawPubKey(keyOther.GetPubKey())));
+    BOOST_CHECK(!filter.MayMatch(CScript() << OP_TRUE));
+
+    // Keys added later are found through the wallet's own filter, across
+    // resizes of the bloom filter, and few other outputs get past it
+    std::vector<CPubKey> vPubKeys;
+    for (int i = 0; i < 500; i++) {
+        CKey keyNew;
+        keyNew.MakeNewKey(i % 2 == 0);
+        wallet.AddKeyPubKey(keyNew, keyNew.GetPubKey());
+        vPubKeys.push_back(keyNew.GetPubKey());
+    }
+    filter = wallet.GetScriptFilter();
+    BOOST_CHECK_EQUAL(filter.Size(), 2 * 501 + 2 + 1);
+    for (const CPubKey& pubkey : vPubKeys) {
+        BOOST_CHECK(filter.MayMatch(GetScriptForDestination(pubkey.GetID())));
+        BOOST_CHECK(filter.MayMatch(GetScriptForRawPubKey(pubkey)));
+        BOOST_CHECK_EQUAL(wallet.IsMine(CTxOut(1, GetScriptForDestination(pubkey.GetID()))), ISMINE_SPENDABLE);
+    }
+    int nFalsePositives = 0;
+    for (int i = 0; i < 2000; i++) {
+        uint256 hash = GetRandHash();
+        CKeyID keyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)));
+        nFalsePositives += filter.MayMatch(GetScriptForDestination(keyID));
+    }
+    BOOST_CHECK(nFalsePositives == 0);
+}
+
+// Verify a rescan finds transactions that only spend from the wallet, and
+// transactions spending those, past the chunk boundaries of the rescan.
+BOOST_FIXTURE_TEST_CASE(rescan_spends, TestChain100Setup)
+{
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptCoinbase = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptOther;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CreateAndProcessBlock({spend}, scriptOther);
+    CBlock block = CreateAndProcessBlock({}, scriptOther);
+
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    CWallet wallet;
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+    }
+    BOOST_CHECK_EQUAL(chainActive.Genesis(), wallet.ScanForWalletTransactions(chainActive.Genesis()));
+
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK(wallet.GetWalletTx(spend.GetHash()));
+    BOOST_CHECK(wallet.IsSpent(coinbaseTxns[0].GetHash(), 0));
+    // The coinbases of the last two blocks pay someone else
+    for (size_t i = 0; i < coinbaseTxns.size(); i++)
+        BOOST_CHECK_EQUAL(wallet.GetWalletTx(coinbaseTxns[i].GetHash()) != NULL, i < 100);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 101U);
+}
+
+static void CheckBalances(const CWallet& wallet)
+{
+    CWalletBalance balance;
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        for (std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it) {
+            const CWalletTx& wtx = it->second;
+            if (wtx.IsTrusted()) {
+                balance.nTrusted += wtx.GetAvailableCredit(false);
+                balance.nWatchOnlyTrusted += wtx.GetAvailableWatchOnlyCredit(false);
+            } else if (wtx.GetDepthInMainChain() == 0 && wtx.InMempool()) {
+                balance.nUntrustedPending += wtx.GetAvailableCredit(false);
+                balance.nWatchOnlyUntrustedPending += wtx.GetAvailableWatchOnlyCredit(false);
+            }
+            balance.nImmature += wtx.GetImmatureCredit(false);
+            balance.nWatchOnlyImmature += wtx.GetImmatureWatchOnlyCredit(false);
+        }
+    }
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), balance.nTrusted);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), balance.nUntrustedPending);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), balance.nImmature);
+    BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance(), balance.nWatchOnlyTrusted);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedWatchOnlyBalance(), balance.nWatchOnlyUntrustedPending);
+    BOOST_CHECK_EQUAL(wallet.GetImmatureWatchOnlyBalance(), balance.nWatchOnlyImmature);
+}
+
+static void CheckAvailableCoins(const CWallet& wallet)
+{
+    std::set<COutPoint> setExpected, setAvailable;
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        for (std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it) {
+            const CWalletTx& wtx = it->second;
+            int nDepth = wtx.GetDepthInMainChain();
+            if (!wtx.IsTrusted() || wtx.GetBlocksToMaturity() > 0 || nDepth < 0 || (nDepth == 0 && !wtx.InMempool()))
+                continue;
+            for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+                if (!wallet.IsSpent(it->first, i) && wallet.IsMine(wtx.tx->vout[i]) != ISMINE_NO &&
+                    !wallet.IsLockedCoin(it->first, i) && wtx.tx->vout[i].nValue > 0)
+                    setExpected.insert(COutPoint(it->first, i));
+            }
+        }
+    }
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    BOOST_FOREACH(const COutput& out, vCoins)
+        setAvailable.insert(COutPoint(out.tx->GetHash(), out.i));
+    BOOST_CHECK_EQUAL(vCoins.size(), setAvailable.size());
+    BOOST_CHECK(setAvailable == setExpected);
+}
+
+// Verify the incrementally kept balances and unspent outputs match summing
+// over all wallet transactions as coinbases mature, a spend goes through the
+// mempool into a block, and that block is disconnected and connected again.
+BOOST_FIXTURE_TEST_CASE(incremental_balances_and_coins, TestChain100Setup)
+{
+    CKey keyWatch;
+    keyWatch.MakeNewKey(true);
+    CScript scriptCoinbase = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    CScript scriptWatch = GetScriptForDestination(keyWatch.GetPubKey().GetID());
+
+    CWallet wallet;
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+        wallet.AddWatchOnly(scriptWatch, 0);
+    }
+    {
+        LOCK(cs_main);
+        wallet.ScanForWalletTransactions(chainActive.Genesis());
+    }
+    CheckBalances(wallet);
+    CheckAvailableCoins(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+    BOOST_CHECK(wallet.GetImmatureBalance() > 0);
+
+    RegisterValidationInterface(&wallet);
+    for (int i = 0; i < 2; i++) {
+        coinbaseTxns.emplace_back(*CreateAndProcessBlock({}, scriptCoinbase).vtx[0]);
+        CheckBalances(wallet);
+        CheckAvailableCoins(wallet);
+    }
+    BOOST_CHECK(wallet.GetBalance() > 0);
+
+    // Spend a mature coinbase to a watch-only script and back to the wallet
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptWatch;
+    spend.vout[1].nValue = coinbaseTxns[0].vout[0].nValue - 12 * CENT;
+    spend.vout[1].scriptPubKey = scriptCoinbase;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(spend), false, NULL));
+    }
+    CheckBalances(wallet);
+    CheckAvailableCoins(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance() + wallet.GetUnconfirmedWatchOnlyBalance(), 11 * CENT);
+
+    CBlock block = CreateAndProcessBlock({spend}, scriptCoinbase);
+    CheckBalances(wallet);
+    CheckAvailableCoins(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance(), 11 * CENT);
+
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        pindex = mapBlockIndex[block.GetHash()];
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), pindex));
+    }
+    CheckBalances(wallet);
+    CheckAvailableCoins(wallet);
+    {
+        LOCK(cs_main);
+        ResetBlockFailureFlags(pindex);
+    }
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    CheckBalances(wallet);
+    CheckAvailableCoins(wallet);
+    BOOST_CHECK_EQUAL(wallet.GetWatchOnlyBalance(), 11 * CENT);
+
+    // Locked coins stay in the index
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.LockCoin(COutPoint(spend.GetHash(), 1));
+    }
+    CheckAvailableCoins(wallet);
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.UnlockCoin(COutPoint(spend.GetHash(), 1));
+    }
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK(std::find_if(vCoins.begin(), vCoins.end(), [&spend](const COutput& out) { return out.tx->GetHash() == spend.GetHash() && out.i == 1; }) != vCoins.end());
+
+    wallet.MarkDirty();
+    CheckBalances(wallet);
+    CheckAvailableCoins(wallet);
+    UnregisterValidationInterface(&wallet);
+}
+
 // Verify importwallet RPC starts rescan at earliest block with timestamp
 // greater or equal than key birthday. Previously there was a bug where
 // importwallet RPC would start the scan at the latest block with timestamp less
@@ -490,4 +818,240 @@ BOOST_FIXTURE_TEST_CASE(importwallet_rescan, TestChain100Setup)
     ::pwalletMain = pwalletMainBackup;
 }
 
+// Verify fully spent transactions deep in the chain are compacted to
+// summaries, still count as spending the wallet's outputs, are read back from
+// the wallet file on demand, and are expanded again when added back.
+BOOST_FIXTURE_TEST_CASE(compact_transactions, TestChain100Setup)
+{
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptCoinbase = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptOther;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CreateAndProcessBlock({spend}, scriptOther);
+    CreateAndProcessBlock({}, scriptOther);
+
+    bitdb.MakeMock();
+    nWalletCompactDepth = 2;
+    {
+        CWallet wallet("wallet_test_compact.dat");
+        bool fFirstRun;
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        LOCK2(cs_main, wallet.cs_wallet);
+        wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+        wallet.ScanForWalletTransactions(chainActive.Genesis());
+        CAmount nBalance = wallet.GetBalance();
+        CAmount nImmature = wallet.GetImmatureBalance();
+
+        // Only the spent coinbase and its spend are done with
+        wallet.CompactTransactions();
+        BOOST_CHECK_EQUAL(wallet.mapWalletCompact.size(), 2U);
+        BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 99U);
+        BOOST_CHECK(!wallet.GetWalletTx(spend.GetHash()));
+        BOOST_CHECK(wallet.IsSpent(coinbaseTxns[0].GetHash(), 0));
+        BOOST_CHECK_EQUAL(wallet.mapWalletCompact[spend.GetHash()].nNet, -coinbaseTxns[0].vout[0].nValue);
+        BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance);
+        BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), nImmature);
+        size_t nTx = 0;
+        wallet.ForEachWalletTx([&nTx](const CWalletTx&) { nTx++; });
+        BOOST_CHECK_EQUAL(nTx, 101U);
+
+        CWalletTx wtx;
+        BOOST_CHECK(wallet.ReadCompactTx(spend.GetHash(), wtx));
+        BOOST_CHECK(wtx.GetHash() == spend.GetHash());
+        BOOST_CHECK_EQUAL(wtx.GetDepthInMainChain(), 2);
+        BOOST_CHECK_EQUAL(wallet.GetDebit(spend.vin[0], ISMINE_SPENDABLE), coinbaseTxns[0].vout[0].nValue);
+
+        BOOST_CHECK(wallet.AddToWallet(wtx));
+        BOOST_CHECK(wallet.GetWalletTx(spend.GetHash()));
+        BOOST_CHECK(!wallet.mapWalletCompact.count(spend.GetHash()));
+        BOOST_CHECK(!wallet.ReadCompactTx(spend.GetHash(), wtx));
+        BOOST_CHECK(wallet.IsSpent(coinbaseTxns[0].GetHash(), 0));
+    }
+    {
+        // The coinbase is loaded compact from its stored summary
+        CWallet wallet("wallet_test_compact.dat");
+        bool fFirstRun;
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        LOCK2(cs_main, wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.mapWalletCompact.size(), 1U);
+        BOOST_CHECK(wallet.mapWalletCompact.count(coinbaseTxns[0].GetHash()));
+        BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 100U);
+        BOOST_CHECK(wallet.GetWalletTx(spend.GetHash()));
+        BOOST_CHECK(wallet.IsSpent(coinbaseTxns[0].GetHash(), 0));
+    }
+    nWalletCompactDepth = DEFAULT_WALLET_COMPACT_DEPTH;
+    bitdb.Flush(true);
+    bitdb.Reset();
+}
+
+// Verify a parent kept compact comes back when its spender leaves the chain
+// in a reorg deeper than the compaction depth and is then abandoned.
+BOOST_FIXTURE_TEST_CASE(compact_transactions_abandon, TestChain100Setup)
+{
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptCoinbase = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptOther;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCoinbase, spend, 0, SIGHASH_ALL);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    // The spent coinbase stays mature once the spend is disconnected
+    CreateAndProcessBlock({}, scriptOther);
+    CreateAndProcessBlock({}, scriptOther);
+    CBlock block = CreateAndProcessBlock({spend}, scriptOther);
+    CreateAndProcessBlock({}, scriptOther);
+
+    bitdb.MakeMock();
+    nWalletCompactDepth = 2;
+    {
+        CWallet wallet("wallet_test_compact_abandon.dat");
+        bool fFirstRun;
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        {
+            LOCK2(cs_main, wallet.cs_wallet);
+            wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey());
+            wallet.ScanForWalletTransactions(chainActive.Genesis());
+            wallet.CompactTransactions();
+            BOOST_CHECK(wallet.mapWalletCompact.count(coinbaseTxns[0].GetHash()));
+            BOOST_CHECK(wallet.mapWalletCompact.count(spend.GetHash()));
+        }
+
+        RegisterValidationInterface(&wallet);
+        {
+            LOCK(cs_main);
+            CValidationState state;
+            BOOST_CHECK(InvalidateBlock(state, Params(), mapBlockIndex[block.GetHash()]));
+        }
+        CValidationState state;
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+        UnregisterValidationInterface(&wallet);
+        mempool.clear();
+
+        LOCK2(cs_main, wallet.cs_wallet);
+        BOOST_CHECK(wallet.GetWalletTx(coinbaseTxns[0].GetHash()));
+        CAmount nBalance = wallet.GetBalance();
+        BOOST_CHECK(wallet.AbandonTransaction(spend.GetHash()));
+        BOOST_CHECK(!wallet.IsSpent(coinbaseTxns[0].GetHash(), 0));
+        BOOST_CHECK_EQUAL(wallet.GetBalance(), nBalance + coinbaseTxns[0].vout[0].nValue);
+    }
+    nWalletCompactDepth = DEFAULT_WALLET_COMPACT_DEPTH;
+    bitdb.Flush(true);
+    bitdb.Reset();
+}
+
+BOOST_AUTO_TEST_CASE(write_batch)
+{
+    // A key pool larger than one batch is committed in several
+    BOOST_CHECK(pwalletMain->TopUpKeyPool(WALLETDB_BATCH_ITEMS + 10));
+    unsigned int nKeyPoolSize = pwalletMain->GetKeyPoolSize();
+    BOOST_CHECK_EQUAL(nKeyPoolSize, WALLETDB_BATCH_ITEMS + 11);
+
+    // Writes within an outer batch join it, including those made by an
+    // inner one
+    CKey key;
+    key.MakeNewKey(true);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        CWalletBatch batch(pwalletMain);
+        BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+        BOOST_CHECK(pwalletMain->SetAddressBook(key.GetPubKey().GetID(), "batch", "receive"));
+        BOOST_CHECK(pwalletMain->TopUpKeyPool(nKeyPoolSize + 9));
+        BOOST_CHECK_NO_THROW(batch.ItemDone());
+    }
+
+    CWallet wallet("wallet_test.dat");
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(wallet.GetKeyPoolSize(), nKeyPoolSize + 10);
+    BOOST_CHECK(wallet.HaveKey(key.GetPubKey().GetID()));
+    BOOST_CHECK_EQUAL(wallet.mapAddressBook[key.GetPubKey().GetID()].name, "batch");
+    std::set<CKeyID> setKeys, setKeysLoaded;
+    pwalletMain->GetKeys(setKeys);
+    wallet.GetKeys(setKeysLoaded);
+    BOOST_CHECK(setKeys == setKeysLoaded);
+}
+
+BOOST_AUTO_TEST_CASE(generate_hd_keys)
+{
+    bool fFirstRun;
+    CWallet walletSerial("wallet_test_hd_serial.dat");
+    CWallet walletParallel("wallet_test_hd_parallel.dat");
+    BOOST_CHECK_EQUAL(walletSerial.LoadWallet(fFirstRun), DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(walletParallel.LoadWallet(fFirstRun), DB_LOAD_OK);
+    LOCK2(walletSerial.cs_wallet, walletParallel.cs_wallet);
+
+    CPubKey masterPubKey = walletSerial.GenerateNewHDMasterKey();
+    BOOST_CHECK(walletSerial.SetHDMasterKey(masterPubKey));
+    CKey masterKey;
+    BOOST_CHECK(walletSerial.GetKey(masterPubKey.GetID(), masterKey));
+    BOOST_CHECK(walletParallel.AddKeyPubKey(masterKey, masterPubKey));
+    BOOST_CHECK(walletParallel.SetHDMasterKey(masterPubKey));
+
+    // Keys derived one at a time and in a batch are the same, and keys
+    // the wallet already has are skipped in both
+    std::vector<CPubKey> vSerial;
+    for (int i = 0; i < 401; i++)
+        vSerial.push_back(walletSerial.GenerateNewKey());
+    CKey keyKnown;
+    BOOST_CHECK(walletSerial.GetKey(vSerial[3].GetID(), keyKnown));
+    BOOST_CHECK(walletParallel.AddKeyPubKey(keyKnown, vSerial[3]));
+    std::vector<CPubKey> vParallel = walletParallel.GenerateNewKeys(400);
+    vSerial.erase(vSerial.begin() + 3);
+    BOOST_CHECK(vParallel == vSerial);
+    BOOST_CHECK_EQUAL(walletParallel.GetHDChain().nExternalChainCounter, 401U);
+    BOOST_CHECK_EQUAL(walletParallel.mapKeyMetadata[vParallel[3].GetID()].hdKeypath, "m/0'/0'/4'");
+    BOOST_CHECK(walletParallel.GenerateNewKey() == walletSerial.GenerateNewKey());
+}
+
+BOOST_AUTO_TEST_CASE(wallet_endpoint)
+{
+    CWallet wallet("wallet_test_endpoint.dat");
+    JSONRPCRequest request;
+
+    // With no wallets listed, requests go to the main wallet
+    BOOST_CHECK(GetWalletForJSONRPCRequest(request) == pwalletMain);
+
+    vpwallets.push_back(pwalletMain);
+    BOOST_CHECK(GetWalletForJSONRPCRequest(request) == pwalletMain);
+    vpwallets.push_back(&wallet);
+
+    // A wallet must be named once several are loaded, except for help
+    BOOST_CHECK_THROW(GetWalletForJSONRPCRequest(request), UniValue);
+    request.fHelp = true;
+    BOOST_CHECK(GetWalletForJSONRPCRequest(request) == pwalletMain);
+    request.fHelp = false;
+
+    request.URI = "/wallet/wallet_test.dat";
+    BOOST_CHECK(GetWalletForJSONRPCRequest(request) == pwalletMain);
+    request.URI = "/wallet/wallet%5Ftest%5Fendpoint.dat";
+    BOOST_CHECK(GetWalletForJSONRPCRequest(request) == &wallet);
+    request.URI = "/wallet/missing.dat";
+    BOOST_CHECK_THROW(GetWalletForJSONRPCRequest(request), UniValue);
+
+    vpwallets.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
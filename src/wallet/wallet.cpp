@@ -14,6 +14,7 @@
 #include "wallet/coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "hash.h"
 #include "key.h"
 #include "keystore.h"
 #include "validation.h"
@@ -21,6 +22,7 @@
 #include "policy/policy.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
@@ -30,6 +32,10 @@
 #include "utilmoneystr.h"
 
 #include <assert.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -38,11 +44,15 @@
 using namespace std;
 
 CWallet* pwalletMain = NULL;
+std::vector<CWallet*> vpwallets;
 /** Transaction fee set by the user */
 CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
+unsigned int nCoinSelectionTries = DEFAULT_COINSELECTION_TRIES;
+int64_t nCoinSelectionTimeout = DEFAULT_COINSELECTION_TIMEOUT;
+unsigned int nWalletCompactDepth = DEFAULT_WALLET_COMPACT_DEPTH;
 
 const char * DEFAULT_WALLET_DAT = "wallet.dat";
 const uint32_t BIP32_HARDENED_KEY_LIMIT = 0x80000000;
@@ -75,6 +85,31 @@ struct CompareValueOnly
     }
 };
 
+namespace {
+
+/** The handle of the wallet's open write batch, or a handle of its own */
+class CWalletDBRef
+{
+private:
+    std::unique_ptr<CWalletDB> pwalletdbOwned;
+    CWalletDB* pwalletdb;
+
+public:
+    CWalletDBRef(CWalletDB* pwalletdbBatch, const std::string& strWalletFile, bool fFlushOnClose = true)
+    {
+        pwalletdb = pwalletdbBatch;
+        if (!pwalletdb) {
+            pwalletdbOwned.reset(new CWalletDB(strWalletFile, "r+", fFlushOnClose));
+            pwalletdb = pwalletdbOwned.get();
+        }
+    }
+
+    CWalletDB* operator->() { return pwalletdb; }
+    CWalletDB* get() { return pwalletdb; }
+};
+
+} // anon namespace
+
 std::string COutput::ToString() const
 {
     return strprintf("COutput(%s, %d, %d) [%s]", tx->GetHash().ToString(), i, nDepth, FormatMoney(tx->tx->vout[i].nValue));
@@ -89,6 +124,42 @@ const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
     return &(it->second);
 }
 
+bool CWallet::ReadCompactTx(const uint256& hash, CWalletTx& wtx, CWalletDB* pwalletdb) const
+{
+    AssertLockHeld(cs_wallet);
+    if (!mapWalletCompact.count(hash))
+        return false;
+
+    // Reads go through the open batch, if any, so they see its writes
+    if (!pwalletdb)
+        pwalletdb = pwalletdbBatch;
+    bool fRead = pwalletdb ? pwalletdb->ReadTx(hash, wtx) : CWalletDB(strWalletFile, "r").ReadTx(hash, wtx);
+    if (!fRead || wtx.GetHash() != hash) {
+        LogPrintf("%s: cannot read wallet transaction %s\n", __func__, hash.ToString());
+        return false;
+    }
+    wtx.BindWalletCopy(this);
+    return true;
+}
+
+void CWallet::ForEachWalletTx(const std::function<void(const CWalletTx&)>& func) const
+{
+    AssertLockHeld(cs_wallet);
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        func(it->second);
+
+    if (mapWalletCompact.empty())
+        return;
+    std::unique_ptr<CWalletDB> pwalletdbRead;
+    if (!pwalletdbBatch)
+        pwalletdbRead.reset(new CWalletDB(strWalletFile, "r"));
+    for (map<uint256, CWalletTxSummary>::const_iterator it = mapWalletCompact.begin(); it != mapWalletCompact.end(); ++it) {
+        CWalletTx wtx;
+        if (ReadCompactTx(it->first, wtx, pwalletdbRead.get()))
+            func(wtx);
+    }
+}
+
 CPubKey CWallet::GenerateNewKey()
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
@@ -122,14 +193,116 @@ CPubKey CWallet::GenerateNewKey()
     return pubkey;
 }
 
-void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
+namespace {
+
+/** Keys derived per thread at least when a batch of HD keys is generated */
+static const unsigned int MIN_DERIVE_KEYS_PER_THREAD = 100;
+/** Most threads deriving a batch of HD keys */
+static const int MAX_DERIVE_THREADS = 8;
+
+/** A child key derived on a worker thread */
+struct CDerivedKey
+{
+    CKey key;
+    CPubKey pubkey;
+    bool fValid;
+
+    CDerivedKey() : fValid(false) {}
+};
+
+/**
+ * Derive the hardened children of chainKey from nFirst on into vKeys, on
+ * up to nThreads threads each taking a contiguous range. The extended keys
+ * are not needed, so the fingerprint of the parent is not computed for
+ * each child.
+ */
+void DeriveChildKeys(const CExtKey& chainKey, uint32_t nFirst, std::vector<CDerivedKey>& vKeys, int nThreads)
+{
+    auto derive = [&chainKey, nFirst, &vKeys](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            ChainCode ccChild;
+            CDerivedKey& derived = vKeys[i];
+            if (!chainKey.key.Derive(derived.key, ccChild, (nFirst + i) | BIP32_HARDENED_KEY_LIMIT, chainKey.chaincode))
+                continue;
+            derived.pubkey = derived.key.GetPubKey();
+            derived.fValid = derived.key.VerifyPubKey(derived.pubkey);
+        }
+    };
+
+    size_t nPerThread = (vKeys.size() + nThreads - 1) / nThreads;
+    std::vector<std::thread> threads;
+    size_t nBegin = nPerThread;
+    try {
+        for (; nBegin < vKeys.size(); nBegin += nPerThread)
+            threads.emplace_back(derive, nBegin, std::min(nBegin + nPerThread, vKeys.size()));
+    } catch (const std::system_error& e) {
+        // The keys no thread could be started for are derived here
+        LogPrintf("%s: cannot start a thread, deriving on this one: %s\n", __func__, e.what());
+    }
+    derive(0, std::min(nPerThread, vKeys.size()));
+    if (nBegin < vKeys.size())
+        derive(nBegin, vKeys.size());
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+} // anon namespace
+
+std::vector<CPubKey> CWallet::GenerateNewKeys(unsigned int nKeys)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
+    std::vector<CPubKey> vPubKeys;
+    vPubKeys.reserve(nKeys);
+    if (!IsHDEnabled()) {
+        while (vPubKeys.size() < nKeys)
+            vPubKeys.push_back(GenerateNewKey());
+        return vPubKeys;
+    }
+
+    CExtKey externalChainChildKey;
+    DeriveExternalChainKey(externalChainChildKey);
+    int64_t nCreationTime = GetTime();
+    int nThreads = std::max(1, std::min(std::min(GetNumCores(), MAX_DERIVE_THREADS), (int)(nKeys / MIN_DERIVE_KEYS_PER_THREAD)));
+
+    // Derive the missing keys in one go, and again for those that were
+    // skipped as already known to the wallet
+    while (vPubKeys.size() < nKeys) {
+        std::vector<CDerivedKey> vKeys(nKeys - vPubKeys.size());
+        uint32_t nFirst = hdChain.nExternalChainCounter;
+        DeriveChildKeys(externalChainChildKey, nFirst, vKeys, nThreads);
+        hdChain.nExternalChainCounter += vKeys.size();
+
+        for (size_t i = 0; i < vKeys.size(); i++) {
+            const CDerivedKey& derived = vKeys[i];
+            if (!derived.fValid)
+                throw std::runtime_error(std::string(__func__) + ": Deriving key failed");
+            if (HaveKey(derived.pubkey.GetID()))
+                continue;
+
+            CKeyMetadata metadata(nCreationTime);
+            metadata.hdKeypath = "m/0'/0'/" + std::to_string(nFirst + i) + "'";
+            metadata.hdMasterKeyID = hdChain.masterKeyID;
+            mapKeyMetadata[derived.pubkey.GetID()] = metadata;
+            UpdateTimeFirstKey(nCreationTime);
+
+            if (!AddKeyPubKey(derived.key, derived.pubkey))
+                throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+            vPubKeys.push_back(derived.pubkey);
+        }
+    }
+
+    // update the chain model in the database
+    if (!CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteHDChain(hdChain))
+        throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
+    return vPubKeys;
+}
+
+void CWallet::DeriveExternalChainKey(CExtKey& externalChainChildKey)
 {
     // for now we use a fixed keypath scheme of m/0'/0'/k
     CKey key;                      //master key seed (256bit)
     CExtKey masterKey;             //hd master key
     CExtKey accountKey;            //key at m/0'
-    CExtKey externalChainChildKey; //key at m/0'/0'
-    CExtKey childKey;              //key at m/0'/0'/<n>'
 
     // try to get the master key
     if (!GetKey(hdChain.masterKeyID, key))
@@ -143,6 +316,14 @@ void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
 
     // derive m/0'/0'
     accountKey.Derive(externalChainChildKey, BIP32_HARDENED_KEY_LIMIT);
+}
+
+void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
+{
+    CExtKey externalChainChildKey; //key at m/0'/0'
+    CExtKey childKey;              //key at m/0'/0'/<n>'
+
+    DeriveExternalChainKey(externalChainChildKey);
 
     // derive child key at next index, skip keys already known to the wallet
     do {
@@ -158,7 +339,7 @@ void CWallet::DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret)
     secret = childKey.key;
 
     // update the chain model in the database
-    if (!CWalletDB(strWalletFile).WriteHDChain(hdChain))
+    if (!CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteHDChain(hdChain))
         throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
 }
 
@@ -167,6 +348,10 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    {
+        LOCK(cs_KeyStore);
+        scriptFilter.AddKey(pubkey);
+    }
 
     // check if we need to remove from watch-only
     CScript script;
@@ -180,9 +365,9 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
-        return CWalletDB(strWalletFile).WriteKey(pubkey,
-                                                 secret.GetPrivKey(),
-                                                 mapKeyMetadata[pubkey.GetID()]);
+        return CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteKey(pubkey,
+                                                                     secret.GetPrivKey(),
+                                                                     mapKeyMetadata[pubkey.GetID()]);
     }
     return true;
 }
@@ -192,6 +377,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    {
+        LOCK(cs_KeyStore);
+        scriptFilter.AddKey(vchPubKey);
+    }
     if (!fFileBacked)
         return true;
     {
@@ -201,9 +390,9 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
         else
-            return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
-                                                            vchCryptedSecret,
-                                                            mapKeyMetadata[vchPubKey.GetID()]);
+            return CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteCryptedKey(vchPubKey,
+                                                                                vchCryptedSecret,
+                                                                                mapKeyMetadata[vchPubKey.GetID()]);
     }
     return false;
 }
@@ -216,9 +405,22 @@ bool CWallet::LoadKeyMetadata(const CTxDestination& keyID, const CKeyMetadata &m
     return true;
 }
 
+bool CWallet::LoadKey(const CKey& key, const CPubKey &pubkey)
+{
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    LOCK(cs_KeyStore);
+    scriptFilter.AddKey(pubkey);
+    return true;
+}
+
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    LOCK(cs_KeyStore);
+    scriptFilter.AddKey(vchPubKey);
+    return true;
 }
 
 void CWallet::UpdateTimeFirstKey(int64_t nCreateTime)
@@ -237,9 +439,13 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    {
+        LOCK(cs_KeyStore);
+        scriptFilter.AddScriptHash(CScriptID(redeemScript));
+    }
     if (!fFileBacked)
         return true;
-    return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
+    return CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
 bool CWallet::LoadCScript(const CScript& redeemScript)
@@ -255,19 +461,27 @@ bool CWallet::LoadCScript(const CScript& redeemScript)
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    LOCK(cs_KeyStore);
+    scriptFilter.AddScriptHash(CScriptID(redeemScript));
+    return true;
 }
 
 bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    {
+        LOCK(cs_KeyStore);
+        scriptFilter.AddScript(dest);
+    }
     const CKeyMetadata& meta = mapKeyMetadata[CScriptID(dest)];
     UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
         return true;
-    return CWalletDB(strWalletFile).WriteWatchOnly(dest, meta);
+    return CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteWatchOnly(dest, meta);
 }
 
 bool CWallet::AddWatchOnly(const CScript& dest, int64_t nCreateTime)
@@ -284,7 +498,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
-        if (!CWalletDB(strWalletFile).EraseWatchOnly(dest))
+        if (!CWalletDBRef(pwalletdbBatch, strWalletFile)->EraseWatchOnly(dest))
             return false;
 
     return true;
@@ -292,7 +506,11 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
 
 bool CWallet::LoadWatchOnly(const CScript &dest)
 {
-    return CCryptoKeyStore::AddWatchOnly(dest);
+    if (!CCryptoKeyStore::AddWatchOnly(dest))
+        return false;
+    LOCK(cs_KeyStore);
+    scriptFilter.AddScript(dest);
+    return true;
 }
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -367,6 +585,18 @@ void CWallet::SetBestChain(const CBlockLocator& loc)
     walletdb.WriteBestBlock(loc);
 }
 
+void CWallet::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (nWalletCompactDepth == 0)
+        return;
+
+    LOCK2(cs_main, cs_wallet);
+    // Transactions get deep enough to be kept compact at the pace of blocks
+    if (pindexNew->nHeight < nCompactHeight + WALLET_COMPACT_INTERVAL && pindexNew->nHeight >= nCompactHeight)
+        return;
+    CompactTransactions();
+}
+
 bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn, bool fExplicit)
 {
     LOCK(cs_wallet); // nWalletVersion
@@ -447,14 +677,19 @@ bool CWallet::Verify()
         return true;
 
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
-    std::string walletFile = GetArg("-wallet", DEFAULT_WALLET_DAT);
-
-    LogPrintf("Using wallet %s\n", walletFile);
     uiInterface.InitMessage(_("Verifying wallet..."));
 
-    // Wallet file must be a plain filename without a directory
-    if (walletFile != boost::filesystem::basename(walletFile) + boost::filesystem::extension(walletFile))
-        return InitError(strprintf(_("Wallet %s resides outside data directory %s"), walletFile, GetDataDir().string()));
+    std::set<std::string> setWalletFiles;
+    BOOST_FOREACH(const std::string& walletFile, GetWalletFiles()) {
+        LogPrintf("Using wallet %s\n", walletFile);
+
+        // Wallet file must be a plain filename without a directory
+        if (walletFile != boost::filesystem::basename(walletFile) + boost::filesystem::extension(walletFile))
+            return InitError(strprintf(_("Wallet %s resides outside data directory %s"), walletFile, GetDataDir().string()));
+
+        if (!setWalletFiles.insert(walletFile).second)
+            return InitError(strprintf(_("Error loading wallet %s. Duplicate -wallet filename specified."), walletFile));
+    }
 
     if (!bitdb.Open(GetDataDir()))
     {
@@ -475,31 +710,52 @@ bool CWallet::Verify()
         }
     }
 
-    if (GetBoolArg("-salvagewallet", false))
-    {
-        // Recover readable keypairs:
-        if (!CWalletDB::Recover(bitdb, walletFile, true))
-            return false;
-    }
+    BOOST_FOREACH(const std::string& walletFile, setWalletFiles) {
+        if (GetBoolArg("-salvagewallet", false))
+        {
+            // Recover readable keypairs:
+            if (!CWalletDB::Recover(bitdb, walletFile, true))
+                return false;
+        }
 
-    if (boost::filesystem::exists(GetDataDir() / walletFile))
-    {
-        CDBEnv::VerifyResult r = bitdb.Verify(walletFile, CWalletDB::Recover);
-        if (r == CDBEnv::RECOVER_OK)
+        // Once copied into a record log, the Berkeley DB file is moved aside,
+        // so finding both stores means one of them is out of date
+        boost::filesystem::path pathLog = CDBEnv::GetLogPath(walletFile);
+        bool fLogExists = boost::filesystem::exists(pathLog);
+        bool fFileExists = boost::filesystem::exists(GetDataDir() / walletFile);
+        if (fLogExists && fFileExists)
+            return InitError(strprintf(_("Both %s and its record log %s exist; move the one that is out of date out of the data directory"), walletFile, pathLog.filename().string()));
+        if (fLogExists && !bitdb.IsRecordLog())
+            return InitError(strprintf(_("%s is kept in the record log %s; start with -walletbackend=log"), walletFile, pathLog.filename().string()));
+        if (fFileExists)
         {
-            InitWarning(strprintf(_("Warning: Wallet file corrupt, data salvaged!"
-                                         " Original %s saved as %s in %s; if"
-                                         " your balance or transactions are incorrect you should"
-                                         " restore from a backup."),
-                walletFile, "wallet.{timestamp}.bak", GetDataDir()));
+            CDBEnv::VerifyResult r = bitdb.Verify(walletFile, CWalletDB::Recover);
+            if (r == CDBEnv::RECOVER_OK)
+            {
+                InitWarning(strprintf(_("Warning: Wallet file corrupt, data salvaged!"
+                                             " Original %s saved as %s in %s; if"
+                                             " your balance or transactions are incorrect you should"
+                                             " restore from a backup."),
+                    walletFile, "wallet.{timestamp}.bak", GetDataDir()));
+            }
+            if (r == CDBEnv::RECOVER_FAIL)
+                return InitError(strprintf(_("%s corrupt, salvage failed"), walletFile));
+
+            if (bitdb.IsRecordLog() && !bitdb.MigrateToLog(walletFile))
+                return InitError(strprintf(_("Error copying %s into a record log"), walletFile));
         }
-        if (r == CDBEnv::RECOVER_FAIL)
-            return InitError(strprintf(_("%s corrupt, salvage failed"), walletFile));
     }
 
     return true;
 }
 
+std::vector<std::string> CWallet::GetWalletFiles()
+{
+    if (mapMultiArgs.count("-wallet"))
+        return mapMultiArgs.at("-wallet");
+    return std::vector<std::string>(1, DEFAULT_WALLET_DAT);
+}
+
 void CWallet::SyncMetaData(pair<TxSpends::iterator, TxSpends::iterator> range)
 {
     // We want all the wallet transactions in range to have the same metadata as
@@ -511,6 +767,9 @@ void CWallet::SyncMetaData(pair<TxSpends::iterator, TxSpends::iterator> range)
     for (TxSpends::iterator it = range.first; it != range.second; ++it)
     {
         const uint256& hash = it->second;
+        // Transactions kept compact no longer change
+        if (mapWalletCompact.count(hash))
+            continue;
         int n = mapWallet[hash].nOrderPos;
         if (n < nMinOrderPos)
         {
@@ -522,6 +781,8 @@ void CWallet::SyncMetaData(pair<TxSpends::iterator, TxSpends::iterator> range)
     for (TxSpends::iterator it = range.first; it != range.second; ++it)
     {
         const uint256& hash = it->second;
+        if (mapWalletCompact.count(hash))
+            continue;
         CWalletTx* copyTo = &mapWallet[hash];
         if (copyFrom == copyTo) continue;
         if (!copyFrom->IsEquivalentTo(*copyTo)) continue;
@@ -556,6 +817,8 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
             if (depth > 0  || (depth == 0 && !mit->second.isAbandoned()))
                 return true; // Spent
         }
+        if (mapWalletCompact.count(wtxid))
+            return true; // Spent deep in the chain
     }
     return false;
 }
@@ -563,6 +826,7 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
+    MarkTxDirty(outpoint.hash);
 
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -689,6 +953,10 @@ DBErrors CWallet::ReorderTransactions()
     // Old wallets didn't have any defined order for transactions
     // Probably a bad idea to change the output of this
 
+    // Transactions kept compact get new positions too
+    while (!mapWalletCompact.empty())
+        ExpandTransaction(mapWalletCompact.begin()->first);
+
     // First: get all CWalletTx and CAccountingEntry into a sorted-by-time multimap.
     typedef pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef multimap<int64_t, TxPair > TxItems;
@@ -765,7 +1033,7 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     if (pwalletdb) {
         pwalletdb->WriteOrderPosNext(nOrderPosNext);
     } else {
-        CWalletDB(strWalletFile).WriteOrderPosNext(nOrderPosNext);
+        CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteOrderPosNext(nOrderPosNext);
     }
     return nRet;
 }
@@ -817,14 +1085,13 @@ bool CWallet::GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bFo
         else {
             // Check if the current key has been used
             CScript scriptPubKey = GetScriptForDestination(account.vchPubKey.GetID());
-            for (map<uint256, CWalletTx>::iterator it = mapWallet.begin();
-                 it != mapWallet.end() && account.vchPubKey.IsValid();
-                 ++it)
-                BOOST_FOREACH(const CTxOut& txout, (*it).second.tx->vout)
+            ForEachWalletTx([&](const CWalletTx& wtx) {
+                BOOST_FOREACH(const CTxOut& txout, wtx.tx->vout)
                     if (txout.scriptPubKey == scriptPubKey) {
                         bForceNew = true;
                         break;
                     }
+            });
         }
     }
 
@@ -844,6 +1111,13 @@ bool CWallet::GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bFo
 
 void CWallet::MarkDirty()
 {
+    {
+        LOCK(cs_txDirty);
+        fBalanceRecount = true;
+        fUnspentRebuild = true;
+        setBalanceDirty.clear();
+        setUnspentDirty.clear();
+    }
     {
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
@@ -884,10 +1158,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 {
     LOCK(cs_wallet);
 
-    CWalletDB walletdb(strWalletFile, "r+", fFlushOnClose);
+    CWalletDBRef walletdb(pwalletdbBatch, strWalletFile, fFlushOnClose);
 
     uint256 hash = wtxIn.GetHash();
 
+    // A transaction kept compact is updated in full
+    ExpandTransaction(hash);
+
     // Inserts only if not already there, returns tx inserted or tx found
     pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
     CWalletTx& wtx = (*ret.first).second;
@@ -896,7 +1173,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     if (fInsertedNew)
     {
         wtx.nTimeReceived = GetAdjustedTime();
-        wtx.nOrderPos = IncOrderPosNext(&walletdb);
+        wtx.nOrderPos = IncOrderPosNext(walletdb.get());
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
 
         wtx.nTimeSmart = wtx.nTimeReceived;
@@ -978,7 +1255,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Write to disk
     if (fInsertedNew || fUpdated)
-        if (!walletdb.WriteTx(wtx))
+        if (!walletdb->WriteTx(wtx))
             return false;
 
     // Break debit/credit balance caches:
@@ -1020,6 +1297,28 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     return true;
 }
 
+bool CWallet::LoadCompactToWallet(const CWalletTx& wtx, const CWalletTxSummary& summary)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // A summary left from an earlier state of the transaction, or one no
+    // longer deep enough after a reorg, is not trusted
+    if (nWalletCompactDepth == 0 || summary.hashBlock != wtx.hashBlock || summary.nOrderPos != wtx.nOrderPos ||
+        summary.GetDepthInMainChain() < (int)nWalletCompactDepth)
+        return false;
+
+    uint256 hash = wtx.GetHash();
+    mapWalletCompact[hash] = summary;
+    wtxCompactOrdered.insert(std::make_pair(summary.nOrderPos, hash));
+    // Its spends stay known, like those of a transaction compacted later
+    if (!wtx.IsCoinBase()) {
+        BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
+            AddToSpends(txin.prevout, hash);
+    }
+    return true;
+}
+
 /**
  * Add a transaction to the wallet, or update it.  pIndex and posInBlock should
  * be set when the transaction was known to be included in a block.  When
@@ -1051,6 +1350,14 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex
             }
         }
 
+        std::map<uint256, CWalletTxSummary>::const_iterator itCompact = mapWalletCompact.find(tx.GetHash());
+        if (itCompact != mapWalletCompact.end()) {
+            // Only a transaction kept compact that left its block has changed
+            if (!fUpdate || (posInBlock != -1 && itCompact->second.hashBlock == pIndex->GetBlockHash()))
+                return false;
+            ExpandTransaction(tx.GetHash());
+        }
+
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
         if (fExisted || IsMine(tx) || IsFromMe(tx))
@@ -1071,7 +1378,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
 {
     LOCK2(cs_main, cs_wallet);
 
-    CWalletDB walletdb(strWalletFile, "r+");
+    CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
 
     std::set<uint256> todo;
     std::set<uint256> done;
@@ -1101,7 +1408,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.setAbandoned();
             wtx.MarkDirty();
-            walletdb.WriteTx(wtx);
+            walletdb->WriteTx(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(hashTx, 0));
@@ -1112,9 +1419,11 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
                 iter++;
             }
             // If a transaction changes 'conflicted' state, that changes the balance
-            // available of the outputs it spends. So force those to be recomputed
+            // available of the outputs it spends. So force those to be recomputed,
+            // bringing back a parent that was kept compact
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
+                ExpandTransaction(txin.prevout.hash);
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
@@ -1143,7 +1452,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
         return;
 
     // Do not flush the wallet here for performance reasons
-    CWalletDB walletdb(strWalletFile, "r+", false);
+    CWalletDBRef walletdb(pwalletdbBatch, strWalletFile, false);
 
     std::set<uint256> todo;
     std::set<uint256> done;
@@ -1154,6 +1463,8 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
         uint256 now = *todo.begin();
         todo.erase(now);
         done.insert(now);
+        if (mapWalletCompact.count(now) && !ExpandTransaction(now))
+            continue;
         assert(mapWallet.count(now));
         CWalletTx& wtx = mapWallet[now];
         int currentconfirm = wtx.GetDepthInMainChain();
@@ -1163,7 +1474,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
-            walletdb.WriteTx(wtx);
+            walletdb->WriteTx(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
             while (iter != mapTxSpends.end() && iter->first.hash == now) {
@@ -1173,9 +1484,11 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
                  iter++;
             }
             // If a transaction changes 'conflicted' state, that changes the balance
-            // available of the outputs it spends. So force those to be recomputed
+            // available of the outputs it spends. So force those to be recomputed,
+            // bringing back a parent that was kept compact
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
+                ExpandTransaction(txin.prevout.hash);
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
@@ -1192,9 +1505,10 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex,
 
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
-    // recomputed, also:
+    // recomputed, also (bringing back a parent that was kept compact):
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
+        ExpandTransaction(txin.prevout.hash);
         if (mapWallet.count(txin.prevout.hash))
             mapWallet[txin.prevout.hash].MarkDirty();
     }
@@ -1203,16 +1517,9 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex,
 
 isminetype CWallet::IsMine(const CTxIn &txin) const
 {
-    {
-        LOCK(cs_wallet);
-        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
-        if (mi != mapWallet.end())
-        {
-            const CWalletTx& prev = (*mi).second;
-            if (txin.prevout.n < prev.tx->vout.size())
-                return IsMine(prev.tx->vout[txin.prevout.n]);
-        }
-    }
+    CTxOut prevout;
+    if (GetWalletTxOut(txin.prevout, prevout))
+        return IsMine(prevout);
     return ISMINE_NO;
 }
 
@@ -1220,22 +1527,42 @@ isminetype CWallet::IsMine(const CTxIn &txin) const
 // and a not-"is mine" (according to the filter) input.
 CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 {
+    CTxOut prevout;
+    if (GetWalletTxOut(txin.prevout, prevout))
+        if (IsMine(prevout) & filter)
+            return prevout.nValue;
+    return 0;
+}
+
+bool CWallet::GetWalletTxOut(const COutPoint& outpoint, CTxOut& txoutRet) const
+{
+    LOCK(cs_wallet);
+    map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+    if (mi != mapWallet.end())
     {
-        LOCK(cs_wallet);
-        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
-        if (mi != mapWallet.end())
-        {
-            const CWalletTx& prev = (*mi).second;
-            if (txin.prevout.n < prev.tx->vout.size())
-                if (IsMine(prev.tx->vout[txin.prevout.n]) & filter)
-                    return prev.tx->vout[txin.prevout.n].nValue;
-        }
+        const CWalletTx& prev = (*mi).second;
+        if (outpoint.n >= prev.tx->vout.size())
+            return false;
+        txoutRet = prev.tx->vout[outpoint.n];
+        return true;
     }
-    return 0;
+
+    // Spends of transactions kept compact are rarely looked at again, as
+    // their debits are cached
+    CWalletTx prev;
+    if (!ReadCompactTx(outpoint.hash, prev) || outpoint.n >= prev.tx->vout.size())
+        return false;
+    txoutRet = prev.tx->vout[outpoint.n];
+    return true;
 }
 
 isminetype CWallet::IsMine(const CTxOut& txout) const
 {
+    {
+        LOCK(cs_KeyStore);
+        if (!scriptFilter.MayMatch(txout.scriptPubKey))
+            return ISMINE_NO;
+    }
     return ::IsMine(*this, txout.scriptPubKey);
 }
 
@@ -1306,16 +1633,11 @@ bool CWallet::IsAllFromMe(const CTransaction& tx, const isminefilter& filter) co
 
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
     {
-        auto mi = mapWallet.find(txin.prevout.hash);
-        if (mi == mapWallet.end())
-            return false; // any unknown inputs can't be from us
-
-        const CWalletTx& prev = (*mi).second;
+        CTxOut prevout;
+        if (!GetWalletTxOut(txin.prevout, prevout))
+            return false; // any unknown or invalid inputs can't be from us
 
-        if (txin.prevout.n >= prev.tx->vout.size())
-            return false; // invalid input!
-
-        if (!(IsMine(prev.tx->vout[txin.prevout.n]) & filter))
+        if (!(IsMine(prevout) & filter))
             return false;
     }
     return true;
@@ -1395,7 +1717,7 @@ bool CWallet::SetHDMasterKey(const CPubKey& pubkey)
 bool CWallet::SetHDChain(const CHDChain& chain, bool memonly)
 {
     LOCK(cs_wallet);
-    if (!memonly && !CWalletDB(strWalletFile).WriteHDChain(chain))
+    if (!memonly && !CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteHDChain(chain))
         throw runtime_error(std::string(__func__) + ": writing chain failed");
 
     hdChain = chain;
@@ -1543,6 +1865,254 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
     }
 }
 
+CWalletScriptFilter::CWalletScriptFilter() :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())), nBlocks(0)
+{
+    Resize(1);
+}
+
+uint64_t CWalletScriptFilter::Hash(const CScript& script) const
+{
+    return CSipHasher(k0, k1).Write(script.data(), script.size()).Finalize();
+}
+
+void CWalletScriptFilter::Insert(uint64_t nHash)
+{
+    // The upper half picks the block, the lower half six bits in it
+    uint64_t* pBlock = &vBloom[((nHash >> 32) * nBlocks >> 32) * BLOCK_WORDS];
+    uint32_t nBit = (uint32_t)nHash, nStep = (nBit >> 16) | 1;
+    for (int i = 0; i < 6; i++, nBit += nStep)
+        pBlock[(nBit >> 6) % BLOCK_WORDS] |= (uint64_t)1 << (nBit & 63);
+}
+
+bool CWalletScriptFilter::Contains(uint64_t nHash) const
+{
+    const uint64_t* pBlock = &vBloom[((nHash >> 32) * nBlocks >> 32) * BLOCK_WORDS];
+    uint32_t nBit = (uint32_t)nHash, nStep = (nBit >> 16) | 1;
+    for (int i = 0; i < 6; i++, nBit += nStep) {
+        if (!(pBlock[(nBit >> 6) % BLOCK_WORDS] & ((uint64_t)1 << (nBit & 63))))
+            return false;
+    }
+    return setHashes.count(nHash) > 0;
+}
+
+void CWalletScriptFilter::Resize(uint32_t nBlocksIn)
+{
+    nBlocks = nBlocksIn;
+    vBloom.assign((size_t)nBlocks * BLOCK_WORDS, 0);
+    BOOST_FOREACH(uint64_t nHash, setHashes)
+        Insert(nHash);
+}
+
+void CWalletScriptFilter::AddScript(const CScript& scriptPubKey)
+{
+    uint64_t nHash = Hash(scriptPubKey);
+    if (!setHashes.insert(nHash).second)
+        return;
+    if (setHashes.size() * BITS_PER_ENTRY > (uint64_t)nBlocks * BLOCK_WORDS * 64)
+        Resize(nBlocks * 2);
+    else
+        Insert(nHash);
+}
+
+void CWalletScriptFilter::AddKey(const CPubKey& pubkey)
+{
+    AddScript(GetScriptForRawPubKey(pubkey));
+    AddScript(GetScriptForDestination(pubkey.GetID()));
+}
+
+void CWalletScriptFilter::AddScriptHash(const CScriptID& scriptID)
+{
+    AddScript(GetScriptForDestination(scriptID));
+}
+
+bool CWalletScriptFilter::MayMatch(const CScript& scriptPubKey) const
+{
+    if (Contains(scriptPubKey))
+        return true;
+
+    // The standard encodings of everything in the keystore are in the set
+    size_t nSize = scriptPubKey.size();
+    if (scriptPubKey.IsPayToScriptHash())
+        return false;
+    if (nSize == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+        return false;
+    if ((nSize == 35 || nSize == 67) && scriptPubKey[0] == nSize - 2 && scriptPubKey[nSize - 1] == OP_CHECKSIG)
+        return false;
+
+    // Other encodings, and multisig, are checked through the keys and
+    // scripts ::IsMine would look up
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return false;
+    switch (whichType)
+    {
+    case TX_PUBKEY:
+        return Contains(GetScriptForDestination(CPubKey(vSolutions[0]).GetID()));
+    case TX_PUBKEYHASH:
+        return Contains(GetScriptForDestination(CKeyID(uint160(vSolutions[0]))));
+    case TX_SCRIPTHASH:
+        return Contains(GetScriptForDestination(CScriptID(uint160(vSolutions[0]))));
+    case TX_MULTISIG:
+        // Only mine if all keys are
+        for (size_t i = 1; i + 1 < vSolutions.size(); i++) {
+            if (!Contains(GetScriptForDestination(CPubKey(vSolutions[i]).GetID())))
+                return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool CWalletScriptFilter::MayMatch(const CTransaction& tx) const
+{
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        if (MayMatch(txout.scriptPubKey))
+            return true;
+    }
+    return false;
+}
+
+CWalletScriptFilter CWallet::GetScriptFilter() const
+{
+    LOCK(cs_KeyStore);
+    return scriptFilter;
+}
+
+bool CWallet::IsLinkedToWallet(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()) || mapWalletCompact.count(tx.GetHash()))
+        return true;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapWalletCompact.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout))
+            return true;
+    }
+    return false;
+}
+
+namespace {
+
+/** Blocks applied per round of a rescan; cs_main and cs_wallet are released between rounds */
+static const size_t RESCAN_CHUNK_BLOCKS = 50;
+/** Most threads reading and pre-filtering blocks for a rescan */
+static const int MAX_RESCAN_THREADS = 8;
+
+/** A block of a rescan, with what is needed to read it without cs_main */
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    uint256 hash;
+    CDiskBlockPos pos;
+    std::shared_ptr<const CBlock> pblock; //!< NULL if the block could not be read
+    std::vector<bool> vMatch;             //!< per transaction, whether an output may be ours
+    bool fDone;
+
+    CRescanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), hash(pindexIn->GetBlockHash()), pos(pindexIn->GetBlockPos()), fDone(false) {}
+};
+
+/**
+ * Threads reading, deserializing and pre-filtering the blocks of a rescan,
+ * which are handed back in the order they were added.
+ */
+class CRescanWorkers
+{
+private:
+    const CWalletScriptFilter& filter;
+    const Consensus::Params& consensusParams;
+
+    std::mutex cs;
+    std::condition_variable cond;
+    //! blocks added and not taken yet; references stay valid while others are added and taken
+    std::deque<CRescanBlock> queue;
+    //! count of blocks taken, and of blocks claimed by a thread
+    size_t nTaken;
+    size_t nClaimed;
+    bool fStop;
+    std::vector<std::thread> threads;
+
+    void ScanBlock(CRescanBlock& entry) const
+    {
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblock, entry.pos, consensusParams))
+            return;
+        if (pblock->GetHash() != entry.hash) {
+            error("%s: block at %s does not match the index for %s", __func__, entry.pos.ToString(), entry.hash.ToString());
+            return;
+        }
+        entry.vMatch.resize(pblock->vtx.size());
+        for (size_t i = 0; i < pblock->vtx.size(); i++)
+            entry.vMatch[i] = filter.MayMatch(*pblock->vtx[i]);
+        entry.pblock = pblock;
+    }
+
+    void ThreadScan()
+    {
+        RenameThread("goldcoin-rescan");
+        while (true) {
+            CRescanBlock* pentry;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cond.wait(lock, [this] { return fStop || nClaimed < nTaken + queue.size(); });
+                if (fStop)
+                    return;
+                pentry = &queue[nClaimed++ - nTaken];
+            }
+            ScanBlock(*pentry);
+            {
+                std::lock_guard<std::mutex> lock(cs);
+                pentry->fDone = true;
+            }
+            cond.notify_all();
+        }
+    }
+
+public:
+    CRescanWorkers(const CWalletScriptFilter& filterIn, const Consensus::Params& consensusParamsIn, int nThreads) :
+        filter(filterIn), consensusParams(consensusParamsIn), nTaken(0), nClaimed(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back(&CRescanWorkers::ThreadScan, this);
+    }
+
+    ~CRescanWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    void Add(const std::vector<CBlockIndex*>& vIndex)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            for (CBlockIndex* pindex : vIndex)
+                queue.emplace_back(pindex);
+        }
+        cond.notify_all();
+    }
+
+    /** Return the oldest block added and not taken yet, once it was scanned */
+    CRescanBlock Next()
+    {
+        std::unique_lock<std::mutex> lock(cs);
+        cond.wait(lock, [this] { return !queue.empty() && queue.front().fDone; });
+        CRescanBlock entry = std::move(queue.front());
+        queue.pop_front();
+        nTaken++;
+        return entry;
+    }
+};
+
+} // anon namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1558,7 +2128,12 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
+    // Keys added during the rescan are not looked for; importing them
+    // triggers a rescan of its own
+    CWalletScriptFilter filter = GetScriptFilter();
+
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1567,33 +2142,77 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool f
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
-        double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
-        while (pindex)
-        {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
+        dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
+    }
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+    CRescanWorkers workers(filter, chainParams.GetConsensus(), std::max(1, std::min(GetNumCores(), MAX_RESCAN_THREADS)));
+    size_t nQueued = 0, nApplied = 0;
+    while (true) {
+        // Keep a chunk queued beyond the one being applied, so the workers
+        // continue reading meanwhile
+        while (pindex && nQueued - nApplied < 2 * RESCAN_CHUNK_BLOCKS) {
+            std::vector<CBlockIndex*> vIndex;
+            {
+                LOCK(cs_main);
+                // Continue on the new branch after a reorg
+                if (!chainActive.Contains(pindex))
+                    pindex = chainActive.Next(chainActive.FindFork(pindex));
+                for (; pindex && vIndex.size() < RESCAN_CHUNK_BLOCKS; pindex = chainActive.Next(pindex))
+                    vIndex.push_back(pindex);
+            }
+            workers.Add(vIndex);
+            nQueued += vIndex.size();
+        }
+        if (nApplied == nQueued)
+            break;
+
+        // Apply the matches of the next chunk in chain order
+        CBlockIndex* pindexLast = nullptr;
+        {
+            LOCK2(cs_main, cs_wallet);
+            CWalletBatch batch(this);
+            size_t nEnd = std::min(nQueued, nApplied + RESCAN_CHUNK_BLOCKS);
+            for (; nApplied < nEnd; nApplied++) {
+                CRescanBlock entry = workers.Next();
+                pindexLast = entry.pindex;
+                if (!entry.pblock) {
+                    ret = nullptr;
+                    continue;
+                }
+                // Blocks that were disconnected meanwhile are scanned again on the new branch
+                if (!chainActive.Contains(entry.pindex))
+                    continue;
+                const CBlock& block = *entry.pblock;
                 for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                    const CTransaction& tx = *block.vtx[posInBlock];
+                    if ((entry.vMatch[posInBlock] || IsLinkedToWallet(tx)) &&
+                        AddToWalletIfInvolvingMe(tx, entry.pindex, posInBlock, fUpdate)) {
+                        batch.ItemDone();
+                        // The available credit of the outputs it spends may
+                        // have been cached between chunks, as in SyncTransaction
+                        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                            if (mapWallet.count(txin.prevout.hash))
+                                mapWallet[txin.prevout.hash].MarkDirty();
+                        }
+                    }
                 }
                 if (!ret) {
-                    ret = pindex;
+                    ret = entry.pindex;
                 }
-            } else {
-                ret = nullptr;
-            }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
             }
+            batch.Commit();
+        }
+
+        if (dProgressTip - dProgressStart > 0.0)
+            ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindexLast) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        if (GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindexLast->nHeight, GuessVerificationProgress(chainParams.TxData(), pindexLast));
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1742,6 +2361,21 @@ CAmount CWalletTx::GetImmatureCredit(bool fUseCache) const
     return 0;
 }
 
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fImmatureCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet)
+        pwallet->MarkTxDirty(GetHash());
+}
+
 CAmount CWalletTx::GetAvailableCredit(bool fUseCache) const
 {
     if (pwallet == 0)
@@ -1931,94 +2565,257 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+void CWallet::MarkTxDirty(const uint256& hash) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+    LOCK(cs_txDirty);
+    if (!fBalanceRecount)
+        setBalanceDirty.insert(hash);
+    if (!fUnspentRebuild)
+        setUnspentDirty.insert(hash);
+}
+
+void CWallet::UpdateBalance(const CWalletTx& wtx) const
+{
+    balanceTotal -= wtx.balanceCounted;
+    wtx.balanceCounted = CWalletBalance();
+
+    int nDepth = wtx.GetDepthInMainChain();
+    if (wtx.IsTrusted()) {
+        wtx.balanceCounted.nTrusted = wtx.GetAvailableCredit();
+        wtx.balanceCounted.nWatchOnlyTrusted = wtx.GetAvailableWatchOnlyCredit();
+    } else if (nDepth == 0 && wtx.InMempool()) {
+        wtx.balanceCounted.nUntrustedPending = wtx.GetAvailableCredit();
+        wtx.balanceCounted.nWatchOnlyUntrustedPending = wtx.GetAvailableWatchOnlyCredit();
     }
+    wtx.balanceCounted.nImmature = wtx.GetImmatureCredit();
+    wtx.balanceCounted.nWatchOnlyImmature = wtx.GetImmatureWatchOnlyCredit();
+    balanceTotal += wtx.balanceCounted;
 
-    return nTotal;
+    // A confirmed transaction only changes through AddToWallet, MarkConflicted
+    // or a spend of it, which all mark it dirty. Depth and mempool changes of
+    // the others are not signalled, so they are counted on every query.
+    if ((nDepth < 1 && !wtx.isAbandoned()) || wtx.GetBlocksToMaturity() > 0)
+        setBalanceVolatile.insert(wtx.GetHash());
+    else
+        setBalanceVolatile.erase(wtx.GetHash());
 }
 
-CAmount CWallet::GetUnconfirmedBalance() const
+CWalletBalance CWallet::GetBalances() const
 {
-    CAmount nTotal = 0;
+    LOCK2(cs_main, cs_wallet);
+
+    bool fRecount;
+    std::set<uint256> setDirty;
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
+        LOCK(cs_txDirty);
+        fRecount = fBalanceRecount;
+        fBalanceRecount = false;
+        setDirty.swap(setBalanceDirty);
+    }
+
+    if (fRecount) {
+        balanceTotal = CWalletBalance();
+        setBalanceVolatile.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+            it->second.balanceCounted = CWalletBalance();
+            UpdateBalance(it->second);
         }
+        return balanceTotal;
     }
-    return nTotal;
+
+    BOOST_FOREACH(const uint256& hash, setDirty) {
+        // Transactions not in the wallet were never counted
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it != mapWallet.end())
+            UpdateBalance(it->second);
+    }
+    std::vector<uint256> vVolatile(setBalanceVolatile.begin(), setBalanceVolatile.end());
+    BOOST_FOREACH(const uint256& hash, vVolatile) {
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            setBalanceVolatile.erase(hash);
+        else if (!setDirty.count(hash))
+            UpdateBalance(it->second);
+    }
+    return balanceTotal;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    return GetBalances().nTrusted;
+}
+
+CAmount CWallet::GetUnconfirmedBalance() const
+{
+    return GetBalances().nUntrustedPending;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
+    return GetBalances().nWatchOnlyTrusted;
+}
+
+CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
+{
+    return GetBalances().nWatchOnlyUntrustedPending;
+}
+
+CAmount CWallet::GetImmatureWatchOnlyBalance() const
+{
+    return GetBalances().nWatchOnlyImmature;
+}
+
+void CWallet::UpdateWalletUnspent() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    bool fRebuild;
+    std::set<uint256> setDirty;
     {
-        LOCK2(cs_main, cs_wallet);
+        LOCK(cs_txDirty);
+        fRebuild = fUnspentRebuild;
+        fUnspentRebuild = false;
+        setDirty.swap(setUnspentDirty);
+    }
+
+    if (fRebuild) {
+        setWalletUnspent.clear();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
+            setDirty.insert(it->first);
+    }
+    BOOST_FOREACH(const uint256& hash, setDirty) {
+        std::set<COutPoint>::iterator itOut = setWalletUnspent.lower_bound(COutPoint(hash, 0));
+        while (itOut != setWalletUnspent.end() && itOut->hash == hash)
+            setWalletUnspent.erase(itOut++);
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            continue;
+        for (unsigned int i = 0; i < it->second.tx->vout.size(); i++) {
+            if (!IsSpent(hash, i) && IsMine(it->second.tx->vout[i]) != ISMINE_NO)
+                setWalletUnspent.insert(setWalletUnspent.end(), COutPoint(hash, i));
         }
     }
+}
+
+bool CWallet::IsCompactable(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (wtx.GetDepthInMainChain() < (int)nWalletCompactDepth || wtx.GetBlocksToMaturity() > 0)
+        return false;
 
-    return nTotal;
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+        if (IsMine(wtx.tx->vout[i]) == ISMINE_NO)
+            continue;
+        bool fSpent = false;
+        std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(hash, i));
+        for (TxSpends::const_iterator it = range.first; it != range.second && !fSpent; ++it) {
+            std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+            if (mit != mapWallet.end())
+                fSpent = mit->second.GetDepthInMainChain() >= (int)nWalletCompactDepth;
+            else
+                fSpent = mapWalletCompact.count(it->second) > 0;
+        }
+        if (!fSpent)
+            return false;
+    }
+    return true;
 }
 
-CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
+void CWallet::CompactTransactions()
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // The full transactions are read back from the wallet file
+    if (nWalletCompactDepth == 0 || !fFileBacked)
+        return;
+    nCompactHeight = chainActive.Height();
+
+    std::vector<uint256> vCompact;
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        if (IsCompactable(it->second))
+            vCompact.push_back(it->first);
+    }
+
+    CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
+    BOOST_FOREACH(const uint256& hash, vCompact) {
+        map<uint256, CWalletTx>::iterator it = mapWallet.find(hash);
+        const CWalletTx& wtx = it->second;
+
+        CWalletTxSummary summary;
+        summary.hashBlock = wtx.hashBlock;
+        summary.nOrderPos = wtx.nOrderPos;
+        CAmount nFee;
+        std::string strSentAccount;
+        std::list<COutputEntry> listReceived, listSent;
+        wtx.GetAmounts(listReceived, listSent, nFee, strSentAccount, ISMINE_SPENDABLE);
+        summary.nNet = -nFee;
+        BOOST_FOREACH(const COutputEntry& r, listReceived)
+            summary.nNet += r.amount;
+        BOOST_FOREACH(const COutputEntry& s, listSent)
+            summary.nNet -= s.amount;
+        // Without its summary on disk it is loaded in full at the next start
+        if (!walletdb->WriteTxSummary(hash, summary))
+            continue;
+
+        std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(wtx.nOrderPos);
+        for (TxItems::iterator itOrdered = range.first; itOrdered != range.second; ++itOrdered) {
+            if (itOrdered->second.first == &wtx) {
+                wtxOrdered.erase(itOrdered);
+                break;
+            }
         }
+        balanceTotal -= wtx.balanceCounted;
+        setBalanceVolatile.erase(hash);
+
+        mapWalletCompact[hash] = summary;
+        wtxCompactOrdered.insert(std::make_pair(summary.nOrderPos, hash));
+        mapWallet.erase(it);
+        // Drops it from setWalletUnspent
+        MarkTxDirty(hash);
     }
-    return nTotal;
+
+    if (!vCompact.empty())
+        LogPrint("db", "%s: %u more transactions kept compact, %u in all\n", __func__, vCompact.size(), mapWalletCompact.size());
 }
 
-CAmount CWallet::GetImmatureWatchOnlyBalance() const
+bool CWallet::ExpandTransaction(const uint256& hash)
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
+    AssertLockHeld(cs_wallet);
+
+    std::map<uint256, CWalletTxSummary>::iterator itCompact = mapWalletCompact.find(hash);
+    if (itCompact == mapWalletCompact.end())
+        return false;
+
+    CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
+    CWalletTx wtxRead;
+    bool fRead = ReadCompactTx(hash, wtxRead, walletdb.get());
+    walletdb->EraseTxSummary(hash);
+    std::pair<TxCompactItems::iterator, TxCompactItems::iterator> range = wtxCompactOrdered.equal_range(itCompact->second.nOrderPos);
+    for (TxCompactItems::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == hash) {
+            wtxCompactOrdered.erase(it);
+            break;
         }
     }
-    return nTotal;
+    mapWalletCompact.erase(itCompact);
+    if (!fRead)
+        return false;
+
+    CWalletTx& wtx = mapWallet[hash];
+    wtx = wtxRead;
+    wtx.BindWallet(this);
+    wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+    return true;
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue) const
@@ -2027,9 +2824,20 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateWalletUnspent();
+        std::set<COutPoint>::iterator itOut = setWalletUnspent.begin();
+        while (itOut != setWalletUnspent.end())
         {
-            const uint256& wtxid = it->first;
+            // Only transactions with outputs in setWalletUnspent are looked at
+            const uint256 wtxid = itOut->hash;
+            std::set<COutPoint>::iterator itTxBegin = itOut;
+            while (itOut != setWalletUnspent.end() && itOut->hash == wtxid)
+                ++itOut;
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            if (it == mapWallet.end()) {
+                setWalletUnspent.erase(itTxBegin, itOut);
+                continue;
+            }
             const CWalletTx* pcoin = &(*it).second;
 
             if (!CheckFinalTx(*pcoin))
@@ -2081,10 +2889,16 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
                 continue;
             }
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
+            for (std::set<COutPoint>::iterator itTxOut = itTxBegin; itTxOut != itOut; ) {
+                unsigned int i = itTxOut->n;
                 isminetype mine = IsMine(pcoin->tx->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->tx->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                if (IsSpent(wtxid, i) || mine == ISMINE_NO) {
+                    // Anything that could make it available again marks the transaction dirty
+                    setWalletUnspent.erase(itTxOut++);
+                    continue;
+                }
+                ++itTxOut;
+                if (!IsLockedCoin((*it).first, i) && (pcoin->tx->vout[i].nValue > 0 || fIncludeZeroValue) &&
                     (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
@@ -2095,8 +2909,70 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
-                                  vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
+bool SelectCoinsBnB(const std::vector<CAmount>& vValues, const CAmount& nTarget, const CAmount& nCostOfChange,
+                    unsigned int nMaxTries, int64_t nDeadline, std::vector<char>& vfBest, CAmount& nBest)
+{
+    // vfSelected holds the decisions for the coins before the current one;
+    // nAvailable is the total of the coins from the current one on
+    std::vector<char> vfSelected;
+    vfSelected.reserve(vValues.size());
+    CAmount nSelected = 0, nAvailable = 0, nBestExcess = std::numeric_limits<CAmount>::max();
+    BOOST_FOREACH(const CAmount& nValue, vValues)
+        nAvailable += nValue;
+    if (nAvailable < nTarget)
+        return false;
+
+    for (unsigned int nTries = 0; nTries < nMaxTries; nTries++) {
+        if ((nTries & 1023) == 0 && GetTimeMicros() > nDeadline)
+            break;
+
+        bool fBacktrack = false;
+        if (nSelected + nAvailable < nTarget || nSelected > nTarget + nCostOfChange) {
+            fBacktrack = true;
+        } else if (nSelected >= nTarget) {
+            // In range; taking more coins only adds excess
+            if (nSelected - nTarget < nBestExcess) {
+                nBestExcess = nSelected - nTarget;
+                vfBest = vfSelected;
+                vfBest.resize(vValues.size(), false);
+                if (nBestExcess == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // Go back to the last coin taken and leave it out instead
+            while (!vfSelected.empty() && !vfSelected.back()) {
+                vfSelected.pop_back();
+                nAvailable += vValues[vfSelected.size()];
+            }
+            if (vfSelected.empty())
+                break;
+            vfSelected.back() = false;
+            nSelected -= vValues[vfSelected.size() - 1];
+        } else {
+            size_t i = vfSelected.size();
+            nAvailable -= vValues[i];
+            // Taking a coin after leaving out one of the same value repeats
+            // a branch already searched
+            if (i > 0 && !vfSelected.back() && vValues[i] == vValues[i - 1]) {
+                vfSelected.push_back(false);
+            } else {
+                vfSelected.push_back(true);
+                nSelected += vValues[i];
+            }
+        }
+    }
+
+    if (nBestExcess == std::numeric_limits<CAmount>::max())
+        return false;
+    nBest = nTarget + nBestExcess;
+    return true;
+}
+
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                                  vector<char>& vfBest, CAmount& nBest, int64_t nDeadline, int iterations = 1000)
 {
     vector<char> vfIncluded;
 
@@ -2105,7 +2981,7 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
 
     FastRandomContext insecure_rand;
 
-    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
+    for (int nRep = 0; nRep < iterations && nBest != nTargetValue && GetTimeMicros() <= nDeadline; nRep++)
     {
         vfIncluded.assign(vValue.size(), false);
         CAmount nTotal = 0;
@@ -2142,10 +3018,11 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
 }
 
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, vector<COutput> vCoins,
-                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
+    int64_t nDeadline = GetTimeMicros() + nCoinSelectionTimeout * 1000;
 
     // List of values less than target
     pair<CAmount, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
@@ -2210,15 +3087,32 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     std::sort(vValue.begin(), vValue.end(), CompareValueOnly());
     std::reverse(vValue.begin(), vValue.end());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest);
+    // Look for coins that need no change output first
+    vector<CAmount> vValues;
+    vValues.reserve(vValue.size());
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        vValues.push_back(vValue[i].first);
+    if (SelectCoinsBnB(vValues, nTargetValue, nCostOfChange, nCoinSelectionTries, nDeadline, vfBest, nBest))
+    {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+        LogPrint("selectcoins", "SelectCoins() changeless: %d coins, total %s\n", setCoinsRet.size(), FormatMoney(nBest));
+        return true;
+    }
+
+    // Solve subset sum by stochastic approximation
+    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nDeadline);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest);
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest, nDeadline);
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -2246,7 +3140,7 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
     return true;
 }
 
-bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, const CAmount& nCostOfChange) const
 {
     vector<COutput> vCoins(vAvailableCoins);
 
@@ -2298,13 +3192,13 @@ bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount&
     bool fRejectLongChains = GetBoolArg("-walletrejectlongchains", DEFAULT_WALLET_REJECT_LONG_CHAINS);
 
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet));
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet, nCostOfChange) ||
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet, nCostOfChange) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet, nCostOfChange)) ||
+        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet, nCostOfChange));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2487,10 +3381,21 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     txNew.vout.push_back(txout);
                 }
 
-                // Choose coins to use
+                // Choose coins to use. Change below the dust threshold goes
+                // to the fee, so coins exceeding the target by less than
+                // that need no change output; unless the fee is taken from
+                // the amounts, as then dust change is raised instead.
                 CAmount nValueIn = 0;
+                CAmount nCostOfChange = 0;
+                if (nSubtractFeeFromAmount == 0)
+                {
+                    CScript scriptChangeDummy = GetScriptForDestination(CKeyID());
+                    if (coinControl && !boost::get<CNoDestination>(&coinControl->destChange))
+                        scriptChangeDummy = GetScriptForDestination(coinControl->destChange);
+                    nCostOfChange = CTxOut(0, scriptChangeDummy).GetDustThreshold(dustRelayFee) - 1;
+                }
                 setCoins.clear();
-                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl))
+                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl, nCostOfChange))
                 {
                     strFailReason = _("Insufficient funds");
                     return false;
@@ -2870,6 +3775,12 @@ DBErrors CWallet::ZapSelectTx(vector<uint256>& vHashIn, vector<uint256>& vHashOu
 {
     if (!fFileBacked)
         return DB_LOAD_OK;
+    {
+        // Transactions kept compact are removed like the others
+        LOCK(cs_wallet);
+        BOOST_FOREACH(const uint256& hash, vHashIn)
+            ExpandTransaction(hash);
+    }
     DBErrors nZapSelectTxRet = CWalletDB(strWalletFile,"cr+").ZapSelectTx(this, vHashIn, vHashOut);
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
@@ -2931,9 +3842,11 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
     if (!fFileBacked)
         return false;
-    if (!strPurpose.empty() && !CWalletDB(strWalletFile).WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
+    LOCK(cs_wallet); // pwalletdbBatch
+    CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
+    if (!strPurpose.empty() && !walletdb->WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
         return false;
-    return CWalletDB(strWalletFile).WriteName(CBitcoinAddress(address).ToString(), strName);
+    return walletdb->WriteName(CBitcoinAddress(address).ToString(), strName);
 }
 
 bool CWallet::DelAddressBook(const CTxDestination& address)
@@ -2945,9 +3858,10 @@ bool CWallet::DelAddressBook(const CTxDestination& address)
         {
             // Delete destdata tuples associated with address
             std::string strAddress = CBitcoinAddress(address).ToString();
+            CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
             BOOST_FOREACH(const PAIRTYPE(string, string) &item, mapAddressBook[address].destdata)
             {
-                CWalletDB(strWalletFile).EraseDestData(strAddress, item.first);
+                walletdb->EraseDestData(strAddress, item.first);
             }
         }
         mapAddressBook.erase(address);
@@ -2957,15 +3871,18 @@ bool CWallet::DelAddressBook(const CTxDestination& address)
 
     if (!fFileBacked)
         return false;
-    CWalletDB(strWalletFile).ErasePurpose(CBitcoinAddress(address).ToString());
-    return CWalletDB(strWalletFile).EraseName(CBitcoinAddress(address).ToString());
+    LOCK(cs_wallet); // pwalletdbBatch
+    CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
+    walletdb->ErasePurpose(CBitcoinAddress(address).ToString());
+    return walletdb->EraseName(CBitcoinAddress(address).ToString());
 }
 
 bool CWallet::SetDefaultKey(const CPubKey &vchPubKey)
 {
     if (fFileBacked)
     {
-        if (!CWalletDB(strWalletFile).WriteDefaultKey(vchPubKey))
+        LOCK(cs_wallet); // pwalletdbBatch
+        if (!CWalletDBRef(pwalletdbBatch, strWalletFile)->WriteDefaultKey(vchPubKey))
             return false;
     }
     vchDefaultKey = vchPubKey;
@@ -2980,9 +3897,10 @@ bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
-        CWalletDB walletdb(strWalletFile);
+        CWalletBatch batch(this);
+        CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
         BOOST_FOREACH(int64_t nIndex, setKeyPool)
-            walletdb.ErasePool(nIndex);
+            walletdb->ErasePool(nIndex);
         setKeyPool.clear();
 
         if (IsLocked())
@@ -2992,9 +3910,13 @@ bool CWallet::NewKeyPool()
         for (int i = 0; i < nKeys; i++)
         {
             int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
+            walletdb->WritePool(nIndex, CKeyPool(GenerateNewKey()));
+            batch.ItemDone();
         }
+        // The keys join the pool once committed
+        batch.Commit();
+        for (int64_t nIndex = 1; nIndex <= nKeys; nIndex++)
+            setKeyPool.insert(nIndex);
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
     return true;
@@ -3008,7 +3930,8 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
+        CWalletBatch batch(this);
+        CWalletDBRef walletdb(pwalletdbBatch, strWalletFile);
 
         // Top up key pool
         unsigned int nTargetSize;
@@ -3019,18 +3942,65 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
 
         while (setKeyPool.size() < (nTargetSize + 1))
         {
+            // Generate the keys of a batch together; HD keys are derived
+            // on several threads. They join the pool once committed, so no
+            // key is handed out that isn't on disk.
+            unsigned int nKeys = std::min<size_t>(nTargetSize + 1 - setKeyPool.size(), WALLETDB_BATCH_ITEMS);
             int64_t nEnd = 1;
             if (!setKeyPool.empty())
                 nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error(std::string(__func__) + ": writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            std::vector<int64_t> vIndex;
+            BOOST_FOREACH(const CPubKey& pubkey, GenerateNewKeys(nKeys))
+            {
+                if (!walletdb->WritePool(nEnd, CKeyPool(pubkey)))
+                    throw runtime_error(std::string(__func__) + ": writing generated key failed");
+                vIndex.push_back(nEnd++);
+            }
+            batch.Commit();
+            BOOST_FOREACH(int64_t nIndex, vIndex)
+            {
+                setKeyPool.insert(nIndex);
+                LogPrintf("keypool added key %d, size=%u\n", nIndex, setKeyPool.size());
+            }
         }
     }
     return true;
 }
 
+CWalletBatch::CWalletBatch(CWallet* pwalletIn) : pwallet(pwalletIn)
+{
+    AssertLockHeld(pwallet->cs_wallet);
+    if (!pwallet->fFileBacked || pwallet->pwalletdbBatch)
+        return;
+    pwalletdb.reset(new CWalletDB(pwallet->strWalletFile));
+    pbatch.reset(new CWalletDBBatch(*pwalletdb));
+    pwallet->pwalletdbBatch = pwalletdb.get();
+    pwallet->pwalletdbBatchTxn = pbatch.get();
+}
+
+CWalletBatch::~CWalletBatch()
+{
+    if (!pwalletdb)
+        return;
+    pbatch.reset();
+    pwallet->pwalletdbBatch = NULL;
+    pwallet->pwalletdbBatchTxn = NULL;
+}
+
+void CWalletBatch::ItemDone()
+{
+    AssertLockHeld(pwallet->cs_wallet);
+    if (pwallet->pwalletdbBatchTxn && !pwallet->pwalletdbBatchTxn->ItemDone())
+        throw std::runtime_error(std::string(__func__) + ": committing wallet write batch failed");
+}
+
+void CWalletBatch::Commit()
+{
+    AssertLockHeld(pwallet->cs_wallet);
+    if (pwallet->pwalletdbBatchTxn && !pwallet->pwalletdbBatchTxn->Commit())
+        throw std::runtime_error(std::string(__func__) + ": committing wallet write batch failed");
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
@@ -3162,9 +4132,8 @@ set< set<CTxDestination> > CWallet::GetAddressGroupings()
     set< set<CTxDestination> > groupings;
     set<CTxDestination> grouping;
 
-    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
-    {
-        CWalletTx *pcoin = &walletEntry.second;
+    ForEachWalletTx([&](const CWalletTx& wtx) {
+        const CWalletTx *pcoin = &wtx;
 
         if (pcoin->tx->vin.size() > 0)
         {
@@ -3173,9 +4142,10 @@ set< set<CTxDestination> > CWallet::GetAddressGroupings()
             BOOST_FOREACH(CTxIn txin, pcoin->tx->vin)
             {
                 CTxDestination address;
-                if(!IsMine(txin)) /* If this input isn't mine, ignore it */
+                CTxOut prevout;
+                if(!GetWalletTxOut(txin.prevout, prevout) || !IsMine(prevout)) /* If this input isn't mine, ignore it */
                     continue;
-                if(!ExtractDestination(mapWallet[txin.prevout.hash].tx->vout[txin.prevout.n].scriptPubKey, address))
+                if(!ExtractDestination(prevout.scriptPubKey, address))
                     continue;
                 grouping.insert(address);
                 any_mine = true;
@@ -3211,7 +4181,7 @@ set< set<CTxDestination> > CWallet::GetAddressGroupings()
                 groupings.insert(grouping);
                 grouping.clear();
             }
-    }
+    });
 
     set< set<CTxDestination>* > uniqueGroupings; // a set of pointers to groups of addresses
     map< CTxDestination, set<CTxDestination>* > setmap;  // map addresses to the unique group containing it
@@ -3260,11 +4230,9 @@ CAmount CWallet::GetAccountBalance(CWalletDB& walletdb, const std::string& strAc
     CAmount nBalance = 0;
 
     // Tally wallet transactions
-    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
+    ForEachWalletTx([&](const CWalletTx& wtx) {
         if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < 0)
-            continue;
+            return;
 
         CAmount nReceived, nSent, nFee;
         wtx.GetAccountAmounts(strAccount, nReceived, nSent, nFee, filter);
@@ -3272,7 +4240,7 @@ CAmount CWallet::GetAccountBalance(CWalletDB& walletdb, const std::string& strAc
         if (nReceived != 0 && wtx.GetDepthInMainChain() >= nMinDepth)
             nBalance += nReceived;
         nBalance -= nSent + nFee;
-    }
+    });
 
     // Tally internal accounting entries
     nBalance += walletdb.GetAccountCreditDebit(strAccount);
@@ -3467,9 +4435,8 @@ void CWallet::GetKeyBirthTimes(std::map<CTxDestination, int64_t> &mapKeyBirth) c
 
     // find first block that affects those keys, if there are any left
     std::vector<CKeyID> vAffected;
-    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++) {
+    ForEachWalletTx([&](const CWalletTx& wtx) {
         // iterate over all wallet transactions...
-        const CWalletTx &wtx = (*it).second;
         BlockMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if (blit != mapBlockIndex.end() && chainActive.Contains(blit->second)) {
             // ... which are already in a block
@@ -3486,7 +4453,7 @@ void CWallet::GetKeyBirthTimes(std::map<CTxDestination, int64_t> &mapKeyBirth) c
                 vAffected.clear();
             }
         }
-    }
+    });
 
     // Extract block timestamps for those keys
     for (std::map<CKeyID, CBlockIndex*>::const_iterator it = mapKeyFirstBlock.begin(); it != mapKeyFirstBlock.end(); it++)
@@ -3510,7 +4477,8 @@ bool CWallet::EraseDestData(const CTxDestination &dest, const std::string &key)
         return false;
     if (!fFileBacked)
         return true;
-    return CWalletDB(strWalletFile).EraseDestData(CBitcoinAddress(dest).ToString(), key);
+    LOCK(cs_wallet); // pwalletdbBatch
+    return CWalletDBRef(pwalletdbBatch, strWalletFile)->EraseDestData(CBitcoinAddress(dest).ToString(), key);
 }
 
 bool CWallet::LoadDestData(const CTxDestination &dest, const std::string &key, const std::string &value)
@@ -3554,8 +4522,10 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
     strUsage += HelpMessageOpt("-usehd", _("Use hierarchical deterministic key generation (HD) after BIP32. Only has effect during wallet creation/first start") + " " + strprintf(_("(default: %u)"), DEFAULT_USE_HD_WALLET));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
-    strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
+    strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory); can be given more than once to load several wallets") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
+    strUsage += HelpMessageOpt("-walletbackend=<type>", _("Keep the wallet in a Berkeley DB file (bdb) or in an append-only record log next to it (log); an existing Berkeley DB wallet is copied into the log on first use and moved aside") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_BACKEND));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
+    strUsage += HelpMessageOpt("-walletcompactdepth=<n>", strprintf(_("Keep only a summary in memory of wallet transactions with at least <n> confirmations whose outputs are all spent as deeply, and read them from the wallet file when needed (0 = off, default: %u)"), DEFAULT_WALLET_COMPACT_DEPTH));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
                                " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
@@ -3564,6 +4534,8 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     {
         strUsage += HelpMessageGroup(_("Wallet debugging/testing options:"));
 
+        strUsage += HelpMessageOpt("-coinselectiontimeout=<n>", strprintf("Stop searching for a better set of coins to spend after <n> milliseconds (default: %u)", DEFAULT_COINSELECTION_TIMEOUT));
+        strUsage += HelpMessageOpt("-coinselectiontries=<n>", strprintf("Search at most <n> branches for a set of coins to spend that needs no change (default: %u)", DEFAULT_COINSELECTION_TRIES));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
@@ -3721,10 +4693,13 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
         if (GetBoolArg("-zapwallettxes", false) && GetArg("-zapwallettxes", "1") != "2")
         {
             CWalletDB walletdb(walletFile);
+            LOCK(walletInstance->cs_wallet);
 
             BOOST_FOREACH(const CWalletTx& wtxOld, vWtx)
             {
                 uint256 hash = wtxOld.GetHash();
+                // It may have been kept compact as the rescan was recorded
+                walletInstance->ExpandTransaction(hash);
                 std::map<uint256, CWalletTx>::iterator mi = walletInstance->mapWallet.find(hash);
                 if (mi != walletInstance->mapWallet.end())
                 {
@@ -3745,9 +4720,11 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
     walletInstance->SetBroadcastTransactions(GetBoolArg("-walletbroadcast", DEFAULT_WALLETBROADCAST));
 
     {
-        LOCK(walletInstance->cs_wallet);
+        LOCK2(cs_main, walletInstance->cs_wallet);
+        walletInstance->CompactTransactions();
         LogPrintf("setKeyPool.size() = %u\n",      walletInstance->GetKeyPoolSize());
         LogPrintf("mapWallet.size() = %u\n",       walletInstance->mapWallet.size());
+        LogPrintf("mapWalletCompact.size() = %u\n", walletInstance->mapWalletCompact.size());
         LogPrintf("mapAddressBook.size() = %u\n",  walletInstance->mapAddressBook.size());
     }
 
@@ -3762,13 +4739,14 @@ bool CWallet::InitLoadWallet()
         return true;
     }
 
-    std::string walletFile = GetArg("-wallet", DEFAULT_WALLET_DAT);
-
-    CWallet * const pwallet = CreateWalletFromFile(walletFile);
-    if (!pwallet) {
-        return false;
+    BOOST_FOREACH(const std::string& walletFile, GetWalletFiles()) {
+        CWallet * const pwallet = CreateWalletFromFile(walletFile);
+        if (!pwallet) {
+            return false;
+        }
+        vpwallets.push_back(pwallet);
     }
-    pwalletMain = pwallet;
+    pwalletMain = vpwallets[0];
 
     return true;
 }
@@ -3806,6 +4784,11 @@ bool CWallet::ParameterInteraction()
         LogPrintf("%s: parameter interaction: -zapwallettxes=<mode> -> setting -rescan=1\n", __func__);
     }
 
+    std::string strBackend = GetArg("-walletbackend", DEFAULT_WALLET_BACKEND);
+    if (strBackend != "bdb" && strBackend != "log")
+        return InitError(strprintf(_("Unknown wallet backend: %s"), strBackend));
+    bitdb.UseRecordLog(strBackend == "log");
+
     if (GetBoolArg("-sysperms", false))
         return InitError("-sysperms is not allowed in combination with enabled wallet functionality");
     if (GetArg("-prune", 0) && GetBoolArg("-rescan", false))
@@ -3868,6 +4851,9 @@ bool CWallet::ParameterInteraction()
     nTxConfirmTarget = GetArg("-txconfirmtarget", DEFAULT_TX_CONFIRM_TARGET);
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
+    nCoinSelectionTries = std::max<int64_t>(1, GetArg("-coinselectiontries", DEFAULT_COINSELECTION_TRIES));
+    nCoinSelectionTimeout = std::max<int64_t>(0, GetArg("-coinselectiontimeout", DEFAULT_COINSELECTION_TIMEOUT));
+    nWalletCompactDepth = std::max<int64_t>(0, GetArg("-walletcompactdepth", DEFAULT_WALLET_COMPACT_DEPTH));
 
     if (fSendFreeTransactions && GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) <= 0)
         return InitError("Creation of free transactions with their relay disabled is not supported.");
@@ -3885,16 +4871,21 @@ bool CWallet::BackupWallet(const std::string& strDest)
             LOCK(bitdb.cs_db);
             if (!bitdb.mapFileUseCount.count(strWalletFile) || bitdb.mapFileUseCount[strWalletFile] == 0)
             {
-                // Flush log data to the dat file
-                bitdb.CloseDb(strWalletFile);
-                bitdb.CheckpointLSN(strWalletFile);
-                bitdb.mapFileUseCount.erase(strWalletFile);
+                boost::filesystem::path pathSrc = GetDataDir() / strWalletFile;
+                if (bitdb.IsRecordLog()) {
+                    bitdb.SyncLog(strWalletFile);
+                    pathSrc = CDBEnv::GetLogPath(strWalletFile);
+                } else {
+                    // Flush log data to the dat file
+                    bitdb.CloseDb(strWalletFile);
+                    bitdb.CheckpointLSN(strWalletFile);
+                    bitdb.mapFileUseCount.erase(strWalletFile);
+                }
 
                 // Copy wallet file
-                boost::filesystem::path pathSrc = GetDataDir() / strWalletFile;
                 boost::filesystem::path pathDest(strDest);
                 if (boost::filesystem::is_directory(pathDest))
-                    pathDest /= strWalletFile;
+                    pathDest /= pathSrc.filename();
 
                 try {
 #if BOOST_VERSION >= 104000
@@ -3941,6 +4932,19 @@ void CMerkleTx::SetMerkleBranch(const CBlockIndex* pindex, int posInBlock)
     nIndex = posInBlock;
 }
 
+int CWalletTxSummary::GetDepthInMainChain() const
+{
+    AssertLockHeld(cs_main);
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi == mapBlockIndex.end())
+        return 0;
+    CBlockIndex* pindex = (*mi).second;
+    if (!pindex || !chainActive.Contains(pindex))
+        return 0;
+    return chainActive.Height() - pindex->nHeight + 1;
+}
+
 int CMerkleTx::GetDepthInMainChain(const CBlockIndex* &pindexRet) const
 {
     if (hashUnset())
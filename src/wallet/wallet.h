@@ -23,8 +23,11 @@
 
 #include <algorithm>
 #include <atomic>
+#include <functional>
 #include <map>
+#include <memory>
 #include <set>
+#include <unordered_set>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
@@ -35,6 +38,8 @@
 #include <boost/thread.hpp>
 
 extern CWallet* pwalletMain;
+//! All loaded wallets; pwalletMain is the first of them
+extern std::vector<CWallet*> vpwallets;
 
 /**
  * Settings
@@ -43,6 +48,9 @@ extern CFeeRate payTxFee;
 extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
+extern unsigned int nCoinSelectionTries;
+extern int64_t nCoinSelectionTimeout;
+extern unsigned int nWalletCompactDepth;
 
 static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
 //! -paytxfee default
@@ -65,6 +73,14 @@ static const bool DEFAULT_SEND_FREE_TRANSACTIONS = false;
 static const bool DEFAULT_WALLET_REJECT_LONG_CHAINS = false;
 //! -txconfirmtarget default
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 6;
+//! -coinselectiontries default
+static const unsigned int DEFAULT_COINSELECTION_TRIES = 100000;
+//! -coinselectiontimeout default, in milliseconds
+static const int64_t DEFAULT_COINSELECTION_TIMEOUT = 250;
+//! -walletcompactdepth default (0 keeps every wallet transaction in full)
+static const unsigned int DEFAULT_WALLET_COMPACT_DEPTH = 0;
+//! Blocks between looks for wallet transactions to keep compact
+static const int WALLET_COMPACT_INTERVAL = 100;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 static const bool DEFAULT_WALLETBROADCAST = true;
@@ -82,6 +98,16 @@ class CScript;
 class CTxMemPool;
 class CWalletTx;
 
+/**
+ * Depth-first branch and bound search over vValues, which must be sorted by
+ * descending value, for the subset adding up to between nTarget and
+ * nTarget + nCostOfChange with the least excess. Gives up after nMaxTries
+ * steps or at nDeadline (in GetTimeMicros() time), keeping the best subset
+ * found so far.
+ */
+bool SelectCoinsBnB(const std::vector<CAmount>& vValues, const CAmount& nTarget, const CAmount& nCostOfChange,
+                    unsigned int nMaxTries, int64_t nDeadline, std::vector<char>& vfBest, CAmount& nBest);
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
 {
@@ -168,6 +194,41 @@ struct COutputEntry
     int vout;
 };
 
+/** Balances of a wallet, or the part of them one transaction makes up */
+struct CWalletBalance
+{
+    CAmount nTrusted;          //!< GetBalance()
+    CAmount nUntrustedPending; //!< GetUnconfirmedBalance()
+    CAmount nImmature;         //!< GetImmatureBalance()
+    CAmount nWatchOnlyTrusted;
+    CAmount nWatchOnlyUntrustedPending;
+    CAmount nWatchOnlyImmature;
+
+    CWalletBalance() : nTrusted(0), nUntrustedPending(0), nImmature(0), nWatchOnlyTrusted(0), nWatchOnlyUntrustedPending(0), nWatchOnlyImmature(0) {}
+
+    CWalletBalance& operator+=(const CWalletBalance& b)
+    {
+        nTrusted += b.nTrusted;
+        nUntrustedPending += b.nUntrustedPending;
+        nImmature += b.nImmature;
+        nWatchOnlyTrusted += b.nWatchOnlyTrusted;
+        nWatchOnlyUntrustedPending += b.nWatchOnlyUntrustedPending;
+        nWatchOnlyImmature += b.nWatchOnlyImmature;
+        return *this;
+    }
+
+    CWalletBalance& operator-=(const CWalletBalance& b)
+    {
+        nTrusted -= b.nTrusted;
+        nUntrustedPending -= b.nUntrustedPending;
+        nImmature -= b.nImmature;
+        nWatchOnlyTrusted -= b.nWatchOnlyTrusted;
+        nWatchOnlyUntrustedPending -= b.nWatchOnlyUntrustedPending;
+        nWatchOnlyImmature -= b.nWatchOnlyImmature;
+        return *this;
+    }
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx
 {
@@ -289,6 +350,8 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    //! What this transaction adds to the wallet's balance totals, see CWallet::GetBalances()
+    mutable CWalletBalance balanceCounted;
 
     CWalletTx()
     {
@@ -328,6 +391,7 @@ public:
         nAvailableWatchCreditCached = 0;
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
+        balanceCounted = CWalletBalance();
         nOrderPos = -1;
     }
 
@@ -376,18 +440,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fImmatureCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -395,6 +448,12 @@ public:
         MarkDirty();
     }
 
+    //! Bind a copy read from the wallet file that stays out of mapWallet, whose caches are all unset yet
+    void BindWalletCopy(const CWallet *pwalletIn)
+    {
+        pwallet = pwalletIn;
+    }
+
     //! filter decides which addresses will count towards the debit
     CAmount GetDebit(const isminefilter& filter) const;
     CAmount GetCredit(const isminefilter& filter) const;
@@ -429,7 +488,34 @@ public:
     std::set<uint256> GetConflicts() const;
 };
 
+/**
+ * What stays in memory of a wallet transaction kept compact (see
+ * -walletcompactdepth): it is deeply confirmed and every output of it to
+ * the wallet is spent, so it no longer changes. The full transaction is
+ * read from the wallet file when it is needed. Summaries are stored in
+ * the wallet file too, so a transaction stays compact across restarts.
+ */
+class CWalletTxSummary
+{
+public:
+    uint256 hashBlock;
+    int64_t nOrderPos;
+    //! What the transaction adds to the balance of the spendable keys
+    CAmount nNet;
+
+    CWalletTxSummary() : nOrderPos(-1), nNet(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nOrderPos);
+        READWRITE(nNet);
+    }
 
+    int GetDepthInMainChain() const;
+};
 
 
 class COutput
@@ -562,6 +648,50 @@ private:
 };
 
 
+/**
+ * Hashes of the scriptPubKeys a wallet recognizes in their standard form: pay
+ * to pubkey and pay to pubkey hash for every key, pay to script hash for
+ * every redeem script, and the watch-only scripts as they are. A blocked bloom
+ * filter in front of the set rejects most outputs that are not ours after
+ * reading a single cache line, without running the Solver or any key lookup.
+ *
+ * MayMatch() is true for every output ::IsMine recognizes, and possibly for
+ * some it does not, so a match still has to be confirmed with ::IsMine.
+ * Entries are never removed: a watch-only script that is removed again only
+ * costs a false positive.
+ */
+class CWalletScriptFilter
+{
+private:
+    uint64_t k0, k1;
+    std::unordered_set<uint64_t> setHashes;
+    //! Blocks of BLOCK_WORDS words; all bits of an entry are in the same block
+    std::vector<uint64_t> vBloom;
+    uint32_t nBlocks;
+
+    uint64_t Hash(const CScript& script) const;
+    void Insert(uint64_t nHash);
+    bool Contains(uint64_t nHash) const;
+    bool Contains(const CScript& script) const { return Contains(Hash(script)); }
+    void Resize(uint32_t nBlocksIn);
+
+public:
+    static const unsigned int BLOCK_WORDS = 8;
+    //! Bloom bits per entry; with six bits set per entry this gives well under 1% false positives
+    static const unsigned int BITS_PER_ENTRY = 16;
+
+    CWalletScriptFilter();
+
+    void AddScript(const CScript& scriptPubKey);
+    void AddKey(const CPubKey& pubkey);
+    void AddScriptHash(const CScriptID& scriptID);
+
+    bool MayMatch(const CScript& scriptPubKey) const;
+    bool MayMatch(const CTransaction& tx) const;
+
+    size_t Size() const { return setHashes.size(); }
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -576,9 +706,14 @@ private:
      * all coins from coinControl are selected; Never select unconfirmed coins
      * if they are not ours
      */
-    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL, const CAmount& nCostOfChange = 0) const;
 
     CWalletDB *pwalletdbEncryption;
+    //! The handle wallet writes go through while a CWalletBatch is open
+    CWalletDB *pwalletdbBatch;
+    //! The transaction of that batch
+    CWalletDBBatch *pwalletdbBatchTxn;
+    friend class CWalletBatch;
 
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
@@ -605,6 +740,52 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /* Whether tx is in the wallet, spends from it or conflicts with it; its outputs are not checked. */
+    bool IsLinkedToWallet(const CTransaction& tx) const;
+
+    //! Every standard script of the keystore, for IsMine(const CTxOut&); protected by cs_KeyStore
+    CWalletScriptFilter scriptFilter;
+
+    /**
+     * Totals of the balanceCounted of the wallet transactions. Only
+     * transactions marked dirty since the last query, and the ones whose
+     * balance can change without that (unconfirmed and conflicted ones and
+     * immature coinbases), are counted again when the balances are queried.
+     * Protected by cs_wallet.
+     */
+    mutable CWalletBalance balanceTotal;
+    mutable std::set<uint256> setBalanceVolatile;
+
+    /**
+     * Outputs of wallet transactions that may be ours and unspent, ordered
+     * so the outputs of a transaction are next to each other. It is a superset
+     * of the outputs AvailableCoins returns, which prunes the ones it finds
+     * spent: every change that can make a spent output unspent again marks
+     * the transaction holding it dirty. Protected by cs_wallet.
+     */
+    mutable std::set<COutPoint> setWalletUnspent;
+
+    /** Leaf lock for the transactions changed since the last query, as MarkDirty may be called without cs_wallet */
+    mutable CCriticalSection cs_txDirty;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setUnspentDirty;
+    mutable bool fBalanceRecount;
+    mutable bool fUnspentRebuild;
+
+    /** Count the balances of wtx again */
+    void UpdateBalance(const CWalletTx& wtx) const;
+    /** Bring setWalletUnspent up to date with the transactions changed since the last call */
+    void UpdateWalletUnspent() const;
+
+    /** Whether wtx can be kept compact: deep enough, and all its outputs to the wallet spent as deeply */
+    bool IsCompactable(const CWalletTx& wtx) const;
+    /** Bring a transaction kept compact back into mapWallet; false if it was not kept compact or cannot be read */
+    bool ExpandTransaction(const uint256& hash);
+    /** Find an output of a wallet transaction, including the ones kept compact */
+    bool GetWalletTxOut(const COutPoint& outpoint, CTxOut& txoutRet) const;
+    //! Tip height at the last CompactTransactions
+    int nCompactHeight;
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
@@ -681,11 +862,17 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pwalletdbBatch = NULL;
+        pwalletdbBatchTxn = NULL;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        nRelockTime = 0;
+        nCompactHeight = 0;
+        fBalanceRecount = true;
+        fUnspentRebuild = true;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -695,6 +882,11 @@ public:
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
 
+    //! Wallet transactions kept compact, which are in neither mapWallet nor wtxOrdered
+    std::map<uint256, CWalletTxSummary> mapWalletCompact;
+    typedef std::multimap<int64_t, uint256> TxCompactItems;
+    TxCompactItems wtxCompactOrdered;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -704,8 +896,24 @@ public:
 
     std::set<COutPoint> setLockedCoins;
 
+    //! Time at which walletpassphrase locks the wallet again, 0 if it is locked
+    int64_t nRelockTime;
+
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
+    /**
+     * Read a transaction kept compact from the wallet file into wtx, through
+     * pwalletdb if given. Fails if the transaction is not kept compact.
+     */
+    bool ReadCompactTx(const uint256& hash, CWalletTx& wtx, CWalletDB* pwalletdb = NULL) const;
+    /**
+     * Call func with every wallet transaction. The ones kept compact are
+     * read from the wallet file one at a time, so func must not keep them.
+     */
+    void ForEachWalletTx(const std::function<void(const CWalletTx&)>& func) const;
+    /** Keep the transactions that no longer change compact, if -walletcompactdepth is set */
+    void CompactTransactions();
+
     //! check whether we are allowed to upgrade (or already support) to the named feature
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
@@ -716,11 +924,13 @@ public:
 
     /**
      * Shuffle and select coins until nTargetValue is reached while avoiding
-     * small change; This method is stochastic for some inputs and upon
+     * small change. A set of coins adding up to between nTargetValue and
+     * nTargetValue + nCostOfChange, which needs no change output, is searched
+     * for first; otherwise this method is stochastic for some inputs. Upon
      * completion the coin set and corresponding actual target value is
      * assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CAmount& nCostOfChange = 0) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -735,11 +945,17 @@ public:
      * Generate a new key
      */
     CPubKey GenerateNewKey();
+    /**
+     * Generate nKeys new keys at once. HD keys are derived on several
+     * threads, and the chain counter is written once.
+     */
+    std::vector<CPubKey> GenerateNewKeys(unsigned int nKeys);
+    void DeriveExternalChainKey(CExtKey& externalChainChildKey);
     void DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret);
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey) override;
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CTxDestination& pubKey, const CKeyMetadata &metadata);
 
@@ -786,12 +1002,27 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose=true);
     bool LoadToWallet(const CWalletTx& wtxIn);
+    /** Load a transaction compact from its stored summary; false if it must be loaded in full */
+    bool LoadCompactToWallet(const CWalletTx& wtx, const CWalletTxSummary& summary);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock) override;
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
+    /** Copy of the script filter, for checking outputs without the wallet locks */
+    CWalletScriptFilter GetScriptFilter() const;
+    /**
+     * Scan the active chain from pindexStart for wallet transactions. Blocks
+     * are read and pre-filtered on worker threads; cs_main and cs_wallet are
+     * only held while the matches of a chunk of blocks are applied, so callers
+     * should not hold them either. Returns the earliest block from which all
+     * later blocks could be read, or NULL.
+     */
     CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);
+    /** Queue a changed transaction for GetBalances() and AvailableCoins() */
+    void MarkTxDirty(const uint256& hash) const;
+    /** All balances at once; the same as summing them over every transaction */
+    CWalletBalance GetBalances() const;
     CAmount GetBalance() const;
     CAmount GetUnconfirmedBalance() const;
     CAmount GetImmatureBalance() const;
@@ -873,6 +1104,7 @@ public:
     CAmount GetCredit(const CTransaction& tx, const isminefilter& filter) const;
     CAmount GetChange(const CTransaction& tx) const;
     void SetBestChain(const CBlockLocator& loc) override;
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
 
     DBErrors LoadWallet(bool& fFirstRunRet);
     DBErrors ZapWalletTx(std::vector<CWalletTx>& vWtx);
@@ -927,8 +1159,10 @@ public:
     //! Flush wallet (bitdb flush)
     void Flush(bool shutdown=false);
 
-    //! Verify the wallet database and perform salvage if required
+    //! Verify the wallet databases and perform salvage if required
     static bool Verify();
+    //! The wallet files given with -wallet, or the default one
+    static std::vector<std::string> GetWalletFiles();
     
     /** 
      * Address book entry changed.
@@ -995,6 +1229,31 @@ public:
     bool SetHDMasterKey(const CPubKey& key);
 };
 
+/**
+ * Sends the records a wallet writes while it is in scope through one
+ * database handle, in a CWalletDBBatch. Call ItemDone() after each key or
+ * transaction added, and Commit() before relying on the writes being on
+ * disk; both throw if committing fails. cs_wallet must be held for as long
+ * as the batch lives; a batch opened within another one adds to that one.
+ */
+class CWalletBatch
+{
+private:
+    CWallet* pwallet;
+    std::unique_ptr<CWalletDB> pwalletdb;
+    std::unique_ptr<CWalletDBBatch> pbatch;
+
+    CWalletBatch(const CWalletBatch&);
+    void operator=(const CWalletBatch&);
+
+public:
+    explicit CWalletBatch(CWallet* pwalletIn);
+    ~CWalletBatch();
+
+    void ItemDone();
+    void Commit();
+};
+
 /** A key allocated from the key pool. */
 class CReserveKey : public CReserveScript
 {
@@ -67,12 +67,29 @@ bool CWalletDB::WriteTx(const CWalletTx& wtx)
     return Write(std::make_pair(std::string("tx"), wtx.GetHash()), wtx);
 }
 
+bool CWalletDB::ReadTx(const uint256& hash, CWalletTx& wtx)
+{
+    return Read(std::make_pair(std::string("tx"), hash), wtx);
+}
+
 bool CWalletDB::EraseTx(uint256 hash)
 {
     nWalletDBUpdateCounter++;
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
+bool CWalletDB::WriteTxSummary(const uint256& hash, const CWalletTxSummary& summary)
+{
+    nWalletDBUpdateCounter++;
+    return Write(std::make_pair(std::string("txsummary"), hash), summary);
+}
+
+bool CWalletDB::EraseTxSummary(const uint256& hash)
+{
+    nWalletDBUpdateCounter++;
+    return Erase(std::make_pair(std::string("txsummary"), hash));
+}
+
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
 {
     nWalletDBUpdateCounter++;
@@ -223,7 +240,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error(std::string(__func__) + ": cannot create DB cursor");
     bool setRange = true;
@@ -240,7 +257,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw runtime_error(std::string(__func__) + ": error scanning DB");
         }
 
@@ -259,7 +276,43 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
         entries.push_back(acentry);
     }
 
-    pcursor->close();
+    delete pcursor;
+}
+
+void CWalletDB::ListTxSummaries(std::map<uint256, CWalletTxSummary>& mapSummaries)
+{
+    CDBCursor* pcursor = GetCursor();
+    if (!pcursor)
+        throw runtime_error(std::string(__func__) + ": cannot create DB cursor");
+    bool setRange = true;
+    while (true)
+    {
+        // Read next record
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (setRange)
+            ssKey << std::make_pair(std::string("txsummary"), uint256());
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        int ret = ReadAtCursor(pcursor, ssKey, ssValue, setRange);
+        setRange = false;
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0)
+        {
+            delete pcursor;
+            throw runtime_error(std::string(__func__) + ": error scanning DB");
+        }
+
+        // Unserialize
+        string strType;
+        ssKey >> strType;
+        if (strType != "txsummary")
+            break;
+        uint256 hash;
+        ssKey >> hash;
+        ssValue >> mapSummaries[hash];
+    }
+
+    delete pcursor;
 }
 
 class CWalletScanState {
@@ -272,6 +325,8 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    //! Stored summaries of the transactions kept compact, read before the transactions
+    std::map<uint256, CWalletTxSummary> mapTxSummary;
 
     CWalletScanState() {
         nKeys = nCKeys = nWatchKeys = nKeyMeta = 0;
@@ -335,7 +390,12 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
             if (wtx.nOrderPos == -1)
                 wss.fAnyUnordered = true;
 
-            pwallet->LoadToWallet(wtx);
+            // A transaction kept compact at the last run is dropped as soon as
+            // it is read, so the wallet never holds all of them in full
+            std::map<uint256, CWalletTxSummary>::const_iterator itSummary = wss.mapTxSummary.find(hash);
+            bool fCompact = itSummary != wss.mapTxSummary.end() && (wss.vWalletUpgrade.empty() || wss.vWalletUpgrade.back() != hash);
+            if (!fCompact || !pwallet->LoadCompactToWallet(wtx, itSummary->second))
+                pwallet->LoadToWallet(wtx);
         }
         else if (strType == "acentry")
         {
@@ -562,7 +622,8 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
-    LOCK(pwallet->cs_wallet);
+    // cs_main for the depth of the transactions loaded compact
+    LOCK2(cs_main, pwallet->cs_wallet);
     try {
         int nMinVersion = 0;
         if (Read((string)"minversion", nMinVersion))
@@ -572,8 +633,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             pwallet->LoadMinVersion(nMinVersion);
         }
 
+        if (nWalletCompactDepth > 0)
+            ListTxSummaries(wss.mapTxSummary);
+
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -614,7 +678,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
-        pcursor->close();
+        delete pcursor;
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -679,7 +743,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -713,7 +777,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
                 vWtx.push_back(wtx);
             }
         }
-        pcursor->close();
+        delete pcursor;
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -826,19 +890,26 @@ void ThreadFlushWalletDB()
                 if (nRefCount == 0)
                 {
                     boost::this_thread::interruption_point();
-                    const std::string& strFile = pwalletMain->strWalletFile;
-                    map<string, int>::iterator _mi = bitdb.mapFileUseCount.find(strFile);
-                    if (_mi != bitdb.mapFileUseCount.end())
-                    {
+                    nLastFlushed = CWalletDB::GetUpdateCounter();
+                    BOOST_FOREACH(const CWallet* pwallet, vpwallets) {
+                        const std::string& strFile = pwallet->strWalletFile;
+                        map<string, int>::iterator _mi = bitdb.mapFileUseCount.find(strFile);
+                        if (_mi == bitdb.mapFileUseCount.end())
+                            continue;
+
                         LogPrint("db", "Flushing %s\n", strFile);
-                        nLastFlushed = CWalletDB::GetUpdateCounter();
                         int64_t nStart = GetTimeMillis();
 
-                        // Flush wallet file so it's self contained
-                        bitdb.CloseDb(strFile);
-                        bitdb.CheckpointLSN(strFile);
+                        if (bitdb.IsRecordLog()) {
+                            // Record logs stay open; this compacts them when due
+                            bitdb.SyncLog(strFile);
+                        } else {
+                            // Flush wallet file so it's self contained
+                            bitdb.CloseDb(strFile);
+                            bitdb.CheckpointLSN(strFile);
 
-                        bitdb.mapFileUseCount.erase(_mi++);
+                            bitdb.mapFileUseCount.erase(_mi);
+                        }
                         LogPrint("db", "Flushed %s %dms\n", strFile, GetTimeMillis() - nStart);
                     }
                 }
@@ -964,3 +1035,35 @@ unsigned int CWalletDB::GetUpdateCounter()
 {
     return nWalletDBUpdateCounter;
 }
+
+//
+// CWalletDBBatch
+//
+
+CWalletDBBatch::CWalletDBBatch(CWalletDB& walletdbIn) : walletdb(walletdbIn), nItems(0)
+{
+    fActive = walletdb.TxnBegin();
+}
+
+CWalletDBBatch::~CWalletDBBatch()
+{
+    if (fActive && !walletdb.TxnCommit())
+        LogPrintf("%s: committing wallet write batch failed\n", __func__);
+}
+
+bool CWalletDBBatch::Commit()
+{
+    if (!fActive)
+        return true;
+    bool ret = walletdb.TxnCommit();
+    fActive = walletdb.TxnBegin();
+    nItems = 0;
+    return ret;
+}
+
+bool CWalletDBBatch::ItemDone()
+{
+    if (++nItems < WALLETDB_BATCH_ITEMS && walletdb.GetLogTxnSize() < WALLETDB_BATCH_MAX_SIZE)
+        return true;
+    return Commit();
+}
@@ -15,12 +15,17 @@
 #include "key.h"
 
 #include <list>
+#include <map>
 #include <stdint.h>
 #include <string>
 #include <utility>
 #include <vector>
 
 static const bool DEFAULT_FLUSHWALLET = true;
+//! Items a write batch commits together before it starts a new transaction
+static const unsigned int WALLETDB_BATCH_ITEMS = 1000;
+//! Bytes after which a write batch commits, far below the frame size a record log takes
+static const size_t WALLETDB_BATCH_MAX_SIZE = 8 * 1024 * 1024;
 
 class CAccount;
 class CAccountingEntry;
@@ -30,6 +35,7 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class CWalletTxSummary;
 class uint160;
 class uint256;
 
@@ -130,7 +136,10 @@ public:
     bool ErasePurpose(const std::string& strAddress);
 
     bool WriteTx(const CWalletTx& wtx);
+    bool ReadTx(const uint256& hash, CWalletTx& wtx);
     bool EraseTx(uint256 hash);
+    bool WriteTxSummary(const uint256& hash, const CWalletTxSummary& summary);
+    bool EraseTxSummary(const uint256& hash);
 
     bool WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata &keyMeta);
     bool WriteCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret, const CKeyMetadata &keyMeta);
@@ -168,6 +177,8 @@ public:
 
     CAmount GetAccountCreditDebit(const std::string& strAccount);
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& acentries);
+    /// Read the stored summaries of the transactions kept compact
+    void ListTxSummaries(std::map<uint256, CWalletTxSummary>& mapSummaries);
 
     DBErrors LoadWallet(CWallet* pwallet);
     DBErrors FindWalletTx(CWallet* pwallet, std::vector<uint256>& vTxHash, std::vector<CWalletTx>& vWtx);
@@ -186,6 +197,37 @@ private:
     void operator=(const CWalletDB&);
 };
 
+/**
+ * Groups the writes made through a CWalletDB into database transactions,
+ * so that thousands of records take one sync to disk rather than one each.
+ * The writes are committed when the batch goes out of scope, or every
+ * WALLETDB_BATCH_ITEMS items to keep each transaction within the Berkeley
+ * DB lock table. On a record log, which writes a transaction as one frame,
+ * they are also committed once they take WALLETDB_BATCH_MAX_SIZE bytes.
+ * A batch on a handle with a transaction already open does nothing, and
+ * its writes go into that transaction.
+ */
+class CWalletDBBatch
+{
+private:
+    CWalletDB& walletdb;
+    bool fActive;
+    unsigned int nItems;
+
+    CWalletDBBatch(const CWalletDBBatch&);
+    void operator=(const CWalletDBBatch&);
+
+public:
+    explicit CWalletDBBatch(CWalletDB& walletdbIn);
+    /** Commits the rest; a failure can only be logged, so Commit() first where it matters */
+    ~CWalletDBBatch();
+
+    /** Commit the writes so far; later ones go into a new transaction */
+    bool Commit();
+    /** Count one item (a key or transaction with its records) as written */
+    bool ItemDone();
+};
+
 void ThreadFlushWalletDB();
 
 #endif // BITCOIN_WALLET_WALLETDB_H